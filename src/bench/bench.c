@@ -0,0 +1,1527 @@
+/* bench.c
+    Headless benchmark suite for the renderer,
+    resource loader and maths kernels. Every case
+    is run a number of warm-up iterations, then
+    timed over repeated runs, and the median and
+    p99 timings are written out as JSON so that
+    results can be compared between versions.
+
+    Usage:
+        bench [--runs N] [--warmup N] [--width W]
+              [--height H] [--max-triangles N]
+              [--output FILE]
+
+    Results go to stdout unless --output is
+    given. Progress is reported on stderr. */
+
+#include "../graphics/renderer.h"
+#include "../graphics/kernels.h"
+#include "../graphics/deferred.h"
+#include "../graphics/capture.h"
+#include "../graphics/viewport.h"
+#include "../graphics/offline.h"
+#include "../graphics/pipeline.h"
+#include "../graphics/sprite.h"
+#include "../maths/maths.h"
+#include "../maths/transform.h"
+#include "../resources/resources.h"
+#include "../resources/bvh.h"
+#include "../system/jobs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifndef BENCH_VERSION
+    #define BENCH_VERSION "unknown"
+#endif
+
+#define BENCH_MAX_RESULTS 128
+#define BENCH_MAX_RUNS 1000
+
+typedef struct {
+    char name[64];
+    const char *unit;
+    double items;
+    int runs;
+    double median_ns;
+    double p99_ns;
+    double min_ns;
+    double mean_ns;
+} bench_result_t;
+
+typedef struct {
+    int runs;
+    int warmup;
+    unsigned int width;
+    unsigned int height;
+    long max_triangles;
+    const char *output;
+    bench_result_t results[BENCH_MAX_RESULTS];
+    int num_results;
+} bench_t;
+
+typedef void (*bench_func_t)(void *ctx);
+
+/* Sink for results of the maths kernels so that
+   the compiler cannot discard the computation. */
+static volatile double bench_sink;
+
+/* Deterministic pseudo-random numbers so that
+   every run draws the same scene. */
+static uint32_t bench_rand_state = 0x12345678;
+
+static uint32_t bench_rand () {
+    bench_rand_state ^= bench_rand_state << 13;
+    bench_rand_state ^= bench_rand_state >> 17;
+    bench_rand_state ^= bench_rand_state << 5;
+    return bench_rand_state;
+}
+
+static double bench_rand_range (double min, double max) {
+    return min + (max - min) * (bench_rand () / (double) UINT32_MAX);
+}
+
+static double bench_now_ns () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double (const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Run a case and record its timing statistics. items
+   is the amount of work done by one run (pixels,
+   triangles, ...) and is used to derive throughput. */
+static void bench_run (bench_t *bench, const char *name, const char *unit, double items, bench_func_t func, void *ctx) {
+    double samples[BENCH_MAX_RUNS];
+    int runs = bench->runs;
+
+    if (bench->num_results == BENCH_MAX_RESULTS) {
+        fprintf (stderr, "Error - bench: too many results, skipping %s.\n", name);
+        return;
+    }
+
+    for (int i = 0; i < bench->warmup; i++) {
+        func (ctx);
+    }
+
+    double total = 0;
+
+    for (int i = 0; i < runs; i++) {
+        double start = bench_now_ns ();
+        func (ctx);
+        samples[i] = bench_now_ns () - start;
+        total += samples[i];
+    }
+
+    qsort (samples, runs, sizeof (double), compare_double);
+
+    /* Nearest-rank percentiles */
+    int p50 = (runs - 1) / 2;
+    int p99 = (int) (0.99 * runs + 0.999999) - 1;
+
+    if (p99 < 0) {
+        p99 = 0;
+    }
+
+    bench_result_t *result = &bench->results[bench->num_results++];
+    snprintf (result->name, sizeof (result->name), "%s", name);
+    result->unit = unit;
+    result->items = items;
+    result->runs = runs;
+    result->median_ns = (runs % 2 == 1) ? samples[p50] : (samples[p50] + samples[p50 + 1]) / 2;
+    result->p99_ns = samples[p99];
+    result->min_ns = samples[0];
+    result->mean_ns = total / runs;
+
+    fprintf (stderr, "bench: %-32s median %12.0f ns  p99 %12.0f ns\n", name, result->median_ns, result->p99_ns);
+}
+
+static bool bench_write_json (bench_t *bench) {
+    FILE *out = stdout;
+
+    if (strcmp (bench->output, "-") != 0) {
+        out = fopen (bench->output, "w");
+
+        if (out == NULL) {
+            fprintf (stderr, "Error - bench: could not open %s for writing.\n", bench->output);
+            return false;
+        }
+    }
+
+    fprintf (out, "{\n");
+    fprintf (out, "  \"version\": \"%s\",\n", BENCH_VERSION);
+    fprintf (out, "  \"kernels\": \"%s\",\n", graphics_kernels.name);
+    fprintf (out, "  \"config\": { \"runs\": %d, \"warmup\": %d, \"width\": %u, \"height\": %u, \"max_triangles\": %ld },\n",
+        bench->runs, bench->warmup, bench->width, bench->height, bench->max_triangles);
+    fprintf (out, "  \"results\": [\n");
+
+    for (int i = 0; i < bench->num_results; i++) {
+        bench_result_t *r = &bench->results[i];
+        double per_second = r->median_ns > 0 ? r->items * 1e9 / r->median_ns : 0;
+
+        fprintf (out,
+            "    { \"name\": \"%s\", \"unit\": \"%s\", \"items\": %.0f, \"runs\": %d, "
+            "\"median_ns\": %.0f, \"p99_ns\": %.0f, \"min_ns\": %.0f, \"mean_ns\": %.0f, "
+            "\"items_per_second\": %.1f }%s\n",
+            r->name, r->unit, r->items, r->runs,
+            r->median_ns, r->p99_ns, r->min_ns, r->mean_ns,
+            per_second, i + 1 < bench->num_results ? "," : "");
+    }
+
+    fprintf (out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose (out);
+    }
+
+    return true;
+}
+
+/* Procedural meshes */
+static resources_mesh_t *bench_alloc_mesh (int num_vertices, int num_faces) {
+    resources_mesh_t *mesh = (resources_mesh_t *) malloc (sizeof (resources_mesh_t));
+
+    if (mesh == NULL) {
+        return NULL;
+    }
+
+    resources_mesh_init (mesh);
+    mesh->num_vertices = num_vertices;
+    mesh->num_faces = num_faces;
+    mesh->vertices = (resources_vertex_t *) malloc (sizeof (resources_vertex_t) * num_vertices);
+    mesh->faces = (resources_triangle_t *) malloc (sizeof (resources_triangle_t) * num_faces);
+
+    if (mesh->vertices == NULL || mesh->faces == NULL) {
+        fprintf (stderr, "Error - bench: could not allocate mesh with %d faces.\n", num_faces);
+        resources_mesh_free (mesh);
+        return NULL;
+    }
+
+    return mesh;
+}
+
+/* UV sphere of unit radius with approximately
+   num_triangles faces. */
+static resources_mesh_t *bench_create_sphere (long num_triangles) {
+    int stacks = 2;
+
+    while ((long) stacks * stacks * 4 < num_triangles) {
+        stacks++;
+    }
+
+    int slices = (int) (num_triangles / (2L * stacks));
+
+    if (slices < 3) {
+        slices = 3;
+    }
+
+    resources_mesh_t *mesh = bench_alloc_mesh ((stacks + 1) * (slices + 1), 2 * stacks * slices);
+
+    if (mesh == NULL) {
+        return NULL;
+    }
+
+    int v = 0;
+
+    for (int i = 0; i <= stacks; i++) {
+        double phi = M_PI * i / stacks;
+
+        for (int j = 0; j <= slices; j++) {
+            double theta = 2 * M_PI * j / slices;
+            mesh->vertices[v++].coord = (maths_vec4f) { sin (phi) * cos (theta), cos (phi), sin (phi) * sin (theta), 1.0 };
+        }
+    }
+
+    int f = 0;
+
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            int a = i * (slices + 1) + j;
+            int b = a + slices + 1;
+
+            mesh->faces[f][0] = a;
+            mesh->faces[f][1] = b;
+            mesh->faces[f][2] = a + 1;
+            f++;
+
+            mesh->faces[f][0] = a + 1;
+            mesh->faces[f][1] = b;
+            mesh->faces[f][2] = b + 1;
+            f++;
+        }
+    }
+
+    return mesh;
+}
+
+/* Flat n x n grid of quads in the x-z plane
+   spanning [-1, 1]. */
+static resources_mesh_t *bench_create_grid (int n) {
+    resources_mesh_t *mesh = bench_alloc_mesh ((n + 1) * (n + 1), 2 * n * n);
+
+    if (mesh == NULL) {
+        return NULL;
+    }
+
+    int v = 0;
+
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= n; j++) {
+            mesh->vertices[v++].coord = (maths_vec4f) { -1.0 + 2.0 * j / n, 0.0, -1.0 + 2.0 * i / n, 1.0 };
+        }
+    }
+
+    int f = 0;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            int a = i * (n + 1) + j;
+            int b = a + n + 1;
+
+            mesh->faces[f][0] = a;
+            mesh->faces[f][1] = b;
+            mesh->faces[f][2] = a + 1;
+            f++;
+
+            mesh->faces[f][0] = a + 1;
+            mesh->faces[f][1] = b;
+            mesh->faces[f][2] = b + 1;
+            f++;
+        }
+    }
+
+    return mesh;
+}
+
+static graphics_renderer_t *bench_create_renderer_format (bench_t *bench, graphics_format_t format) {
+    graphics_renderer_t *renderer = graphics_renderer_init (bench->width, bench->height, format);
+
+    if (renderer == NULL) {
+        return NULL;
+    }
+
+    renderer->view_distance = 1;
+    renderer->view_width = 2;
+    renderer->view_height = 2 * bench->height / (double) bench->width;
+
+    return renderer;
+}
+
+static graphics_renderer_t *bench_create_renderer (bench_t *bench) {
+    return bench_create_renderer_format (bench, GRAPHICS_FORMAT_BGRX8888);
+}
+
+/* Rasterization cases */
+typedef struct {
+    graphics_renderer_t *renderer;
+    int count;
+    int *coords;
+} bench_raster_ctx_t;
+
+static void bench_fill_rate (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+    int w = c->renderer->width - 1;
+    int h = c->renderer->height - 1;
+
+    graphics_renderer_clear_buffer (c->renderer);
+
+    for (int i = 0; i < c->count; i++) {
+        graphics_renderer_draw_filled_triangle (c->renderer, 0, 0, w, 0, 0, h, 255, 0, 0);
+        graphics_renderer_draw_filled_triangle (c->renderer, w, 0, w, h, 0, h, 0, 255, 0);
+    }
+}
+
+static void bench_shaded_fill_rate (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+    int w = c->renderer->width - 1;
+    int h = c->renderer->height - 1;
+
+    graphics_renderer_clear_buffer (c->renderer);
+
+    for (int i = 0; i < c->count; i++) {
+        graphics_renderer_draw_shaded_triangle (c->renderer, 0, 0, w, 0, 0, h, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+        graphics_renderer_draw_shaded_triangle (c->renderer, w, 0, w, h, 0, h, 0, 255, 0, 0, 0, 255, 255, 0, 0);
+    }
+}
+
+static void bench_triangle_rate (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+
+    graphics_renderer_clear_buffer (c->renderer);
+
+    for (int i = 0; i < c->count; i++) {
+        int *p = &c->coords[i * 6];
+        graphics_renderer_draw_filled_triangle (c->renderer, p[0], p[1], p[2], p[3], p[4], p[5], 255, 255, 255);
+    }
+}
+
+static void bench_line_rate (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+
+    graphics_renderer_clear_buffer (c->renderer);
+
+    for (int i = 0; i < c->count; i++) {
+        int *p = &c->coords[i * 4];
+        graphics_renderer_draw_line (c->renderer, p[0], p[1], p[2], p[3], 255, 255, 255);
+    }
+}
+
+static void bench_clear (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+    graphics_renderer_clear_buffer (c->renderer);
+}
+
+static void bench_linearize (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+    graphics_renderer_linearize (c->renderer);
+}
+
+/* Expanding a compact frame to BGRX, as presenting
+   it to a 24 bit display does. */
+static void bench_expand (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+    graphics_renderer_t *renderer = c->renderer;
+    int n = (int) (renderer->width * renderer->height);
+
+    if (renderer->format == GRAPHICS_FORMAT_RGB565) {
+        graphics_kernels.expand_rgb565 ((graphics_pixel_t *) c->coords, (const uint16_t *) renderer->pixels, n);
+    } else {
+        graphics_kernels.expand_indexed ((graphics_pixel_t *) c->coords, (const uint8_t *) renderer->pixels, n);
+    }
+}
+
+static void bench_raster (bench_t *bench, graphics_layout_t layout, bool msaa, graphics_format_t format, bool dither, const char *prefix) {
+    graphics_renderer_t *renderer = bench_create_renderer_format (bench, format);
+
+    if (renderer == NULL || !graphics_renderer_set_layout (renderer, layout) || !graphics_renderer_set_msaa (renderer, msaa)) {
+        graphics_renderer_destroy (renderer);
+        return;
+    }
+
+    graphics_renderer_set_dither (renderer, dither);
+
+    /* Same scene for every layout */
+    bench_rand_state = 0x12345678;
+
+    char name[64];
+    double pixels = (double) renderer->width * renderer->height;
+    bench_raster_ctx_t ctx = { renderer, 1, NULL };
+
+    snprintf (name, sizeof (name), "%s/clear", prefix);
+    bench_run (bench, name, "pixels", pixels, bench_clear, &ctx);
+
+    snprintf (name, sizeof (name), "%s/linearize", prefix);
+    bench_run (bench, name, "pixels", pixels, bench_linearize, &ctx);
+
+    if (format != GRAPHICS_FORMAT_BGRX8888) {
+        ctx.coords = (int *) malloc (sizeof (graphics_pixel_t) * renderer->width * renderer->height);
+
+        if (ctx.coords) {
+            snprintf (name, sizeof (name), "%s/expand", prefix);
+            bench_run (bench, name, "pixels", pixels, bench_expand, &ctx);
+            free (ctx.coords);
+            ctx.coords = NULL;
+        }
+    }
+
+    ctx.count = 8;
+    snprintf (name, sizeof (name), "%s/fill_rate", prefix);
+    bench_run (bench, name, "pixels", pixels * ctx.count, bench_fill_rate, &ctx);
+    snprintf (name, sizeof (name), "%s/shaded_fill_rate", prefix);
+    bench_run (bench, name, "pixels", pixels * ctx.count, bench_shaded_fill_rate, &ctx);
+
+    /* Translucent fills, which read back the target */
+    static const struct {
+        graphics_blend_mode_t mode;
+        const char *name;
+    } blends[] = {
+        { GRAPHICS_BLEND_ALPHA, "blend_alpha" },
+        { GRAPHICS_BLEND_ADDITIVE, "blend_additive" },
+        { GRAPHICS_BLEND_MULTIPLY, "blend_multiply" }
+    };
+
+    for (int i = 0; i < (int) (sizeof (blends) / sizeof (blends[0])); i++) {
+        graphics_renderer_set_blend_mode (renderer, blends[i].mode, 128);
+        snprintf (name, sizeof (name), "%s/%s_fill_rate", prefix, blends[i].name);
+        bench_run (bench, name, "pixels", pixels * ctx.count, bench_fill_rate, &ctx);
+    }
+
+    graphics_renderer_set_blend_mode (renderer, GRAPHICS_BLEND_NONE, 255);
+
+    /* Tiny triangles of a few pixels each */
+    ctx.count = 100000;
+    ctx.coords = (int *) malloc (sizeof (int) * 6 * ctx.count);
+
+    if (ctx.coords) {
+        for (int i = 0; i < ctx.count; i++) {
+            int x = bench_rand () % (renderer->width - 4);
+            int y = bench_rand () % (renderer->height - 4);
+            int *p = &ctx.coords[i * 6];
+            p[0] = x;
+            p[1] = y;
+            p[2] = x + 1 + bench_rand () % 3;
+            p[3] = y + bench_rand () % 3;
+            p[4] = x + bench_rand () % 3;
+            p[5] = y + 1 + bench_rand () % 3;
+        }
+
+        snprintf (name, sizeof (name), "%s/triangle_rate", prefix);
+        bench_run (bench, name, "triangles", ctx.count, bench_triangle_rate, &ctx);
+        free (ctx.coords);
+    }
+
+    /* Random lines, partly off screen so that
+       per-pixel bounds checks are exercised. */
+    ctx.count = 20000;
+    ctx.coords = (int *) malloc (sizeof (int) * 4 * ctx.count);
+
+    if (ctx.coords) {
+        for (int i = 0; i < ctx.count * 4; i += 2) {
+            ctx.coords[i] = (int) bench_rand_range (-0.1 * renderer->width, 1.1 * renderer->width);
+            ctx.coords[i + 1] = (int) bench_rand_range (-0.1 * renderer->height, 1.1 * renderer->height);
+        }
+
+        snprintf (name, sizeof (name), "%s/line_rate", prefix);
+        bench_run (bench, name, "lines", ctx.count, bench_line_rate, &ctx);
+        free (ctx.coords);
+    }
+
+    graphics_renderer_destroy (renderer);
+}
+
+/* Small changing regions over an otherwise
+   static frame, as drawn by tools and dashboards. */
+static void bench_small_updates (void *ctx) {
+    bench_raster_ctx_t *c = (bench_raster_ctx_t *) ctx;
+
+    graphics_renderer_clear_buffer (c->renderer);
+
+    for (int i = 0; i < 8; i++) {
+        int x = 20 + i * 70;
+        int y = 20 + (c->count + i * 13) % 400;
+        graphics_renderer_draw_filled_triangle (c->renderer, x, y, x + 40, y, x + 20, y + 30, 255, 255, 0);
+    }
+
+    c->count++;
+}
+
+static void bench_dirty (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+
+    if (renderer == NULL) {
+        return;
+    }
+
+    bench_raster_ctx_t ctx = { renderer, 0, NULL };
+
+    bench_run (bench, "dirty/small_updates_full_clear", "frames", 1, bench_small_updates, &ctx);
+
+    graphics_renderer_set_dirty_tracking (renderer, true);
+    bench_run (bench, "dirty/small_updates_tracked", "frames", 1, bench_small_updates, &ctx);
+
+    graphics_renderer_destroy (renderer);
+}
+
+/* Capture - small updates encoded to Y4M by the
+   writer thread. Each frame waits for a free buffer
+   rather than being dropped, so this is the rate
+   capture can keep up with. */
+typedef struct {
+    bench_raster_ctx_t raster;
+    graphics_capture_t *capture;
+} bench_capture_ctx_t;
+
+static void bench_capture_frame (void *ctx) {
+    bench_capture_ctx_t *c = (bench_capture_ctx_t *) ctx;
+
+    bench_small_updates (&c->raster);
+    graphics_renderer_display (c->raster.renderer, NULL);
+
+    while (!graphics_capture_frame (c->capture, c->raster.renderer)) {
+        sched_yield ();
+    }
+}
+
+static void bench_capture (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+
+    if (renderer == NULL) {
+        return;
+    }
+
+    static const bool tracked[] = { false, true };
+
+    for (int i = 0; i < (int) (sizeof (tracked) / sizeof (tracked[0])); i++) {
+        bench_capture_ctx_t ctx = { { renderer, 0, NULL }, NULL };
+        ctx.capture = graphics_capture_start ("/dev/null", GRAPHICS_CAPTURE_Y4M, bench->width, bench->height, 60, 4);
+
+        if (ctx.capture == NULL) {
+            break;
+        }
+
+        graphics_renderer_set_dirty_tracking (renderer, tracked[i]);
+        bench_run (bench, tracked[i] ? "capture/y4m_small_updates_tracked" : "capture/y4m_small_updates_full", "frames", 1, bench_capture_frame, &ctx);
+        graphics_capture_stop (ctx.capture);
+    }
+
+    graphics_renderer_destroy (renderer);
+}
+
+/* Viewports - the frame split into four views,
+   each drawn on its own thread. */
+static void bench_viewport_draw (graphics_viewport_t *viewport, void *aux) {
+    for (int i = 0; i < 64; i++) {
+        int x = (i * 37) % (int) viewport->renderer->width;
+        int y = (i * 53) % (int) viewport->renderer->height;
+        graphics_renderer_draw_filled_triangle (viewport->renderer, x, y, x + 60, y + 10, x + 20, y + 50, 0, 255, 128);
+    }
+}
+
+static void bench_viewports_frame (void *ctx) {
+    graphics_viewports_render ((graphics_viewports_t *) ctx);
+}
+
+static void bench_viewports (bench_t *bench) {
+    graphics_viewports_t *viewports = graphics_viewports_create ();
+    graphics_renderer_t *renderers[4] = { NULL };
+
+    if (viewports == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        renderers[i] = graphics_renderer_init (bench->width / 2, bench->height / 2, GRAPHICS_FORMAT_BGRX8888);
+
+        if (renderers[i] == NULL || graphics_viewports_add (viewports, renderers[i], NULL, (i % 2) * bench->width / 2, (i / 2) * bench->height / 2, bench_viewport_draw, NULL) == NULL) {
+            break;
+        }
+    }
+
+    if (viewports->count == 4) {
+        bench_run (bench, "viewports/4_views", "frames", 1, bench_viewports_frame, viewports);
+    }
+
+    graphics_viewports_destroy (viewports);
+
+    for (int i = 0; i < 4; i++) {
+        graphics_renderer_destroy (renderers[i]);
+    }
+}
+
+/* Model pipeline cases (transform, clip, project, draw) */
+typedef struct {
+    graphics_renderer_t *renderer;
+    resources_model_t model;
+    graphics_camera_t camera;
+} bench_model_ctx_t;
+
+static void bench_render_model (void *ctx) {
+    bench_model_ctx_t *c = (bench_model_ctx_t *) ctx;
+    graphics_renderer_clear_buffer (c->renderer);
+    graphics_renderer_render_model (c->renderer, &c->model, &c->camera);
+}
+
+static void bench_init_model_ctx (bench_model_ctx_t *ctx, graphics_renderer_t *renderer, resources_mesh_t *mesh) {
+    ctx->renderer = renderer;
+    ctx->model.mesh = mesh;
+    ctx->model.position = (maths_vec4f) { 0.0, 0.0, 4.0, 1.0 };
+    ctx->model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    ctx->model.rotation = (maths_vec4f) { 0.3, 0.2, 0.0, 0.0 };
+    ctx->camera.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+    ctx->camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    ctx->camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+}
+
+static void bench_models (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+
+    if (renderer == NULL) {
+        return;
+    }
+
+    bench_model_ctx_t ctx;
+
+    /* Clipping heavy - a large floor grid passing
+       under and around the camera, so that most
+       triangles cross at least one frustum plane. */
+    resources_mesh_t *grid = bench_create_grid (64);
+
+    if (grid) {
+        bench_init_model_ctx (&ctx, renderer, grid);
+        ctx.model.position = (maths_vec4f) { 0.0, -1.0, 0.0, 1.0 };
+        ctx.model.scale = (maths_vec4f) { 50.0, 1.0, 50.0, 1.0 };
+        ctx.model.rotation = (maths_vec4f) { 0.0, 0.4, 0.0, 0.0 };
+        bench_run (bench, "pipeline/clip_heavy", "triangles", grid->num_faces, bench_render_model, &ctx);
+        resources_mesh_free (grid);
+    }
+
+    /* Scaling with mesh size */
+    for (long n = 1000; n <= bench->max_triangles; n *= 10) {
+        resources_mesh_t *sphere = bench_create_sphere (n);
+
+        if (sphere == NULL) {
+            break;
+        }
+
+        char name[64];
+        snprintf (name, sizeof (name), "pipeline/sphere_%ld", n);
+
+        bench_init_model_ctx (&ctx, renderer, sphere);
+        bench_run (bench, name, "triangles", sphere->num_faces, bench_render_model, &ctx);
+        resources_mesh_free (sphere);
+    }
+
+    graphics_renderer_destroy (renderer);
+}
+
+/* Wireframe modes - a closed mesh drawn as face
+   outlines, as unique edges, and as its outline. */
+static void bench_wireframe (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+    resources_mesh_t *sphere = renderer != NULL ? bench_create_sphere (100000) : NULL;
+
+    if (sphere == NULL || !resources_mesh_build_edges (sphere)) {
+        resources_mesh_free (sphere);
+        graphics_renderer_destroy (renderer);
+        return;
+    }
+
+    static const char *names[] = { "triangles", "edges", "outline" };
+    bench_model_ctx_t ctx;
+    bench_init_model_ctx (&ctx, renderer, sphere);
+
+    for (int mode = GRAPHICS_WIREFRAME_TRIANGLES; mode <= GRAPHICS_WIREFRAME_OUTLINE; mode++) {
+        char name[64];
+        snprintf (name, sizeof (name), "wireframe/sphere_100000_%s", names[mode]);
+
+        graphics_renderer_set_wireframe_mode (renderer, (graphics_wireframe_mode_t) mode, 0.5);
+        bench_run (bench, name, "triangles", sphere->num_faces, bench_render_model, &ctx);
+    }
+
+    resources_mesh_free (sphere);
+    graphics_renderer_destroy (renderer);
+}
+
+/* Vertex formats - the same sphere's vertices
+   stored as doubles, packed floats and quantized,
+   transformed into camera space. */
+typedef struct {
+    resources_mesh_t *mesh;
+    maths_vec4f *out;
+    maths_mat4x4f transform;
+} bench_vertex_format_ctx_t;
+
+static void bench_transform_mesh (void *ctx) {
+    bench_vertex_format_ctx_t *c = (bench_vertex_format_ctx_t *) ctx;
+    resources_mesh_t *mesh = c->mesh;
+
+    switch (mesh->format) {
+        case RESOURCES_VERTEX_FLOAT3:
+            graphics_kernels.transform_vertices_float3 (c->out, mesh->vertices_float3, mesh->num_vertices, &c->transform);
+            break;
+        case RESOURCES_VERTEX_QUANTIZED:
+            graphics_kernels.transform_vertices_quantized (c->out, mesh->vertices_quantized, mesh->num_vertices, &c->transform);
+            break;
+        default:
+            graphics_kernels.transform_vertices (c->out, mesh->vertices, mesh->num_vertices, &c->transform);
+            break;
+    }
+}
+
+static void bench_vertex_formats (bench_t *bench) {
+    resources_mesh_t *sphere = bench_create_sphere (1000000);
+    maths_vec4f *out = sphere != NULL ? (maths_vec4f *) malloc (sizeof (maths_vec4f) * sphere->num_vertices) : NULL;
+
+    if (out == NULL) {
+        resources_mesh_free (sphere);
+        return;
+    }
+
+    static const char *names[] = { "double", "float3", "quantized" };
+    maths_mat4x4f model_view = maths_model_transform ((maths_vec4f) { 0.0, 0.0, 4.0, 1.0 }, (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 }, (maths_vec4f) { 0.3, 0.2, 0.0, 0.0 });
+    bench_vertex_format_ctx_t ctx = { sphere, out, model_view };
+
+    for (int format = RESOURCES_VERTEX_DOUBLE; format <= RESOURCES_VERTEX_QUANTIZED; format++) {
+        if (!resources_mesh_set_vertex_format (sphere, (resources_vertex_format_t) format)) {
+            break;
+        }
+
+        char name[64];
+        snprintf (name, sizeof (name), "vertex_format/transform_1000000_%s", names[format]);
+
+        ctx.transform = resources_mesh_dequantize (sphere, model_view);
+        bench_run (bench, name, "vertices", sphere->num_vertices, bench_transform_mesh, &ctx);
+    }
+
+    free (out);
+    resources_mesh_free (sphere);
+}
+
+/* OBJ loading */
+typedef struct {
+    const char *path;
+} bench_obj_ctx_t;
+
+/* Staged frames - the same list drawn directly, and
+   through the geometry/raster pipeline with one and
+   two frames in flight. */
+typedef struct {
+    graphics_renderer_t *renderer;
+    graphics_command_list_t *list;
+    graphics_pipeline_t *pipeline;
+} bench_staged_ctx_t;
+
+static void bench_staged_immediate (void *ctx) {
+    bench_staged_ctx_t *c = (bench_staged_ctx_t *) ctx;
+    graphics_renderer_execute_command_lists (c->renderer, &c->list, 1);
+}
+
+static void bench_staged_pipelined (void *ctx) {
+    bench_staged_ctx_t *c = (bench_staged_ctx_t *) ctx;
+    graphics_pipeline_frame (c->pipeline, c->list);
+}
+
+static void bench_staged (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+    resources_mesh_t *sphere = renderer != NULL ? bench_create_sphere (100000) : NULL;
+    static graphics_command_list_t list;
+
+    if (sphere == NULL || !graphics_command_list_init (&list)) {
+        resources_mesh_free (sphere);
+        graphics_renderer_destroy (renderer);
+        return;
+    }
+
+    bench_model_ctx_t model;
+    bench_init_model_ctx (&model, renderer, sphere);
+    graphics_command_list_clear (&list);
+    graphics_command_list_set_camera (&list, &model.camera);
+    graphics_command_list_draw_model (&list, &model.model);
+
+    bench_staged_ctx_t ctx = { renderer, &list, NULL };
+    bench_run (bench, "staged/sphere_100000_immediate", "frames", 1, bench_staged_immediate, &ctx);
+
+    static const int frames[] = { 1, 2 };
+
+    for (int i = 0; i < (int) (sizeof (frames) / sizeof (frames[0])); i++) {
+        ctx.pipeline = graphics_pipeline_create (renderer, frames[i], 16);
+
+        if (ctx.pipeline == NULL) {
+            break;
+        }
+
+        char name[64];
+        snprintf (name, sizeof (name), "staged/sphere_100000_%d_in_flight", frames[i]);
+        bench_run (bench, name, "frames", 1, bench_staged_pipelined, &ctx);
+
+        graphics_pipeline_destroy (ctx.pipeline);
+    }
+
+    graphics_command_list_destroy (&list);
+    resources_mesh_free (sphere);
+    graphics_renderer_destroy (renderer);
+}
+
+/* Sprites - a HUD of text and alpha blended icons
+   batched over a frame, against the same text drawn
+   pixel by pixel. */
+typedef struct {
+    graphics_renderer_t *renderer;
+    graphics_sprite_batch_t batch;
+    graphics_font_t *font;
+    graphics_surface_t *icon;
+    graphics_surface_t *image;
+    const char *text;
+} bench_sprites_ctx_t;
+
+static void bench_sprites_text (void *ctx) {
+    bench_sprites_ctx_t *c = (bench_sprites_ctx_t *) ctx;
+
+    graphics_sprite_batch_reset (&c->batch);
+    graphics_sprite_batch_add_text (&c->batch, c->font, 4, 4, 1, c->text);
+    graphics_renderer_draw_sprites (c->renderer, &c->batch);
+}
+
+static void bench_sprites_text_pixels (void *ctx) {
+    bench_sprites_ctx_t *c = (bench_sprites_ctx_t *) ctx;
+    const graphics_surface_t *atlas = c->font->atlas;
+    int x = 4, y = 4;
+
+    for (const char *t = c->text; *t != '\0'; t++) {
+        if (*t == '\n') {
+            x = 4;
+            y += c->font->line_height;
+            continue;
+        }
+
+        const graphics_rect_t *glyph = &c->font->glyphs[*t - GRAPHICS_FONT_FIRST_CHAR];
+
+        for (int j = 0; j < GRAPHICS_FONT_GLYPH_SIZE; j++) {
+            const uint32_t *row = (const uint32_t *) atlas->pixels + (glyph->y0 + j) * atlas->width + glyph->x0;
+
+            for (int i = 0; i < GRAPHICS_FONT_GLYPH_SIZE; i++) {
+                if (row[i] != atlas->key) {
+                    graphics_renderer_draw_pixel (c->renderer, x + i, y + j, 255, 255, 255);
+                }
+            }
+        }
+
+        x += c->font->advance;
+    }
+}
+
+static void bench_sprites_icons (void *ctx) {
+    bench_sprites_ctx_t *c = (bench_sprites_ctx_t *) ctx;
+
+    graphics_sprite_batch_reset (&c->batch);
+
+    for (int i = 0; i < 64; i++) {
+        graphics_rect_t dest = { (i % 8) * 72, (i / 8) * 56, (i % 8) * 72 + 64, (i / 8) * 56 + 64 };
+        graphics_sprite_batch_add (&c->batch, c->icon, NULL, &dest, GRAPHICS_UPSCALE_NEAREST);
+    }
+
+    graphics_renderer_draw_sprites (c->renderer, &c->batch);
+}
+
+static void bench_sprites_scaled (void *ctx) {
+    bench_sprites_ctx_t *c = (bench_sprites_ctx_t *) ctx;
+    graphics_rect_t dest = { 0, 0, c->renderer->width, c->renderer->height };
+
+    graphics_renderer_blit_scaled (c->renderer, c->image, NULL, &dest, GRAPHICS_UPSCALE_BILINEAR);
+}
+
+static void bench_sprites (bench_t *bench) {
+    static const graphics_format_t formats[] = { GRAPHICS_FORMAT_BGRX8888, GRAPHICS_FORMAT_RGB565 };
+    static const char *format_names[] = { "bgrx", "rgb565" };
+    static char text[16 * 65];
+    int glyphs = 0;
+
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 64; x++) {
+            text[y * 65 + x] = GRAPHICS_FONT_FIRST_CHAR + 1 + (x * 7 + y) % (GRAPHICS_FONT_NUM_CHARS - 1);
+            glyphs++;
+        }
+
+        text[y * 65 + 64] = y < 15 ? '\n' : '\0';
+    }
+
+    graphics_pixel_t *pixels = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * 256 * 256);
+
+    if (pixels == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 256 * 256; i++) {
+        int x = i % 256 - 128, y = i / 256 - 128;
+        uint8_t alpha = x * x + y * y < 128 * 128 ? 255 - (x * x + y * y) / 65 : 0;
+        pixels[i] = (graphics_pixel_t) { (uint8_t) i, (uint8_t) (i >> 8), 200, alpha };
+    }
+
+    for (int f = 0; f < (int) (sizeof (formats) / sizeof (formats[0])); f++) {
+        bench_sprites_ctx_t ctx = { bench_create_renderer_format (bench, formats[f]) };
+
+        if (ctx.renderer == NULL || !graphics_sprite_batch_init (&ctx.batch)) {
+            graphics_renderer_destroy (ctx.renderer);
+            break;
+        }
+
+        ctx.font = graphics_font_create (formats[f], 255, 255, 255);
+        ctx.icon = graphics_surface_create (64, 64, GRAPHICS_FORMAT_BGRX8888, GRAPHICS_SURFACE_ALPHA);
+        ctx.image = graphics_surface_create (256, 256, formats[f], GRAPHICS_SURFACE_OPAQUE);
+        ctx.text = text;
+
+        if (ctx.font != NULL && ctx.icon != NULL && ctx.image != NULL) {
+            char name[64];
+            graphics_surface_upload (ctx.image, pixels);
+
+            /* Every fourth pixel of the image makes an icon */
+            for (int i = 0; i < 64 * 64; i++) {
+                pixels[i] = pixels[(i / 64) * 4 * 256 + (i % 64) * 4];
+            }
+
+            graphics_surface_upload (ctx.icon, pixels);
+            graphics_renderer_clear_buffer (ctx.renderer);
+
+            snprintf (name, sizeof (name), "sprites/text_%s", format_names[f]);
+            bench_run (bench, name, "glyphs", glyphs, bench_sprites_text, &ctx);
+
+            if (formats[f] == GRAPHICS_FORMAT_BGRX8888) {
+                bench_run (bench, "sprites/text_draw_pixel", "glyphs", glyphs, bench_sprites_text_pixels, &ctx);
+            }
+
+            snprintf (name, sizeof (name), "sprites/alpha_icons_%s", format_names[f]);
+            bench_run (bench, name, "pixels", 64 * 64 * 64, bench_sprites_icons, &ctx);
+
+            snprintf (name, sizeof (name), "sprites/bilinear_fullscreen_%s", format_names[f]);
+            bench_run (bench, name, "pixels", bench->width * bench->height, bench_sprites_scaled, &ctx);
+        }
+
+        graphics_surface_destroy (ctx.image);
+        graphics_surface_destroy (ctx.icon);
+        graphics_font_destroy (ctx.font);
+        graphics_sprite_batch_destroy (&ctx.batch);
+        graphics_renderer_destroy (ctx.renderer);
+    }
+
+    free (pixels);
+}
+
+static void bench_load_obj (void *ctx) {
+    bench_obj_ctx_t *c = (bench_obj_ctx_t *) ctx;
+    resources_mesh_free (resources_load_mesh_from_obj_file (c->path));
+}
+
+static void bench_obj (bench_t *bench) {
+    char path[] = "/tmp/softgfx_bench_XXXXXX";
+    int fd = mkstemp (path);
+
+    if (fd == -1) {
+        fprintf (stderr, "Error - bench: could not create temporary OBJ file.\n");
+        return;
+    }
+
+    FILE *file = fdopen (fd, "w");
+    resources_mesh_t *sphere = bench_create_sphere (100000);
+
+    if (file == NULL || sphere == NULL) {
+        fprintf (stderr, "Error - bench: could not write temporary OBJ file.\n");
+        if (file) {
+            fclose (file);
+        } else {
+            close (fd);
+        }
+        resources_mesh_free (sphere);
+        unlink (path);
+        return;
+    }
+
+    fprintf (file, "# bench sphere\nvt 0.0 0.0\n");
+
+    for (int i = 0; i < sphere->num_vertices; i++) {
+        maths_vec4f v = sphere->vertices[i].coord;
+        fprintf (file, "v %f %f %f\n", v.x, v.y, v.z);
+    }
+
+    for (int i = 0; i < sphere->num_faces; i++) {
+        fprintf (file, "f %d/1 %d/1 %d/1\n", sphere->faces[i][0] + 1, sphere->faces[i][1] + 1, sphere->faces[i][2] + 1);
+    }
+
+    long bytes = ftell (file);
+    int faces = sphere->num_faces;
+    fclose (file);
+    resources_mesh_free (sphere);
+
+    bench_obj_ctx_t ctx = { path };
+    bench_run (bench, "resources/obj_load_faces", "faces", faces, bench_load_obj, &ctx);
+
+    bench_result_t *r = &bench->results[bench->num_results - 1];
+    fprintf (stderr, "bench: obj file is %ld bytes (%.1f MB/s)\n", bytes, bytes * 1e3 / r->median_ns);
+
+    unlink (path);
+}
+
+/* Out-of-core streaming - a sphere too large for its
+   cache budget, with the camera close in and turning
+   so that clusters keep coming in and out of view. */
+typedef struct {
+    graphics_renderer_t *renderer;
+    resources_clustered_mesh_t *mesh;
+    resources_model_t model;
+    graphics_camera_t camera;
+} bench_streaming_ctx_t;
+
+static void bench_render_clustered (void *ctx) {
+    bench_streaming_ctx_t *c = (bench_streaming_ctx_t *) ctx;
+    c->camera.rotation.y += 0.05;
+    graphics_renderer_clear_buffer (c->renderer);
+    graphics_renderer_render_clustered_mesh (c->renderer, c->mesh, &c->model, &c->camera);
+}
+
+static void bench_streaming (bench_t *bench) {
+    char path[] = "/tmp/softgfx_bench_XXXXXX";
+    int fd = mkstemp (path);
+
+    if (fd == -1) {
+        fprintf (stderr, "Error - bench: could not create temporary clustered mesh file.\n");
+        return;
+    }
+
+    close (fd);
+
+    resources_mesh_t *sphere = bench_create_sphere (100000);
+    int faces = sphere != NULL ? sphere->num_faces : 0;
+    size_t size = sphere != NULL ? sizeof (resources_vertex_t) * sphere->num_vertices + sizeof (resources_triangle_t) * faces : 0;
+    bool written = sphere != NULL && resources_clustered_mesh_write (sphere, path, RESOURCES_CLUSTER_FACES);
+
+    resources_mesh_free (sphere);
+
+    graphics_renderer_t *renderer = written ? bench_create_renderer (bench) : NULL;
+    resources_clustered_mesh_t *mesh = renderer != NULL ? resources_clustered_mesh_open (path, size / 4) : NULL;
+
+    if (mesh != NULL) {
+        bench_streaming_ctx_t ctx = { renderer, mesh };
+        ctx.model.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+        ctx.model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+        ctx.model.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+        ctx.camera.position = (maths_vec4f) { 0.0, 0.0, -1.2, 1.0 };
+        ctx.camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+        ctx.camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+
+        bench_run (bench, "streaming/clustered_sphere", "frames", 1, bench_render_clustered, &ctx);
+        fprintf (stderr, "bench: %u clusters, %zu of %zu bytes cached\n", mesh->num_clusters, mesh->cached, size);
+    } else {
+        fprintf (stderr, "Error - bench: could not set up clustered mesh.\n");
+    }
+
+    resources_clustered_mesh_close (mesh);
+    graphics_renderer_destroy (renderer);
+    unlink (path);
+}
+
+/* Deferred lighting - a floor lit by many small
+   point lights scattered over it, as in night scenes.
+   The frame includes filling the G-buffer. */
+#define BENCH_LIGHTS 256
+
+typedef struct {
+    bench_model_ctx_t scene;
+    graphics_light_t lights[BENCH_LIGHTS];
+} bench_lighting_ctx_t;
+
+static void bench_render_lit (void *ctx) {
+    bench_lighting_ctx_t *c = (bench_lighting_ctx_t *) ctx;
+    bench_render_model (&c->scene);
+    graphics_deferred_light (c->scene.renderer, c->lights, BENCH_LIGHTS, &c->scene.camera, 0.1);
+}
+
+static void bench_lighting (bench_t *bench) {
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+    resources_mesh_t *grid = renderer != NULL ? bench_create_grid (64) : NULL;
+
+    if (grid == NULL) {
+        graphics_renderer_destroy (renderer);
+        return;
+    }
+
+    static bench_lighting_ctx_t ctx;
+    bench_init_model_ctx (&ctx.scene, renderer, grid);
+    ctx.scene.model.position = (maths_vec4f) { 0.0, 1.0, 10.0, 1.0 };
+    ctx.scene.model.scale = (maths_vec4f) { 10.0, 1.0, 10.0, 1.0 };
+    ctx.scene.model.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < BENCH_LIGHTS; i++) {
+        ctx.lights[i].position = (maths_vec4f) { bench_rand_range (-10.0, 10.0), bench_rand_range (0.2, 0.8), bench_rand_range (0.0, 20.0), 1.0 };
+        ctx.lights[i].radius = bench_rand_range (0.5, 2.0);
+        ctx.lights[i].intensity = 2.0;
+        ctx.lights[i].red = (uint8_t) bench_rand_range (64, 255);
+        ctx.lights[i].green = (uint8_t) bench_rand_range (64, 255);
+        ctx.lights[i].blue = (uint8_t) bench_rand_range (64, 255);
+    }
+
+    static const int threads[] = { 1, 4 };
+
+    for (int i = 0; i < (int) (sizeof (threads) / sizeof (threads[0])); i++) {
+        char name[64];
+        snprintf (name, sizeof (name), "lighting/deferred_%d_lights_%dt", BENCH_LIGHTS, threads[i]);
+
+        /* Workers besides the render thread */
+        system_jobs_t *jobs = threads[i] > 1 ? system_jobs_create (threads[i] - 1, false) : NULL;
+        graphics_renderer_set_jobs (renderer, jobs);
+
+        if (graphics_deferred_enable (renderer)) {
+            bench_run (bench, name, "frames", 1, bench_render_lit, &ctx);
+        }
+
+        graphics_deferred_disable (renderer);
+        graphics_renderer_set_jobs (renderer, NULL);
+        system_jobs_destroy (jobs);
+    }
+
+    resources_mesh_free (grid);
+    graphics_renderer_destroy (renderer);
+}
+
+/* Job system - the cost of submitting small jobs,
+   and a memory bound loop and a large mesh shared
+   out between workers. */
+#define BENCH_JOBS 1024
+#define BENCH_JOBS_LOOP (1 << 20)
+
+typedef struct {
+    system_jobs_t *jobs;
+    float *values;
+    bench_model_ctx_t scene;
+} bench_jobs_ctx_t;
+
+static void bench_empty_job (void *arg) {
+    (void) arg;
+}
+
+static void bench_submit_jobs (void *ctx) {
+    bench_jobs_ctx_t *c = (bench_jobs_ctx_t *) ctx;
+    static system_job_t list[BENCH_JOBS];
+
+    for (int i = 0; i < BENCH_JOBS; i++) {
+        list[i] = (system_job_t) { bench_empty_job, NULL };
+    }
+
+    system_job_counter_t counter;
+    system_job_counter_init (&counter);
+    system_jobs_submit (c->jobs, list, BENCH_JOBS, &counter);
+    system_jobs_wait (c->jobs, &counter);
+    system_job_counter_destroy (&counter);
+}
+
+static void bench_scale_range (int begin, int end, void *arg) {
+    float *values = (float *) arg;
+
+    for (int i = begin; i < end; i++) {
+        values[i] = values[i] * 0.5f + 1.0f;
+    }
+}
+
+static void bench_parallel_for (void *ctx) {
+    bench_jobs_ctx_t *c = (bench_jobs_ctx_t *) ctx;
+    system_jobs_parallel_for (c->jobs, 0, BENCH_JOBS_LOOP, 4096, bench_scale_range, c->values);
+}
+
+static void bench_jobs (bench_t *bench) {
+    static bench_jobs_ctx_t ctx;
+    ctx.values = (float *) calloc (BENCH_JOBS_LOOP, sizeof (float));
+    graphics_renderer_t *renderer = bench_create_renderer (bench);
+    resources_mesh_t *sphere = bench_create_sphere (1000000);
+
+    if (ctx.values == NULL || renderer == NULL || sphere == NULL) {
+        free (ctx.values);
+        graphics_renderer_destroy (renderer);
+        resources_mesh_free (sphere);
+        return;
+    }
+
+    bench_init_model_ctx (&ctx.scene, renderer, sphere);
+
+    static const int threads[] = { 1, 4 };
+
+    for (int i = 0; i < (int) (sizeof (threads) / sizeof (threads[0])); i++) {
+        char name[64];
+
+        /* Workers besides the calling thread */
+        ctx.jobs = threads[i] > 1 ? system_jobs_create (threads[i] - 1, false) : NULL;
+        graphics_renderer_set_jobs (renderer, ctx.jobs);
+
+        if (ctx.jobs != NULL) {
+            snprintf (name, sizeof (name), "jobs/submit_%d_empty_%dt", BENCH_JOBS, threads[i]);
+            bench_run (bench, name, "jobs", BENCH_JOBS, bench_submit_jobs, &ctx);
+        }
+
+        snprintf (name, sizeof (name), "jobs/parallel_for_1m_%dt", threads[i]);
+        bench_run (bench, name, "items", BENCH_JOBS_LOOP, bench_parallel_for, &ctx);
+
+        snprintf (name, sizeof (name), "jobs/sphere_1000000_%dt", threads[i]);
+        bench_run (bench, name, "triangles", sphere->num_faces, bench_render_model, &ctx.scene);
+
+        graphics_renderer_set_jobs (renderer, NULL);
+        system_jobs_destroy (ctx.jobs);
+    }
+
+    free (ctx.values);
+    resources_mesh_free (sphere);
+    graphics_renderer_destroy (renderer);
+}
+
+/* Offline rendering - a short flythrough around a
+   sphere, one renderer per thread. */
+#define BENCH_OFFLINE_FRAMES 8
+
+static void bench_render_offline (void *ctx) {
+    bench_sink = graphics_offline_render ((const graphics_offline_job_t *) ctx);
+}
+
+static void bench_offline (bench_t *bench) {
+    resources_mesh_t *sphere = bench_create_sphere (20000);
+
+    if (sphere == NULL) {
+        return;
+    }
+
+    static resources_model_t model;
+    model.mesh = sphere;
+    model.position = (maths_vec4f) { 0.0, 0.0, 4.0, 1.0 };
+    model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    model.rotation = (maths_vec4f) { 0.3, 0.2, 0.0, 0.0 };
+
+    static graphics_camera_key_t keys[2];
+    keys[0] = (graphics_camera_key_t) { 0.0, { { -1.0, 0.0, 0.0, 1.0 }, { 1.0, 1.0, 1.0, 1.0 }, { 0.0, 0.2, 0.0, 0.0 } } };
+    keys[1] = (graphics_camera_key_t) { 1.0, { { 1.0, 0.5, 1.0, 1.0 }, { 1.0, 1.0, 1.0, 1.0 }, { 0.1, -0.2, 0.0, 0.0 } } };
+
+    static const int threads[] = { 1, 4 };
+
+    for (int i = 0; i < (int) (sizeof (threads) / sizeof (threads[0])); i++) {
+        graphics_offline_job_t job = {
+            .width = bench->width,
+            .height = bench->height,
+            .view_distance = 1,
+            .view_width = 2,
+            .view_height = 2 * bench->height / (double) bench->width,
+            .num_frames = BENCH_OFFLINE_FRAMES,
+            .frame_rate = BENCH_OFFLINE_FRAMES,
+            .keys = keys,
+            .num_keys = 2,
+            .models = &model,
+            .num_models = 1,
+            .num_threads = threads[i]
+        };
+
+        char name[64];
+        snprintf (name, sizeof (name), "offline/sphere_20000_%dt", threads[i]);
+        bench_run (bench, name, "frames", BENCH_OFFLINE_FRAMES, bench_render_offline, &job);
+    }
+
+    resources_mesh_free (sphere);
+}
+
+/* Ray queries - picking rays from around a sphere
+   towards random points near its centre, as from
+   the mouse. */
+#define BENCH_RAYS 1000
+
+typedef struct {
+    resources_model_t model;
+    resources_ray_t rays[BENCH_RAYS];
+    resources_ray_hit_t hits[BENCH_RAYS];
+} bench_picking_ctx_t;
+
+static void bench_build_bvh (void *ctx) {
+    bench_picking_ctx_t *c = (bench_picking_ctx_t *) ctx;
+    resources_bvh_free (c->model.mesh->bvh);
+    c->model.mesh->bvh = NULL;
+    resources_mesh_build_bvh (c->model.mesh, NULL);
+}
+
+static void bench_ray_queries (void *ctx) {
+    bench_picking_ctx_t *c = (bench_picking_ctx_t *) ctx;
+    bench_sink = resources_model_intersect (&c->model, c->rays, BENCH_RAYS, c->hits);
+}
+
+static void bench_picking (bench_t *bench) {
+    resources_mesh_t *sphere = bench_create_sphere (100000);
+
+    if (sphere == NULL) {
+        return;
+    }
+
+    static bench_picking_ctx_t ctx;
+    ctx.model.mesh = sphere;
+    ctx.model.position = (maths_vec4f) { 0.0, 0.0, 4.0, 1.0 };
+    ctx.model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    ctx.model.rotation = (maths_vec4f) { 0.3, 0.2, 0.0, 0.0 };
+
+    for (int i = 0; i < BENCH_RAYS; i++) {
+        maths_vec4f origin = { bench_rand_range (-3.0, 3.0), bench_rand_range (-3.0, 3.0), bench_rand_range (0.0, 1.0), 1.0 };
+        maths_vec4f target = { bench_rand_range (-0.5, 0.5), bench_rand_range (-0.5, 0.5), bench_rand_range (3.5, 4.5), 1.0 };
+        ctx.rays[i] = (resources_ray_t) { origin, maths_vec4f_sub (target, origin), INFINITY };
+    }
+
+    bench_run (bench, "picking/bvh_build_sphere_100000", "triangles", sphere->num_faces, bench_build_bvh, &ctx);
+    bench_run (bench, "picking/ray_query_sphere_100000", "rays", BENCH_RAYS, bench_ray_queries, &ctx);
+
+    resources_mesh_free (sphere);
+}
+
+/* Maths kernels */
+#define BENCH_MATHS_ITERATIONS 1000000
+
+static void bench_mat4x4f_mul (void *ctx) {
+    maths_mat4x4f a = maths_4x4f_rotation_yxz_3d (0.1, 0.2, 0.3);
+    maths_mat4x4f b = maths_4x4f_translation_3d (1.0, 2.0, 3.0);
+
+    for (int i = 0; i < BENCH_MATHS_ITERATIONS; i++) {
+        b = maths_mat4x4f_mul (a, b);
+        b.data[3][0] = i;
+    }
+
+    bench_sink = b.data[0][0];
+}
+
+static void bench_mat4x4f_mul_vec4f (void *ctx) {
+    maths_mat4x4f m = maths_model_transform ((maths_vec4f) { 1.0, 2.0, 3.0, 1.0 }, (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 }, (maths_vec4f) { 0.1, 0.2, 0.3, 0.0 });
+    maths_vec4f v = { 1.0, 1.0, 1.0, 1.0 };
+    double sum = 0;
+
+    for (int i = 0; i < BENCH_MATHS_ITERATIONS; i++) {
+        v.x = i;
+        sum += maths_mat4x4f_mul_vec4f (m, v).z;
+    }
+
+    bench_sink = sum;
+}
+
+static void bench_project_vertex (void *ctx) {
+    maths_vec4f v = { 1.0, 1.0, 5.0, 1.0 };
+    double sum = 0;
+
+    for (int i = 0; i < BENCH_MATHS_ITERATIONS; i++) {
+        v.x = i * 1e-6;
+        sum += maths_project_vertex_4f_3d (1.0, 640, 480, 2.0, 1.5, v).x;
+    }
+
+    bench_sink = sum;
+}
+
+static void bench_model_transform (void *ctx) {
+    double sum = 0;
+
+    for (int i = 0; i < BENCH_MATHS_ITERATIONS; i++) {
+        maths_vec4f r = { i * 1e-6, 0.2, 0.3, 0.0 };
+        sum += maths_model_transform ((maths_vec4f) { 1.0, 2.0, 3.0, 1.0 }, (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 }, r).data[0][0];
+    }
+
+    bench_sink = sum;
+}
+
+static void bench_vec4f_cross_normalise (void *ctx) {
+    maths_vec4f a = { 1.0, 2.0, 3.0, 0.0 };
+    maths_vec4f b = { 3.0, 2.0, 1.0, 0.0 };
+    double sum = 0;
+
+    for (int i = 0; i < BENCH_MATHS_ITERATIONS; i++) {
+        a.x = i;
+        sum += maths_vec4f_normalise (maths_vec4f_cross_3d (a, b)).y;
+    }
+
+    bench_sink = sum;
+}
+
+/* Transform hierarchy - a few roots, each with a
+   chain of children, as in articulated models. */
+#define BENCH_TRANSFORMS 4096
+#define BENCH_TRANSFORM_CHAIN 8
+
+typedef struct {
+    maths_transform_hierarchy_t hierarchy;
+    int moving;                 /* Roots rotated per update */
+} bench_transform_ctx_t;
+
+static void bench_transform_update (void *ctx) {
+    bench_transform_ctx_t *c = (bench_transform_ctx_t *) ctx;
+    maths_quat spin = maths_quat_from_axis_angle ((maths_vec3f) { 0.0, 1.0, 0.0 }, 0.01);
+
+    for (int i = 0; i < c->moving; i++) {
+        maths_transform_hierarchy_rotate (&c->hierarchy, (maths_transform_t) (i * BENCH_TRANSFORM_CHAIN), spin);
+    }
+
+    maths_transform_hierarchy_update (&c->hierarchy);
+    bench_sink = maths_transform_hierarchy_world (&c->hierarchy, BENCH_TRANSFORMS - 1)->data[3][0];
+}
+
+static void bench_transforms (bench_t *bench) {
+    bench_transform_ctx_t ctx;
+
+    if (!maths_transform_hierarchy_init (&ctx.hierarchy, BENCH_TRANSFORMS)) {
+        return;
+    }
+
+    for (int i = 0; i < BENCH_TRANSFORMS; i++) {
+        maths_transform_t parent = i % BENCH_TRANSFORM_CHAIN == 0 ? MATHS_TRANSFORM_NONE : (maths_transform_t) (i - 1);
+        maths_transform_t t = maths_transform_hierarchy_add (&ctx.hierarchy, parent);
+        maths_transform_hierarchy_set_position (&ctx.hierarchy, t, (maths_vec4f) { 1.0, 0.5, 0.0, 1.0 });
+    }
+
+    ctx.moving = 0;
+    maths_transform_hierarchy_update (&ctx.hierarchy);
+    bench_run (bench, "maths/transform_update_static", "transforms", BENCH_TRANSFORMS, bench_transform_update, &ctx);
+
+    ctx.moving = BENCH_TRANSFORMS / BENCH_TRANSFORM_CHAIN / 10;
+    bench_run (bench, "maths/transform_update_10pct", "transforms", BENCH_TRANSFORMS, bench_transform_update, &ctx);
+
+    ctx.moving = BENCH_TRANSFORMS / BENCH_TRANSFORM_CHAIN;
+    bench_run (bench, "maths/transform_update_all", "transforms", BENCH_TRANSFORMS, bench_transform_update, &ctx);
+
+    maths_transform_hierarchy_destroy (&ctx.hierarchy);
+}
+
+static void bench_maths (bench_t *bench) {
+    bench_run (bench, "maths/mat4x4f_mul", "ops", BENCH_MATHS_ITERATIONS, bench_mat4x4f_mul, NULL);
+    bench_run (bench, "maths/mat4x4f_mul_vec4f", "ops", BENCH_MATHS_ITERATIONS, bench_mat4x4f_mul_vec4f, NULL);
+    bench_run (bench, "maths/project_vertex_4f_3d", "ops", BENCH_MATHS_ITERATIONS, bench_project_vertex, NULL);
+    bench_run (bench, "maths/model_transform", "ops", BENCH_MATHS_ITERATIONS, bench_model_transform, NULL);
+    bench_run (bench, "maths/vec4f_cross_normalise", "ops", BENCH_MATHS_ITERATIONS, bench_vec4f_cross_normalise, NULL);
+    bench_transforms (bench);
+}
+
+static bool bench_parse_args (bench_t *bench, int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp (argv[i], "--runs") == 0 && has_value) {
+            bench->runs = atoi (argv[++i]);
+        } else if (strcmp (argv[i], "--warmup") == 0 && has_value) {
+            bench->warmup = atoi (argv[++i]);
+        } else if (strcmp (argv[i], "--width") == 0 && has_value) {
+            bench->width = atoi (argv[++i]);
+        } else if (strcmp (argv[i], "--height") == 0 && has_value) {
+            bench->height = atoi (argv[++i]);
+        } else if (strcmp (argv[i], "--max-triangles") == 0 && has_value) {
+            bench->max_triangles = atol (argv[++i]);
+        } else if (strcmp (argv[i], "--output") == 0 && has_value) {
+            bench->output = argv[++i];
+        } else {
+            fprintf (stderr, "usage: %s [--runs N] [--warmup N] [--width W] [--height H] [--max-triangles N] [--output FILE]\n", argv[0]);
+            return false;
+        }
+    }
+
+    if (bench->runs < 1 || bench->runs > BENCH_MAX_RUNS || bench->warmup < 0 || bench->width < 16 || bench->height < 16) {
+        fprintf (stderr, "Error - bench: invalid arguments.\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main (int argc, char **argv) {
+    static bench_t bench;
+
+    bench.runs = 11;
+    bench.warmup = 2;
+    bench.width = 640;
+    bench.height = 480;
+    bench.max_triangles = 10000000;
+    bench.output = "-";
+
+    if (!bench_parse_args (&bench, argc, argv)) {
+        return 1;
+    }
+
+    bench_maths (&bench);
+    bench_raster (&bench, GRAPHICS_LAYOUT_LINEAR, false, GRAPHICS_FORMAT_BGRX8888, false, "raster");
+    bench_raster (&bench, GRAPHICS_LAYOUT_TILED, false, GRAPHICS_FORMAT_BGRX8888, false, "raster_tiled");
+    bench_raster (&bench, GRAPHICS_LAYOUT_LINEAR, true, GRAPHICS_FORMAT_BGRX8888, false, "raster_msaa");
+    bench_raster (&bench, GRAPHICS_LAYOUT_LINEAR, false, GRAPHICS_FORMAT_RGB565, false, "raster_rgb565");
+    bench_raster (&bench, GRAPHICS_LAYOUT_LINEAR, false, GRAPHICS_FORMAT_INDEXED8, true, "raster_indexed_dither");
+    bench_dirty (&bench);
+    bench_viewports (&bench);
+    bench_obj (&bench);
+    bench_models (&bench);
+    bench_wireframe (&bench);
+    bench_vertex_formats (&bench);
+    bench_staged (&bench);
+    bench_sprites (&bench);
+    bench_streaming (&bench);
+    bench_offline (&bench);
+    bench_lighting (&bench);
+    bench_jobs (&bench);
+    bench_picking (&bench);
+    bench_capture (&bench);
+
+    return bench_write_json (&bench) ? 0 : 1;
+}
@@ -1,23 +1,67 @@
 #include "../../system/window.h"
+#include "../../system/frame_scheduler.h"
+#include "../../system/log.h"
+#include "../../system/jobs.h"
 #include "../../graphics/renderer.h"
 #include "../../maths/maths.h"
+#include "../../maths/transform.h"
 #include "../../resources/resources.h"
+#include "../../resources/manager.h"
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 bool is_running;
 
+typedef struct {
+    system_window_t *window;
+    graphics_renderer_t *renderer;
+    maths_transform_hierarchy_t *transforms;
+    maths_transform_t cube;
+    graphics_camera_t *camera;
+    resources_manager_t *resources;
+    resources_handle_t mesh;
+} scene_t;
+
 void terminate (system_window_t *window, void *aux_1, void *aux_2) {
-    printf ("Terminating...\nGoodbye!\n");
+    SYSTEM_LOG_INFO ("hello_world", "terminating... goodbye!");
     is_running = false;
 }
 
+void update (double dt, void *aux) {
+    scene_t *scene = (scene_t *) aux;
+
+    maths_quat spin = maths_quat_from_axis_angle ((maths_vec3f) { 1.0, 0.0, 0.0 }, -0.0005);
+    maths_transform_hierarchy_rotate (scene->transforms, scene->cube, spin);
+    scene->camera->rotation.y += 0.01;
+}
+
+void render (double alpha, void *aux) {
+    scene_t *scene = (scene_t *) aux;
+
+    graphics_renderer_clear_buffer (scene->renderer);
+
+    maths_transform_hierarchy_update (scene->transforms);
+
+    maths_mat4x4f view = graphics_camera_view_transform (scene->camera);
+    maths_mat4x4f model_view = maths_mat4x4f_mul_affine (view, *maths_transform_hierarchy_world (scene->transforms, scene->cube));
+
+    /* Placeholder cube until the mesh has loaded */
+    resources_mesh_t *mesh = resources_manager_get_mesh (scene->resources, scene->mesh);
+
+    SYSTEM_LOG_TRACE ("hello_world", "going to render cube");
+    graphics_renderer_render_mesh (scene->renderer, mesh, &model_view);
+    SYSTEM_LOG_TRACE ("hello_world", "rendered cube");
+
+    graphics_renderer_display (scene->renderer, scene->window); 
+}
+
 int main () {
+    system_log_init ();
     system_window_init ();
 
     system_window_t *window = system_window_create ("Hello World!!!", 640, 480, true);
-    graphics_renderer_t *renderer = graphics_renderer_init (640, 480);
+    graphics_renderer_t *renderer = graphics_renderer_init (640, 480, GRAPHICS_FORMAT_BGRX8888);
     renderer->view_distance = 1;
     renderer->view_width = 2;
     renderer->view_height = 2;
@@ -28,39 +72,47 @@ int main () {
 
     system_window_set_shown (window, true);
 
-    resources_mesh_t *mesh = resources_load_mesh_from_obj_file ("./build/res/cube.obj");
+    system_jobs_t *jobs = system_jobs_create (0, false);
+    assert (jobs != NULL);
+
+    graphics_renderer_set_jobs (renderer, jobs);
+
+    resources_manager_t *resources = resources_manager_create (jobs, 16 * 1024 * 1024);
+    assert (resources != NULL);
+
+    resources_handle_t mesh = resources_manager_load_mesh (resources, "./build/res/cube.obj");
 
-    resources_model_t cube_model;
-    cube_model.mesh = mesh;
-    cube_model.position = (maths_vec4f) { -5.0, 1.0, 15.0, 1.0 };
-    cube_model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
-    cube_model.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+    maths_transform_hierarchy_t transforms;
+    maths_transform_hierarchy_init (&transforms, 16);
+
+    maths_transform_t cube = maths_transform_hierarchy_add (&transforms, MATHS_TRANSFORM_NONE);
+    maths_transform_hierarchy_set_position (&transforms, cube, (maths_vec4f) { -5.0, 1.0, 15.0, 1.0 });
 
     graphics_camera_t camera;
     camera.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
     camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
     camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0 };
 
-    is_running = true;
+    scene_t scene = { window, renderer, &transforms, cube, &camera, resources, mesh };
 
-    while (is_running) {
-        graphics_renderer_clear_buffer (renderer);
+    system_frame_scheduler_t scheduler;
+    system_frame_scheduler_init (&scheduler, 60.0, 120.0);
 
-        printf ("going to rener cube\n");
-        //cube_model.rotation.x += 0.001;
-        cube_model.rotation.x += 0.0005;
-        camera.rotation.y += 0.01;
-        graphics_renderer_render_model (renderer, &cube_model, &camera);
-        printf ("rendererd cube\n");
+    is_running = true;
 
-        graphics_renderer_display (renderer, window); 
+    system_frame_scheduler_run (&scheduler, window, &is_running, update, render, &scene);
 
-        system_window_handle_events (window);
-    }
+    resources_manager_release (resources, mesh);
+    resources_manager_destroy (resources);
+    maths_transform_hierarchy_destroy (&transforms);
+    graphics_renderer_destroy (renderer);
+    system_jobs_destroy (jobs);
 
     system_window_destroy (window);
 
     system_window_cleanup ();
 
+    system_log_shutdown ();
+
     return 0;
 }
\ No newline at end of file
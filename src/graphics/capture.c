@@ -0,0 +1,486 @@
+#include "capture.h"
+#include "kernels.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Full range BT.601, in 15 bit fixed point. The
+   chroma weights each sum to zero, so grey has no
+   colour. Saturated blue and red round up to 256 in
+   chroma, which is clamped. */
+#define LUMA_RED 9798
+#define LUMA_GREEN 19235
+#define LUMA_BLUE 3735
+#define CB_RED -5529
+#define CB_GREEN -10855
+#define CB_BLUE 16384
+#define CR_RED 16384
+#define CR_GREEN -13720
+#define CR_BLUE -2664
+#define YUV_SHIFT 15
+#define YUV_ROUND (1 << (YUV_SHIFT - 1))
+
+static unsigned int chroma_width (const graphics_capture_t *capture) {
+    return (capture->width + 1) / 2;
+}
+
+static unsigned int chroma_height (const graphics_capture_t *capture) {
+    return (capture->height + 1) / 2;
+}
+
+static uint8_t average (uint8_t a, uint8_t b) {
+    return (uint8_t) ((a + b + 1) >> 1);
+}
+
+/* Mean of two pixels, rounded up as _mm_avg_epu8
+   does so both paths agree. */
+static graphics_pixel_t average_pixel (graphics_pixel_t a, graphics_pixel_t b) {
+    graphics_pixel_t p;
+    p.blue = average (a.blue, b.blue);
+    p.green = average (a.green, b.green);
+    p.red = average (a.red, b.red);
+    p.pad = average (a.pad, b.pad);
+    return p;
+}
+
+static void luma_row (const graphics_pixel_t *src, uint8_t *dst, unsigned int width) {
+    unsigned int x = 0;
+
+#if defined (__SSE2__)
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i weights = _mm_setr_epi16 (LUMA_BLUE, LUMA_GREEN, LUMA_RED, 0, LUMA_BLUE, LUMA_GREEN, LUMA_RED, 0);
+    const __m128i round = _mm_set1_epi32 (YUV_ROUND);
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i luma[2];
+
+        for (int half = 0; half < 2; half++) {
+            __m128i px = _mm_loadu_si128 ((const __m128i *) (src + x + half * 4));
+
+            /* Each pixel gives two sums, blue and green
+               then red and alpha, which are added. */
+            __m128 lo = _mm_castsi128_ps (_mm_madd_epi16 (_mm_unpacklo_epi8 (px, zero), weights));
+            __m128 hi = _mm_castsi128_ps (_mm_madd_epi16 (_mm_unpackhi_epi8 (px, zero), weights));
+            __m128i even = _mm_castps_si128 (_mm_shuffle_ps (lo, hi, _MM_SHUFFLE (2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128 (_mm_shuffle_ps (lo, hi, _MM_SHUFFLE (3, 1, 3, 1)));
+            luma[half] = _mm_srai_epi32 (_mm_add_epi32 (_mm_add_epi32 (even, odd), round), YUV_SHIFT);
+        }
+
+        __m128i packed = _mm_packs_epi32 (luma[0], luma[1]);
+        _mm_storel_epi64 ((__m128i *) (dst + x), _mm_packus_epi16 (packed, packed));
+    }
+#endif
+
+    for (; x < width; x++) {
+        graphics_pixel_t p = src[x];
+        dst[x] = (uint8_t) ((LUMA_RED * p.red + LUMA_GREEN * p.green + LUMA_BLUE * p.blue + YUV_ROUND) >> YUV_SHIFT);
+    }
+}
+
+/* A chroma sum as a sample, clamped to [0, 255] as
+   _mm_packus_epi16 does so both paths agree. */
+static uint8_t chroma_sample (int sum) {
+    int value = ((sum + YUV_ROUND) >> YUV_SHIFT) + 128;
+    return (uint8_t) (value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+/* Subsample two rows to one row of each chroma plane.
+   The last column is repeated when the width is odd. */
+static void chroma_row (const graphics_pixel_t *row0, const graphics_pixel_t *row1, uint8_t *cb, uint8_t *cr, unsigned int width) {
+    unsigned int x = 0;
+
+#if defined (__SSE2__)
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i cb_weights = _mm_setr_epi16 (CB_BLUE, CB_GREEN, CB_RED, 0, CB_BLUE, CB_GREEN, CB_RED, 0);
+    const __m128i cr_weights = _mm_setr_epi16 (CR_BLUE, CR_GREEN, CR_RED, 0, CR_BLUE, CR_GREEN, CR_RED, 0);
+    const __m128i offset = _mm_set1_epi32 (YUV_ROUND + (128 << YUV_SHIFT));
+
+    for (; x + 8 <= width; x += 8) {
+        __m128i pairs[2];
+
+        for (int half = 0; half < 2; half++) {
+            __m128i above = _mm_loadu_si128 ((const __m128i *) (row0 + x + half * 4));
+            __m128i below = _mm_loadu_si128 ((const __m128i *) (row1 + x + half * 4));
+            __m128i v = _mm_avg_epu8 (above, below);
+            __m128i h = _mm_avg_epu8 (v, _mm_srli_si128 (v, 4));
+            pairs[half] = _mm_shuffle_epi32 (h, _MM_SHUFFLE (3, 3, 2, 0));
+        }
+
+        /* The four averaged pixels */
+        __m128i px = _mm_unpacklo_epi64 (pairs[0], pairs[1]);
+        __m128i lo = _mm_unpacklo_epi8 (px, zero);
+        __m128i hi = _mm_unpackhi_epi8 (px, zero);
+        __m128i sums[2];
+
+        for (int plane = 0; plane < 2; plane++) {
+            __m128i weights = plane == 0 ? cb_weights : cr_weights;
+            __m128 a = _mm_castsi128_ps (_mm_madd_epi16 (lo, weights));
+            __m128 b = _mm_castsi128_ps (_mm_madd_epi16 (hi, weights));
+            __m128i even = _mm_castps_si128 (_mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128 (_mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1)));
+            sums[plane] = _mm_srai_epi32 (_mm_add_epi32 (_mm_add_epi32 (even, odd), offset), YUV_SHIFT);
+        }
+
+        __m128i packed = _mm_packus_epi16 (_mm_packs_epi32 (sums[0], sums[1]), zero);
+        uint32_t cb4 = (uint32_t) _mm_cvtsi128_si32 (packed);
+        uint32_t cr4 = (uint32_t) _mm_cvtsi128_si32 (_mm_srli_si128 (packed, 4));
+        memcpy (cb + x / 2, &cb4, 4);
+        memcpy (cr + x / 2, &cr4, 4);
+    }
+#endif
+
+    for (; x < width; x += 2) {
+        unsigned int right = x + 1 < width ? x + 1 : x;
+        graphics_pixel_t p = average_pixel (average_pixel (row0[x], row1[x]), average_pixel (row0[right], row1[right]));
+        cb[x / 2] = chroma_sample (CB_RED * p.red + CB_GREEN * p.green + CB_BLUE * p.blue);
+        cr[x / 2] = chroma_sample (CR_RED * p.red + CR_GREEN * p.green + CR_BLUE * p.blue);
+    }
+}
+
+static void encode_y4m (graphics_capture_t *capture) {
+    unsigned int width = capture->width;
+    unsigned int height = capture->height;
+    uint8_t *luma = capture->encoded;
+    uint8_t *cb = luma + width * height;
+    uint8_t *cr = cb + chroma_width (capture) * chroma_height (capture);
+
+    for (unsigned int y = 0; y < height; y++) {
+        luma_row (capture->canvas + y * width, luma + y * width, width);
+    }
+
+    for (unsigned int y = 0; y < chroma_height (capture); y++) {
+        const graphics_pixel_t *row0 = capture->canvas + (2 * y) * width;
+        const graphics_pixel_t *row1 = 2 * y + 1 < height ? row0 + width : row0;
+        chroma_row (row0, row1, cb + y * chroma_width (capture), cr + y * chroma_width (capture), width);
+    }
+}
+
+static bool write_ppm (graphics_capture_t *capture, uint64_t frame) {
+    size_t length = strlen (capture->path) + 32;
+    char name[length];
+    snprintf (name, length, "%s%06llu.ppm", capture->path, (unsigned long long) frame);
+
+    size_t count = (size_t) capture->width * capture->height;
+    uint8_t *rgb = capture->encoded;
+
+    for (size_t i = 0; i < count; i++) {
+        rgb[i * 3 + 0] = capture->canvas[i].red;
+        rgb[i * 3 + 1] = capture->canvas[i].green;
+        rgb[i * 3 + 2] = capture->canvas[i].blue;
+    }
+
+    FILE *file = fopen (name, "wb");
+
+    if (file == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "could not open %s.", name);
+        return false;
+    }
+
+    fprintf (file, "P6\n%u %u\n255\n", capture->width, capture->height);
+    bool ok = fwrite (rgb, 3, count, file) == count;
+
+    if (fclose (file) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "could not write %s.", name);
+    }
+
+    return ok;
+}
+
+/* Patch the writer's frame with the changed regions,
+   then encode and write it. Runs on the writer. */
+static bool write_frame (graphics_capture_t *capture, const graphics_capture_buffer_t *buffer) {
+    const graphics_pixel_t *src = buffer->pixels;
+
+    for (int i = 0; i < buffer->num_rects; i++) {
+        graphics_rect_t r = buffer->rects[i];
+        size_t row = (size_t) (r.x1 - r.x0);
+
+        for (int y = r.y0; y < r.y1; y++) {
+            memcpy (capture->canvas + (size_t) y * capture->width + r.x0, src, sizeof (graphics_pixel_t) * row);
+            src += row;
+        }
+    }
+
+    size_t count = (size_t) capture->width * capture->height;
+
+    switch (capture->format) {
+    case GRAPHICS_CAPTURE_RAW:
+        if (fwrite (capture->canvas, sizeof (graphics_pixel_t), count, capture->file) != count) {
+            SYSTEM_LOG_ERROR ("graphics/capture", "could not write to %s.", capture->path);
+            return false;
+        }
+
+        return true;
+
+    case GRAPHICS_CAPTURE_PPM:
+        return write_ppm (capture, buffer->frame);
+
+    case GRAPHICS_CAPTURE_Y4M: {
+        size_t size = count + 2 * (size_t) chroma_width (capture) * chroma_height (capture);
+        encode_y4m (capture);
+
+        if (fputs ("FRAME\n", capture->file) == EOF || fwrite (capture->encoded, 1, size, capture->file) != size) {
+            SYSTEM_LOG_ERROR ("graphics/capture", "could not write to %s.", capture->path);
+            return false;
+        }
+
+        return true;
+    }
+    }
+
+    return false;
+}
+
+static void *writer_thread_main (void *aux) {
+    graphics_capture_t *capture = (graphics_capture_t *) aux;
+
+    pthread_mutex_lock (&capture->lock);
+
+    for (;;) {
+        while (capture->queue_count == 0 && !capture->stopping) {
+            pthread_cond_wait (&capture->queued, &capture->lock);
+        }
+
+        /* Frames already queued are written before
+           stopping. */
+        if (capture->queue_count == 0) {
+            break;
+        }
+
+        int index = capture->queue[capture->queue_head];
+        capture->queue_head = (capture->queue_head + 1) % capture->num_buffers;
+        capture->queue_count--;
+        bool failed = capture->stats.failed;
+        pthread_mutex_unlock (&capture->lock);
+
+        bool ok = !failed && write_frame (capture, &capture->buffers[index]);
+
+        pthread_mutex_lock (&capture->lock);
+
+        if (ok) {
+            capture->stats.written++;
+        } else {
+            capture->stats.failed = true;
+        }
+
+        capture->free[capture->num_free++] = index;
+        pthread_cond_signal (&capture->returned);
+    }
+
+    pthread_mutex_unlock (&capture->lock);
+    return NULL;
+}
+
+/* Frames must be width by height, the renderer's
+   output resolution. fps is only recorded in Y4M
+   headers. num_buffers is how many frames may wait
+   to be written before frames are dropped. */
+graphics_capture_t *graphics_capture_start (const char *path, graphics_capture_format_t format, unsigned int width, unsigned int height, unsigned int fps, int num_buffers) {
+    if (width == 0 || height == 0) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "cannot capture empty frames.");
+        return NULL;
+    }
+
+    graphics_capture_t *capture = (graphics_capture_t *) calloc (1, sizeof (graphics_capture_t));
+
+    if (capture == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "could not allocate memory for capture.");
+        return NULL;
+    }
+
+    if (num_buffers < 2) {
+        num_buffers = 2;
+    } else if (num_buffers > GRAPHICS_CAPTURE_MAX_BUFFERS) {
+        num_buffers = GRAPHICS_CAPTURE_MAX_BUFFERS;
+    }
+
+    size_t count = (size_t) width * height;
+    capture->format = format;
+    capture->width = width;
+    capture->height = height;
+    capture->fps = fps > 0 ? fps : 30;
+    capture->num_buffers = num_buffers;
+    capture->need_full = true;
+    capture->path = strdup (path);
+    capture->canvas = (graphics_pixel_t *) calloc (count, sizeof (graphics_pixel_t));
+    capture->encoded = (uint8_t *) malloc (count * 3);
+    pthread_mutex_init (&capture->lock, NULL);
+    pthread_cond_init (&capture->queued, NULL);
+    pthread_cond_init (&capture->returned, NULL);
+
+    bool ok = capture->path != NULL && capture->canvas != NULL && capture->encoded != NULL;
+
+    for (int i = 0; ok && i < num_buffers; i++) {
+        capture->buffers[i].pixels = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * count);
+        ok = capture->buffers[i].pixels != NULL;
+        capture->free[capture->num_free++] = num_buffers - 1 - i;
+    }
+
+    if (!ok) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "could not allocate memory for capture.");
+        graphics_capture_stop (capture);
+        return NULL;
+    }
+
+    if (format != GRAPHICS_CAPTURE_PPM) {
+        capture->file = fopen (path, "wb");
+
+        if (capture->file == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/capture", "could not open %s.", path);
+            graphics_capture_stop (capture);
+            return NULL;
+        }
+
+        if (format == GRAPHICS_CAPTURE_Y4M) {
+            fprintf (capture->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, capture->fps);
+        }
+    }
+
+    if (pthread_create (&capture->thread, NULL, writer_thread_main, capture) != 0) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "could not start writer thread.");
+        graphics_capture_stop (capture);
+        return NULL;
+    }
+
+    capture->running = true;
+    return capture;
+}
+
+static bool capture_frame (graphics_capture_t *capture, const graphics_renderer_t *renderer, bool wait) {
+    if (renderer->presented == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "no frame has been displayed.");
+        return false;
+    }
+
+    if (renderer->output_width != capture->width || renderer->output_height != capture->height) {
+        SYSTEM_LOG_ERROR ("graphics/capture", "frame is %ux%u, capture is %ux%u.", renderer->output_width, renderer->output_height, capture->width, capture->height);
+        return false;
+    }
+
+    pthread_mutex_lock (&capture->lock);
+
+    while (wait && capture->num_free == 0) {
+        pthread_cond_wait (&capture->returned, &capture->lock);
+    }
+
+    if (capture->num_free == 0) {
+        capture->stats.dropped++;
+        capture->need_full = true;
+        pthread_mutex_unlock (&capture->lock);
+        return false;
+    }
+
+    int index = capture->free[--capture->num_free];
+    bool full = capture->need_full;
+    capture->need_full = false;
+    uint64_t frame = capture->stats.captured++;
+    pthread_mutex_unlock (&capture->lock);
+
+    /* The buffer is the render thread's until queued */
+    graphics_capture_buffer_t *buffer = &capture->buffers[index];
+    buffer->frame = frame;
+
+    if (full) {
+        buffer->rects[0] = (graphics_rect_t) { 0, 0, (int) capture->width, (int) capture->height };
+        buffer->num_rects = 1;
+    } else {
+        memcpy (buffer->rects, renderer->presented_rects.rects, sizeof (graphics_rect_t) * renderer->presented_rects.count);
+        buffer->num_rects = renderer->presented_rects.count;
+    }
+
+    graphics_pixel_t *dst = buffer->pixels;
+
+    for (int i = 0; i < buffer->num_rects; i++) {
+        graphics_rect_t r = buffer->rects[i];
+        size_t row = (size_t) (r.x1 - r.x0);
+
+        for (int y = r.y0; y < r.y1; y++) {
+            size_t at = (size_t) y * capture->width + r.x0;
+
+            switch (renderer->presented_format) {
+                case GRAPHICS_FORMAT_RGB565:
+                    graphics_kernels.expand_rgb565 (dst, (const uint16_t *) renderer->presented + at, (int) row);
+                    break;
+                case GRAPHICS_FORMAT_INDEXED8:
+                    graphics_kernels.expand_indexed (dst, (const uint8_t *) renderer->presented + at, (int) row);
+                    break;
+                default:
+                    memcpy (dst, (const graphics_pixel_t *) renderer->presented + at, sizeof (graphics_pixel_t) * row);
+                    break;
+            }
+
+            dst += row;
+        }
+    }
+
+    pthread_mutex_lock (&capture->lock);
+    capture->queue[(capture->queue_head + capture->queue_count) % capture->num_buffers] = index;
+    capture->queue_count++;
+    pthread_cond_signal (&capture->queued);
+    pthread_mutex_unlock (&capture->lock);
+
+    return true;
+}
+
+/* Queue the frame last displayed by the renderer.
+   Never waits for the writer - returns false if the
+   frame was dropped. */
+bool graphics_capture_frame (graphics_capture_t *capture, const graphics_renderer_t *renderer) {
+    return capture_frame (capture, renderer, false);
+}
+
+/* As graphics_capture_frame, but waits for a buffer
+   rather than dropping the frame, for when every
+   frame matters more than the frame rate. */
+bool graphics_capture_frame_wait (graphics_capture_t *capture, const graphics_renderer_t *renderer) {
+    return capture_frame (capture, renderer, true);
+}
+
+void graphics_capture_get_stats (graphics_capture_t *capture, graphics_capture_stats_t *stats) {
+    pthread_mutex_lock (&capture->lock);
+    *stats = capture->stats;
+    pthread_mutex_unlock (&capture->lock);
+}
+
+/* Writes any frames still queued, then closes the
+   output. */
+void graphics_capture_stop (graphics_capture_t *capture) {
+    if (capture == NULL) {
+        return;
+    }
+
+    if (capture->running) {
+        pthread_mutex_lock (&capture->lock);
+        capture->stopping = true;
+        pthread_cond_signal (&capture->queued);
+        pthread_mutex_unlock (&capture->lock);
+        pthread_join (capture->thread, NULL);
+
+        SYSTEM_LOG_INFO ("graphics/capture", "wrote %llu frames to %s, dropped %llu.",
+                         (unsigned long long) capture->stats.written, capture->path, (unsigned long long) capture->stats.dropped);
+    }
+
+    if (capture->file != NULL) {
+        fclose (capture->file);
+    }
+
+    for (int i = 0; i < capture->num_buffers; i++) {
+        free (capture->buffers[i].pixels);
+    }
+
+    pthread_mutex_destroy (&capture->lock);
+    pthread_cond_destroy (&capture->queued);
+    pthread_cond_destroy (&capture->returned);
+    free (capture->encoded);
+    free (capture->canvas);
+    free (capture->path);
+    free (capture);
+}
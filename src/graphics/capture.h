@@ -0,0 +1,88 @@
+/* graphics/capture.h
+    Recording displayed frames to disk without
+    holding up the render thread. Each frame is copied
+    into one of a fixed pool of buffers and handed to
+    a writer thread, which encodes and writes it.
+
+    With dirty tracking on, only the regions which
+    changed since the previous frame are copied. The
+    writer keeps its own copy of the whole frame and
+    patches it before encoding. If every buffer is
+    still waiting to be written, the frame is dropped
+    and counted, and the next frame is copied whole so
+    that later patches apply to the right picture.
+
+    Formats:
+        RAW     one file of frames back to back, each
+                width * height graphics_pixel_t
+        PPM     one binary PPM file per frame, named
+                <path><frame number>.ppm
+        Y4M     one YUV4MPEG2 file, 4:2:0 full range
+                BT.601 (C420jpeg), readable by most
+                video tools */
+
+#ifndef GRAPHICS_CAPTURE_H
+#define GRAPHICS_CAPTURE_H
+
+#include "renderer.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define GRAPHICS_CAPTURE_MAX_BUFFERS 16
+
+typedef enum {
+    GRAPHICS_CAPTURE_RAW,
+    GRAPHICS_CAPTURE_PPM,
+    GRAPHICS_CAPTURE_Y4M
+} graphics_capture_format_t;
+
+typedef struct {
+    graphics_pixel_t *pixels;   /* Each rect's pixels in turn, row by row */
+    graphics_rect_t rects[GRAPHICS_MAX_DIRTY_RECTS];
+    int num_rects;
+    uint64_t frame;
+} graphics_capture_buffer_t;
+
+typedef struct {
+    uint64_t captured;          /* Frames handed to the writer */
+    uint64_t dropped;           /* Frames skipped as no buffer was free */
+    uint64_t written;
+    bool failed;                /* Writing stopped on an I/O error */
+} graphics_capture_stats_t;
+
+typedef struct {
+    graphics_capture_format_t format;
+    char *path;
+    unsigned int width;
+    unsigned int height;
+    unsigned int fps;
+    FILE *file;                 /* RAW and Y4M */
+
+    graphics_capture_buffer_t buffers[GRAPHICS_CAPTURE_MAX_BUFFERS];
+    int num_buffers;
+    int free[GRAPHICS_CAPTURE_MAX_BUFFERS];   /* Stack of buffers the render thread may fill */
+    int num_free;
+    int queue[GRAPHICS_CAPTURE_MAX_BUFFERS];  /* Ring of filled buffers, oldest first */
+    int queue_head;
+    int queue_count;
+    bool need_full;             /* Next frame must be copied whole */
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      /* Signalled when a buffer is queued, or on stop */
+    pthread_cond_t returned;    /* Signalled when the writer frees a buffer */
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    graphics_capture_stats_t stats;
+
+    graphics_pixel_t *canvas;   /* Writer's copy of the whole frame */
+    uint8_t *encoded;           /* Writer's output for one frame */
+} graphics_capture_t;
+
+graphics_capture_t *graphics_capture_start (const char *path, graphics_capture_format_t format, unsigned int width, unsigned int height, unsigned int fps, int num_buffers);
+bool graphics_capture_frame (graphics_capture_t *capture, const graphics_renderer_t *renderer);
+bool graphics_capture_frame_wait (graphics_capture_t *capture, const graphics_renderer_t *renderer);
+void graphics_capture_get_stats (graphics_capture_t *capture, graphics_capture_stats_t *stats);
+void graphics_capture_stop (graphics_capture_t *capture);
+
+#endif
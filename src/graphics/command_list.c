@@ -0,0 +1,270 @@
+#include "command_list.h"
+#include "./../system/log.h"
+#include <stdio.h>
+#include <stdalign.h>
+
+/* Commands are small, so a block holds
+   a few hundred of them. */
+#define GRAPHICS_COMMAND_LIST_BLOCK_SIZE (32 * 1024)
+
+bool graphics_command_list_init (graphics_command_list_t *list) {
+    assert (list != NULL);
+
+    list->first = NULL;
+    list->last = NULL;
+    list->num_commands = 0;
+
+    if (!system_linear_allocator_init (&list->allocator, GRAPHICS_COMMAND_LIST_BLOCK_SIZE)) {
+        SYSTEM_LOG_ERROR ("graphics/command_list", "could not initialise command allocator.");
+        return false;
+    }
+
+    return true;
+}
+
+void graphics_command_list_reset (graphics_command_list_t *list) {
+    assert (list != NULL);
+
+    system_linear_allocator_reset (&list->allocator);
+    list->first = NULL;
+    list->last = NULL;
+    list->num_commands = 0;
+}
+
+void graphics_command_list_destroy (graphics_command_list_t *list) {
+    assert (list != NULL);
+
+    system_linear_allocator_destroy (&list->allocator);
+    list->first = NULL;
+    list->last = NULL;
+    list->num_commands = 0;
+}
+
+/* Allocate a command and append it to the list. */
+static graphics_command_t *push_command (graphics_command_list_t *list, graphics_command_type_t type) {
+    graphics_command_t *command = (graphics_command_t *) system_linear_allocator_alloc (&list->allocator, sizeof (graphics_command_t), alignof (graphics_command_t));
+
+    if (command == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/command_list", "could not allocate command.");
+        return NULL;
+    }
+
+    command->type = type;
+    command->next = NULL;
+
+    if (list->last == NULL) {
+        list->first = command;
+    } else {
+        list->last->next = command;
+    }
+
+    list->last = command;
+    list->num_commands++;
+
+    return command;
+}
+
+static bool push_primitive (graphics_command_list_t *list, graphics_command_type_t type, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t r_0, uint8_t g_0, uint8_t b_0, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2) {
+    graphics_command_t *command = push_command (list, type);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    command->primitive.x[0] = x0;
+    command->primitive.y[0] = y0;
+    command->primitive.x[1] = x1;
+    command->primitive.y[1] = y1;
+    command->primitive.x[2] = x2;
+    command->primitive.y[2] = y2;
+    command->primitive.colour[0] = (graphics_pixel_t) { b_0, g_0, r_0, 0 };
+    command->primitive.colour[1] = (graphics_pixel_t) { b_1, g_1, r_1, 0 };
+    command->primitive.colour[2] = (graphics_pixel_t) { b_2, g_2, r_2, 0 };
+
+    return true;
+}
+
+bool graphics_command_list_clear (graphics_command_list_t *list) {
+    return push_command (list, GRAPHICS_COMMAND_CLEAR) != NULL;
+}
+
+bool graphics_command_list_set_camera (graphics_command_list_t *list, graphics_camera_t *camera) {
+    assert (camera != NULL);
+
+    graphics_command_t *command = push_command (list, GRAPHICS_COMMAND_SET_CAMERA);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    command->camera = *camera;
+
+    return true;
+}
+
+bool graphics_command_list_set_view (graphics_command_list_t *list, double distance, double width, double height) {
+    graphics_command_t *command = push_command (list, GRAPHICS_COMMAND_SET_VIEW);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    command->view.distance = distance;
+    command->view.width = width;
+    command->view.height = height;
+
+    return true;
+}
+
+bool graphics_command_list_set_blend_mode (graphics_command_list_t *list, graphics_blend_mode_t mode, uint8_t alpha) {
+    graphics_command_t *command = push_command (list, GRAPHICS_COMMAND_SET_BLEND_MODE);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    command->blend.mode = mode;
+    command->blend.alpha = alpha;
+
+    return true;
+}
+
+bool graphics_command_list_draw_model (graphics_command_list_t *list, resources_model_t *model) {
+    assert (model != NULL);
+
+    graphics_command_t *command = push_command (list, GRAPHICS_COMMAND_DRAW_MODEL);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    command->model = *model;
+
+    return true;
+}
+
+bool graphics_command_list_draw_mesh (graphics_command_list_t *list, resources_mesh_t *mesh, const maths_mat4x4f *world) {
+    assert (mesh != NULL && world != NULL);
+
+    maths_mat4x4f *copy = (maths_mat4x4f *) system_linear_allocator_alloc (&list->allocator, sizeof (maths_mat4x4f), alignof (maths_mat4x4f));
+
+    if (copy == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/command_list", "could not allocate world matrix.");
+        return false;
+    }
+
+    graphics_command_t *command = push_command (list, GRAPHICS_COMMAND_DRAW_MESH);
+
+    if (command == NULL) {
+        return false;
+    }
+
+    *copy = *world;
+    command->mesh.mesh = mesh;
+    command->mesh.world = copy;
+
+    return true;
+}
+
+bool graphics_command_list_draw_line (graphics_command_list_t *list, int x0, int y0, int x1, int y1, uint8_t red, uint8_t green, uint8_t blue) {
+    return push_primitive (list, GRAPHICS_COMMAND_DRAW_LINE, x0, y0, x1, y1, 0, 0, red, green, blue, red, green, blue, red, green, blue);
+}
+
+bool graphics_command_list_draw_wireframe_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue) {
+    return push_primitive (list, GRAPHICS_COMMAND_DRAW_WIREFRAME_TRIANGLE, x0, y0, x1, y1, x2, y2, red, green, blue, red, green, blue, red, green, blue);
+}
+
+bool graphics_command_list_draw_filled_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue) {
+    return push_primitive (list, GRAPHICS_COMMAND_DRAW_FILLED_TRIANGLE, x0, y0, x1, y1, x2, y2, red, green, blue, red, green, blue, red, green, blue);
+}
+
+bool graphics_command_list_draw_shaded_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t r_0, uint8_t g_0, uint8_t b_0, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2) {
+    return push_primitive (list, GRAPHICS_COMMAND_DRAW_SHADED_TRIANGLE, x0, y0, x1, y1, x2, y2, r_0, g_0, b_0, r_1, g_1, b_1, r_2, g_2, b_2);
+}
+
+/* Execute a command which draws no meshes, e.g. on
+   the raster side of a pipeline. Camera and mesh
+   commands are left to whatever transforms meshes. */
+void graphics_renderer_execute_command (graphics_renderer_t *renderer, const graphics_command_t *command) {
+    const int *x = command->primitive.x;
+    const int *y = command->primitive.y;
+    const graphics_pixel_t *c = command->primitive.colour;
+
+    switch (command->type) {
+        case GRAPHICS_COMMAND_CLEAR:
+            graphics_renderer_clear_buffer (renderer);
+            break;
+        case GRAPHICS_COMMAND_SET_VIEW:
+            renderer->view_distance = command->view.distance;
+            renderer->view_width = command->view.width;
+            renderer->view_height = command->view.height;
+            break;
+        case GRAPHICS_COMMAND_SET_BLEND_MODE:
+            graphics_renderer_set_blend_mode (renderer, command->blend.mode, command->blend.alpha);
+            break;
+        case GRAPHICS_COMMAND_DRAW_LINE:
+            graphics_renderer_draw_line (renderer, x[0], y[0], x[1], y[1], c[0].red, c[0].green, c[0].blue);
+            break;
+        case GRAPHICS_COMMAND_DRAW_WIREFRAME_TRIANGLE:
+            graphics_renderer_draw_wireframe_triangle (renderer, x[0], y[0], x[1], y[1], x[2], y[2], c[0].red, c[0].green, c[0].blue);
+            break;
+        case GRAPHICS_COMMAND_DRAW_FILLED_TRIANGLE:
+            graphics_renderer_draw_filled_triangle (renderer, x[0], y[0], x[1], y[1], x[2], y[2], c[0].red, c[0].green, c[0].blue);
+            break;
+        case GRAPHICS_COMMAND_DRAW_SHADED_TRIANGLE:
+            graphics_renderer_draw_shaded_triangle (renderer, x[0], y[0], x[1], y[1], x[2], y[2],
+                c[0].red, c[0].green, c[0].blue, c[1].red, c[1].green, c[1].blue, c[2].red, c[2].green, c[2].blue);
+            break;
+        case GRAPHICS_COMMAND_SET_CAMERA:
+        case GRAPHICS_COMMAND_DRAW_MODEL:
+        case GRAPHICS_COMMAND_DRAW_MESH:
+            break;
+    }
+}
+
+static void execute_command_list (graphics_renderer_t *renderer, graphics_command_list_t *list) {
+    /* Each list starts with a camera at the
+       origin until it sets its own. */
+    graphics_camera_t camera;
+    camera.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+    camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+
+    /* Built once per camera rather than per model */
+    maths_mat4x4f view = graphics_camera_view_transform (&camera);
+    maths_mat4x4f transform;
+
+    for (graphics_command_t *command = list->first; command != NULL; command = command->next) {
+        switch (command->type) {
+            case GRAPHICS_COMMAND_SET_CAMERA:
+                camera = command->camera;
+                view = graphics_camera_view_transform (&camera);
+                break;
+            case GRAPHICS_COMMAND_DRAW_MODEL:
+                transform = maths_model_transform (command->model.position, command->model.scale, command->model.rotation);
+                transform = maths_mat4x4f_mul_affine (view, transform);
+                graphics_renderer_render_mesh (renderer, command->model.mesh, &transform);
+                break;
+            case GRAPHICS_COMMAND_DRAW_MESH:
+                transform = maths_mat4x4f_mul_affine (view, *command->mesh.world);
+                graphics_renderer_render_mesh (renderer, command->mesh.mesh, &transform);
+                break;
+            default:
+                graphics_renderer_execute_command (renderer, command);
+                break;
+        }
+    }
+}
+
+/* Execute the lists in array order. Recording of
+   all lists must have finished before this is
+   called. */
+void graphics_renderer_execute_command_lists (graphics_renderer_t *renderer, graphics_command_list_t **lists, int num_lists) {
+    assert (renderer != NULL);
+
+    for (int i = 0; i < num_lists; i++) {
+        if (lists[i] != NULL) {
+            execute_command_list (renderer, lists[i]);
+        }
+    }
+}
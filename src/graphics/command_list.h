@@ -0,0 +1,96 @@
+/* graphics/command_list.h
+    Deferred draw submission. A command list
+    records draw and state commands into its own
+    linear allocator instead of writing to the
+    framebuffer, so several threads can each
+    prepare a list at the same time. The lists
+    are then executed against a renderer, in the
+    order given, by a single thread.
+
+    A command list must only be recorded by one
+    thread at a time, and must not be recorded
+    while it is being executed. Models and world
+    matrices are copied into the list, but meshes
+    are only referenced and must stay alive until
+    the list has been executed. */
+
+#ifndef GRAPHICS_COMMAND_LIST_H
+#define GRAPHICS_COMMAND_LIST_H
+
+#include "renderer.h"
+#include "./../system/linear_allocator.h"
+
+typedef enum {
+    GRAPHICS_COMMAND_CLEAR,
+    GRAPHICS_COMMAND_SET_CAMERA,
+    GRAPHICS_COMMAND_SET_VIEW,
+    GRAPHICS_COMMAND_SET_BLEND_MODE,
+    GRAPHICS_COMMAND_DRAW_MODEL,
+    GRAPHICS_COMMAND_DRAW_MESH,
+    GRAPHICS_COMMAND_DRAW_LINE,
+    GRAPHICS_COMMAND_DRAW_WIREFRAME_TRIANGLE,
+    GRAPHICS_COMMAND_DRAW_FILLED_TRIANGLE,
+    GRAPHICS_COMMAND_DRAW_SHADED_TRIANGLE
+} graphics_command_type_t;
+
+typedef struct graphics_command_t {
+    graphics_command_type_t type;
+    struct graphics_command_t *next;
+
+    union {
+        graphics_camera_t camera;
+
+        struct {
+            double distance;
+            double width;
+            double height;
+        } view;
+
+        struct {
+            graphics_blend_mode_t mode;
+            uint8_t alpha;
+        } blend;
+
+        resources_model_t model;
+
+        struct {
+            resources_mesh_t *mesh;
+            maths_mat4x4f *world;   /* Copied into the list */
+        } mesh;
+
+        struct {
+            int x[3];
+            int y[3];
+            graphics_pixel_t colour[3];
+        } primitive;
+    };
+} graphics_command_t;
+
+typedef struct {
+    system_linear_allocator_t allocator;
+    graphics_command_t *first;
+    graphics_command_t *last;
+    int num_commands;
+} graphics_command_list_t;
+
+bool graphics_command_list_init (graphics_command_list_t *list);
+void graphics_command_list_reset (graphics_command_list_t *list);
+void graphics_command_list_destroy (graphics_command_list_t *list);
+
+/* Recording */
+bool graphics_command_list_clear (graphics_command_list_t *list);
+bool graphics_command_list_set_camera (graphics_command_list_t *list, graphics_camera_t *camera);
+bool graphics_command_list_set_view (graphics_command_list_t *list, double distance, double width, double height);
+bool graphics_command_list_set_blend_mode (graphics_command_list_t *list, graphics_blend_mode_t mode, uint8_t alpha);
+bool graphics_command_list_draw_model (graphics_command_list_t *list, resources_model_t *model);
+bool graphics_command_list_draw_mesh (graphics_command_list_t *list, resources_mesh_t *mesh, const maths_mat4x4f *world);
+bool graphics_command_list_draw_line (graphics_command_list_t *list, int x0, int y0, int x1, int y1, uint8_t red, uint8_t green, uint8_t blue);
+bool graphics_command_list_draw_wireframe_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue);
+bool graphics_command_list_draw_filled_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue);
+bool graphics_command_list_draw_shaded_triangle (graphics_command_list_t *list, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t r_0, uint8_t g_0, uint8_t b_0, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2);
+
+/* Execution */
+void graphics_renderer_execute_command (graphics_renderer_t *renderer, const graphics_command_t *command);
+void graphics_renderer_execute_command_lists (graphics_renderer_t *renderer, graphics_command_list_t **lists, int num_lists);
+
+#endif
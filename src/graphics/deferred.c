@@ -0,0 +1,496 @@
+#include "deferred.h"
+#include "kernels_common.h"
+#include "./../system/log.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A light moved into camera space for the pass */
+typedef struct {
+    double x;
+    double y;
+    double z;
+    double radius;
+    double inverse_radius_squared;
+    double red;                 /* Colour times intensity, 1 is full */
+    double green;
+    double blue;
+} graphics_view_light_t;
+
+typedef struct {
+    graphics_renderer_t *renderer;
+    const graphics_view_light_t *lights;
+    int num_lights;
+    const uint32_t *tile_start;     /* Lights of tile t are tile_lights[tile_start[t]] up to tile_start[t + 1] */
+    const uint32_t *tile_lights;
+    unsigned int tiles_x;
+    unsigned int num_tiles;
+    double ambient;
+    double pixel_x;                 /* Camera space size of a pixel at z = 1 */
+    double pixel_y;
+} graphics_lighting_pass_t;
+
+/* Normals */
+
+static inline double sign_not_zero (double x) {
+    return x >= 0.0 ? 1.0 : -1.0;
+}
+
+/* Octahedral encoding - the unit sphere is projected
+   onto an octahedron, whose lower half is folded out
+   over the corners of the upper half's square. */
+static uint32_t encode_normal (maths_vec4f n) {
+    double l1 = fabs (n.x) + fabs (n.y) + fabs (n.z);
+    double x = n.x / l1;
+    double y = n.y / l1;
+
+    if (n.z < 0.0) {
+        double folded_x = (1.0 - fabs (y)) * sign_not_zero (x);
+        y = (1.0 - fabs (x)) * sign_not_zero (y);
+        x = folded_x;
+    }
+
+    uint16_t ex = (uint16_t) (int16_t) lround (x * 32767.0);
+    uint16_t ey = (uint16_t) (int16_t) lround (y * 32767.0);
+    return (uint32_t) ex | ((uint32_t) ey << 16);
+}
+
+static inline maths_vec4f decode_normal (uint32_t packed) {
+    double x = (int16_t) (packed & 0xffff) / 32767.0;
+    double y = (int16_t) (packed >> 16) / 32767.0;
+    double z = 1.0 - fabs (x) - fabs (y);
+
+    if (z < 0.0) {
+        double unfolded_x = (1.0 - fabs (y)) * sign_not_zero (x);
+        y = (1.0 - fabs (x)) * sign_not_zero (y);
+        x = unfolded_x;
+    }
+
+    double length = sqrt (x * x + y * y + z * z);
+    return (maths_vec4f) { x / length, y / length, z / length, 0.0 };
+}
+
+/* Lighting */
+
+static void shade_tile (graphics_lighting_pass_t *pass, uint32_t *visible, unsigned int tile);
+
+/* Shade a run of tiles, on whichever thread the job
+   system gives it to. */
+static void shade_tiles (int begin, int end, void *arg) {
+    graphics_lighting_pass_t *pass = (graphics_lighting_pass_t *) arg;
+    uint32_t *visible = (uint32_t *) malloc (sizeof (uint32_t) * (pass->num_lights + 1));
+
+    if (visible == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "could not allocate memory for %d lights.", pass->num_lights);
+        return;
+    }
+
+    for (int tile = begin; tile < end; tile++) {
+        shade_tile (pass, visible, tile);
+    }
+
+    free (visible);
+}
+
+/* Turn on deferred mode. Tiles are lit on the
+   renderer's job system, if it has one. The G-buffer
+   is sized for the output resolution, so it does not
+   need to change with the render resolution. */
+bool graphics_deferred_enable (graphics_renderer_t *renderer) {
+    assert (renderer != NULL);
+
+    if (renderer->deferred != NULL) {
+        graphics_deferred_disable (renderer);
+    }
+
+    graphics_deferred_t *deferred = (graphics_deferred_t *) calloc (1, sizeof (graphics_deferred_t));
+
+    if (deferred == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "could not allocate memory for deferred renderer.");
+        return false;
+    }
+
+    deferred->colour = (graphics_pixel_t) { 255, 255, 255, 255 };
+    renderer->deferred = deferred;
+
+    size_t pixels = (size_t) renderer->output_width * renderer->output_height;
+    deferred->inverse_depth = (float *) calloc (pixels, sizeof (float));
+    deferred->normal = (uint32_t *) malloc (sizeof (uint32_t) * pixels);
+    deferred->albedo = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * pixels);
+
+    if (deferred->inverse_depth == NULL || deferred->normal == NULL || deferred->albedo == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "could not allocate memory for G-buffer.");
+        graphics_deferred_disable (renderer);
+        return false;
+    }
+
+    return true;
+}
+
+void graphics_deferred_disable (graphics_renderer_t *renderer) {
+    graphics_deferred_t *deferred = renderer->deferred;
+
+    if (deferred == NULL) {
+        return;
+    }
+
+    free (deferred->inverse_depth);
+    free (deferred->normal);
+    free (deferred->albedo);
+    free (deferred);
+    renderer->deferred = NULL;
+}
+
+void graphics_deferred_set_albedo (graphics_renderer_t *renderer, uint8_t red, uint8_t green, uint8_t blue) {
+    assert (renderer->deferred != NULL);
+    renderer->deferred->colour = (graphics_pixel_t) { blue, green, red, 255 };
+}
+
+/* Only the depth needs clearing - the normal and
+   albedo of a pixel are never read unless something
+   was drawn there. */
+void graphics_deferred_clear (graphics_renderer_t *renderer) {
+    memset (renderer->deferred->inverse_depth, 0, sizeof (float) * renderer->width * renderer->height);
+}
+
+/* Rasterization */
+
+static inline double min_3 (double a, double b, double c) {
+    return a < b ? (a < c ? a : c) : (b < c ? b : c);
+}
+
+static inline double max_3 (double a, double b, double c) {
+    return a > b ? (a > c ? a : c) : (b > c ? b : c);
+}
+
+/* Fill a clipped camera space triangle, given its
+   projected vertices, into the G-buffer. Pixels are
+   covered when their centre is inside, and the
+   inverse depth is interpolated linearly in screen
+   space, which is perspective correct. Nearer
+   surfaces have larger inverse depths. */
+void graphics_deferred_draw_triangle (graphics_renderer_t *renderer, maths_triangle4f t, const maths_vec2f *p) {
+    graphics_deferred_t *deferred = renderer->deferred;
+    int width = renderer->width;
+    int height = renderer->height;
+
+    double area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+
+    if (fabs (area) < 1e-12) {
+        return;
+    }
+
+    int min_x = (int) floor (min_3 (p[0].x, p[1].x, p[2].x));
+    int max_x = (int) ceil (max_3 (p[0].x, p[1].x, p[2].x));
+    int min_y = (int) floor (min_3 (p[0].y, p[1].y, p[2].y));
+    int max_y = (int) ceil (max_3 (p[0].y, p[1].y, p[2].y));
+
+    min_x = min_x < 0 ? 0 : min_x;
+    min_y = min_y < 0 ? 0 : min_y;
+    max_x = max_x > width - 1 ? width - 1 : max_x;
+    max_y = max_y > height - 1 ? height - 1 : max_y;
+
+    /* Flat normal, turned to face the camera */
+    maths_vec4f normal = maths_vec4f_normalise (maths_vec4f_cross_3d (maths_vec4f_sub (t[1], t[0]), maths_vec4f_sub (t[2], t[0])));
+
+    if (maths_vec4f_dot (normal, t[0]) > 0.0) {
+        normal = maths_vec4f_scale (normal, -1.0);
+    }
+
+    uint32_t packed = encode_normal (normal);
+    double w0 = 1.0 / t[0].z;
+    double w1 = 1.0 / t[1].z;
+    double w2 = 1.0 / t[2].z;
+
+    /* Barycentric weight of each vertex - its edge
+       function over the area - and how much it steps
+       by per pixel across and down. */
+    double dx0 = -(p[2].y - p[1].y) / area, dy0 = (p[2].x - p[1].x) / area;
+    double dx1 = -(p[0].y - p[2].y) / area, dy1 = (p[0].x - p[2].x) / area;
+    double dx2 = -(p[1].y - p[0].y) / area, dy2 = (p[1].x - p[0].x) / area;
+
+    double sx = min_x + 0.5;
+    double sy = min_y + 0.5;
+    double row_b0 = ((p[2].x - p[1].x) * (sy - p[1].y) - (p[2].y - p[1].y) * (sx - p[1].x)) / area;
+    double row_b1 = ((p[0].x - p[2].x) * (sy - p[2].y) - (p[0].y - p[2].y) * (sx - p[2].x)) / area;
+    double row_b2 = ((p[1].x - p[0].x) * (sy - p[0].y) - (p[1].y - p[0].y) * (sx - p[0].x)) / area;
+
+    for (int y = min_y; y <= max_y; y++) {
+        double b0 = row_b0;
+        double b1 = row_b1;
+        double b2 = row_b2;
+        size_t row = (size_t) y * width;
+
+        for (int x = min_x; x <= max_x; x++) {
+            if (b0 >= 0.0 && b1 >= 0.0 && b2 >= 0.0) {
+                float w = (float) (b0 * w0 + b1 * w1 + b2 * w2);
+
+                if (w > deferred->inverse_depth[row + x]) {
+                    deferred->inverse_depth[row + x] = w;
+                    deferred->normal[row + x] = packed;
+                    deferred->albedo[row + x] = deferred->colour;
+                }
+            }
+
+            b0 += dx0;
+            b1 += dx1;
+            b2 += dx2;
+        }
+
+        row_b0 += dy0;
+        row_b1 += dy1;
+        row_b2 += dy2;
+    }
+}
+
+/* Lighting */
+
+static void shade_tile (graphics_lighting_pass_t *pass, uint32_t *visible, unsigned int tile) {
+    graphics_renderer_t *renderer = pass->renderer;
+    graphics_deferred_t *deferred = renderer->deferred;
+    int width = renderer->width;
+    int height = renderer->height;
+
+    int x0 = (tile % pass->tiles_x) * GRAPHICS_DEFERRED_TILE_SIZE;
+    int y0 = (tile / pass->tiles_x) * GRAPHICS_DEFERRED_TILE_SIZE;
+    int x1 = x0 + GRAPHICS_DEFERRED_TILE_SIZE > width ? width : x0 + GRAPHICS_DEFERRED_TILE_SIZE;
+    int y1 = y0 + GRAPHICS_DEFERRED_TILE_SIZE > height ? height : y0 + GRAPHICS_DEFERRED_TILE_SIZE;
+
+    /* Depth bounds of what was drawn in the tile */
+    float nearest = 0.0f;
+    float farthest = INFINITY;
+
+    for (int y = y0; y < y1; y++) {
+        const float *row = deferred->inverse_depth + (size_t) y * width;
+
+        for (int x = x0; x < x1; x++) {
+            if (row[x] > 0.0f) {
+                nearest = row[x] > nearest ? row[x] : nearest;
+                farthest = row[x] < farthest ? row[x] : farthest;
+            }
+        }
+    }
+
+    if (nearest == 0.0f) {
+        /* Nothing drawn - leave it clear */
+        return;
+    }
+
+    double z_near = 1.0 / nearest;
+    double z_far = 1.0 / farthest;
+    int count = 0;
+
+    for (uint32_t i = pass->tile_start[tile]; i < pass->tile_start[tile + 1]; i++) {
+        const graphics_view_light_t *light = &pass->lights[pass->tile_lights[i]];
+
+        if (light->z - light->radius <= z_far && light->z + light->radius >= z_near) {
+            visible[count++] = pass->tile_lights[i];
+        }
+    }
+
+    double half_width = width / 2.0;
+    double half_height = height / 2.0;
+
+    for (int y = y0; y < y1; y++) {
+        size_t row = (size_t) y * width;
+
+        for (int x = x0; x < x1; x++) {
+            float w = deferred->inverse_depth[row + x];
+
+            if (w == 0.0f) {
+                continue;
+            }
+
+            double z = 1.0 / w;
+            double px = (x + 0.5 - half_width) * pass->pixel_x * z;
+            double py = (y + 0.5 - half_height) * pass->pixel_y * z;
+            maths_vec4f n = decode_normal (deferred->normal[row + x]);
+
+            double red = pass->ambient;
+            double green = pass->ambient;
+            double blue = pass->ambient;
+
+            for (int i = 0; i < count; i++) {
+                const graphics_view_light_t *light = &pass->lights[visible[i]];
+                double lx = light->x - px;
+                double ly = light->y - py;
+                double lz = light->z - z;
+                double distance_squared = lx * lx + ly * ly + lz * lz;
+                double falloff = 1.0 - distance_squared * light->inverse_radius_squared;
+
+                if (falloff <= 0.0) {
+                    continue;
+                }
+
+                double n_dot_l = n.x * lx + n.y * ly + n.z * lz;
+
+                if (n_dot_l <= 0.0) {
+                    continue;
+                }
+
+                double amount = falloff * falloff * n_dot_l / sqrt (distance_squared);
+                red += light->red * amount;
+                green += light->green * amount;
+                blue += light->blue * amount;
+            }
+
+            graphics_pixel_t albedo = deferred->albedo[row + x];
+            double r = albedo.red * red;
+            double g = albedo.green * green;
+            double b = albedo.blue * blue;
+
+            graphics_pixel_t out;
+            out.red = r >= 255.0 ? 255 : (uint8_t) r;
+            out.green = g >= 255.0 ? 255 : (uint8_t) g;
+            out.blue = b >= 255.0 ? 255 : (uint8_t) b;
+            out.pad = 255;
+            store_pixel (renderer, renderer->row_offset[y] + renderer->column_offset[x], x, y, out);
+        }
+    }
+}
+
+/* Range of tiles a light's sphere covers on screen,
+   or false if it cannot touch anything drawn. */
+static bool light_tiles (graphics_renderer_t *renderer, const graphics_view_light_t *light, unsigned int tiles_x, unsigned int tiles_y, graphics_rect_t *rect) {
+    double d = renderer->view_distance;
+    double width = renderer->width;
+    double height = renderer->height;
+
+    /* Nothing is drawn in front of the view plane */
+    if (light->z + light->radius < d) {
+        return false;
+    }
+
+    *rect = (graphics_rect_t) { 0, 0, (int) tiles_x, (int) tiles_y };
+
+    double near = light->z - light->radius;
+    double far = light->z + light->radius;
+
+    if (near <= 1e-6) {
+        /* Reaches behind the camera - the whole screen */
+        return true;
+    }
+
+    /* The sphere lies in a box, and its extremes on
+       screen are at the box's nearest or farthest
+       face depending on which side of centre they
+       fall. */
+    double scale_x = d * width / renderer->view_width;
+    double scale_y = d * height / renderer->view_height;
+    double max_x = light->x + light->radius;
+    double min_x = light->x - light->radius;
+    double max_y = light->y + light->radius;
+    double min_y = light->y - light->radius;
+
+    double screen_max_x = (max_x >= 0.0 ? max_x / near : max_x / far) * scale_x + width / 2.0;
+    double screen_min_x = (min_x <= 0.0 ? min_x / near : min_x / far) * scale_x + width / 2.0;
+    double screen_max_y = (max_y >= 0.0 ? max_y / near : max_y / far) * scale_y + height / 2.0;
+    double screen_min_y = (min_y <= 0.0 ? min_y / near : min_y / far) * scale_y + height / 2.0;
+
+    if (screen_max_x < 0.0 || screen_max_y < 0.0 || screen_min_x >= width || screen_min_y >= height) {
+        return false;
+    }
+
+    /* Pixels are shaded at their centres */
+    screen_min_x = screen_min_x < 0.5 ? 0.0 : screen_min_x - 0.5;
+    screen_min_y = screen_min_y < 0.5 ? 0.0 : screen_min_y - 0.5;
+    screen_max_x = screen_max_x > width - 1 ? width - 1 : screen_max_x;
+    screen_max_y = screen_max_y > height - 1 ? height - 1 : screen_max_y;
+
+    rect->x0 = (int) screen_min_x / GRAPHICS_DEFERRED_TILE_SIZE;
+    rect->y0 = (int) screen_min_y / GRAPHICS_DEFERRED_TILE_SIZE;
+    rect->x1 = (int) screen_max_x / GRAPHICS_DEFERRED_TILE_SIZE + 1;
+    rect->y1 = (int) screen_max_y / GRAPHICS_DEFERRED_TILE_SIZE + 1;
+
+    return true;
+}
+
+static void *pass_alloc (graphics_renderer_t *renderer, size_t size) {
+    return system_frame_arena_alloc (&renderer->frame_arena, GRAPHICS_RENDER_THREAD, size, sizeof (double));
+}
+
+/* Shade the G-buffer into the target. The ambient
+   level scales the albedo of everything drawn, lit
+   or not. */
+void graphics_deferred_light (graphics_renderer_t *renderer, const graphics_light_t *lights, int num_lights, graphics_camera_t *camera, double ambient) {
+    graphics_deferred_t *deferred = renderer->deferred;
+
+    if (deferred == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "deferred mode is not enabled.");
+        return;
+    }
+
+    unsigned int tiles_x = (renderer->width + GRAPHICS_DEFERRED_TILE_SIZE - 1) / GRAPHICS_DEFERRED_TILE_SIZE;
+    unsigned int tiles_y = (renderer->height + GRAPHICS_DEFERRED_TILE_SIZE - 1) / GRAPHICS_DEFERRED_TILE_SIZE;
+    unsigned int num_tiles = tiles_x * tiles_y;
+
+    graphics_view_light_t *view_lights = (graphics_view_light_t *) pass_alloc (renderer, sizeof (graphics_view_light_t) * (num_lights + 1));
+    graphics_rect_t *rects = (graphics_rect_t *) pass_alloc (renderer, sizeof (graphics_rect_t) * (num_lights + 1));
+    uint32_t *tile_start = (uint32_t *) pass_alloc (renderer, sizeof (uint32_t) * (num_tiles + 1));
+    uint32_t *cursor = (uint32_t *) pass_alloc (renderer, sizeof (uint32_t) * num_tiles);
+
+    if (view_lights == NULL || rects == NULL || tile_start == NULL || cursor == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "could not allocate frame memory for lighting.");
+        return;
+    }
+
+    /* Bin each light into the tiles it covers, first
+       counting then filling in a second pass. */
+    maths_mat4x4f view = graphics_camera_view_transform (camera);
+    memset (tile_start, 0, sizeof (uint32_t) * (num_tiles + 1));
+
+    for (int i = 0; i < num_lights; i++) {
+        maths_vec4f p = maths_mat4x4f_mul_vec4f (view, lights[i].position);
+        double radius = lights[i].radius;
+        double scale = lights[i].intensity / 255.0;
+
+        view_lights[i] = (graphics_view_light_t) {
+            p.x, p.y, p.z, radius, 1.0 / (radius * radius),
+            lights[i].red * scale, lights[i].green * scale, lights[i].blue * scale
+        };
+
+        if (radius <= 0.0 || !light_tiles (renderer, &view_lights[i], tiles_x, tiles_y, &rects[i])) {
+            rects[i] = (graphics_rect_t) { 0, 0, 0, 0 };
+            continue;
+        }
+
+        for (int ty = rects[i].y0; ty < rects[i].y1; ty++) {
+            for (int tx = rects[i].x0; tx < rects[i].x1; tx++) {
+                tile_start[ty * tiles_x + tx + 1]++;
+            }
+        }
+    }
+
+    for (unsigned int t = 0; t < num_tiles; t++) {
+        tile_start[t + 1] += tile_start[t];
+        cursor[t] = tile_start[t];
+    }
+
+    uint32_t *tile_lights = (uint32_t *) pass_alloc (renderer, sizeof (uint32_t) * (tile_start[num_tiles] + 1));
+
+    if (tile_lights == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/deferred", "could not allocate frame memory for lighting.");
+        return;
+    }
+
+    for (int i = 0; i < num_lights; i++) {
+        for (int ty = rects[i].y0; ty < rects[i].y1; ty++) {
+            for (int tx = rects[i].x0; tx < rects[i].x1; tx++) {
+                tile_lights[cursor[ty * tiles_x + tx]++] = i;
+            }
+        }
+    }
+
+    graphics_lighting_pass_t pass = {
+        renderer, view_lights, num_lights, tile_start, tile_lights, tiles_x, num_tiles, ambient,
+        renderer->view_width / (renderer->width * renderer->view_distance),
+        renderer->view_height / (renderer->height * renderer->view_distance)
+    };
+
+    system_jobs_parallel_for (renderer->jobs, 0, num_tiles, GRAPHICS_DEFERRED_TILES_PER_JOB, shade_tiles, &pass);
+
+    /* Lit pixels are not tracked as dirty rects */
+    renderer->clear_full = true;
+    renderer->present_full = true;
+}
@@ -0,0 +1,58 @@
+/* graphics/deferred.h
+    Deferred lighting for scenes with many lights.
+    While deferred mode is on, meshes are rasterized
+    as filled triangles into a G-buffer rather than
+    drawn to the target. For each pixel it holds the
+    inverse of the camera space depth of the nearest
+    surface, that surface's normal and its albedo.
+
+    The lighting pass then shades the G-buffer into
+    the target. The screen is split into tiles of
+    GRAPHICS_DEFERRED_TILE_SIZE pixels square, and the
+    screen bounds of each light are binned into the
+    tiles they cover. Each tile drops the lights which
+    do not reach the range of depths it holds, so a
+    pixel is only shaded by lights which could touch
+    it. Tiles are shared out as jobs on the renderer's
+    job system.
+
+    Meshes carry no normals, so the G-buffer holds the
+    flat normal of each face. Deferred mode takes the
+    place of multisampling while it is on. */
+
+#ifndef GRAPHICS_DEFERRED_H
+#define GRAPHICS_DEFERRED_H
+
+#include "renderer.h"
+
+#define GRAPHICS_DEFERRED_TILE_SIZE 16
+#define GRAPHICS_DEFERRED_TILES_PER_JOB 4
+
+/* Point light. Its contribution falls smoothly
+   to nothing at its radius. */
+typedef struct {
+    maths_vec4f position;       /* World space */
+    double radius;
+    double intensity;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} graphics_light_t;
+
+typedef struct graphics_deferred_t {
+    float *inverse_depth;       /* 1 / camera space z, 0 where nothing was drawn */
+    uint32_t *normal;           /* Camera space, octahedral encoded as two 16 bit halves */
+    graphics_pixel_t *albedo;
+    graphics_pixel_t colour;    /* Albedo of triangles drawn from now on */
+} graphics_deferred_t;
+
+bool graphics_deferred_enable (graphics_renderer_t *renderer);
+void graphics_deferred_disable (graphics_renderer_t *renderer);
+void graphics_deferred_set_albedo (graphics_renderer_t *renderer, uint8_t red, uint8_t green, uint8_t blue);
+void graphics_deferred_light (graphics_renderer_t *renderer, const graphics_light_t *lights, int num_lights, graphics_camera_t *camera, double ambient);
+
+/* Called by the renderer */
+void graphics_deferred_clear (graphics_renderer_t *renderer);
+void graphics_deferred_draw_triangle (graphics_renderer_t *renderer, maths_triangle4f t, const maths_vec2f *p);
+
+#endif
@@ -0,0 +1,223 @@
+#include "kernels.h"
+#include "kernels_common.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Scalar variants, for any CPU */
+
+static void fill_span_scalar (graphics_pixel_t *dst, graphics_pixel_t colour, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = colour;
+    }
+}
+
+static void blend_span_scalar (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    for (int i = 0; i < n; i++) {
+        blend_pixel (&dst[i], src != NULL ? src[i] : colour, mode);
+    }
+}
+
+static void expand_rgb565_scalar (graphics_pixel_t *dst, const uint16_t *src, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = unpack_rgb565 (src[i]);
+    }
+}
+
+static void expand_indexed_scalar (graphics_pixel_t *dst, const uint8_t *src, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = unpack_indexed (src[i]);
+    }
+}
+
+static void pack_rgb565_scalar (uint16_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = pack_rgb565 (src[i], threshold[i & 3]);
+    }
+}
+
+static void pack_indexed_scalar (uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = pack_indexed (src[i], threshold[i & 3]);
+    }
+}
+
+static void copy_keyed_span_scalar (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t key, int n) {
+    for (int i = 0; i < n; i++) {
+        if (memcmp (&src[i], &key, sizeof (key)) != 0) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_rgb565_scalar (uint16_t *dst, const uint16_t *src, uint16_t key, int n) {
+    for (int i = 0; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_indexed_scalar (uint8_t *dst, const uint8_t *src, uint8_t key, int n) {
+    for (int i = 0; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void scale_nearest_span_scalar (graphics_pixel_t *dst, const graphics_pixel_t *src, int n, uint32_t x, uint32_t step) {
+    for (int i = 0; i < n; i++, x += step) {
+        dst[i] = src[x >> 16];
+    }
+}
+
+static void scale_bilinear_span_scalar (graphics_pixel_t *dst, const graphics_pixel_t *top, const graphics_pixel_t *bottom, int n, int32_t x, int32_t step, int width, unsigned int wy) {
+    for (int i = 0; i < n; i++, x += step) {
+        dst[i] = bilinear_pixel (top, bottom, x, width, wy);
+    }
+}
+
+static void transform_vertices_scalar (maths_vec4f *dst, const resources_vertex_t *src, int n, const maths_mat4x4f *m) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = transform_vertex (m, src[i].coord);
+    }
+}
+
+static void transform_vertices_float3_scalar (maths_vec4f *dst, const resources_vertex_float3_t *src, int n, const maths_mat4x4f *m) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = transform_vertex (m, (maths_vec4f) { src[i].x, src[i].y, src[i].z, 1.0 });
+    }
+}
+
+static void transform_vertices_quantized_scalar (maths_vec4f *dst, const resources_vertex_quantized_t *src, int n, const maths_mat4x4f *m) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = transform_vertex (m, (maths_vec4f) { src[i].x, src[i].y, src[i].z, 1.0 });
+    }
+}
+
+const graphics_kernels_t graphics_kernels_scalar = {
+    GRAPHICS_ISA_SCALAR,
+    "scalar",
+    fill_span_scalar,
+    blend_span_scalar,
+    expand_rgb565_scalar,
+    expand_indexed_scalar,
+    pack_rgb565_scalar,
+    pack_indexed_scalar,
+    copy_keyed_span_scalar,
+    copy_keyed_rgb565_scalar,
+    copy_keyed_indexed_scalar,
+    scale_nearest_span_scalar,
+    scale_bilinear_span_scalar,
+    transform_vertices_scalar,
+    transform_vertices_float3_scalar,
+    transform_vertices_quantized_scalar
+};
+
+graphics_kernels_t graphics_kernels = {
+    GRAPHICS_ISA_SCALAR,
+    "scalar",
+    fill_span_scalar,
+    blend_span_scalar,
+    expand_rgb565_scalar,
+    expand_indexed_scalar,
+    pack_rgb565_scalar,
+    pack_indexed_scalar,
+    copy_keyed_span_scalar,
+    copy_keyed_rgb565_scalar,
+    copy_keyed_indexed_scalar,
+    scale_nearest_span_scalar,
+    scale_bilinear_span_scalar,
+    transform_vertices_scalar,
+    transform_vertices_float3_scalar,
+    transform_vertices_quantized_scalar
+};
+
+/* Dispatch */
+
+static const graphics_kernels_t *variant (graphics_isa_t isa) {
+#if defined (__x86_64__) || defined (__i386__)
+    switch (isa) {
+        case GRAPHICS_ISA_SSE41:
+            return &graphics_kernels_sse41;
+        case GRAPHICS_ISA_AVX2:
+            return &graphics_kernels_avx2;
+        case GRAPHICS_ISA_AVX512:
+            return &graphics_kernels_avx512;
+        default:
+            break;
+    }
+#endif
+
+    return &graphics_kernels_scalar;
+}
+
+bool graphics_kernels_supported (graphics_isa_t isa) {
+#if defined (__x86_64__) || defined (__i386__)
+    __builtin_cpu_init ();
+
+    switch (isa) {
+        case GRAPHICS_ISA_SCALAR:
+            return true;
+        case GRAPHICS_ISA_SSE41:
+            return __builtin_cpu_supports ("sse4.1");
+        case GRAPHICS_ISA_AVX2:
+            return __builtin_cpu_supports ("avx2");
+        case GRAPHICS_ISA_AVX512:
+            return __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw");
+    }
+
+    return false;
+#else
+    return isa == GRAPHICS_ISA_SCALAR;
+#endif
+}
+
+/* Switch to the given variants. Only safe while no
+   other thread is drawing. */
+bool graphics_kernels_select (graphics_isa_t isa) {
+    if (!graphics_kernels_supported (isa)) {
+        return false;
+    }
+
+    graphics_kernels = *variant (isa);
+    return true;
+}
+
+static void select_best () {
+    graphics_isa_t limit = GRAPHICS_ISA_AVX512;
+    const char *cap = getenv ("SOFTGFX_ISA");
+
+    if (cap != NULL) {
+        static const char *names[] = { "scalar", "sse41", "avx2", "avx512" };
+        bool known = false;
+
+        for (int i = 0; i <= GRAPHICS_ISA_AVX512; i++) {
+            if (strcmp (cap, names[i]) == 0) {
+                limit = (graphics_isa_t) i;
+                known = true;
+            }
+        }
+
+        if (!known) {
+            SYSTEM_LOG_WARN ("graphics/kernels", "unknown SOFTGFX_ISA %s, ignoring.", cap);
+        }
+    }
+
+    for (int isa = limit; isa >= GRAPHICS_ISA_SCALAR; isa--) {
+        if (graphics_kernels_select ((graphics_isa_t) isa)) {
+            break;
+        }
+    }
+
+    SYSTEM_LOG_INFO ("graphics/kernels", "using %s kernels.", graphics_kernels.name);
+}
+
+/* Pick the best variants the CPU supports. Only does
+   anything the first time it is called. */
+void graphics_kernels_init () {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once (&once, select_best);
+}
@@ -0,0 +1,89 @@
+/* graphics/kernels.h
+    Hot inner loops, built once per instruction set
+    and chosen at run time. Each variant lives in its
+    own file, compiled with the flags for its
+    instruction set, so one binary runs everywhere and
+    uses the widest vectors the CPU has.
+
+    graphics_kernels starts out pointing at the scalar
+    variants. graphics_kernels_init checks the CPU and
+    switches to the best supported set; it is called
+    by graphics_renderer_init. Setting the environment
+    variable SOFTGFX_ISA to scalar, sse41, avx2 or
+    avx512 caps the choice, e.g. for comparing output.
+
+    Every variant gives bit for bit the same results. */
+
+#ifndef GRAPHICS_KERNELS_H
+#define GRAPHICS_KERNELS_H
+
+#include "renderer.h"
+#include <stdbool.h>
+
+typedef enum {
+    GRAPHICS_ISA_SCALAR,
+    GRAPHICS_ISA_SSE41,
+    GRAPHICS_ISA_AVX2,
+    GRAPHICS_ISA_AVX512
+} graphics_isa_t;
+
+typedef struct {
+    graphics_isa_t isa;
+    const char *name;
+
+    /* Set n pixels to one colour */
+    void (*fill_span) (graphics_pixel_t *dst, graphics_pixel_t colour, int n);
+
+    /* Blend n source pixels into dst, or n copies of
+       colour if src is NULL. mode is not NONE. Sources
+       must be premultiplied, with no channel above the
+       alpha in the pad byte, as from source_pixel. Only
+       then do the SIMD variants, which saturate, match
+       the scalar kernel, which wraps. */
+    void (*blend_span) (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode);
+
+    /* Expand n compact pixels to BGRX, for display */
+    void (*expand_rgb565) (graphics_pixel_t *dst, const uint16_t *src, int n);
+    void (*expand_indexed) (graphics_pixel_t *dst, const uint8_t *src, int n);
+
+    /* Pack n BGRX pixels into a compact format. The
+       four dither thresholds of a row repeat across
+       the span, starting with threshold[0]. */
+    void (*pack_rgb565) (uint16_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold);
+    void (*pack_indexed) (uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold);
+
+    /* Copy n pixels, leaving dst where src is the key
+       colour, for colour keyed blits */
+    void (*copy_keyed_span) (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t key, int n);
+    void (*copy_keyed_rgb565) (uint16_t *dst, const uint16_t *src, uint16_t key, int n);
+    void (*copy_keyed_indexed) (uint8_t *dst, const uint8_t *src, uint8_t key, int n);
+
+    /* Scale a row of n pixels for upscaling, sampling
+       the source at x + i * step for pixel i, in 16.16
+       fixed point. Nearest takes the pixel there, and
+       bilinear blends rows top and bottom by wy as
+       bilinear_pixel does. */
+    void (*scale_nearest_span) (graphics_pixel_t *dst, const graphics_pixel_t *src, int n, uint32_t x, uint32_t step);
+    void (*scale_bilinear_span) (graphics_pixel_t *dst, const graphics_pixel_t *top, const graphics_pixel_t *bottom, int n, int32_t x, int32_t step, int width, unsigned int wy);
+
+    /* Transform n vertices, taking w as 1 */
+    void (*transform_vertices) (maths_vec4f *dst, const resources_vertex_t *src, int n, const maths_mat4x4f *m);
+
+    /* The same from the compact formats. For quantized
+       vertices m has the dequantization folded in. */
+    void (*transform_vertices_float3) (maths_vec4f *dst, const resources_vertex_float3_t *src, int n, const maths_mat4x4f *m);
+    void (*transform_vertices_quantized) (maths_vec4f *dst, const resources_vertex_quantized_t *src, int n, const maths_mat4x4f *m);
+} graphics_kernels_t;
+
+extern graphics_kernels_t graphics_kernels;
+
+extern const graphics_kernels_t graphics_kernels_scalar;
+extern const graphics_kernels_t graphics_kernels_sse41;
+extern const graphics_kernels_t graphics_kernels_avx2;
+extern const graphics_kernels_t graphics_kernels_avx512;
+
+void graphics_kernels_init ();
+bool graphics_kernels_supported (graphics_isa_t isa);
+bool graphics_kernels_select (graphics_isa_t isa);
+
+#endif
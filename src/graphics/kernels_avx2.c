@@ -0,0 +1,360 @@
+/* Built with -mavx2 */
+
+#include "kernels.h"
+#include "kernels_common.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+
+#include <immintrin.h>
+
+static void fill_span_avx2 (graphics_pixel_t *dst, graphics_pixel_t colour, int n) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m256i colour_8 = _mm256_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256 ((__m256i *) (dst + i), colour_8);
+    }
+
+    if (i < n) {
+        /* Ones in the lanes still to write */
+        __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (n - i), _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        _mm256_maskstore_epi32 ((int *) (dst + i), mask, colour_8);
+    }
+}
+
+static inline __m256i div_255_epi16_x8 (__m256i x) {
+    x = _mm256_add_epi16 (x, _mm256_set1_epi16 (128));
+    return _mm256_srli_epi16 (_mm256_add_epi16 (x, _mm256_srli_epi16 (x, 8)), 8);
+}
+
+/* Blend eight pixels, with the channels widened to 16
+   bits for the multiplies. The unpacks and packs work
+   within each 128 bit lane, so the pixel order comes
+   back out unchanged. */
+static inline __m256i blend_8 (__m256i d, __m256i s, graphics_blend_mode_t mode) {
+    if (mode == GRAPHICS_BLEND_ADDITIVE) {
+        return _mm256_adds_epu8 (d, s);
+    }
+
+    __m256i zero = _mm256_setzero_si256 ();
+    __m256i max = _mm256_set1_epi16 (255);
+    __m256i d_lo = _mm256_unpacklo_epi8 (d, zero);
+    __m256i d_hi = _mm256_unpackhi_epi8 (d, zero);
+    __m256i s_lo = _mm256_unpacklo_epi8 (s, zero);
+    __m256i s_hi = _mm256_unpackhi_epi8 (s, zero);
+    __m256i inv_lo = _mm256_sub_epi16 (max, _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (s_lo, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3)));
+    __m256i inv_hi = _mm256_sub_epi16 (max, _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (s_hi, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3)));
+
+    if (mode == GRAPHICS_BLEND_ALPHA) {
+        d_lo = _mm256_add_epi16 (s_lo, div_255_epi16_x8 (_mm256_mullo_epi16 (d_lo, inv_lo)));
+        d_hi = _mm256_add_epi16 (s_hi, div_255_epi16_x8 (_mm256_mullo_epi16 (d_hi, inv_hi)));
+    } else {
+        /* The alpha lane scales by 255, leaving it unchanged */
+        d_lo = div_255_epi16_x8 (_mm256_mullo_epi16 (d_lo, _mm256_add_epi16 (s_lo, inv_lo)));
+        d_hi = div_255_epi16_x8 (_mm256_mullo_epi16 (d_hi, _mm256_add_epi16 (s_hi, inv_hi)));
+    }
+
+    return _mm256_packus_epi16 (d_lo, d_hi);
+}
+
+static void blend_span_avx2 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m256i colour_8 = _mm256_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = src != NULL ? _mm256_loadu_si256 ((const __m256i *) (src + i)) : colour_8;
+        __m256i d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), blend_8 (d, s, mode));
+    }
+
+    for (; i < n; i++) {
+        blend_pixel (&dst[i], src != NULL ? src[i] : colour, mode);
+    }
+}
+
+/* Widen and replicate the top bits of each channel,
+   one pixel per 32 bit lane. */
+static inline __m256i expand_rgb565_lanes (__m256i v) {
+    __m256i r = _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (v, 8), _mm256_set1_epi32 (0xf8)), _mm256_srli_epi32 (v, 13));
+    __m256i g = _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (v, 3), _mm256_set1_epi32 (0xfc)), _mm256_and_si256 (_mm256_srli_epi32 (v, 9), _mm256_set1_epi32 (0x03)));
+    __m256i b = _mm256_or_si256 (_mm256_and_si256 (_mm256_slli_epi32 (v, 3), _mm256_set1_epi32 (0xf8)), _mm256_and_si256 (_mm256_srli_epi32 (v, 2), _mm256_set1_epi32 (0x07)));
+
+    return _mm256_or_si256 (_mm256_or_si256 (b, _mm256_slli_epi32 (g, 8)), _mm256_or_si256 (_mm256_slli_epi32 (r, 16), _mm256_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_rgb565_avx2 (graphics_pixel_t *dst, const uint16_t *src, int n) {
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256 ((__m256i *) (dst + i), expand_rgb565_lanes (_mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) (src + i)))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_rgb565 (src[i]);
+    }
+}
+
+/* As unpack_indexed, one pixel per 32 bit lane */
+static inline __m256i expand_indexed_lanes (__m256i v) {
+    __m256i scale = _mm256_set1_epi32 (73);
+    __m256i r = _mm256_srli_epi32 (_mm256_mullo_epi32 (_mm256_srli_epi32 (v, 5), scale), 1);
+    __m256i g = _mm256_srli_epi32 (_mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (v, 2), _mm256_set1_epi32 (7)), scale), 1);
+    __m256i b = _mm256_mullo_epi32 (_mm256_and_si256 (v, _mm256_set1_epi32 (3)), _mm256_set1_epi32 (85));
+
+    return _mm256_or_si256 (_mm256_or_si256 (b, _mm256_slli_epi32 (g, 8)), _mm256_or_si256 (_mm256_slli_epi32 (r, 16), _mm256_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_indexed_avx2 (graphics_pixel_t *dst, const uint8_t *src, int n) {
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256 ((__m256i *) (dst + i), expand_indexed_lanes (_mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (src + i)))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_indexed (src[i]);
+    }
+}
+
+/* As quantize_channel, for levels of 2^bits - 1 */
+static inline __m256i quantize_lanes (__m256i c, int bits, __m256i t) {
+    __m256i x = _mm256_add_epi32 (_mm256_sub_epi32 (_mm256_slli_epi32 (c, bits), c), t);
+
+    return _mm256_srli_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (x, _mm256_set1_epi32 (1)), _mm256_srli_epi32 (x, 8)), 8);
+}
+
+static void pack_rgb565_avx2 (uint16_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m256i t = _mm256_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3], threshold[0], threshold[1], threshold[2], threshold[3]);
+    __m256i mask = _mm256_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i b = quantize_lanes (_mm256_and_si256 (v, mask), 5, t);
+        __m256i g = quantize_lanes (_mm256_and_si256 (_mm256_srli_epi32 (v, 8), mask), 6, t);
+        __m256i r = quantize_lanes (_mm256_and_si256 (_mm256_srli_epi32 (v, 16), mask), 5, t);
+        __m256i packed = _mm256_or_si256 (_mm256_or_si256 (_mm256_slli_epi32 (r, 11), _mm256_slli_epi32 (g, 5)), b);
+
+        /* Packing works within each half, so gather the
+           low quarter of each half */
+        __m256i words = _mm256_permute4x64_epi64 (_mm256_packus_epi32 (packed, packed), 0x08);
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm256_castsi256_si128 (words));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_rgb565 (src[i], threshold[i & 3]);
+    }
+}
+
+static void pack_indexed_avx2 (uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m256i t = _mm256_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3], threshold[0], threshold[1], threshold[2], threshold[3]);
+    __m256i mask = _mm256_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i b = quantize_lanes (_mm256_and_si256 (v, mask), 2, t);
+        __m256i g = quantize_lanes (_mm256_and_si256 (_mm256_srli_epi32 (v, 8), mask), 3, t);
+        __m256i r = quantize_lanes (_mm256_and_si256 (_mm256_srli_epi32 (v, 16), mask), 3, t);
+        __m256i packed = _mm256_or_si256 (_mm256_or_si256 (_mm256_slli_epi32 (r, 5), _mm256_slli_epi32 (g, 2)), b);
+
+        __m256i words = _mm256_packus_epi32 (packed, packed);
+        __m256i bytes = _mm256_permutevar8x32_epi32 (_mm256_packus_epi16 (words, words), _mm256_setr_epi32 (0, 4, 0, 0, 0, 0, 0, 0));
+        _mm_storel_epi64 ((__m128i *) (dst + i), _mm256_castsi256_si128 (bytes));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_indexed (src[i], threshold[i & 3]);
+    }
+}
+
+/* Source lanes equal to the key take the target's
+   bytes instead */
+static void copy_keyed_span_avx2 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t key, int n) {
+    uint32_t packed;
+    memcpy (&packed, &key, sizeof (packed));
+
+    __m256i key_8 = _mm256_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_blendv_epi8 (s, d, _mm256_cmpeq_epi32 (s, key_8)));
+    }
+
+    for (; i < n; i++) {
+        if (memcmp (&src[i], &key, sizeof (key)) != 0) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_rgb565_avx2 (uint16_t *dst, const uint16_t *src, uint16_t key, int n) {
+    __m256i key_16 = _mm256_set1_epi16 ((short) key);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_blendv_epi8 (s, d, _mm256_cmpeq_epi16 (s, key_16)));
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_indexed_avx2 (uint8_t *dst, const uint8_t *src, uint8_t key, int n) {
+    __m256i key_32 = _mm256_set1_epi8 ((char) key);
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *) (src + i));
+        __m256i d = _mm256_loadu_si256 ((const __m256i *) (dst + i));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_blendv_epi8 (s, d, _mm256_cmpeq_epi8 (s, key_32)));
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void scale_nearest_span_avx2 (graphics_pixel_t *dst, const graphics_pixel_t *src, int n, uint32_t x, uint32_t step) {
+    __m256i lanes = _mm256_add_epi32 (_mm256_set1_epi32 ((int) x), _mm256_mullo_epi32 (_mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32 ((int) step)));
+    __m256i step_8 = _mm256_set1_epi32 ((int) (step * 8));
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8, lanes = _mm256_add_epi32 (lanes, step_8)) {
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_i32gather_epi32 ((const int *) src, _mm256_srli_epi32 (lanes, 16), 4));
+    }
+
+    for (x += step * i; i < n; i++, x += step) {
+        dst[i] = src[x >> 16];
+    }
+}
+
+/* (a * (128 - w) + b * w) >> 7 on each 16 bit lane */
+static inline __m256i lerp_epi16_x8 (__m256i a, __m256i b, __m256i w) {
+    return _mm256_srli_epi16 (_mm256_add_epi16 (_mm256_mullo_epi16 (a, _mm256_sub_epi16 (_mm256_set1_epi16 (128), w)), _mm256_mullo_epi16 (b, w)), 7);
+}
+
+/* As for SSE4.1, eight pixels at a time. The weights
+   are unpacked within each 128 bit lane, as the
+   pixels are, so they stay lined up. */
+static void scale_bilinear_span_avx2 (graphics_pixel_t *dst, const graphics_pixel_t *top, const graphics_pixel_t *bottom, int n, int32_t x, int32_t step, int width, unsigned int wy) {
+    __m256i zero = _mm256_setzero_si256 ();
+    __m256i lanes = _mm256_add_epi32 (_mm256_set1_epi32 (x), _mm256_mullo_epi32 (_mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32 (step)));
+    __m256i step_8 = _mm256_set1_epi32 (step * 8);
+    __m256i last = _mm256_set1_epi32 (width - 1);
+    __m256i wy_16 = _mm256_set1_epi16 ((short) wy);
+    const int *t = (const int *) top;
+    const int *b = (const int *) bottom;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8, lanes = _mm256_add_epi32 (lanes, step_8)) {
+        __m256i cx = _mm256_max_epi32 (lanes, zero);
+        __m256i x0 = _mm256_srli_epi32 (cx, 16);
+        __m256i x1 = _mm256_min_epi32 (_mm256_add_epi32 (x0, _mm256_set1_epi32 (1)), last);
+        __m256i wx = _mm256_and_si256 (_mm256_srli_epi32 (cx, 9), _mm256_set1_epi32 (0x7F));
+        wx = _mm256_or_si256 (wx, _mm256_slli_epi32 (wx, 16));
+
+        __m256i wx_lo = _mm256_unpacklo_epi32 (wx, wx);
+        __m256i wx_hi = _mm256_unpackhi_epi32 (wx, wx);
+        __m256i p00 = _mm256_i32gather_epi32 (t, x0, 4);
+        __m256i p01 = _mm256_i32gather_epi32 (t, x1, 4);
+        __m256i p10 = _mm256_i32gather_epi32 (b, x0, 4);
+        __m256i p11 = _mm256_i32gather_epi32 (b, x1, 4);
+
+        __m256i t_lo = lerp_epi16_x8 (_mm256_unpacklo_epi8 (p00, zero), _mm256_unpacklo_epi8 (p01, zero), wx_lo);
+        __m256i t_hi = lerp_epi16_x8 (_mm256_unpackhi_epi8 (p00, zero), _mm256_unpackhi_epi8 (p01, zero), wx_hi);
+        __m256i u_lo = lerp_epi16_x8 (_mm256_unpacklo_epi8 (p10, zero), _mm256_unpacklo_epi8 (p11, zero), wx_lo);
+        __m256i u_hi = lerp_epi16_x8 (_mm256_unpackhi_epi8 (p10, zero), _mm256_unpackhi_epi8 (p11, zero), wx_hi);
+
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_packus_epi16 (lerp_epi16_x8 (t_lo, u_lo, wy_16), lerp_epi16_x8 (t_hi, u_hi, wy_16)));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = bilinear_pixel (top, bottom, x + i * step, width, wy);
+    }
+}
+
+/* One vertex per register. Multiplies and adds are
+   kept separate rather than fused, to round the same
+   as the other variants. */
+static void transform_vertices_avx2 (maths_vec4f *dst, const resources_vertex_t *src, int n, const maths_mat4x4f *m) {
+    __m256d c0 = _mm256_loadu_pd (m->data[0]);
+    __m256d c1 = _mm256_loadu_pd (m->data[1]);
+    __m256d c2 = _mm256_loadu_pd (m->data[2]);
+    __m256d c3 = _mm256_loadu_pd (m->data[3]);
+
+    for (int i = 0; i < n; i++) {
+        __m256d x = _mm256_broadcast_sd (&src[i].coord.x);
+        __m256d y = _mm256_broadcast_sd (&src[i].coord.y);
+        __m256d z = _mm256_broadcast_sd (&src[i].coord.z);
+        __m256d v = _mm256_add_pd (_mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (c0, x), _mm256_mul_pd (c1, y)), _mm256_mul_pd (c2, z)), c3);
+
+        _mm256_storeu_pd (&dst[i].x, v);
+    }
+}
+
+/* Transform a vertex held as (x, y, z, _) */
+static inline __m256d transform_avx2 (const __m256d *c, __m256d v) {
+    __m256d x = _mm256_permute4x64_pd (v, 0x00);
+    __m256d y = _mm256_permute4x64_pd (v, 0x55);
+    __m256d z = _mm256_permute4x64_pd (v, 0xaa);
+
+    return _mm256_add_pd (_mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (c[0], x), _mm256_mul_pd (c[1], y)), _mm256_mul_pd (c[2], z)), c[3]);
+}
+
+/* Three lanes are loaded, so the last vertex is not
+   read past. */
+static void transform_vertices_float3_avx2 (maths_vec4f *dst, const resources_vertex_float3_t *src, int n, const maths_mat4x4f *m) {
+    __m256d c[4] = { _mm256_loadu_pd (m->data[0]), _mm256_loadu_pd (m->data[1]), _mm256_loadu_pd (m->data[2]), _mm256_loadu_pd (m->data[3]) };
+    __m128i mask = _mm_setr_epi32 (-1, -1, -1, 0);
+
+    for (int i = 0; i < n; i++) {
+        __m256d v = _mm256_cvtps_pd (_mm_maskload_ps (&src[i].x, mask));
+        _mm256_storeu_pd (&dst[i].x, transform_avx2 (c, v));
+    }
+}
+
+static void transform_vertices_quantized_avx2 (maths_vec4f *dst, const resources_vertex_quantized_t *src, int n, const maths_mat4x4f *m) {
+    __m256d c[4] = { _mm256_loadu_pd (m->data[0]), _mm256_loadu_pd (m->data[1]), _mm256_loadu_pd (m->data[2]), _mm256_loadu_pd (m->data[3]) };
+
+    for (int i = 0; i < n; i++) {
+        __m256d v = _mm256_cvtepi32_pd (_mm_cvtepu16_epi32 (_mm_loadl_epi64 ((const __m128i *) &src[i])));
+        _mm256_storeu_pd (&dst[i].x, transform_avx2 (c, v));
+    }
+}
+
+const graphics_kernels_t graphics_kernels_avx2 = {
+    GRAPHICS_ISA_AVX2,
+    "avx2",
+    fill_span_avx2,
+    blend_span_avx2,
+    expand_rgb565_avx2,
+    expand_indexed_avx2,
+    pack_rgb565_avx2,
+    pack_indexed_avx2,
+    copy_keyed_span_avx2,
+    copy_keyed_rgb565_avx2,
+    copy_keyed_indexed_avx2,
+    scale_nearest_span_avx2,
+    scale_bilinear_span_avx2,
+    transform_vertices_avx2,
+    transform_vertices_float3_avx2,
+    transform_vertices_quantized_avx2
+};
+
+#endif
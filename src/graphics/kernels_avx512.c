@@ -0,0 +1,400 @@
+/* Built with -mavx512f -mavx512bw */
+
+#include "kernels.h"
+#include "kernels_common.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+
+#include <immintrin.h>
+
+/* Lanes still to do in the last, partial vector */
+static inline __mmask16 tail_mask (int n) {
+    return (__mmask16) ((1u << n) - 1);
+}
+
+static void fill_span_avx512 (graphics_pixel_t *dst, graphics_pixel_t colour, int n) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m512i colour_16 = _mm512_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512 ((void *) (dst + i), colour_16);
+    }
+
+    if (i < n) {
+        _mm512_mask_storeu_epi32 ((void *) (dst + i), tail_mask (n - i), colour_16);
+    }
+}
+
+static inline __m512i div_255_epi16_x16 (__m512i x) {
+    x = _mm512_add_epi16 (x, _mm512_set1_epi16 (128));
+    return _mm512_srli_epi16 (_mm512_add_epi16 (x, _mm512_srli_epi16 (x, 8)), 8);
+}
+
+/* Blend sixteen pixels, as blend_8 in the AVX2
+   variant, with the unpacks and packs working within
+   each 128 bit lane. */
+static inline __m512i blend_16 (__m512i d, __m512i s, graphics_blend_mode_t mode) {
+    if (mode == GRAPHICS_BLEND_ADDITIVE) {
+        return _mm512_adds_epu8 (d, s);
+    }
+
+    __m512i zero = _mm512_setzero_si512 ();
+    __m512i max = _mm512_set1_epi16 (255);
+    __m512i d_lo = _mm512_unpacklo_epi8 (d, zero);
+    __m512i d_hi = _mm512_unpackhi_epi8 (d, zero);
+    __m512i s_lo = _mm512_unpacklo_epi8 (s, zero);
+    __m512i s_hi = _mm512_unpackhi_epi8 (s, zero);
+    __m512i inv_lo = _mm512_sub_epi16 (max, _mm512_shufflehi_epi16 (_mm512_shufflelo_epi16 (s_lo, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3)));
+    __m512i inv_hi = _mm512_sub_epi16 (max, _mm512_shufflehi_epi16 (_mm512_shufflelo_epi16 (s_hi, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3)));
+
+    if (mode == GRAPHICS_BLEND_ALPHA) {
+        d_lo = _mm512_add_epi16 (s_lo, div_255_epi16_x16 (_mm512_mullo_epi16 (d_lo, inv_lo)));
+        d_hi = _mm512_add_epi16 (s_hi, div_255_epi16_x16 (_mm512_mullo_epi16 (d_hi, inv_hi)));
+    } else {
+        /* The alpha lane scales by 255, leaving it unchanged */
+        d_lo = div_255_epi16_x16 (_mm512_mullo_epi16 (d_lo, _mm512_add_epi16 (s_lo, inv_lo)));
+        d_hi = div_255_epi16_x16 (_mm512_mullo_epi16 (d_hi, _mm512_add_epi16 (s_hi, inv_hi)));
+    }
+
+    return _mm512_packus_epi16 (d_lo, d_hi);
+}
+
+/* The tail goes through the same vector code with
+   masked loads and stores. */
+static void blend_span_avx512 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m512i colour_16 = _mm512_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512i s = src != NULL ? _mm512_loadu_si512 ((const void *) (src + i)) : colour_16;
+        __m512i d = _mm512_loadu_si512 ((const void *) (dst + i));
+        _mm512_storeu_si512 ((void *) (dst + i), blend_16 (d, s, mode));
+    }
+
+    if (i < n) {
+        __mmask16 mask = tail_mask (n - i);
+        __m512i s = src != NULL ? _mm512_maskz_loadu_epi32 (mask, (const void *) (src + i)) : colour_16;
+        __m512i d = _mm512_maskz_loadu_epi32 (mask, (const void *) (dst + i));
+        _mm512_mask_storeu_epi32 ((void *) (dst + i), mask, blend_16 (d, s, mode));
+    }
+}
+
+_Static_assert (sizeof (resources_vertex_t) == sizeof (maths_vec4f), "vertices are loaded two at a time");
+
+/* Widen and replicate the top bits of each channel,
+   one pixel per 32 bit lane. */
+static inline __m512i expand_rgb565_lanes (__m512i v) {
+    __m512i r = _mm512_or_si512 (_mm512_and_si512 (_mm512_srli_epi32 (v, 8), _mm512_set1_epi32 (0xf8)), _mm512_srli_epi32 (v, 13));
+    __m512i g = _mm512_or_si512 (_mm512_and_si512 (_mm512_srli_epi32 (v, 3), _mm512_set1_epi32 (0xfc)), _mm512_and_si512 (_mm512_srli_epi32 (v, 9), _mm512_set1_epi32 (0x03)));
+    __m512i b = _mm512_or_si512 (_mm512_and_si512 (_mm512_slli_epi32 (v, 3), _mm512_set1_epi32 (0xf8)), _mm512_and_si512 (_mm512_srli_epi32 (v, 2), _mm512_set1_epi32 (0x07)));
+
+    return _mm512_or_si512 (_mm512_or_si512 (b, _mm512_slli_epi32 (g, 8)), _mm512_or_si512 (_mm512_slli_epi32 (r, 16), _mm512_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_rgb565_avx512 (graphics_pixel_t *dst, const uint16_t *src, int n) {
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512 ((void *) (dst + i), expand_rgb565_lanes (_mm512_cvtepu16_epi32 (_mm256_loadu_si256 ((const __m256i *) (src + i)))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_rgb565 (src[i]);
+    }
+}
+
+/* As unpack_indexed, one pixel per 32 bit lane */
+static inline __m512i expand_indexed_lanes (__m512i v) {
+    __m512i scale = _mm512_set1_epi32 (73);
+    __m512i r = _mm512_srli_epi32 (_mm512_mullo_epi32 (_mm512_srli_epi32 (v, 5), scale), 1);
+    __m512i g = _mm512_srli_epi32 (_mm512_mullo_epi32 (_mm512_and_si512 (_mm512_srli_epi32 (v, 2), _mm512_set1_epi32 (7)), scale), 1);
+    __m512i b = _mm512_mullo_epi32 (_mm512_and_si512 (v, _mm512_set1_epi32 (3)), _mm512_set1_epi32 (85));
+
+    return _mm512_or_si512 (_mm512_or_si512 (b, _mm512_slli_epi32 (g, 8)), _mm512_or_si512 (_mm512_slli_epi32 (r, 16), _mm512_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_indexed_avx512 (graphics_pixel_t *dst, const uint8_t *src, int n) {
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512 ((void *) (dst + i), expand_indexed_lanes (_mm512_cvtepu8_epi32 (_mm_loadu_si128 ((const __m128i *) (src + i)))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_indexed (src[i]);
+    }
+}
+
+/* As quantize_channel, for levels of 2^bits - 1 */
+static inline __m512i quantize_lanes (__m512i c, int bits, __m512i t) {
+    __m512i x = _mm512_add_epi32 (_mm512_sub_epi32 (_mm512_slli_epi32 (c, bits), c), t);
+
+    return _mm512_srli_epi32 (_mm512_add_epi32 (_mm512_add_epi32 (x, _mm512_set1_epi32 (1)), _mm512_srli_epi32 (x, 8)), 8);
+}
+
+static void pack_rgb565_avx512 (uint16_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m512i t = _mm512_broadcast_i32x4 (_mm_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3]));
+    __m512i mask = _mm512_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512 ((const void *) (src + i));
+        __m512i b = quantize_lanes (_mm512_and_si512 (v, mask), 5, t);
+        __m512i g = quantize_lanes (_mm512_and_si512 (_mm512_srli_epi32 (v, 8), mask), 6, t);
+        __m512i r = quantize_lanes (_mm512_and_si512 (_mm512_srli_epi32 (v, 16), mask), 5, t);
+        __m512i packed = _mm512_or_si512 (_mm512_or_si512 (_mm512_slli_epi32 (r, 11), _mm512_slli_epi32 (g, 5)), b);
+
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm512_cvtepi32_epi16 (packed));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_rgb565 (src[i], threshold[i & 3]);
+    }
+}
+
+static void pack_indexed_avx512 (uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m512i t = _mm512_broadcast_i32x4 (_mm_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3]));
+    __m512i mask = _mm512_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512 ((const void *) (src + i));
+        __m512i b = quantize_lanes (_mm512_and_si512 (v, mask), 2, t);
+        __m512i g = quantize_lanes (_mm512_and_si512 (_mm512_srli_epi32 (v, 8), mask), 3, t);
+        __m512i r = quantize_lanes (_mm512_and_si512 (_mm512_srli_epi32 (v, 16), mask), 3, t);
+        __m512i packed = _mm512_or_si512 (_mm512_or_si512 (_mm512_slli_epi32 (r, 5), _mm512_slli_epi32 (g, 2)), b);
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm512_cvtepi32_epi8 (packed));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_indexed (src[i], threshold[i & 3]);
+    }
+}
+
+/* Only lanes which differ from the key are stored */
+static void copy_keyed_span_avx512 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t key, int n) {
+    uint32_t packed;
+    memcpy (&packed, &key, sizeof (packed));
+
+    __m512i key_16 = _mm512_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512i s = _mm512_loadu_si512 ((const void *) (src + i));
+        _mm512_mask_storeu_epi32 ((void *) (dst + i), _mm512_cmpneq_epi32_mask (s, key_16), s);
+    }
+
+    for (; i < n; i++) {
+        if (memcmp (&src[i], &key, sizeof (key)) != 0) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_rgb565_avx512 (uint16_t *dst, const uint16_t *src, uint16_t key, int n) {
+    __m512i key_32 = _mm512_set1_epi16 ((short) key);
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m512i s = _mm512_loadu_si512 ((const void *) (src + i));
+        _mm512_mask_storeu_epi16 ((void *) (dst + i), _mm512_cmpneq_epi16_mask (s, key_32), s);
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_indexed_avx512 (uint8_t *dst, const uint8_t *src, uint8_t key, int n) {
+    __m512i key_64 = _mm512_set1_epi8 ((char) key);
+    int i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i s = _mm512_loadu_si512 ((const void *) (src + i));
+        _mm512_mask_storeu_epi8 ((void *) (dst + i), _mm512_cmpneq_epi8_mask (s, key_64), s);
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void scale_nearest_span_avx512 (graphics_pixel_t *dst, const graphics_pixel_t *src, int n, uint32_t x, uint32_t step) {
+    __m512i lanes = _mm512_add_epi32 (_mm512_set1_epi32 ((int) x), _mm512_mullo_epi32 (_mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32 ((int) step)));
+    __m512i step_16 = _mm512_set1_epi32 ((int) (step * 16));
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16, lanes = _mm512_add_epi32 (lanes, step_16)) {
+        _mm512_storeu_si512 ((void *) (dst + i), _mm512_i32gather_epi32 (_mm512_srli_epi32 (lanes, 16), (const void *) src, 4));
+    }
+
+    if (i < n) {
+        __mmask16 mask = tail_mask (n - i);
+        __m512i p = _mm512_mask_i32gather_epi32 (_mm512_setzero_si512 (), mask, _mm512_srli_epi32 (lanes, 16), (const void *) src, 4);
+        _mm512_mask_storeu_epi32 ((void *) (dst + i), mask, p);
+    }
+}
+
+/* (a * (128 - w) + b * w) >> 7 on each 16 bit lane */
+static inline __m512i lerp_epi16_x16 (__m512i a, __m512i b, __m512i w) {
+    return _mm512_srli_epi16 (_mm512_add_epi16 (_mm512_mullo_epi16 (a, _mm512_sub_epi16 (_mm512_set1_epi16 (128), w)), _mm512_mullo_epi16 (b, w)), 7);
+}
+
+/* Sixteen pixels of the row, with the weights
+   unpacked within each 128 bit lane as the pixels
+   are. The tail gathers and stores under a mask. */
+static inline __m512i bilinear_16 (const graphics_pixel_t *top, const graphics_pixel_t *bottom, __m512i lanes, __m512i last, __m512i wy_32, __mmask16 mask) {
+    __m512i zero = _mm512_setzero_si512 ();
+    __m512i cx = _mm512_max_epi32 (lanes, zero);
+    __m512i x0 = _mm512_srli_epi32 (cx, 16);
+    __m512i x1 = _mm512_min_epi32 (_mm512_add_epi32 (x0, _mm512_set1_epi32 (1)), last);
+    __m512i wx = _mm512_and_si512 (_mm512_srli_epi32 (cx, 9), _mm512_set1_epi32 (0x7F));
+    wx = _mm512_or_si512 (wx, _mm512_slli_epi32 (wx, 16));
+
+    __m512i wx_lo = _mm512_unpacklo_epi32 (wx, wx);
+    __m512i wx_hi = _mm512_unpackhi_epi32 (wx, wx);
+    __m512i p00 = _mm512_mask_i32gather_epi32 (zero, mask, x0, (const void *) top, 4);
+    __m512i p01 = _mm512_mask_i32gather_epi32 (zero, mask, x1, (const void *) top, 4);
+    __m512i p10 = _mm512_mask_i32gather_epi32 (zero, mask, x0, (const void *) bottom, 4);
+    __m512i p11 = _mm512_mask_i32gather_epi32 (zero, mask, x1, (const void *) bottom, 4);
+
+    __m512i t_lo = lerp_epi16_x16 (_mm512_unpacklo_epi8 (p00, zero), _mm512_unpacklo_epi8 (p01, zero), wx_lo);
+    __m512i t_hi = lerp_epi16_x16 (_mm512_unpackhi_epi8 (p00, zero), _mm512_unpackhi_epi8 (p01, zero), wx_hi);
+    __m512i u_lo = lerp_epi16_x16 (_mm512_unpacklo_epi8 (p10, zero), _mm512_unpacklo_epi8 (p11, zero), wx_lo);
+    __m512i u_hi = lerp_epi16_x16 (_mm512_unpackhi_epi8 (p10, zero), _mm512_unpackhi_epi8 (p11, zero), wx_hi);
+
+    return _mm512_packus_epi16 (lerp_epi16_x16 (t_lo, u_lo, wy_32), lerp_epi16_x16 (t_hi, u_hi, wy_32));
+}
+
+static void scale_bilinear_span_avx512 (graphics_pixel_t *dst, const graphics_pixel_t *top, const graphics_pixel_t *bottom, int n, int32_t x, int32_t step, int width, unsigned int wy) {
+    __m512i lanes = _mm512_add_epi32 (_mm512_set1_epi32 (x), _mm512_mullo_epi32 (_mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32 (step)));
+    __m512i step_16 = _mm512_set1_epi32 (step * 16);
+    __m512i last = _mm512_set1_epi32 (width - 1);
+    __m512i wy_32 = _mm512_set1_epi16 ((short) wy);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16, lanes = _mm512_add_epi32 (lanes, step_16)) {
+        _mm512_storeu_si512 ((void *) (dst + i), bilinear_16 (top, bottom, lanes, last, wy_32, 0xFFFF));
+    }
+
+    if (i < n) {
+        __mmask16 mask = tail_mask (n - i);
+        _mm512_mask_storeu_epi32 ((void *) (dst + i), mask, bilinear_16 (top, bottom, lanes, last, wy_32, mask));
+    }
+}
+
+/* Two vertices per register, one in each half.
+   Multiplies and adds are kept separate rather than
+   fused, to round the same as the other variants. */
+static void transform_vertices_avx512 (maths_vec4f *dst, const resources_vertex_t *src, int n, const maths_mat4x4f *m) {
+    __m512d c0 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[0]));
+    __m512d c1 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[1]));
+    __m512d c2 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[2]));
+    __m512d c3 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[3]));
+    __m512i x_index = _mm512_set_epi64 (4, 4, 4, 4, 0, 0, 0, 0);
+    __m512i y_index = _mm512_set_epi64 (5, 5, 5, 5, 1, 1, 1, 1);
+    __m512i z_index = _mm512_set_epi64 (6, 6, 6, 6, 2, 2, 2, 2);
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m512d v = _mm512_loadu_pd (&src[i].coord.x);
+        __m512d x = _mm512_permutexvar_pd (x_index, v);
+        __m512d y = _mm512_permutexvar_pd (y_index, v);
+        __m512d z = _mm512_permutexvar_pd (z_index, v);
+        __m512d r = _mm512_add_pd (_mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (c0, x), _mm512_mul_pd (c1, y)), _mm512_mul_pd (c2, z)), c3);
+
+        _mm512_storeu_pd (&dst[i].x, r);
+    }
+
+    for (; i < n; i++) {
+        dst[i] = transform_vertex (m, src[i].coord);
+    }
+}
+
+/* Two packed vertices, six floats, are loaded under
+   a mask so nothing past them is read. */
+static void transform_vertices_float3_avx512 (maths_vec4f *dst, const resources_vertex_float3_t *src, int n, const maths_mat4x4f *m) {
+    __m512d c0 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[0]));
+    __m512d c1 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[1]));
+    __m512d c2 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[2]));
+    __m512d c3 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[3]));
+    __m512i x_index = _mm512_set_epi64 (3, 3, 3, 3, 0, 0, 0, 0);
+    __m512i y_index = _mm512_set_epi64 (4, 4, 4, 4, 1, 1, 1, 1);
+    __m512i z_index = _mm512_set_epi64 (5, 5, 5, 5, 2, 2, 2, 2);
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m512d v = _mm512_cvtps_pd (_mm512_castps512_ps256 (_mm512_maskz_loadu_ps (0x3f, &src[i].x)));
+        __m512d x = _mm512_permutexvar_pd (x_index, v);
+        __m512d y = _mm512_permutexvar_pd (y_index, v);
+        __m512d z = _mm512_permutexvar_pd (z_index, v);
+        __m512d r = _mm512_add_pd (_mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (c0, x), _mm512_mul_pd (c1, y)), _mm512_mul_pd (c2, z)), c3);
+
+        _mm512_storeu_pd (&dst[i].x, r);
+    }
+
+    for (; i < n; i++) {
+        dst[i] = transform_vertex (m, (maths_vec4f) { src[i].x, src[i].y, src[i].z, 1.0 });
+    }
+}
+
+_Static_assert (sizeof (resources_vertex_quantized_t) == 8, "quantized vertices are loaded two at a time");
+
+/* Two vertices widened from 16 bit integers to
+   doubles, laid out as two double vertices would be. */
+static void transform_vertices_quantized_avx512 (maths_vec4f *dst, const resources_vertex_quantized_t *src, int n, const maths_mat4x4f *m) {
+    __m512d c0 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[0]));
+    __m512d c1 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[1]));
+    __m512d c2 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[2]));
+    __m512d c3 = _mm512_broadcast_f64x4 (_mm256_loadu_pd (m->data[3]));
+    __m512i x_index = _mm512_set_epi64 (4, 4, 4, 4, 0, 0, 0, 0);
+    __m512i y_index = _mm512_set_epi64 (5, 5, 5, 5, 1, 1, 1, 1);
+    __m512i z_index = _mm512_set_epi64 (6, 6, 6, 6, 2, 2, 2, 2);
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m512d v = _mm512_cvtepi32_pd (_mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) &src[i])));
+        __m512d x = _mm512_permutexvar_pd (x_index, v);
+        __m512d y = _mm512_permutexvar_pd (y_index, v);
+        __m512d z = _mm512_permutexvar_pd (z_index, v);
+        __m512d r = _mm512_add_pd (_mm512_add_pd (_mm512_add_pd (_mm512_mul_pd (c0, x), _mm512_mul_pd (c1, y)), _mm512_mul_pd (c2, z)), c3);
+
+        _mm512_storeu_pd (&dst[i].x, r);
+    }
+
+    for (; i < n; i++) {
+        dst[i] = transform_vertex (m, (maths_vec4f) { src[i].x, src[i].y, src[i].z, 1.0 });
+    }
+}
+
+const graphics_kernels_t graphics_kernels_avx512 = {
+    GRAPHICS_ISA_AVX512,
+    "avx512",
+    fill_span_avx512,
+    blend_span_avx512,
+    expand_rgb565_avx512,
+    expand_indexed_avx512,
+    pack_rgb565_avx512,
+    pack_indexed_avx512,
+    copy_keyed_span_avx512,
+    copy_keyed_rgb565_avx512,
+    copy_keyed_indexed_avx512,
+    scale_nearest_span_avx512,
+    scale_bilinear_span_avx512,
+    transform_vertices_avx512,
+    transform_vertices_float3_avx512,
+    transform_vertices_quantized_avx512
+};
+
+#endif
@@ -0,0 +1,170 @@
+/* graphics/kernels_common.h
+    Scalar helpers shared by the renderer and every
+    kernel variant, used for the pixels left over at
+    the end of a vector loop. */
+
+#ifndef GRAPHICS_KERNELS_COMMON_H
+#define GRAPHICS_KERNELS_COMMON_H
+
+#include "renderer.h"
+
+/* x / 255 rounded, for x in [0, 255 * 255] */
+static inline unsigned int div_255 (unsigned int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/* Blend a single source pixel into the target. */
+static inline void blend_pixel (graphics_pixel_t *dst, graphics_pixel_t src, graphics_blend_mode_t mode) {
+    uint8_t *d = (uint8_t *) dst;
+    const uint8_t *s = (const uint8_t *) &src;
+    unsigned int inv = 255 - src.pad;
+
+    switch (mode) {
+        case GRAPHICS_BLEND_NONE:
+            *dst = src;
+            break;
+        case GRAPHICS_BLEND_ALPHA:
+            for (int i = 0; i < 4; i++) {
+                d[i] = s[i] + div_255 (d[i] * inv);
+            }
+            break;
+        case GRAPHICS_BLEND_ADDITIVE:
+            for (int i = 0; i < 4; i++) {
+                unsigned int sum = d[i] + s[i];
+                d[i] = sum > 255 ? 255 : sum;
+            }
+            break;
+        case GRAPHICS_BLEND_MULTIPLY:
+            /* Scaled by the source colour where it covers,
+               so the alpha of the target is unchanged. */
+            for (int i = 0; i < 3; i++) {
+                d[i] = div_255 (d[i] * (s[i] + inv));
+            }
+            break;
+    }
+}
+
+/* Packing threshold for the pixel at (x, y), in
+   [0, 254]. Dithering spreads the rounding of each
+   channel over a 4x4 ordered pattern; otherwise it
+   rounds to nearest. */
+static inline unsigned int dither_threshold (bool dither, int x, int y) {
+    static const uint8_t bayer[4][4] = {
+        {  0,  8,  2, 10 },
+        { 12,  4, 14,  6 },
+        {  3, 11,  1,  9 },
+        { 15,  7, 13,  5 }
+    };
+
+    return dither ? bayer[y & 3][x & 3] * 16u + 7u : 127u;
+}
+
+/* Thresholds of the four pixels of row y from x */
+static inline void dither_row (bool dither, int x, int y, uint8_t *threshold) {
+    for (int k = 0; k < 4; k++) {
+        threshold[k] = (uint8_t) dither_threshold (dither, x + k, y);
+    }
+}
+
+/* A channel in [0, 255] as one of levels + 1 levels.
+   The vector variants divide by 255 as
+   (x + 1 + (x >> 8)) >> 8, which is exact for every
+   x this can give. */
+static inline unsigned int quantize_channel (unsigned int v, unsigned int levels, unsigned int threshold) {
+    return (v * levels + threshold) / 255;
+}
+
+static inline uint16_t pack_rgb565 (graphics_pixel_t p, unsigned int threshold) {
+    return (uint16_t) (quantize_channel (p.red, 31, threshold) << 11 | quantize_channel (p.green, 63, threshold) << 5 | quantize_channel (p.blue, 31, threshold));
+}
+
+static inline graphics_pixel_t unpack_rgb565 (uint16_t v) {
+    unsigned int r = v >> 11;
+    unsigned int g = (v >> 5) & 63;
+    unsigned int b = v & 31;
+
+    return (graphics_pixel_t) { (uint8_t) (b << 3 | b >> 2), (uint8_t) (g << 2 | g >> 4), (uint8_t) (r << 3 | r >> 2), 255 };
+}
+
+/* The palette is fixed at 3 bits of red and green
+   and 2 of blue, so packing needs no search and
+   expanding is arithmetic. */
+static inline uint8_t pack_indexed (graphics_pixel_t p, unsigned int threshold) {
+    return (uint8_t) (quantize_channel (p.red, 7, threshold) << 5 | quantize_channel (p.green, 7, threshold) << 2 | quantize_channel (p.blue, 3, threshold));
+}
+
+/* Levels of 3 bits scale by 255 / 7, which * 73 / 2
+   gives rounded. */
+static inline graphics_pixel_t unpack_indexed (uint8_t v) {
+    return (graphics_pixel_t) { (uint8_t) ((v & 3) * 85), (uint8_t) ((((v >> 2) & 7) * 73) >> 1), (uint8_t) (((v >> 5) * 73) >> 1), 255 };
+}
+
+/* Target pixel at offset, read back as BGRX. The
+   compact formats hold no alpha, which reads as 255. */
+static inline graphics_pixel_t load_pixel (const graphics_renderer_t *renderer, uint32_t offset) {
+    switch (renderer->format) {
+        case GRAPHICS_FORMAT_RGB565:
+            return unpack_rgb565 (((const uint16_t *) renderer->target)[offset]);
+        case GRAPHICS_FORMAT_INDEXED8:
+            return unpack_indexed (((const uint8_t *) renderer->target)[offset]);
+        default:
+            return ((const graphics_pixel_t *) renderer->target)[offset];
+    }
+}
+
+/* Write the target pixel at offset, which is at
+   (x, y) on screen for dithering. */
+static inline void store_pixel (const graphics_renderer_t *renderer, uint32_t offset, int x, int y, graphics_pixel_t p) {
+    switch (renderer->format) {
+        case GRAPHICS_FORMAT_RGB565:
+            ((uint16_t *) renderer->target)[offset] = pack_rgb565 (p, dither_threshold (renderer->dither, x, y));
+            break;
+        case GRAPHICS_FORMAT_INDEXED8:
+            ((uint8_t *) renderer->target)[offset] = pack_indexed (p, dither_threshold (renderer->dither, x, y));
+            break;
+        default:
+            ((graphics_pixel_t *) renderer->target)[offset] = p;
+            break;
+    }
+}
+
+/* Bilinear sample of rows top and bottom at x, in
+   16.16 fixed point, with 7 bit weights. x clamps at
+   0 and its right neighbour at width - 1. No sum
+   exceeds 16 bits, which the vector variants widen
+   each channel to. */
+static inline graphics_pixel_t bilinear_pixel (const graphics_pixel_t *top, const graphics_pixel_t *bottom, int32_t x, int width, unsigned int wy) {
+    int32_t cx = x < 0 ? 0 : x;
+    int x0 = cx >> 16;
+    int x1 = x0 + 1 < width ? x0 + 1 : width - 1;
+    unsigned int wx = (cx >> 9) & 0x7F;
+
+    graphics_pixel_t result;
+    const uint8_t *a = (const uint8_t *) &top[x0];
+    const uint8_t *b = (const uint8_t *) &top[x1];
+    const uint8_t *c = (const uint8_t *) &bottom[x0];
+    const uint8_t *d = (const uint8_t *) &bottom[x1];
+    uint8_t *out = (uint8_t *) &result;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned int t = (a[i] * (128 - wx) + b[i] * wx) >> 7;
+        unsigned int u = (c[i] * (128 - wx) + d[i] * wx) >> 7;
+        out[i] = (uint8_t) ((t * (128 - wy) + u * wy) >> 7);
+    }
+
+    return result;
+}
+
+/* The same sums in the same order in every variant,
+   so results match whatever the vector width. */
+static inline maths_vec4f transform_vertex (const maths_mat4x4f *m, maths_vec4f v) {
+    return (maths_vec4f) {
+        m->data[0][0] * v.x + m->data[1][0] * v.y + m->data[2][0] * v.z + m->data[3][0],
+        m->data[0][1] * v.x + m->data[1][1] * v.y + m->data[2][1] * v.z + m->data[3][1],
+        m->data[0][2] * v.x + m->data[1][2] * v.y + m->data[2][2] * v.z + m->data[3][2],
+        m->data[0][3] * v.x + m->data[1][3] * v.y + m->data[2][3] * v.z + m->data[3][3]
+    };
+}
+
+#endif
@@ -0,0 +1,380 @@
+/* Built with -msse4.1 */
+
+#include "kernels.h"
+#include "kernels_common.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+
+#include <smmintrin.h>
+
+static void fill_span_sse41 (graphics_pixel_t *dst, graphics_pixel_t colour, int n) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m128i colour_4 = _mm_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128 ((__m128i *) (dst + i), colour_4);
+    }
+
+    for (; i < n; i++) {
+        dst[i] = colour;
+    }
+}
+
+/* div_255 on each 16 bit lane */
+static inline __m128i div_255_epi16 (__m128i x) {
+    x = _mm_add_epi16 (x, _mm_set1_epi16 (128));
+    return _mm_srli_epi16 (_mm_add_epi16 (x, _mm_srli_epi16 (x, 8)), 8);
+}
+
+/* Blend four pixels, with the channels widened
+   to 16 bits for the multiplies. */
+static inline __m128i blend_4 (__m128i d, __m128i s, graphics_blend_mode_t mode) {
+    if (mode == GRAPHICS_BLEND_ADDITIVE) {
+        return _mm_adds_epu8 (d, s);
+    }
+
+    __m128i max = _mm_set1_epi16 (255);
+    __m128i d_lo = _mm_cvtepu8_epi16 (d);
+    __m128i d_hi = _mm_cvtepu8_epi16 (_mm_srli_si128 (d, 8));
+    __m128i s_lo = _mm_cvtepu8_epi16 (s);
+    __m128i s_hi = _mm_cvtepu8_epi16 (_mm_srli_si128 (s, 8));
+
+    /* 255 - alpha, broadcast across each pixel's channels */
+    __m128i alpha = _mm_set_epi8 (15, 14, 15, 14, 15, 14, 15, 14, 7, 6, 7, 6, 7, 6, 7, 6);
+    __m128i inv_lo = _mm_sub_epi16 (max, _mm_shuffle_epi8 (s_lo, alpha));
+    __m128i inv_hi = _mm_sub_epi16 (max, _mm_shuffle_epi8 (s_hi, alpha));
+
+    if (mode == GRAPHICS_BLEND_ALPHA) {
+        d_lo = _mm_add_epi16 (s_lo, div_255_epi16 (_mm_mullo_epi16 (d_lo, inv_lo)));
+        d_hi = _mm_add_epi16 (s_hi, div_255_epi16 (_mm_mullo_epi16 (d_hi, inv_hi)));
+    } else {
+        /* The alpha lane scales by 255, leaving it unchanged */
+        d_lo = div_255_epi16 (_mm_mullo_epi16 (d_lo, _mm_add_epi16 (s_lo, inv_lo)));
+        d_hi = div_255_epi16 (_mm_mullo_epi16 (d_hi, _mm_add_epi16 (s_hi, inv_hi)));
+    }
+
+    return _mm_packus_epi16 (d_lo, d_hi);
+}
+
+static void blend_span_sse41 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    uint32_t packed;
+    memcpy (&packed, &colour, sizeof (packed));
+
+    __m128i colour_4 = _mm_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = src != NULL ? _mm_loadu_si128 ((const __m128i *) (src + i)) : colour_4;
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), blend_4 (d, s, mode));
+    }
+
+    for (; i < n; i++) {
+        blend_pixel (&dst[i], src != NULL ? src[i] : colour, mode);
+    }
+}
+
+/* Widen and replicate the top bits of each channel,
+   one pixel per 32 bit lane. */
+static inline __m128i expand_rgb565_lanes (__m128i v) {
+    __m128i r = _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (v, 8), _mm_set1_epi32 (0xf8)), _mm_srli_epi32 (v, 13));
+    __m128i g = _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (v, 3), _mm_set1_epi32 (0xfc)), _mm_and_si128 (_mm_srli_epi32 (v, 9), _mm_set1_epi32 (0x03)));
+    __m128i b = _mm_or_si128 (_mm_and_si128 (_mm_slli_epi32 (v, 3), _mm_set1_epi32 (0xf8)), _mm_and_si128 (_mm_srli_epi32 (v, 2), _mm_set1_epi32 (0x07)));
+
+    return _mm_or_si128 (_mm_or_si128 (b, _mm_slli_epi32 (g, 8)), _mm_or_si128 (_mm_slli_epi32 (r, 16), _mm_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_rgb565_sse41 (graphics_pixel_t *dst, const uint16_t *src, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128 ((__m128i *) (dst + i), expand_rgb565_lanes (_mm_cvtepu16_epi32 (_mm_loadl_epi64 ((const __m128i *) (src + i)))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_rgb565 (src[i]);
+    }
+}
+
+/* As unpack_indexed, one pixel per 32 bit lane */
+static inline __m128i expand_indexed_lanes (__m128i v) {
+    __m128i scale = _mm_set1_epi32 (73);
+    __m128i r = _mm_srli_epi32 (_mm_mullo_epi32 (_mm_srli_epi32 (v, 5), scale), 1);
+    __m128i g = _mm_srli_epi32 (_mm_mullo_epi32 (_mm_and_si128 (_mm_srli_epi32 (v, 2), _mm_set1_epi32 (7)), scale), 1);
+    __m128i b = _mm_mullo_epi32 (_mm_and_si128 (v, _mm_set1_epi32 (3)), _mm_set1_epi32 (85));
+
+    return _mm_or_si128 (_mm_or_si128 (b, _mm_slli_epi32 (g, 8)), _mm_or_si128 (_mm_slli_epi32 (r, 16), _mm_set1_epi32 ((int) 0xff000000)));
+}
+
+static void expand_indexed_sse41 (graphics_pixel_t *dst, const uint8_t *src, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        uint32_t packed;
+        memcpy (&packed, src + i, sizeof (packed));
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), expand_indexed_lanes (_mm_cvtepu8_epi32 (_mm_cvtsi32_si128 ((int) packed))));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = unpack_indexed (src[i]);
+    }
+}
+
+/* As quantize_channel, for levels of 2^bits - 1 */
+static inline __m128i quantize_lanes (__m128i c, int bits, __m128i t) {
+    __m128i x = _mm_add_epi32 (_mm_sub_epi32 (_mm_slli_epi32 (c, bits), c), t);
+
+    return _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (x, _mm_set1_epi32 (1)), _mm_srli_epi32 (x, 8)), 8);
+}
+
+static void pack_rgb565_sse41 (uint16_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m128i t = _mm_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3]);
+    __m128i mask = _mm_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i b = quantize_lanes (_mm_and_si128 (v, mask), 5, t);
+        __m128i g = quantize_lanes (_mm_and_si128 (_mm_srli_epi32 (v, 8), mask), 6, t);
+        __m128i r = quantize_lanes (_mm_and_si128 (_mm_srli_epi32 (v, 16), mask), 5, t);
+        __m128i packed = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi32 (r, 11), _mm_slli_epi32 (g, 5)), b);
+
+        _mm_storel_epi64 ((__m128i *) (dst + i), _mm_packus_epi32 (packed, packed));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_rgb565 (src[i], threshold[i & 3]);
+    }
+}
+
+static void pack_indexed_sse41 (uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    __m128i t = _mm_setr_epi32 (threshold[0], threshold[1], threshold[2], threshold[3]);
+    __m128i mask = _mm_set1_epi32 (0xff);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i b = quantize_lanes (_mm_and_si128 (v, mask), 2, t);
+        __m128i g = quantize_lanes (_mm_and_si128 (_mm_srli_epi32 (v, 8), mask), 3, t);
+        __m128i r = quantize_lanes (_mm_and_si128 (_mm_srli_epi32 (v, 16), mask), 3, t);
+        __m128i packed = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi32 (r, 5), _mm_slli_epi32 (g, 2)), b);
+
+        __m128i words = _mm_packus_epi32 (packed, packed);
+        uint32_t bytes = (uint32_t) _mm_cvtsi128_si32 (_mm_packus_epi16 (words, words));
+        memcpy (dst + i, &bytes, sizeof (bytes));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = pack_indexed (src[i], threshold[i & 3]);
+    }
+}
+
+/* Source lanes equal to the key take the target's
+   bytes instead */
+static void copy_keyed_span_sse41 (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t key, int n) {
+    uint32_t packed;
+    memcpy (&packed, &key, sizeof (packed));
+
+    __m128i key_4 = _mm_set1_epi32 ((int) packed);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_blendv_epi8 (s, d, _mm_cmpeq_epi32 (s, key_4)));
+    }
+
+    for (; i < n; i++) {
+        if (memcmp (&src[i], &key, sizeof (key)) != 0) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_rgb565_sse41 (uint16_t *dst, const uint16_t *src, uint16_t key, int n) {
+    __m128i key_8 = _mm_set1_epi16 ((short) key);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_blendv_epi8 (s, d, _mm_cmpeq_epi16 (s, key_8)));
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void copy_keyed_indexed_sse41 (uint8_t *dst, const uint8_t *src, uint8_t key, int n) {
+    __m128i key_16 = _mm_set1_epi8 ((char) key);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *) (src + i));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_blendv_epi8 (s, d, _mm_cmpeq_epi8 (s, key_16)));
+    }
+
+    for (; i < n; i++) {
+        if (src[i] != key) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+/* Four pixels of src at the indices in the lanes of
+   index, which SSE4.1 has no gather for. */
+static inline __m128i gather_4 (const graphics_pixel_t *src, __m128i index) {
+    int at[4];
+    uint32_t p[4];
+    _mm_storeu_si128 ((__m128i *) at, index);
+
+    for (int k = 0; k < 4; k++) {
+        memcpy (&p[k], &src[at[k]], sizeof (p[k]));
+    }
+
+    return _mm_loadu_si128 ((const __m128i *) p);
+}
+
+static void scale_nearest_span_sse41 (graphics_pixel_t *dst, const graphics_pixel_t *src, int n, uint32_t x, uint32_t step) {
+    __m128i lanes = _mm_add_epi32 (_mm_set1_epi32 ((int) x), _mm_mullo_epi32 (_mm_setr_epi32 (0, 1, 2, 3), _mm_set1_epi32 ((int) step)));
+    __m128i step_4 = _mm_set1_epi32 ((int) (step * 4));
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4, lanes = _mm_add_epi32 (lanes, step_4)) {
+        _mm_storeu_si128 ((__m128i *) (dst + i), gather_4 (src, _mm_srli_epi32 (lanes, 16)));
+    }
+
+    for (x += step * i; i < n; i++, x += step) {
+        dst[i] = src[x >> 16];
+    }
+}
+
+/* (a * (128 - w) + b * w) >> 7 on each 16 bit lane */
+static inline __m128i lerp_epi16 (__m128i a, __m128i b, __m128i w) {
+    return _mm_srli_epi16 (_mm_add_epi16 (_mm_mullo_epi16 (a, _mm_sub_epi16 (_mm_set1_epi16 (128), w)), _mm_mullo_epi16 (b, w)), 7);
+}
+
+/* Four pixels at a time, each with its weight
+   widened to cover its four 16 bit channels. */
+static void scale_bilinear_span_sse41 (graphics_pixel_t *dst, const graphics_pixel_t *top, const graphics_pixel_t *bottom, int n, int32_t x, int32_t step, int width, unsigned int wy) {
+    __m128i zero = _mm_setzero_si128 ();
+    __m128i lanes = _mm_add_epi32 (_mm_set1_epi32 (x), _mm_mullo_epi32 (_mm_setr_epi32 (0, 1, 2, 3), _mm_set1_epi32 (step)));
+    __m128i step_4 = _mm_set1_epi32 (step * 4);
+    __m128i last = _mm_set1_epi32 (width - 1);
+    __m128i wy_8 = _mm_set1_epi16 ((short) wy);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4, lanes = _mm_add_epi32 (lanes, step_4)) {
+        __m128i cx = _mm_max_epi32 (lanes, zero);
+        __m128i x0 = _mm_srli_epi32 (cx, 16);
+        __m128i x1 = _mm_min_epi32 (_mm_add_epi32 (x0, _mm_set1_epi32 (1)), last);
+        __m128i wx = _mm_and_si128 (_mm_srli_epi32 (cx, 9), _mm_set1_epi32 (0x7F));
+        wx = _mm_or_si128 (wx, _mm_slli_epi32 (wx, 16));
+
+        __m128i wx_lo = _mm_unpacklo_epi32 (wx, wx);
+        __m128i wx_hi = _mm_unpackhi_epi32 (wx, wx);
+        __m128i a = gather_4 (top, x0);
+        __m128i b = gather_4 (top, x1);
+        __m128i c = gather_4 (bottom, x0);
+        __m128i d = gather_4 (bottom, x1);
+
+        __m128i t_lo = lerp_epi16 (_mm_unpacklo_epi8 (a, zero), _mm_unpacklo_epi8 (b, zero), wx_lo);
+        __m128i t_hi = lerp_epi16 (_mm_unpackhi_epi8 (a, zero), _mm_unpackhi_epi8 (b, zero), wx_hi);
+        __m128i u_lo = lerp_epi16 (_mm_unpacklo_epi8 (c, zero), _mm_unpacklo_epi8 (d, zero), wx_lo);
+        __m128i u_hi = lerp_epi16 (_mm_unpackhi_epi8 (c, zero), _mm_unpackhi_epi8 (d, zero), wx_hi);
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lerp_epi16 (t_lo, u_lo, wy_8), lerp_epi16 (t_hi, u_hi, wy_8)));
+    }
+
+    for (; i < n; i++) {
+        dst[i] = bilinear_pixel (top, bottom, x + i * step, width, wy);
+    }
+}
+
+/* Two rows of the result per register */
+static void transform_vertices_sse41 (maths_vec4f *dst, const resources_vertex_t *src, int n, const maths_mat4x4f *m) {
+    __m128d c0_lo = _mm_loadu_pd (&m->data[0][0]), c0_hi = _mm_loadu_pd (&m->data[0][2]);
+    __m128d c1_lo = _mm_loadu_pd (&m->data[1][0]), c1_hi = _mm_loadu_pd (&m->data[1][2]);
+    __m128d c2_lo = _mm_loadu_pd (&m->data[2][0]), c2_hi = _mm_loadu_pd (&m->data[2][2]);
+    __m128d c3_lo = _mm_loadu_pd (&m->data[3][0]), c3_hi = _mm_loadu_pd (&m->data[3][2]);
+
+    for (int i = 0; i < n; i++) {
+        __m128d x = _mm_set1_pd (src[i].coord.x);
+        __m128d y = _mm_set1_pd (src[i].coord.y);
+        __m128d z = _mm_set1_pd (src[i].coord.z);
+
+        __m128d lo = _mm_add_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (c0_lo, x), _mm_mul_pd (c1_lo, y)), _mm_mul_pd (c2_lo, z)), c3_lo);
+        __m128d hi = _mm_add_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (c0_hi, x), _mm_mul_pd (c1_hi, y)), _mm_mul_pd (c2_hi, z)), c3_hi);
+
+        _mm_storeu_pd (&dst[i].x, lo);
+        _mm_storeu_pd (&dst[i].z, hi);
+    }
+}
+
+static inline void transform_store_sse41 (maths_vec4f *dst, const __m128d *c, __m128d x, __m128d y, __m128d z) {
+    __m128d lo = _mm_add_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (c[0], x), _mm_mul_pd (c[2], y)), _mm_mul_pd (c[4], z)), c[6]);
+    __m128d hi = _mm_add_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (c[1], x), _mm_mul_pd (c[3], y)), _mm_mul_pd (c[5], z)), c[7]);
+
+    _mm_storeu_pd (&dst->x, lo);
+    _mm_storeu_pd (&dst->z, hi);
+}
+
+static inline void load_columns_sse41 (__m128d *c, const maths_mat4x4f *m) {
+    for (int i = 0; i < 4; i++) {
+        c[i * 2] = _mm_loadu_pd (&m->data[i][0]);
+        c[i * 2 + 1] = _mm_loadu_pd (&m->data[i][2]);
+    }
+}
+
+static void transform_vertices_float3_sse41 (maths_vec4f *dst, const resources_vertex_float3_t *src, int n, const maths_mat4x4f *m) {
+    __m128d c[8];
+    load_columns_sse41 (c, m);
+
+    for (int i = 0; i < n; i++) {
+        transform_store_sse41 (&dst[i], c, _mm_set1_pd (src[i].x), _mm_set1_pd (src[i].y), _mm_set1_pd (src[i].z));
+    }
+}
+
+/* Each vertex is widened from 16 to 32 bit integers
+   in one load, then converted two lanes at a time. */
+static void transform_vertices_quantized_sse41 (maths_vec4f *dst, const resources_vertex_quantized_t *src, int n, const maths_mat4x4f *m) {
+    __m128d c[8];
+    load_columns_sse41 (c, m);
+
+    for (int i = 0; i < n; i++) {
+        __m128i q = _mm_cvtepu16_epi32 (_mm_loadl_epi64 ((const __m128i *) &src[i]));
+        __m128d xy = _mm_cvtepi32_pd (q);
+        __m128d zw = _mm_cvtepi32_pd (_mm_unpackhi_epi64 (q, q));
+
+        transform_store_sse41 (&dst[i], c, _mm_unpacklo_pd (xy, xy), _mm_unpackhi_pd (xy, xy), _mm_unpacklo_pd (zw, zw));
+    }
+}
+
+const graphics_kernels_t graphics_kernels_sse41 = {
+    GRAPHICS_ISA_SSE41,
+    "sse41",
+    fill_span_sse41,
+    blend_span_sse41,
+    expand_rgb565_sse41,
+    expand_indexed_sse41,
+    pack_rgb565_sse41,
+    pack_indexed_sse41,
+    copy_keyed_span_sse41,
+    copy_keyed_rgb565_sse41,
+    copy_keyed_indexed_sse41,
+    scale_nearest_span_sse41,
+    scale_bilinear_span_sse41,
+    transform_vertices_sse41,
+    transform_vertices_float3_sse41,
+    transform_vertices_quantized_sse41
+};
+
+#endif
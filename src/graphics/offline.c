@@ -0,0 +1,200 @@
+#include "offline.h"
+#include "./../system/log.h"
+#include <assert.h>
+#include <stdlib.h>
+
+/* Shared between the threads of one job */
+typedef struct {
+    const graphics_offline_job_t *job;
+    pthread_mutex_t lock;
+    pthread_cond_t turn;        /* Signalled when a frame is handed on, or on failure */
+    int next;                   /* Next frame to render */
+    int written;                /* Frames handed on so far */
+    bool failed;
+} graphics_offline_state_t;
+
+static double catmull_rom (double p0, double p1, double p2, double p3, double t) {
+    double t2 = t * t;
+    double t3 = t2 * t;
+
+    return 0.5 * ((2.0 * p1) + (p2 - p0) * t + (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3) * t2 + (3.0 * p1 - p0 - 3.0 * p2 + p3) * t3);
+}
+
+static maths_vec4f catmull_rom_vec4f (maths_vec4f p0, maths_vec4f p1, maths_vec4f p2, maths_vec4f p3, double t) {
+    return (maths_vec4f) {
+        catmull_rom (p0.x, p1.x, p2.x, p3.x, t),
+        catmull_rom (p0.y, p1.y, p2.y, p3.y, t),
+        catmull_rom (p0.z, p1.z, p2.z, p3.z, t),
+        p1.w
+    };
+}
+
+/* The camera at a time along the path. Before the
+   first key and after the last the camera holds
+   still. The ends of the curve use their end keys
+   twice in place of the missing neighbours. */
+graphics_camera_t graphics_camera_path_sample (const graphics_camera_key_t *keys, int num_keys, double time) {
+    assert (num_keys > 0);
+
+    if (num_keys == 1 || time <= keys[0].time) {
+        return keys[0].camera;
+    } else if (time >= keys[num_keys - 1].time) {
+        return keys[num_keys - 1].camera;
+    }
+
+    int i = 0;
+
+    while (keys[i + 1].time <= time) {
+        i++;
+    }
+
+    const graphics_camera_t *c0 = &keys[i > 0 ? i - 1 : i].camera;
+    const graphics_camera_t *c1 = &keys[i].camera;
+    const graphics_camera_t *c2 = &keys[i + 1].camera;
+    const graphics_camera_t *c3 = &keys[i + 2 < num_keys ? i + 2 : i + 1].camera;
+    double t = (time - keys[i].time) / (keys[i + 1].time - keys[i].time);
+
+    graphics_camera_t camera;
+    camera.position = catmull_rom_vec4f (c0->position, c1->position, c2->position, c3->position, t);
+    camera.scale = catmull_rom_vec4f (c0->scale, c1->scale, c2->scale, c3->scale, t);
+    camera.rotation = catmull_rom_vec4f (c0->rotation, c1->rotation, c2->rotation, c3->rotation, t);
+
+    return camera;
+}
+
+static void fail (graphics_offline_state_t *state) {
+    pthread_mutex_lock (&state->lock);
+    state->failed = true;
+    pthread_cond_broadcast (&state->turn);
+    pthread_mutex_unlock (&state->lock);
+}
+
+/* Wait for the frames before this one, then hand it
+   on. */
+static bool hand_on (graphics_offline_state_t *state, graphics_renderer_t *renderer, int frame) {
+    const graphics_offline_job_t *job = state->job;
+
+    pthread_mutex_lock (&state->lock);
+
+    while (state->written != frame && !state->failed) {
+        pthread_cond_wait (&state->turn, &state->lock);
+    }
+
+    bool failed = state->failed;
+    pthread_mutex_unlock (&state->lock);
+
+    if (failed) {
+        return false;
+    }
+
+    if (job->capture != NULL && !graphics_capture_frame_wait (job->capture, renderer)) {
+        return false;
+    }
+
+    if (job->output != NULL && !job->output (renderer, frame, job->output_aux)) {
+        return false;
+    }
+
+    pthread_mutex_lock (&state->lock);
+    state->written++;
+    pthread_cond_broadcast (&state->turn);
+    pthread_mutex_unlock (&state->lock);
+
+    return true;
+}
+
+static void *offline_thread_main (void *arg) {
+    graphics_offline_state_t *state = (graphics_offline_state_t *) arg;
+    const graphics_offline_job_t *job = state->job;
+    graphics_renderer_t *renderer = graphics_renderer_init (job->width, job->height, GRAPHICS_FORMAT_BGRX8888);
+
+    if (renderer == NULL) {
+        fail (state);
+        return NULL;
+    }
+
+    renderer->view_distance = job->view_distance;
+    renderer->view_width = job->view_width;
+    renderer->view_height = job->view_height;
+
+    for (;;) {
+        pthread_mutex_lock (&state->lock);
+        int frame = state->failed ? job->num_frames : state->next++;
+        pthread_mutex_unlock (&state->lock);
+
+        if (frame >= job->num_frames) {
+            break;
+        }
+
+        graphics_camera_t camera = graphics_camera_path_sample (job->keys, job->num_keys, frame / job->frame_rate);
+
+        graphics_renderer_clear_buffer (renderer);
+
+        for (int i = 0; i < job->num_models; i++) {
+            graphics_renderer_render_model (renderer, &job->models[i], &camera);
+        }
+
+        if (job->draw != NULL) {
+            job->draw (renderer, &camera, frame, job->aux);
+        }
+
+        graphics_renderer_display (renderer, NULL);
+
+        if (!hand_on (state, renderer, frame)) {
+            fail (state);
+            break;
+        }
+    }
+
+    graphics_renderer_destroy (renderer);
+    return NULL;
+}
+
+/* Render every frame of the job, returning once all
+   have been handed on, or false if any could not be. */
+bool graphics_offline_render (const graphics_offline_job_t *job) {
+    if (job->num_keys < 1 || job->frame_rate <= 0.0) {
+        SYSTEM_LOG_ERROR ("graphics/offline", "a job needs a camera path and a frame rate.");
+        return false;
+    }
+
+    graphics_offline_state_t state = { .job = job };
+    pthread_t threads[GRAPHICS_OFFLINE_MAX_THREADS];
+    int num_threads = job->num_threads;
+    int started = 0;
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    } else if (num_threads > GRAPHICS_OFFLINE_MAX_THREADS) {
+        num_threads = GRAPHICS_OFFLINE_MAX_THREADS;
+    }
+
+    pthread_mutex_init (&state.lock, NULL);
+    pthread_cond_init (&state.turn, NULL);
+
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create (&threads[started], NULL, offline_thread_main, &state) != 0) {
+            SYSTEM_LOG_WARN ("graphics/offline", "could only start %d of %d render threads.", started, num_threads - 1);
+            break;
+        }
+
+        started++;
+    }
+
+    /* The calling thread renders frames too */
+    offline_thread_main (&state);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join (threads[i], NULL);
+    }
+
+    pthread_cond_destroy (&state.turn);
+    pthread_mutex_destroy (&state.lock);
+
+    if (state.failed || state.written != job->num_frames) {
+        SYSTEM_LOG_ERROR ("graphics/offline", "stopped after %d of %d frames.", state.written, job->num_frames);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,66 @@
+/* graphics/offline.h
+    Rendering pre-planned sequences, such as camera
+    flythroughs and turntables, as fast as possible
+    rather than in real time. No window is needed.
+
+    The camera follows a path of keyframes, passing
+    through each key on a smooth (Catmull-Rom) curve.
+    Frames are shared out between threads, each with
+    a renderer of its own, and all reading the same
+    models and meshes, which must not change while
+    the job runs. Finished frames are handed on
+    strictly in order: a thread which finishes a frame
+    early waits for the frames before it to be handed
+    on first. */
+
+#ifndef GRAPHICS_OFFLINE_H
+#define GRAPHICS_OFFLINE_H
+
+#include "renderer.h"
+#include "capture.h"
+#include <pthread.h>
+
+#define GRAPHICS_OFFLINE_MAX_THREADS 64
+
+typedef struct {
+    double time;                /* Seconds, keys in increasing order */
+    graphics_camera_t camera;
+} graphics_camera_key_t;
+
+/* Called on a render thread after the models are
+   drawn, to draw anything else into the frame. */
+typedef void (*graphics_offline_draw_t) (graphics_renderer_t *renderer, const graphics_camera_t *camera, int frame, void *aux);
+
+/* Called for each frame in order, once it has been
+   displayed to no window. Returning false stops the
+   job. */
+typedef bool (*graphics_offline_output_t) (const graphics_renderer_t *renderer, int frame, void *aux);
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    double view_distance;
+    double view_width;
+    double view_height;
+
+    int num_frames;
+    double frame_rate;          /* Frame i shows the path at i / frame_rate seconds */
+    const graphics_camera_key_t *keys;
+    int num_keys;
+
+    resources_model_t *models;
+    int num_models;
+    graphics_offline_draw_t draw;           /* Optional */
+    void *aux;
+
+    graphics_capture_t *capture;            /* Optional, written without dropping frames */
+    graphics_offline_output_t output;       /* Optional */
+    void *output_aux;
+
+    int num_threads;            /* Including the calling thread */
+} graphics_offline_job_t;
+
+graphics_camera_t graphics_camera_path_sample (const graphics_camera_key_t *keys, int num_keys, double time);
+bool graphics_offline_render (const graphics_offline_job_t *job);
+
+#endif
@@ -0,0 +1,322 @@
+#include "pipeline.h"
+#include "./../system/log.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#define GRAPHICS_PIPELINE_ARENA_BLOCK_SIZE (256 * 1024)
+
+/* Take the next empty chunk for the geometry stage,
+   waiting for the raster stage to empty one if they
+   are all full. Sets current to NULL on shutdown. */
+static void begin_chunk (graphics_pipeline_t *pipeline) {
+    pthread_mutex_lock (&pipeline->lock);
+
+    while (!pipeline->stopping && pipeline->filled == pipeline->num_chunks) {
+        pthread_cond_wait (&pipeline->space, &pipeline->lock);
+    }
+
+    if (pipeline->stopping) {
+        pipeline->current = NULL;
+    } else {
+        pipeline->current = &pipeline->chunks[(pipeline->head + pipeline->filled) % pipeline->num_chunks];
+        pipeline->current->count = 0;
+        pipeline->current->command = NULL;
+        pipeline->current->end_of_frame = false;
+    }
+
+    pthread_mutex_unlock (&pipeline->lock);
+}
+
+/* Hand the current chunk to the raster stage, ending
+   it with command, and start another unless it ends
+   the frame. */
+static void end_chunk (graphics_pipeline_t *pipeline, const graphics_command_t *command, bool end_of_frame) {
+    if (pipeline->current == NULL) {
+        return;
+    }
+
+    pipeline->current->command = command;
+    pipeline->current->end_of_frame = end_of_frame;
+
+    pthread_mutex_lock (&pipeline->lock);
+    pipeline->filled++;
+    pthread_cond_signal (&pipeline->ready);
+    pthread_mutex_unlock (&pipeline->lock);
+
+    if (end_of_frame) {
+        pipeline->current = NULL;
+    } else {
+        begin_chunk (pipeline);
+    }
+}
+
+static void stream_triangle (void *aux, maths_triangle4f t, const maths_vec2f *p) {
+    graphics_pipeline_t *pipeline = (graphics_pipeline_t *) aux;
+    graphics_stream_chunk_t *chunk = pipeline->current;
+
+    if (chunk == NULL) {
+        return;
+    }
+
+    graphics_stream_triangle_t *triangle = &chunk->triangles[chunk->count++];
+
+    for (int i = 0; i < 3; i++) {
+        triangle->camera[i] = t[i];
+        triangle->screen[i] = p[i];
+    }
+
+    if (chunk->count == GRAPHICS_PIPELINE_CHUNK_TRIANGLES) {
+        end_chunk (pipeline, NULL, false);
+    }
+}
+
+/* Run a frame's list through the geometry stage, as
+   graphics_renderer_execute_command_lists would, but
+   streaming triangles rather than drawing them. */
+static void run_geometry (graphics_pipeline_t *pipeline, graphics_pipeline_frame_t *frame) {
+    graphics_geometry_t geometry = frame->geometry;
+    geometry.arena = &pipeline->arena;
+    geometry.thread = 0;
+    geometry.sink = stream_triangle;
+    geometry.aux = pipeline;
+    geometry.view_distance = pipeline->view_distance;
+    geometry.view_width = pipeline->view_width;
+    geometry.view_height = pipeline->view_height;
+
+    system_frame_arena_reset (&pipeline->arena);
+    begin_chunk (pipeline);
+
+    graphics_camera_t camera;
+    camera.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+    camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+
+    maths_mat4x4f view = graphics_camera_view_transform (&camera);
+    maths_mat4x4f transform;
+
+    for (graphics_command_t *command = frame->list->first; command != NULL && pipeline->current != NULL; command = command->next) {
+        switch (command->type) {
+            case GRAPHICS_COMMAND_SET_CAMERA:
+                camera = command->camera;
+                view = graphics_camera_view_transform (&camera);
+                break;
+            case GRAPHICS_COMMAND_DRAW_MODEL:
+                transform = maths_model_transform (command->model.position, command->model.scale, command->model.rotation);
+                transform = maths_mat4x4f_mul_affine (view, transform);
+                graphics_geometry_render_mesh (&geometry, command->model.mesh, &transform);
+                break;
+            case GRAPHICS_COMMAND_DRAW_MESH:
+                transform = maths_mat4x4f_mul_affine (view, *command->mesh.world);
+                graphics_geometry_render_mesh (&geometry, command->mesh.mesh, &transform);
+                break;
+            case GRAPHICS_COMMAND_SET_VIEW:
+                /* Both stages need to see the new view, and
+                   the lists after this one start from it */
+                geometry.view_distance = command->view.distance;
+                geometry.view_width = command->view.width;
+                geometry.view_height = command->view.height;
+                pipeline->view_distance = command->view.distance;
+                pipeline->view_width = command->view.width;
+                pipeline->view_height = command->view.height;
+                end_chunk (pipeline, command, false);
+                break;
+            default:
+                end_chunk (pipeline, command, false);
+                break;
+        }
+    }
+
+    end_chunk (pipeline, NULL, true);
+}
+
+static void *geometry_thread_main (void *arg) {
+    graphics_pipeline_t *pipeline = (graphics_pipeline_t *) arg;
+    uint64_t next = 0;
+
+    pthread_mutex_lock (&pipeline->lock);
+
+    for (;;) {
+        while (!pipeline->stopping && pipeline->submitted == next) {
+            pthread_cond_wait (&pipeline->work, &pipeline->lock);
+        }
+
+        if (pipeline->stopping) {
+            break;
+        }
+
+        graphics_pipeline_frame_t frame = pipeline->frames[next % pipeline->max_frames];
+        pthread_mutex_unlock (&pipeline->lock);
+
+        run_geometry (pipeline, &frame);
+
+        pthread_mutex_lock (&pipeline->lock);
+        next++;
+    }
+
+    pthread_mutex_unlock (&pipeline->lock);
+    return NULL;
+}
+
+/* Draw the oldest frame in flight into the renderer,
+   chunk by chunk as the geometry stage fills them. */
+static void raster_frame (graphics_pipeline_t *pipeline) {
+    bool end_of_frame = false;
+
+    while (!end_of_frame) {
+        pthread_mutex_lock (&pipeline->lock);
+
+        while (pipeline->filled == 0) {
+            pthread_cond_wait (&pipeline->ready, &pipeline->lock);
+        }
+
+        graphics_stream_chunk_t *chunk = &pipeline->chunks[pipeline->head];
+        pthread_mutex_unlock (&pipeline->lock);
+
+        for (int i = 0; i < chunk->count; i++) {
+            graphics_renderer_draw_projected_triangle (pipeline->renderer, chunk->triangles[i].camera, chunk->triangles[i].screen);
+        }
+
+        if (chunk->command != NULL) {
+            graphics_renderer_execute_command (pipeline->renderer, chunk->command);
+        }
+
+        end_of_frame = chunk->end_of_frame;
+
+        pthread_mutex_lock (&pipeline->lock);
+        pipeline->head = (pipeline->head + 1) % pipeline->num_chunks;
+        pipeline->filled--;
+
+        if (end_of_frame) {
+            pipeline->rastered++;
+        }
+
+        pthread_cond_signal (&pipeline->space);
+        pthread_mutex_unlock (&pipeline->lock);
+    }
+}
+
+/* max_frames sets the latency as above. num_chunks
+   bounds the stream at num_chunks times
+   GRAPHICS_PIPELINE_CHUNK_TRIANGLES triangles. */
+graphics_pipeline_t *graphics_pipeline_create (graphics_renderer_t *renderer, int max_frames, int num_chunks) {
+    assert (renderer != NULL);
+
+    graphics_pipeline_t *pipeline = (graphics_pipeline_t *) calloc (1, sizeof (graphics_pipeline_t));
+
+    if (pipeline == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/pipeline", "could not allocate memory for pipeline.");
+        return NULL;
+    }
+
+    if (max_frames < 1) {
+        max_frames = 1;
+    } else if (max_frames > GRAPHICS_PIPELINE_MAX_FRAMES) {
+        max_frames = GRAPHICS_PIPELINE_MAX_FRAMES;
+    }
+
+    if (num_chunks < 2) {
+        num_chunks = 2;
+    }
+
+    pipeline->renderer = renderer;
+    pipeline->max_frames = max_frames;
+    pipeline->view_distance = renderer->view_distance;
+    pipeline->view_width = renderer->view_width;
+    pipeline->view_height = renderer->view_height;
+    pipeline->num_chunks = num_chunks;
+    pthread_mutex_init (&pipeline->lock, NULL);
+    pthread_cond_init (&pipeline->work, NULL);
+    pthread_cond_init (&pipeline->ready, NULL);
+    pthread_cond_init (&pipeline->space, NULL);
+    system_frame_arena_init (&pipeline->arena, GRAPHICS_PIPELINE_ARENA_BLOCK_SIZE);
+    pipeline->chunks = (graphics_stream_chunk_t *) malloc (sizeof (graphics_stream_chunk_t) * num_chunks);
+
+    if (pipeline->chunks == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/pipeline", "could not allocate memory for triangle stream.");
+        graphics_pipeline_destroy (pipeline);
+        return NULL;
+    }
+
+    if (pthread_create (&pipeline->thread, NULL, geometry_thread_main, pipeline) != 0) {
+        SYSTEM_LOG_ERROR ("graphics/pipeline", "could not start geometry thread.");
+        graphics_pipeline_destroy (pipeline);
+        return NULL;
+    }
+
+    pipeline->running = true;
+    return pipeline;
+}
+
+/* Give the next frame to the geometry stage. Once
+   max_frames frames are in flight, the oldest is
+   rasterized and true returned, so the renderer holds
+   a finished frame to display. */
+bool graphics_pipeline_frame (graphics_pipeline_t *pipeline, graphics_command_list_t *list) {
+    graphics_renderer_t *renderer = pipeline->renderer;
+
+    /* The geometry stage fills in its own view */
+    graphics_geometry_t geometry = {
+        renderer->width,
+        renderer->height,
+        0.0,
+        0.0,
+        0.0,
+        NULL,
+        0,
+        NULL,
+        NULL,
+        renderer->jobs
+    };
+
+    pthread_mutex_lock (&pipeline->lock);
+    pipeline->frames[pipeline->submitted % pipeline->max_frames] = (graphics_pipeline_frame_t) { list, geometry };
+    pipeline->submitted++;
+    pthread_cond_signal (&pipeline->work);
+    bool full = pipeline->submitted - pipeline->rastered == (uint64_t) pipeline->max_frames;
+    pthread_mutex_unlock (&pipeline->lock);
+
+    if (full) {
+        raster_frame (pipeline);
+    }
+
+    return full;
+}
+
+/* Rasterize the oldest frame still in flight, e.g.
+   at the end of a sequence. Returns false if there
+   were none. */
+bool graphics_pipeline_flush (graphics_pipeline_t *pipeline) {
+    pthread_mutex_lock (&pipeline->lock);
+    bool waiting = pipeline->submitted != pipeline->rastered;
+    pthread_mutex_unlock (&pipeline->lock);
+
+    if (waiting) {
+        raster_frame (pipeline);
+    }
+
+    return waiting;
+}
+
+/* Frames still in flight are abandoned. */
+void graphics_pipeline_destroy (graphics_pipeline_t *pipeline) {
+    if (pipeline == NULL) {
+        return;
+    }
+
+    if (pipeline->running) {
+        pthread_mutex_lock (&pipeline->lock);
+        pipeline->stopping = true;
+        pthread_cond_broadcast (&pipeline->work);
+        pthread_cond_broadcast (&pipeline->space);
+        pthread_mutex_unlock (&pipeline->lock);
+        pthread_join (pipeline->thread, NULL);
+    }
+
+    pthread_cond_destroy (&pipeline->space);
+    pthread_cond_destroy (&pipeline->ready);
+    pthread_cond_destroy (&pipeline->work);
+    pthread_mutex_destroy (&pipeline->lock);
+    system_frame_arena_destroy (&pipeline->arena);
+    free (pipeline->chunks);
+    free (pipeline);
+}
@@ -0,0 +1,99 @@
+/* graphics/pipeline.h
+    Frames split into a geometry stage and a raster
+    stage which run at the same time. Each frame is
+    given as a command list. A geometry thread
+    transforms, clips and projects the list's meshes
+    into a stream of screen space triangles, while the
+    render thread rasterizes the stream of an earlier
+    frame into the renderer.
+
+    The stream is a ring of fixed size chunks, so the
+    memory between the stages is bounded: when every
+    chunk is full the geometry stage waits for the
+    raster stage. Commands which draw no meshes, such
+    as clears and 2D primitives, travel in the stream
+    in order with the triangles.
+
+    max_frames is how many frames may be in flight. At
+    1 each frame is rasterized as soon as it is given,
+    with the two stages only overlapping within it. At
+    2 the geometry of the next frame overlaps
+    rasterizing this one, at the cost of a frame of
+    latency. A command list, and the meshes it refers
+    to, must be left alone until its frame has been
+    rasterized, so the caller needs max_frames lists
+    to record into in turn.
+
+    Between calls the renderer is the render
+    thread's as usual, but its resolution is read when
+    a frame is given, so later changes only affect
+    later frames. Its view is read once, when the
+    pipeline is created. From then on the geometry
+    stage keeps its own view, changed only by each
+    list's SET_VIEW commands in turn, so a list sees
+    the view the lists before it left, as it would
+    executing them one after another. */
+
+#ifndef GRAPHICS_PIPELINE_H
+#define GRAPHICS_PIPELINE_H
+
+#include "renderer.h"
+#include "command_list.h"
+#include "./../system/frame_arena.h"
+#include <pthread.h>
+
+#define GRAPHICS_PIPELINE_CHUNK_TRIANGLES 256
+#define GRAPHICS_PIPELINE_MAX_FRAMES 4
+
+typedef struct {
+    maths_triangle4f camera;
+    maths_vec2f screen[3];
+} graphics_stream_triangle_t;
+
+typedef struct {
+    graphics_stream_triangle_t triangles[GRAPHICS_PIPELINE_CHUNK_TRIANGLES];
+    int count;
+    const graphics_command_t *command;  /* Executed after the triangles, or NULL */
+    bool end_of_frame;
+} graphics_stream_chunk_t;
+
+typedef struct {
+    graphics_command_list_t *list;
+    graphics_geometry_t geometry;       /* Resolution when given */
+} graphics_pipeline_frame_t;
+
+typedef struct {
+    graphics_renderer_t *renderer;
+
+    graphics_pipeline_frame_t frames[GRAPHICS_PIPELINE_MAX_FRAMES];
+    int max_frames;
+    uint64_t submitted;                 /* Frames given so far */
+    uint64_t rastered;                  /* Frames rasterized so far */
+
+    graphics_stream_chunk_t *chunks;
+    int num_chunks;
+    int head;                           /* Oldest filled chunk */
+    int filled;                         /* Chunks waiting for the raster stage */
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;                /* Signalled when a frame is given, or on shutdown */
+    pthread_cond_t ready;               /* Signalled when a chunk is filled */
+    pthread_cond_t space;               /* Signalled when a chunk is emptied, or on shutdown */
+    pthread_t thread;
+    bool running;
+    bool stopping;
+
+    /* Geometry thread only */
+    system_frame_arena_t arena;
+    double view_distance;               /* View as left by the lists so far */
+    double view_width;
+    double view_height;
+    graphics_stream_chunk_t *current;   /* Being filled, NULL once stopping */
+} graphics_pipeline_t;
+
+graphics_pipeline_t *graphics_pipeline_create (graphics_renderer_t *renderer, int max_frames, int num_chunks);
+bool graphics_pipeline_frame (graphics_pipeline_t *pipeline, graphics_command_list_t *list);
+bool graphics_pipeline_flush (graphics_pipeline_t *pipeline);
+void graphics_pipeline_destroy (graphics_pipeline_t *pipeline);
+
+#endif
@@ -1,67 +1,1440 @@
 #include "renderer.h"
+#include "kernels.h"
+#include "kernels_common.h"
+#include "deferred.h"
+#include "./../system/log.h"
 #include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined (__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+
 static void interpolate (double i0, double d0, double i1, double d1, void (*func)(double, double, void *, void *), void *aux1, void *aux2);
 static bool same_side_of_plane (maths_vec4f p1, maths_vec4f p2, maths_vec4f plane_point, maths_vec4f plane_dir_1, maths_vec4f plane_dir_2);
 static bool line_plane_intersect (maths_vec4f start, maths_vec4f dir, maths_vec4f plane_point, maths_vec4f plane_dir_1, maths_vec4f plane_dir_2, maths_vec4f *result);
 static void clip_triangle_1_in (maths_vec4f *in, maths_vec4f *out_1, maths_vec4f *out_2, maths_vec4f plane_point, maths_vec4f plane_dir_1, maths_vec4f plane_dir_2, maths_vec4f *in_res, maths_vec4f *out_1_res, maths_vec4f *out_2_res);
 static void clip_triangle_2_in (maths_vec4f *in_1, maths_vec4f *in_2, maths_vec4f *out, maths_vec4f plane_point, maths_vec4f plane_dir_1, maths_vec4f plane_dir_2, maths_vec4f *t_1_in_1_res, maths_vec4f *t_1_in_2_res, maths_vec4f *t_1_out_res, maths_vec4f *t_2_in_1_res, maths_vec4f *t_2_in_2_res, maths_vec4f *t_2_out_res);
-static void clip_view_plane (graphics_renderer_t *renderer, maths_triangle4f t);
-static void project_and_draw_triangle (graphics_renderer_t *renderer, maths_triangle4f t);
-static void clip_view_plane (graphics_renderer_t *renderer, maths_triangle4f t);
-static void clip_left_plane (graphics_renderer_t *renderer, maths_triangle4f t);
-static void clip_right_plane (graphics_renderer_t *renderer, maths_triangle4f t);
-static void clip_bottom_plane (graphics_renderer_t *renderer, maths_triangle4f t);
-static void clip_top_plane (graphics_renderer_t *renderer, maths_triangle4f t);
+static inline void msaa_write (graphics_renderer_t *renderer, int x, int y, unsigned int mask, graphics_pixel_t colour, graphics_blend_mode_t mode);
+static int clip_triangle_plane (maths_triangle4f t, maths_vec4f plane_point, maths_vec4f plane_dir_1, maths_vec4f plane_dir_2, maths_vec4f sample, maths_triangle4f t1, maths_triangle4f t2);
+
+/* Bytes per pixel of a format */
+unsigned int graphics_format_size (graphics_format_t format) {
+    switch (format) {
+        case GRAPHICS_FORMAT_RGB565:
+            return sizeof (uint16_t);
+        case GRAPHICS_FORMAT_INDEXED8:
+            return sizeof (uint8_t);
+        default:
+            return sizeof (graphics_pixel_t);
+    }
+}
+
+graphics_renderer_t *graphics_renderer_init (unsigned int width, unsigned int height, graphics_format_t format) {
+    graphics_renderer_t *renderer = (graphics_renderer_t *) calloc (1, sizeof (graphics_renderer_t));
+
+    if (renderer == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for renderer.");
+        return NULL;
+    }
+
+    renderer->format = format;
+    renderer->pixel_size = graphics_format_size (format);
+    renderer->presented_format = format;
+    renderer->pixels = malloc ((size_t) renderer->pixel_size * width * height);
+    renderer->row_offset = (uint32_t *) malloc (sizeof (uint32_t) * height);
+    renderer->column_offset = (uint32_t *) malloc (sizeof (uint32_t) * width);
+
+    if (renderer->pixels == NULL || renderer->row_offset == NULL || renderer->column_offset == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for render buffer.");
+        graphics_renderer_destroy (renderer);
+        return NULL;
+    }
+
+    renderer->width = width;
+    renderer->height = height;
+    renderer->output_width = width;
+    renderer->output_height = height;
+    renderer->blend_mode = GRAPHICS_BLEND_NONE;
+    renderer->alpha = 255;
+    renderer->wireframe = GRAPHICS_WIREFRAME_TRIANGLES;
+    renderer->feature_cosine = -1.0;
+
+    system_frame_arena_init (&renderer->frame_arena, GRAPHICS_FRAME_ARENA_BLOCK_SIZE);
+
+    graphics_kernels_init ();
+
+    graphics_renderer_set_layout (renderer, GRAPHICS_LAYOUT_LINEAR);
+
+    return renderer;    
+};
+
+void graphics_renderer_destroy (graphics_renderer_t *renderer) {
+    if (renderer == NULL) {
+        return;
+    }
+
+    if (renderer->target != renderer->pixels) {
+        free (renderer->target);
+    }
+
+    free (renderer->pixels);
+    free (renderer->scaled);
+    free (renderer->expanded);
+    free (renderer->packed);
+    free (renderer->sample_block);
+    free (renderer->blocks);
+    free (renderer->row_offset);
+    free (renderer->column_offset);
+    graphics_deferred_disable (renderer);
+    system_frame_arena_destroy (&renderer->frame_arena);
+    free (renderer);
+}
+
+/* Number of bits needed to index n tiles along an axis. */
+static unsigned int tile_bits (unsigned int n) {
+    unsigned int bits = 0;
+
+    while ((1u << bits) < n) {
+        bits++;
+    }
+
+    return bits;
+}
+
+/* Spread the bits of a tile coordinate into the positions
+   it occupies in the Morton index. Bits are interleaved
+   x, y, x, y, ... until the shorter axis runs out, after
+   which the remaining bits of the longer axis follow on. */
+static uint32_t morton_spread (unsigned int coord, unsigned int bits, unsigned int other_bits, bool is_y) {
+    uint32_t result = 0;
+    unsigned int pos = 0;
+
+    for (unsigned int i = 0; i < bits || i < other_bits; i++) {
+        if (is_y) {
+            pos += (i < other_bits) ? 1 : 0;
+        }
+
+        if (i < bits) {
+            result |= ((coord >> i) & 1u) << pos;
+            pos++;
+        }
+
+        if (!is_y) {
+            pos += (i < other_bits) ? 1 : 0;
+        }
+    }
+
+    return result;
+}
+
+static unsigned int tiles_for (unsigned int pixels) {
+    return (pixels + GRAPHICS_TILE_SIZE - 1) >> GRAPHICS_TILE_SHIFT;
+}
+
+static unsigned int tiles_x (graphics_renderer_t *renderer) {
+    return tiles_for (renderer->width);
+}
+
+static unsigned int tiles_y (graphics_renderer_t *renderer) {
+    return tiles_for (renderer->height);
+}
+
+/* Offset of the first pixel of a tile within the target. */
+static inline uint32_t tile_offset (graphics_renderer_t *renderer, unsigned int tx, unsigned int ty) {
+    return renderer->row_offset[ty << GRAPHICS_TILE_SHIFT] + renderer->column_offset[tx << GRAPHICS_TILE_SHIFT];
+}
+
+/* Fill the row and column offset tables for the
+   current layout and render resolution. */
+static void build_offsets (graphics_renderer_t *renderer) {
+    if (renderer->layout == GRAPHICS_LAYOUT_LINEAR) {
+        for (unsigned int y = 0; y < renderer->height; y++) {
+            renderer->row_offset[y] = y * renderer->width;
+        }
+
+        for (unsigned int x = 0; x < renderer->width; x++) {
+            renderer->column_offset[x] = x;
+        }
+
+        return;
+    }
+
+    unsigned int bits_x = tile_bits (tiles_x (renderer));
+    unsigned int bits_y = tile_bits (tiles_y (renderer));
+
+    for (unsigned int y = 0; y < renderer->height; y++) {
+        uint32_t tile = morton_spread (y >> GRAPHICS_TILE_SHIFT, bits_y, bits_x, true);
+        renderer->row_offset[y] = (tile << (2 * GRAPHICS_TILE_SHIFT)) + ((y & (GRAPHICS_TILE_SIZE - 1)) << GRAPHICS_TILE_SHIFT);
+    }
+
+    for (unsigned int x = 0; x < renderer->width; x++) {
+        uint32_t tile = morton_spread (x >> GRAPHICS_TILE_SHIFT, bits_x, bits_y, false);
+        renderer->column_offset[x] = (tile << (2 * GRAPHICS_TILE_SHIFT)) + (x & (GRAPHICS_TILE_SIZE - 1));
+    }
+}
+
+/* Number of pixels the target can hold in any layout
+   at any resolution up to the output resolution. */
+static size_t target_capacity (graphics_renderer_t *renderer) {
+    unsigned int bits_x = tile_bits (tiles_for (renderer->output_width));
+    unsigned int bits_y = tile_bits (tiles_for (renderer->output_height));
+    return ((size_t) 1 << (bits_x + bits_y)) * GRAPHICS_TILE_SIZE * GRAPHICS_TILE_SIZE;
+}
+
+/* Select the layout of the buffer the rasterizer
+   draws into. All drawing addresses pixels through
+   the row and column offset tables, so the layout
+   only changes how those tables are filled. */
+bool graphics_renderer_set_layout (graphics_renderer_t *renderer, graphics_layout_t layout) {
+    assert (renderer != NULL);
+
+    if (layout == GRAPHICS_LAYOUT_LINEAR) {
+        if (renderer->target != NULL && renderer->target != renderer->pixels) {
+            graphics_renderer_linearize (renderer);
+            free (renderer->target);
+        }
+
+        renderer->target = renderer->pixels;
+        renderer->layout = layout;
+        build_offsets (renderer);
+        return true;
+    }
+
+    if (renderer->layout == GRAPHICS_LAYOUT_TILED && renderer->target != NULL && renderer->target != renderer->pixels) {
+        return true;
+    }
+
+    /* Sized for the full output resolution, which bounds
+       the Morton index at any lower render resolution. */
+    uint8_t *target = (uint8_t *) aligned_alloc (64, target_capacity (renderer) * renderer->pixel_size);
+
+    if (target == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for tiled render buffer.");
+        return false;
+    }
+
+    renderer->target = target;
+    renderer->layout = layout;
+    build_offsets (renderer);
+
+    /* Carry the current contents over */
+    unsigned int size = renderer->pixel_size;
+
+    for (unsigned int y = 0; y < renderer->height; y++) {
+        for (unsigned int x = 0; x < renderer->width; x++) {
+            memcpy (target + (size_t) (renderer->row_offset[y] + renderer->column_offset[x]) * size, (uint8_t *) renderer->pixels + ((size_t) y * renderer->width + x) * size, size);
+        }
+    }
+
+    return true;
+}
+
+/* Change the resolution rendered at. It may not exceed
+   the output resolution given at initialisation - when
+   it is lower, the frame is upscaled on display. The
+   contents of the target are undefined afterwards, so
+   the next clear and present cover the whole frame. */
+bool graphics_renderer_set_resolution (graphics_renderer_t *renderer, unsigned int width, unsigned int height) {
+    assert (renderer != NULL);
+
+    if (width == 0 || height == 0 || width > renderer->output_width || height > renderer->output_height) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "invalid render resolution %ux%u.", width, height);
+        return false;
+    }
+
+    if (width == renderer->width && height == renderer->height) {
+        return true;
+    }
+
+    if (renderer->scaled == NULL && (width != renderer->output_width || height != renderer->output_height)) {
+        renderer->scaled = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * renderer->output_width * renderer->output_height);
+
+        if (renderer->scaled == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for upscale buffer.");
+            return false;
+        }
+    }
+
+    renderer->width = width;
+    renderer->height = height;
+    build_offsets (renderer);
+
+    renderer->dirty.count = 0;
+    renderer->previous.count = 0;
+    renderer->clear_full = true;
+    renderer->present_full = true;
+
+    return true;
+}
+
+void graphics_renderer_set_upscale_filter (graphics_renderer_t *renderer, graphics_upscale_filter_t filter) {
+    renderer->upscale_filter = filter;
+}
+
+/* Drop all expanded pixels, leaving every pixel
+   compressed to the colour in the target. */
+static void msaa_reset (graphics_renderer_t *renderer) {
+    for (uint32_t i = 0; i < renderer->num_blocks; i++) {
+        renderer->sample_block[renderer->blocks[i].pixel] = 0;
+    }
+
+    renderer->num_blocks = 0;
+}
+
+/* Enable 4x multisampling of triangles and lines. The
+   per pixel index is the only full-size allocation,
+   sample blocks are only used for edge pixels. */
+bool graphics_renderer_set_msaa (graphics_renderer_t *renderer, bool enabled) {
+    assert (renderer != NULL);
+
+    if (enabled && renderer->sample_block == NULL) {
+        renderer->sample_block = (uint32_t *) calloc (target_capacity (renderer), sizeof (uint32_t));
+
+        if (renderer->sample_block == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for multisample index.");
+            return false;
+        }
+    }
+
+    if (renderer->sample_block != NULL) {
+        msaa_reset (renderer);
+    }
+
+    renderer->msaa = enabled;
+
+    return true;
+}
+
+/* Average the samples of every expanded pixel into
+   the target, ready for presenting. */
+static void msaa_resolve (graphics_renderer_t *renderer) {
+    if (!renderer->msaa) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < renderer->num_blocks; i++) {
+        graphics_msaa_block_t *block = &renderer->blocks[i];
+
+        /* Skip blocks for pixels which have since
+           been fully covered and compressed again. */
+        if (renderer->sample_block[block->pixel] != i + 1) {
+            continue;
+        }
+
+        unsigned int r = 0, g = 0, b = 0, a = 0;
+
+        for (int s = 0; s < GRAPHICS_MSAA_SAMPLES; s++) {
+            r += block->samples[s].red;
+            g += block->samples[s].green;
+            b += block->samples[s].blue;
+            a += block->samples[s].pad;
+        }
+
+        graphics_pixel_t px;
+        px.red = (uint8_t) ((r + GRAPHICS_MSAA_SAMPLES / 2) / GRAPHICS_MSAA_SAMPLES);
+        px.green = (uint8_t) ((g + GRAPHICS_MSAA_SAMPLES / 2) / GRAPHICS_MSAA_SAMPLES);
+        px.blue = (uint8_t) ((b + GRAPHICS_MSAA_SAMPLES / 2) / GRAPHICS_MSAA_SAMPLES);
+        px.pad = (uint8_t) ((a + GRAPHICS_MSAA_SAMPLES / 2) / GRAPHICS_MSAA_SAMPLES);
+        store_pixel (renderer, block->pixel, block->x, block->y, px);
+    }
+}
+
+/* Copy one tile row of n bytes into the linear buffer. */
+static inline void copy_tile_row (uint8_t *dst, const uint8_t *src, unsigned int n) {
+#if defined (__SSE2__)
+    if (n == GRAPHICS_TILE_SIZE * sizeof (graphics_pixel_t)) {
+        __m128i a = _mm_load_si128 ((const __m128i *) src);
+        __m128i b = _mm_load_si128 ((const __m128i *) (src + 16));
+        _mm_storeu_si128 ((__m128i *) dst, a);
+        _mm_storeu_si128 ((__m128i *) (dst + 16), b);
+        return;
+    }
+#endif
+
+    memcpy (dst, src, n);
+}
+
+static graphics_rect_t screen_rect (graphics_renderer_t *renderer) {
+    return (graphics_rect_t) { 0, 0, (int) renderer->width, (int) renderer->height };
+}
+
+/* Detile every tile overlapping the rectangle
+   into the linear buffer. */
+static void linearize_rect (graphics_renderer_t *renderer, graphics_rect_t rect) {
+    if (renderer->target == renderer->pixels) {
+        return;
+    }
+
+    unsigned int size = renderer->pixel_size;
+    unsigned int tx0 = rect.x0 >> GRAPHICS_TILE_SHIFT;
+    unsigned int ty0 = rect.y0 >> GRAPHICS_TILE_SHIFT;
+    unsigned int tx1 = (rect.x1 + GRAPHICS_TILE_SIZE - 1) >> GRAPHICS_TILE_SHIFT;
+    unsigned int ty1 = (rect.y1 + GRAPHICS_TILE_SIZE - 1) >> GRAPHICS_TILE_SHIFT;
+
+    for (unsigned int ty = ty0; ty < ty1; ty++) {
+        unsigned int y0 = ty << GRAPHICS_TILE_SHIFT;
+        unsigned int rows = renderer->height - y0 < GRAPHICS_TILE_SIZE ? renderer->height - y0 : GRAPHICS_TILE_SIZE;
+
+        for (unsigned int tx = tx0; tx < tx1; tx++) {
+            unsigned int x0 = tx << GRAPHICS_TILE_SHIFT;
+            unsigned int cols = renderer->width - x0 < GRAPHICS_TILE_SIZE ? renderer->width - x0 : GRAPHICS_TILE_SIZE;
+            const uint8_t *src = (const uint8_t *) renderer->target + (size_t) tile_offset (renderer, tx, ty) * size;
+            uint8_t *dst = (uint8_t *) renderer->pixels + ((size_t) y0 * renderer->width + x0) * size;
+
+            for (unsigned int r = 0; r < rows; r++) {
+                copy_tile_row (dst, src, cols * size);
+                src += GRAPHICS_TILE_SIZE * size;
+                dst += renderer->width * size;
+            }
+        }
+    }
+}
+
+/* Bring the linear pixel buffer up to date with
+   the render target. This is a no-op for the
+   linear layout, which draws into it directly. */
+void graphics_renderer_linearize (graphics_renderer_t *renderer) {
+    msaa_resolve (renderer);
+    linearize_rect (renderer, screen_rect (renderer));
+}
+
+static int rect_area (graphics_rect_t r) {
+    return (r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+static graphics_rect_t rect_union (graphics_rect_t a, graphics_rect_t b) {
+    return (graphics_rect_t) {
+        a.x0 < b.x0 ? a.x0 : b.x0,
+        a.y0 < b.y0 ? a.y0 : b.y0,
+        a.x1 > b.x1 ? a.x1 : b.x1,
+        a.y1 > b.y1 ? a.y1 : b.y1
+    };
+}
+
+static bool rect_touches (graphics_rect_t a, graphics_rect_t b) {
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+/* Add a rectangle to a dirty list, merging it into an
+   existing rectangle it touches. If the list is full it
+   is merged into whichever rectangle grows the least. */
+static void dirty_list_add (graphics_dirty_list_t *list, graphics_rect_t rect) {
+    for (int i = 0; i < list->count; i++) {
+        if (rect_touches (list->rects[i], rect)) {
+            list->rects[i] = rect_union (list->rects[i], rect);
+            return;
+        }
+    }
+
+    if (list->count < GRAPHICS_MAX_DIRTY_RECTS) {
+        list->rects[list->count++] = rect;
+        return;
+    }
+
+    int best = 0;
+    int best_growth = -1;
+
+    for (int i = 0; i < list->count; i++) {
+        int growth = rect_area (rect_union (list->rects[i], rect)) - rect_area (list->rects[i]);
+
+        if (best_growth < 0 || growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+
+    list->rects[best] = rect_union (list->rects[best], rect);
+}
+
+/* Record that the bounding box [x0, x1] x [y0, y1]
+   (inclusive) was drawn to this frame. */
+static void mark_dirty (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1) {
+    if (!renderer->dirty_tracking) {
+        return;
+    }
+
+    graphics_rect_t rect = {
+        x0 < 0 ? 0 : x0,
+        y0 < 0 ? 0 : y0,
+        x1 >= (int) renderer->width ? (int) renderer->width : x1 + 1,
+        y1 >= (int) renderer->height ? (int) renderer->height : y1 + 1
+    };
+
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+        return;
+    }
+
+    dirty_list_add (&renderer->dirty, rect);
+}
+
+/* Track the regions drawn each frame so that clearing
+   and presenting only touch what has changed. Content
+   drawn outside the renderer (e.g. the window being
+   uncovered) needs graphics_renderer_invalidate. */
+void graphics_renderer_set_dirty_tracking (graphics_renderer_t *renderer, bool enabled) {
+    renderer->dirty_tracking = enabled;
+    renderer->dirty.count = 0;
+    renderer->previous.count = 0;
+    renderer->clear_full = true;
+    renderer->present_full = true;
+}
+
+/* Outlines draw the silhouette, the boundary of
+   open meshes, and edges whose faces meet at more
+   than feature_angle radians. */
+void graphics_renderer_set_wireframe_mode (graphics_renderer_t *renderer, graphics_wireframe_mode_t mode, double feature_angle) {
+    renderer->wireframe = mode;
+    renderer->feature_cosine = cos (feature_angle);
+}
+
+/* Place the frame at (x, y) in the window it is
+   displayed in, e.g. for one of several viewports
+   sharing a window. */
+void graphics_renderer_set_window_position (graphics_renderer_t *renderer, int x, int y) {
+    renderer->window_x = x;
+    renderer->window_y = y;
+    renderer->present_full = true;
+}
+
+/* Share vertex batches, clears and lighting tiles
+   out on a job system, or do them all on the render
+   thread again given NULL. The job system must
+   outlive the renderer's use of it. */
+void graphics_renderer_set_jobs (graphics_renderer_t *renderer, system_jobs_t *jobs) {
+    renderer->jobs = jobs;
+}
+
+/* Present the whole buffer on the next display. */
+void graphics_renderer_invalidate (graphics_renderer_t *renderer) {
+    renderer->present_full = true;
+}
+
+/* Track a region drawn into the target from outside
+   the renderer, such as by blits. */
+void graphics_renderer_mark_dirty (graphics_renderer_t *renderer, const graphics_rect_t *rect) {
+    mark_dirty (renderer, rect->x0, rect->y0, rect->x1 - 1, rect->y1 - 1);
+}
+
+/* Nearest neighbour upscale of a linear BGRX frame
+   into the output sized buffer. Output rows which
+   sample the same source row are copied from the row
+   above. */
+static void upscale_nearest (graphics_renderer_t *renderer, const graphics_pixel_t *frame) {
+    unsigned int ow = renderer->output_width;
+    unsigned int oh = renderer->output_height;
+    uint32_t step_x = (uint32_t) (((uint64_t) renderer->width << 16) / ow);
+    unsigned int previous_sy = (unsigned int) -1;
+
+    for (unsigned int oy = 0; oy < oh; oy++) {
+        unsigned int sy = (unsigned int) ((uint64_t) oy * renderer->height / oh);
+        graphics_pixel_t *dst = renderer->scaled + oy * ow;
+
+        if (sy == previous_sy) {
+            memcpy (dst, dst - ow, sizeof (graphics_pixel_t) * ow);
+            continue;
+        }
+
+        graphics_kernels.scale_nearest_span (dst, frame + sy * renderer->width, ow, step_x >> 1, step_x);
+        previous_sy = sy;
+    }
+}
+
+static void upscale_bilinear (graphics_renderer_t *renderer, const graphics_pixel_t *frame) {
+    unsigned int ow = renderer->output_width;
+    unsigned int oh = renderer->output_height;
+    unsigned int w = renderer->width;
+    unsigned int h = renderer->height;
+
+    /* Source coordinates of output pixel centres in
+       16.16 fixed point. */
+    int32_t step_x = (int32_t) (((int64_t) w << 16) / ow);
+    int32_t step_y = (int32_t) (((int64_t) h << 16) / oh);
+    int32_t fy = step_y / 2 - (1 << 15);
+
+    for (unsigned int oy = 0; oy < oh; oy++, fy += step_y) {
+        int32_t cy = fy < 0 ? 0 : fy;
+        unsigned int y0 = cy >> 16;
+        unsigned int y1 = y0 + 1 < h ? y0 + 1 : h - 1;
+        unsigned int wy = (cy >> 9) & 0x7F;
+        const graphics_pixel_t *top = frame + y0 * w;
+        const graphics_pixel_t *bottom = frame + y1 * w;
+        graphics_pixel_t *dst = renderer->scaled + oy * ow;
+        graphics_kernels.scale_bilinear_span (dst, top, bottom, ow, step_x / 2 - (1 << 15), step_x, w, wy);
+    }
+}
+
+static void present_region (graphics_renderer_t *renderer, system_window_t *window, void *buffer, graphics_rect_t r) {
+    system_window_render_view_to_screen (window, buffer, renderer->output_width, renderer->output_height,
+                                         r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, renderer->window_x + r.x0, renderer->window_y + r.y0);
+}
+
+/* Expand a rectangle of a compact linear buffer into
+   the BGRX one, allocating it on first use. */
+static graphics_pixel_t *expand_rect (graphics_renderer_t *renderer, graphics_rect_t r) {
+    if (renderer->expanded == NULL) {
+        renderer->expanded = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * renderer->output_width * renderer->output_height);
+
+        if (renderer->expanded == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for expanded frame.");
+            return NULL;
+        }
+    }
+
+    for (int y = r.y0; y < r.y1; y++) {
+        size_t at = (size_t) y * renderer->width + r.x0;
+
+        if (renderer->format == GRAPHICS_FORMAT_RGB565) {
+            graphics_kernels.expand_rgb565 (renderer->expanded + at, (const uint16_t *) renderer->pixels + at, r.x1 - r.x0);
+        } else {
+            graphics_kernels.expand_indexed (renderer->expanded + at, (const uint8_t *) renderer->pixels + at, r.x1 - r.x0);
+        }
+    }
+
+    return renderer->expanded;
+}
+
+/* Present a rectangle of a BGRX frame at output
+   resolution, packed first for a 16 bit display. */
+static void present_pixels (graphics_renderer_t *renderer, system_window_t *window, graphics_pixel_t *frame, graphics_rect_t r) {
+    if (system_window_depth (window) != 16) {
+        present_region (renderer, window, frame, r);
+        return;
+    }
+
+    if (renderer->packed == NULL) {
+        renderer->packed = (uint16_t *) malloc (sizeof (uint16_t) * renderer->output_width * renderer->output_height);
+
+        if (renderer->packed == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for packed frame.");
+            return;
+        }
+    }
+
+    for (int y = r.y0; y < r.y1; y++) {
+        size_t at = (size_t) y * renderer->output_width + r.x0;
+        uint8_t threshold[4];
+
+        dither_row (renderer->dither, r.x0, y, threshold);
+        graphics_kernels.pack_rgb565 (renderer->packed + at, frame + at, r.x1 - r.x0, threshold);
+    }
+
+    present_region (renderer, window, renderer->packed, r);
+}
+
+/* Present a rectangle of the linear buffer, expanded
+   first unless the window takes its format as is. */
+static void present_linear (graphics_renderer_t *renderer, system_window_t *window, graphics_rect_t r) {
+    if (window == NULL) {
+        return;
+    }
+
+    if (renderer->format == GRAPHICS_FORMAT_RGB565 && system_window_depth (window) == 16) {
+        present_region (renderer, window, renderer->pixels, r);
+        return;
+    }
+
+    graphics_pixel_t *frame = renderer->format == GRAPHICS_FORMAT_BGRX8888 ? renderer->pixels : expand_rect (renderer, r);
+
+    if (frame != NULL) {
+        present_pixels (renderer, window, frame, r);
+    }
+}
+
+/* Present the frame. With no window the frame is
+   still finished at output resolution, e.g. to be
+   captured from a renderer without a display. */
+void graphics_renderer_display (graphics_renderer_t *renderer, system_window_t *window) {
+    msaa_resolve (renderer);
+
+    graphics_rect_t full = { 0, 0, (int) renderer->output_width, (int) renderer->output_height };
+    renderer->presented_rects.count = 0;
+
+    if (renderer->width != renderer->output_width || renderer->height != renderer->output_height) {
+        /* Rendered below output resolution - always
+           present the whole upscaled frame. */
+        graphics_renderer_linearize (renderer);
+        const graphics_pixel_t *frame = renderer->format == GRAPHICS_FORMAT_BGRX8888 ? renderer->pixels : expand_rect (renderer, screen_rect (renderer));
+
+        if (frame == NULL) {
+            return;
+        }
+
+        if (renderer->upscale_filter == GRAPHICS_UPSCALE_BILINEAR) {
+            upscale_bilinear (renderer, frame);
+        } else {
+            upscale_nearest (renderer, frame);
+        }
+
+        if (window != NULL) {
+            present_pixels (renderer, window, renderer->scaled, full);
+        }
+
+        renderer->presented = renderer->scaled;
+        renderer->presented_format = GRAPHICS_FORMAT_BGRX8888;
+        dirty_list_add (&renderer->presented_rects, full);
+        renderer->present_full = true;
+        return;
+    }
+
+    renderer->presented = renderer->pixels;
+    renderer->presented_format = renderer->format;
+
+    if (!renderer->dirty_tracking || renderer->present_full) {
+        graphics_renderer_linearize (renderer);
+        present_linear (renderer, window, full);
+
+        dirty_list_add (&renderer->presented_rects, full);
+        renderer->present_full = false;
+        return;
+    }
+
+    /* Regions drawn this frame, plus those drawn last
+       frame which have since been cleared. */
+    graphics_dirty_list_t present = renderer->dirty;
+
+    for (int i = 0; i < renderer->previous.count; i++) {
+        dirty_list_add (&present, renderer->previous.rects[i]);
+    }
+
+    for (int i = 0; i < present.count; i++) {
+        graphics_rect_t r = present.rects[i];
+        linearize_rect (renderer, r);
+        present_linear (renderer, window, r);
+    }
+
+    renderer->presented_rects = present;
+}
+
+/* Zero a rectangle of the render target, which is
+   black in every format. */
+static void clear_rect (graphics_renderer_t *renderer, graphics_rect_t rect) {
+    unsigned int size = renderer->pixel_size;
+
+    for (int y = rect.y0; y < rect.y1; y++) {
+        uint8_t *row = (uint8_t *) renderer->target + (size_t) renderer->row_offset[y] * size;
+
+        if (renderer->target == renderer->pixels) {
+            memset (row + rect.x0 * size, 0, size * (rect.x1 - rect.x0));
+            continue;
+        }
+
+        /* Tiled - each tile row is contiguous */
+        for (int x = rect.x0; x < rect.x1;) {
+            int end = ((x >> GRAPHICS_TILE_SHIFT) + 1) << GRAPHICS_TILE_SHIFT;
+
+            if (end > rect.x1) {
+                end = rect.x1;
+            }
+
+            memset (row + renderer->column_offset[x] * size, 0, size * (end - x));
+            x = end;
+        }
+    }
+}
+
+typedef struct {
+    graphics_renderer_t *renderer;
+    unsigned int tiles_x;
+} graphics_clear_job_t;
+
+static void clear_rows (int begin, int end, void *arg) {
+    graphics_clear_job_t *clear = (graphics_clear_job_t *) arg;
+    graphics_renderer_t *renderer = clear->renderer;
+
+    size_t row_bytes = (size_t) renderer->pixel_size * renderer->width;
+
+    memset ((uint8_t *) renderer->pixels + begin * row_bytes, 0, row_bytes * (end - begin));
+}
+
+static void clear_tile_rows (int begin, int end, void *arg) {
+    graphics_clear_job_t *clear = (graphics_clear_job_t *) arg;
+    graphics_renderer_t *renderer = clear->renderer;
+
+    for (int ty = begin; ty < end; ty++) {
+        for (unsigned int tx = 0; tx < clear->tiles_x; tx++) {
+            memset ((uint8_t *) renderer->target + (size_t) tile_offset (renderer, tx, ty) * renderer->pixel_size, 0, renderer->pixel_size * GRAPHICS_TILE_SIZE * GRAPHICS_TILE_SIZE);
+        }
+    }
+}
+
+/* Rows, or rows of tiles, needed to make up about
+   GRAPHICS_JOB_CLEAR_BYTES. */
+static int clear_chunk (unsigned int row_bytes) {
+    return GRAPHICS_JOB_CLEAR_BYTES / row_bytes + 1;
+}
+
+void graphics_renderer_clear_buffer (graphics_renderer_t *renderer) {
+    /* A new frame - last frame's scratch memory is done with */
+    system_frame_arena_reset (&renderer->frame_arena);
+
+    if (renderer->msaa) {
+        msaa_reset (renderer);
+    }
+
+    if (renderer->deferred != NULL) {
+        graphics_deferred_clear (renderer);
+    }
+
+    if (renderer->dirty_tracking && !renderer->clear_full) {
+        /* Only what was drawn last frame needs clearing,
+           the rest of the target is still clear. */
+        for (int i = 0; i < renderer->dirty.count; i++) {
+            clear_rect (renderer, renderer->dirty.rects[i]);
+        }
+
+        renderer->previous = renderer->dirty;
+        renderer->dirty.count = 0;
+        return;
+    }
+
+    renderer->previous.count = 0;
+    renderer->dirty.count = 0;
+    renderer->clear_full = false;
+
+    graphics_clear_job_t clear = { renderer, tiles_x (renderer) };
+
+    if (renderer->target == renderer->pixels) {
+        system_jobs_parallel_for (renderer->jobs, 0, renderer->height, clear_chunk (renderer->pixel_size * renderer->width), clear_rows, &clear);
+        return;
+    }
+
+    /* Only clear tiles which lie on screen - the
+       Morton padding in between is never drawn to. */
+    unsigned int tile_row_bytes = renderer->pixel_size * GRAPHICS_TILE_SIZE * GRAPHICS_TILE_SIZE * clear.tiles_x;
+    system_jobs_parallel_for (renderer->jobs, 0, tiles_y (renderer), clear_chunk (tile_row_bytes), clear_tile_rows, &clear);
+};
+
+static void mark_triangle_dirty (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2) {
+    int min_x = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+    int max_x = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+    int min_y = y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2);
+    int max_y = y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2);
+    mark_dirty (renderer, min_x - 1, min_y - 1, max_x + 1, max_y + 1);
+}
+
+/* Dither colours packed into a compact target, trading
+   banding in gradients for a fine pattern. Has no
+   effect on BGRX targets. */
+void graphics_renderer_set_dither (graphics_renderer_t *renderer, bool enabled) {
+    renderer->dither = enabled;
+    renderer->pattern_valid = false;
+}
+
+void graphics_renderer_set_blend_mode (graphics_renderer_t *renderer, graphics_blend_mode_t mode, uint8_t alpha) {
+    renderer->blend_mode = mode;
+    renderer->alpha = alpha;
+}
+
+/* The blend actually needed for the current state - alpha
+   blending a fully opaque source is the same as
+   overwriting, so it takes the fast path. */
+static inline graphics_blend_mode_t active_blend_mode (graphics_renderer_t *renderer) {
+    if (renderer->blend_mode == GRAPHICS_BLEND_ALPHA && renderer->alpha == 255) {
+        return GRAPHICS_BLEND_NONE;
+    }
+
+    return renderer->blend_mode;
+}
+
+/* Source pixel for a colour, premultiplied by the
+   current alpha, which goes in the pad byte. */
+static inline graphics_pixel_t source_pixel (graphics_renderer_t *renderer, uint8_t red, uint8_t green, uint8_t blue) {
+    unsigned int a = renderer->alpha;
+
+    if (a == 255) {
+        return (graphics_pixel_t) { blue, green, red, 255 };
+    }
+
+    return (graphics_pixel_t) { div_255 (blue * a), div_255 (green * a), div_255 (red * a), a };
+}
+
+/* Blend n contiguous source pixels into the target,
+   with the kernels for the CPU. src is NULL for a run
+   of a single colour. */
+static inline void blend_run (graphics_pixel_t *dst, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    if (mode != GRAPHICS_BLEND_NONE) {
+        graphics_kernels.blend_span (dst, src, colour, n, mode);
+    } else if (src != NULL) {
+        /* Opaque - nothing to read back */
+        memcpy (dst, src, sizeof (graphics_pixel_t) * n);
+    } else {
+        graphics_kernels.fill_span (dst, colour, n);
+    }
+}
+
+/* Pixels blended at a time in a compact target, by
+   way of a BGRX copy */
+#define COMPACT_SPAN_CHUNK 64
+
+/* Pack n pixels into the target's compact format */
+static inline void pack_run (const graphics_renderer_t *renderer, uint8_t *dst, const graphics_pixel_t *src, int n, const uint8_t *threshold) {
+    if (renderer->format == GRAPHICS_FORMAT_RGB565) {
+        graphics_kernels.pack_rgb565 ((uint16_t *) dst, src, n, threshold);
+    } else {
+        graphics_kernels.pack_indexed (dst, src, n, threshold);
+    }
+}
+
+/* A solid colour packed for row y of the dither
+   pattern, from x on. Rows hold the pattern twice over
+   so that four pixels from any x are contiguous. The
+   spans of a shape share its colour, so the pattern is
+   kept until the colour changes. */
+static const uint8_t *solid_pattern (graphics_renderer_t *renderer, graphics_pixel_t colour, int x, int y) {
+    if (!renderer->pattern_valid || memcmp (&colour, &renderer->pattern_colour, sizeof (colour)) != 0) {
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 8; k++) {
+                unsigned int threshold = dither_threshold (renderer->dither, k, j);
+
+                if (renderer->format == GRAPHICS_FORMAT_RGB565) {
+                    uint16_t p = pack_rgb565 (colour, threshold);
+                    memcpy (&renderer->pattern[j][k * sizeof (p)], &p, sizeof (p));
+                } else {
+                    renderer->pattern[j][k] = pack_indexed (colour, threshold);
+                }
+            }
+        }
+
+        renderer->pattern_colour = colour;
+        renderer->pattern_valid = true;
+    }
+
+    return &renderer->pattern[y & 3][(x & 3) * renderer->pixel_size];
+}
+
+/* As blend_run, into n contiguous pixels of a compact
+   target starting at (x, y). Runs of one colour repeat
+   every four pixels, the width of the dither pattern,
+   and are filled a block of repeats at a time. */
+static void blend_run_compact (graphics_renderer_t *renderer, uint8_t *dst, int x, int y, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    if (mode == GRAPHICS_BLEND_NONE && src == NULL) {
+        const uint8_t *pattern = solid_pattern (renderer, colour, x, y);
+        size_t size = 4 * renderer->pixel_size;
+        size_t length = (size_t) n * renderer->pixel_size;
+        size_t i = 0;
+
+        /* Spans of small shapes store directly */
+        if (n <= 4) {
+            for (; i < length; i++) {
+                dst[i] = pattern[i];
+            }
+
+            return;
+        }
+
+        uint8_t block[32];
+
+        for (size_t k = 0; k < sizeof (block); k += size) {
+            memcpy (block + k, pattern, size);
+        }
+
+        for (; i + sizeof (block) <= length; i += sizeof (block)) {
+            memcpy (dst + i, block, sizeof (block));
+        }
+
+        memcpy (dst + i, block, length - i);
+        return;
+    }
+
+    uint8_t threshold[4];
+    dither_row (renderer->dither, x, y, threshold);
+
+    graphics_pixel_t buffer[COMPACT_SPAN_CHUNK];
+
+    /* Chunks are a multiple of four pixels apart, so
+       each starts at the same point of the dither row */
+    for (int i = 0; i < n; i += COMPACT_SPAN_CHUNK) {
+        int m = n - i < COMPACT_SPAN_CHUNK ? n - i : COMPACT_SPAN_CHUNK;
+        uint8_t *chunk = dst + (size_t) i * renderer->pixel_size;
+        const graphics_pixel_t *pixels = src != NULL ? src + i : NULL;
+
+        if (mode != GRAPHICS_BLEND_NONE) {
+            if (renderer->format == GRAPHICS_FORMAT_RGB565) {
+                graphics_kernels.expand_rgb565 (buffer, (const uint16_t *) chunk, m);
+            } else {
+                graphics_kernels.expand_indexed (buffer, chunk, m);
+            }
+
+            graphics_kernels.blend_span (buffer, pixels, colour, m, mode);
+            pixels = buffer;
+        }
+
+        pack_run (renderer, chunk, pixels, m, threshold);
+    }
+}
+
+/* Blend n pixels from (x, y), contiguous at offset
+   into the target, in the target's format. */
+static inline void blend_target_run (graphics_renderer_t *renderer, uint32_t offset, int x, int y, const graphics_pixel_t *src, graphics_pixel_t colour, int n, graphics_blend_mode_t mode) {
+    if (renderer->format == GRAPHICS_FORMAT_BGRX8888) {
+        blend_run ((graphics_pixel_t *) renderer->target + offset, src, colour, n, mode);
+    } else {
+        blend_run_compact (renderer, (uint8_t *) renderer->target + (size_t) offset * renderer->pixel_size, x, y, src, colour, n, mode);
+    }
+}
+
+/* Blend a clipped span [x0, x1] of row y, split at tile
+   boundaries in the tiled layout. */
+static void write_span (graphics_renderer_t *renderer, int x0, int x1, int y, const graphics_pixel_t *src, graphics_pixel_t colour) {
+    graphics_blend_mode_t mode = active_blend_mode (renderer);
+    uint32_t row = renderer->row_offset[y];
+
+    if (renderer->target == renderer->pixels) {
+        blend_target_run (renderer, row + x0, x0, y, src, colour, x1 - x0 + 1, mode);
+        return;
+    }
+
+    for (int x = x0; x <= x1;) {
+        int end = ((x >> GRAPHICS_TILE_SHIFT) + 1) << GRAPHICS_TILE_SHIFT;
+
+        if (end > x1 + 1) {
+            end = x1 + 1;
+        }
+
+        blend_target_run (renderer, row + renderer->column_offset[x], x, y, src != NULL ? src + (x - x0) : NULL, colour, end - x, mode);
+        x = end;
+    }
+}
+
+/* Blend a single pixel into the target */
+static inline void blend_target (graphics_renderer_t *renderer, uint32_t offset, int x, int y, graphics_pixel_t src, graphics_blend_mode_t mode) {
+    if (renderer->format == GRAPHICS_FORMAT_BGRX8888) {
+        blend_pixel ((graphics_pixel_t *) renderer->target + offset, src, mode);
+        return;
+    }
+
+    graphics_pixel_t p = src;
+
+    if (mode != GRAPHICS_BLEND_NONE) {
+        p = load_pixel (renderer, offset);
+        blend_pixel (&p, src, mode);
+    }
+
+    store_pixel (renderer, offset, x, y, p);
+}
+
+static inline void put_pixel (graphics_renderer_t *renderer, int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+    if (x >= 0 && x < renderer->width && y >= 0 && y < renderer->height) {
+        graphics_pixel_t src = source_pixel (renderer, red, green, blue);
+
+        /* Covers every sample of the pixel */
+        if (renderer->msaa) {
+            msaa_write (renderer, x, y, (1u << GRAPHICS_MSAA_SAMPLES) - 1, src, active_blend_mode (renderer));
+            return;
+        }
+
+        uint32_t offset = renderer->row_offset[y] + renderer->column_offset[x];
+        blend_target (renderer, offset, x, y, src, active_blend_mode (renderer));
+    };
+}
+
+void graphics_renderer_draw_pixel (graphics_renderer_t *renderer, int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+    mark_dirty (renderer, x, y, x, y);
+    put_pixel (renderer, x, y, red, green, blue);
+};
+
+/* Sample positions within a pixel, on a rotated grid
+   so that near-horizontal and near-vertical edges
+   both get four distinct coverage levels. */
+static const double msaa_sample_x[GRAPHICS_MSAA_SAMPLES] = { 0.375, 0.875, 0.125, 0.625 };
+static const double msaa_sample_y[GRAPHICS_MSAA_SAMPLES] = { 0.125, 0.375, 0.625, 0.875 };
+
+/* Blend a source pixel into the covered samples of a
+   pixel, with the mode from active_blend_mode. */
+static inline void msaa_write (graphics_renderer_t *renderer, int x, int y, unsigned int mask, graphics_pixel_t colour, graphics_blend_mode_t mode) {
+    uint32_t offset = renderer->row_offset[y] + renderer->column_offset[x];
+    uint32_t index = renderer->sample_block[offset];
+
+    /* Fully covered - store compressed, unless blending
+       with samples which already differ. */
+    if (mask == (1u << GRAPHICS_MSAA_SAMPLES) - 1 && (index == 0 || mode == GRAPHICS_BLEND_NONE)) {
+        blend_target (renderer, offset, x, y, colour, mode);
+        renderer->sample_block[offset] = 0;
+        return;
+    }
+
+    if (index == 0) {
+        /* Expand the pixel into a block */
+        if (renderer->num_blocks == renderer->max_blocks) {
+            uint32_t max_blocks = renderer->max_blocks ? renderer->max_blocks * 2 : 4096;
+            graphics_msaa_block_t *blocks = (graphics_msaa_block_t *) realloc (renderer->blocks, sizeof (graphics_msaa_block_t) * max_blocks);
+
+            if (blocks == NULL) {
+                SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate memory for multisample blocks.");
+                return;
+            }
+
+            renderer->blocks = blocks;
+            renderer->max_blocks = max_blocks;
+        }
+
+        graphics_msaa_block_t *block = &renderer->blocks[renderer->num_blocks++];
+        graphics_pixel_t compressed = load_pixel (renderer, offset);
+        block->pixel = offset;
+        block->x = (uint16_t) x;
+        block->y = (uint16_t) y;
+
+        for (int s = 0; s < GRAPHICS_MSAA_SAMPLES; s++) {
+            block->samples[s] = compressed;
+        }
+
+        index = renderer->num_blocks;
+        renderer->sample_block[offset] = index;
+    }
+
+    graphics_msaa_block_t *block = &renderer->blocks[index - 1];
 
-graphics_renderer_t *graphics_renderer_init (unsigned int width, unsigned int height) {
-    graphics_renderer_t *renderer = (graphics_renderer_t *) malloc (sizeof (graphics_renderer_t));
+    for (int s = 0; s < GRAPHICS_MSAA_SAMPLES; s++) {
+        if (mask & (1u << s)) {
+            blend_pixel (&block->samples[s], colour, mode);
+        }
+    }
+}
 
-    if (renderer == NULL) {
-        fprintf (stderr, "Error - graphics/renderer: could not allocate memory for renderer.\n");
-        return NULL;
+/* Unlike fmin and fmax these ignore NaN handling,
+   which lets them compile to single instructions. */
+static inline double min_double (double a, double b) {
+    return a < b ? a : b;
+}
+
+static inline double max_double (double a, double b) {
+    return a > b ? a : b;
+}
+
+/* Rasterize a triangle with per sample coverage, but
+   only one colour evaluation per pixel, taken at the
+   pixel centre. Coordinates are continuous, with pixel
+   (x, y) covering [x, x + 1) x [y, y + 1). */
+static void msaa_fill_triangle (graphics_renderer_t *renderer, double x0, double y0, double x1, double y1, double x2, double y2, graphics_pixel_t c0, graphics_pixel_t c1, graphics_pixel_t c2) {
+    double area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+
+    if (area == 0) {
+        return;
+    }
+
+    /* Make the winding consistent */
+    if (area < 0) {
+        double tx = x1, ty = y1;
+        graphics_pixel_t tc = c1;
+        x1 = x2; y1 = y2; c1 = c2;
+        x2 = tx; y2 = ty; c2 = tc;
+        area = -area;
     }
 
-    renderer->pixels = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * width * height);
+    /* Clamp before converting, as off screen vertices
+       may be far outside the range of an int. */
+    int min_x = (int) floor (max_double (min_double (x0, min_double (x1, x2)), 0));
+    int max_x = (int) floor (min_double (max_double (x0, max_double (x1, x2)), renderer->width - 1));
+    int min_y = (int) floor (max_double (min_double (y0, min_double (y1, y2)), 0));
+    int max_y = (int) floor (min_double (max_double (y0, max_double (y1, y2)), renderer->height - 1));
 
-    if (renderer->pixels == NULL) {
-        fprintf (stderr, "Error - graphics/renderer: could not allocate memory for render buffer.\n");
-        free (renderer);
-        return NULL;
+    if (min_x > max_x || min_y > max_y) {
+        return;
     }
 
-    renderer->width = width;
-    renderer->height = height;
+    mark_dirty (renderer, min_x, min_y, max_x, max_y);
+
+    /* Edge functions e(x, y) = a * x + b * y + c, positive
+       inside. Edge i is opposite vertex i. */
+    double a[3] = { y1 - y2, y2 - y0, y0 - y1 };
+    double b[3] = { x2 - x1, x0 - x2, x1 - x0 };
+    double c[3] = { x1 * y2 - x2 * y1, x2 * y0 - x0 * y2, x0 * y1 - x1 * y0 };
+
+    /* Offsets of each edge function from a pixel's origin
+       to its samples, and their range, so that pixels
+       entirely inside or outside an edge skip the per
+       sample tests. */
+    double sample_offset[3][GRAPHICS_MSAA_SAMPLES];
+    double min_offset[3];
+    double max_offset[3];
+
+    for (int e = 0; e < 3; e++) {
+        min_offset[e] = HUGE_VAL;
+        max_offset[e] = -HUGE_VAL;
+
+        for (int i = 0; i < GRAPHICS_MSAA_SAMPLES; i++) {
+            sample_offset[e][i] = a[e] * msaa_sample_x[i] + b[e] * msaa_sample_y[i];
+            min_offset[e] = min_double (min_offset[e], sample_offset[e][i]);
+            max_offset[e] = max_double (max_offset[e], sample_offset[e][i]);
+        }
+    }
 
-    return renderer;    
-};
+    /* Edges as x = ex + (y - ey) * slope, for finding the
+       extent of the triangle within each row. */
+    double vx[3] = { x0, x1, x2 };
+    double vy[3] = { y0, y1, y2 };
+    double slope[3];
 
-void graphics_renderer_display (graphics_renderer_t *renderer, system_window_t *window) {
-    system_window_render_buffer_to_screen (window, renderer->pixels);
-};
+    for (int e = 0; e < 3; e++) {
+        double dy = vy[(e + 1) % 3] - vy[e];
+        slope[e] = dy != 0 ? (vx[(e + 1) % 3] - vx[e]) / dy : 0;
+    }
 
-void graphics_renderer_clear_buffer (graphics_renderer_t *renderer) {
-    memset (renderer->pixels, 0, sizeof (graphics_pixel_t) * renderer->width * renderer->height);
-};
+    bool flat = memcmp (&c0, &c1, sizeof (graphics_pixel_t)) == 0 && memcmp (&c0, &c2, sizeof (graphics_pixel_t)) == 0;
 
-void graphics_renderer_draw_pixel (graphics_renderer_t *renderer, int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
-    if (x >= 0 && x < renderer->width && y >= 0 && y < renderer->height) {
-        graphics_pixel_t *px = &renderer->pixels[y * renderer->width + x];
-        px->red = red;
-        px->green = green;
-        px->blue = blue;
+    /* The edge functions sum to twice the area everywhere,
+       so each channel is a plane in x and y and needs no
+       division per pixel. */
+    double plane[3][3];
+    double channel[3][3] = {
+        { c0.red, c1.red, c2.red },
+        { c0.green, c1.green, c2.green },
+        { c0.blue, c1.blue, c2.blue }
     };
-};
+
+    for (int k = 0; k < 3 && !flat; k++) {
+        plane[k][0] = (a[0] * channel[k][0] + a[1] * channel[k][1] + a[2] * channel[k][2]) / area;
+        plane[k][1] = (b[0] * channel[k][0] + b[1] * channel[k][1] + b[2] * channel[k][2]) / area;
+        plane[k][2] = (c[0] * channel[k][0] + c[1] * channel[k][1] + c[2] * channel[k][2]) / area;
+    }
+
+    unsigned int full_mask = (1u << GRAPHICS_MSAA_SAMPLES) - 1;
+    graphics_pixel_t source = source_pixel (renderer, c0.red, c0.green, c0.blue);
+    graphics_blend_mode_t mode = active_blend_mode (renderer);
+
+    for (int y = min_y; y <= max_y; y++) {
+        /* Horizontal extent of the triangle within this row,
+           so that long thin triangles (such as lines) do not
+           walk their whole bounding box. */
+        double lo = HUGE_VAL;
+        double hi = -HUGE_VAL;
+
+        for (int e = 0; e < 3; e++) {
+            double ay = vy[e];
+            double by = vy[(e + 1) % 3];
+            double top = max_double (min_double (ay, by), y);
+            double bottom = min_double (max_double (ay, by), y + 1);
+
+            if (top > bottom) {
+                continue;
+            }
+
+            double xt = vx[e] + (top - ay) * slope[e];
+            double xb = vx[e] + (bottom - ay) * slope[e];
+
+            if (ay == by) {
+                xt = vx[e];
+                xb = vx[(e + 1) % 3];
+            }
+
+            lo = min_double (lo, min_double (xt, xb));
+            hi = max_double (hi, max_double (xt, xb));
+        }
+
+        if (lo > hi) {
+            continue;
+        }
+
+        int row_min_x = (int) floor (max_double (lo, min_x));
+        int row_max_x = (int) floor (min_double (hi, max_x));
+
+        double rgb[3] = { 0, 0, 0 };
+
+        for (int k = 0; k < 3 && !flat; k++) {
+            rgb[k] = plane[k][0] * (row_min_x + 0.5) + plane[k][1] * (y + 0.5) + plane[k][2];
+        }
+
+        double e0 = a[0] * row_min_x + b[0] * y + c[0];
+        double e1 = a[1] * row_min_x + b[1] * y + c[1];
+        double e2 = a[2] * row_min_x + b[2] * y + c[2];
+
+        for (int x = row_min_x; x <= row_max_x; x++, e0 += a[0], e1 += a[1], e2 += a[2], rgb[0] += plane[0][0], rgb[1] += plane[1][0], rgb[2] += plane[2][0]) {
+            unsigned int mask;
+
+            if (e0 + min_offset[0] >= 0 && e1 + min_offset[1] >= 0 && e2 + min_offset[2] >= 0) {
+                mask = full_mask;
+            } else if (e0 + max_offset[0] < 0 || e1 + max_offset[1] < 0 || e2 + max_offset[2] < 0) {
+                continue;
+            } else {
+                mask = 0;
+
+                for (int i = 0; i < GRAPHICS_MSAA_SAMPLES; i++) {
+                    if (e0 + sample_offset[0][i] >= 0 && e1 + sample_offset[1][i] >= 0 && e2 + sample_offset[2][i] >= 0) {
+                        mask |= 1u << i;
+                    }
+                }
+
+                if (mask == 0) {
+                    continue;
+                }
+            }
+
+            if (!flat) {
+                /* Shaded once, at the pixel centre, and clamped
+                   as partly covered pixels may have their centre
+                   outside the triangle. */
+                source = source_pixel (renderer,
+                    (uint8_t) min_double (max_double (rgb[0], 0), 255),
+                    (uint8_t) min_double (max_double (rgb[1], 0), 255),
+                    (uint8_t) min_double (max_double (rgb[2], 0), 255));
+            }
+
+            msaa_write (renderer, x, y, mask, source, mode);
+        }
+    }
+}
+
+/* Rasterize a convex quad of one colour with per
+   sample coverage. Lines use this rather than two
+   triangles, which would both cover the samples on
+   their shared diagonal and so blend them twice. */
+static void msaa_fill_quad (graphics_renderer_t *renderer, const double vx[4], const double vy[4], graphics_pixel_t colour) {
+    double area = 0;
+
+    for (int e = 0; e < 4; e++) {
+        area += vx[e] * vy[(e + 1) % 4] - vx[(e + 1) % 4] * vy[e];
+    }
+
+    if (area == 0) {
+        return;
+    }
+
+    int min_x = (int) floor (max_double (min_double (min_double (vx[0], vx[1]), min_double (vx[2], vx[3])), 0));
+    int max_x = (int) floor (min_double (max_double (max_double (vx[0], vx[1]), max_double (vx[2], vx[3])), renderer->width - 1));
+    int min_y = (int) floor (max_double (min_double (min_double (vy[0], vy[1]), min_double (vy[2], vy[3])), 0));
+    int max_y = (int) floor (min_double (max_double (max_double (vy[0], vy[1]), max_double (vy[2], vy[3])), renderer->height - 1));
+
+    if (min_x > max_x || min_y > max_y) {
+        return;
+    }
+
+    mark_dirty (renderer, min_x, min_y, max_x, max_y);
+
+    /* Edge functions as for triangles, with edge i running
+       from vertex i to the next, and negated if need be so
+       that they are positive inside either winding. */
+    double sign = area > 0 ? 1 : -1;
+    double a[4], b[4], c[4];
+    double sample_offset[4][GRAPHICS_MSAA_SAMPLES];
+    double min_offset[4];
+    double max_offset[4];
+    double slope[4];
+
+    for (int e = 0; e < 4; e++) {
+        int n = (e + 1) % 4;
+        a[e] = sign * (vy[e] - vy[n]);
+        b[e] = sign * (vx[n] - vx[e]);
+        c[e] = sign * (vx[e] * vy[n] - vx[n] * vy[e]);
+
+        min_offset[e] = HUGE_VAL;
+        max_offset[e] = -HUGE_VAL;
+
+        for (int i = 0; i < GRAPHICS_MSAA_SAMPLES; i++) {
+            sample_offset[e][i] = a[e] * msaa_sample_x[i] + b[e] * msaa_sample_y[i];
+            min_offset[e] = min_double (min_offset[e], sample_offset[e][i]);
+            max_offset[e] = max_double (max_offset[e], sample_offset[e][i]);
+        }
+
+        double dy = vy[n] - vy[e];
+        slope[e] = dy != 0 ? (vx[n] - vx[e]) / dy : 0;
+    }
+
+    unsigned int full_mask = (1u << GRAPHICS_MSAA_SAMPLES) - 1;
+    graphics_pixel_t source = source_pixel (renderer, colour.red, colour.green, colour.blue);
+    graphics_blend_mode_t mode = active_blend_mode (renderer);
+
+    for (int y = min_y; y <= max_y; y++) {
+        double lo = HUGE_VAL;
+        double hi = -HUGE_VAL;
+
+        for (int e = 0; e < 4; e++) {
+            int n = (e + 1) % 4;
+            double top = max_double (min_double (vy[e], vy[n]), y);
+            double bottom = min_double (max_double (vy[e], vy[n]), y + 1);
+
+            if (top > bottom) {
+                continue;
+            }
+
+            double xt = vx[e] + (top - vy[e]) * slope[e];
+            double xb = vx[e] + (bottom - vy[e]) * slope[e];
+
+            if (vy[e] == vy[n]) {
+                xt = vx[e];
+                xb = vx[n];
+            }
+
+            lo = min_double (lo, min_double (xt, xb));
+            hi = max_double (hi, max_double (xt, xb));
+        }
+
+        if (lo > hi) {
+            continue;
+        }
+
+        int row_min_x = (int) floor (max_double (lo, min_x));
+        int row_max_x = (int) floor (min_double (hi, max_x));
+        double edge[4];
+
+        for (int e = 0; e < 4; e++) {
+            edge[e] = a[e] * row_min_x + b[e] * y + c[e];
+        }
+
+        for (int x = row_min_x; x <= row_max_x; x++, edge[0] += a[0], edge[1] += a[1], edge[2] += a[2], edge[3] += a[3]) {
+            unsigned int mask = full_mask;
+
+            for (int e = 0; e < 4 && mask != 0; e++) {
+                if (edge[e] + min_offset[e] >= 0) {
+                    continue;
+                }
+
+                if (edge[e] + max_offset[e] < 0) {
+                    mask = 0;
+                    continue;
+                }
+
+                for (int i = 0; i < GRAPHICS_MSAA_SAMPLES; i++) {
+                    if (edge[e] + sample_offset[e][i] < 0) {
+                        mask &= ~(1u << i);
+                    }
+                }
+            }
+
+            if (mask != 0) {
+                msaa_write (renderer, x, y, mask, source, mode);
+            }
+        }
+    }
+}
+
+/* Draw a line as a one pixel wide quad, so that it
+   gets the same edge anti-aliasing as triangles. */
+static void msaa_draw_line (graphics_renderer_t *renderer, double x0, double y0, double x1, double y1, graphics_pixel_t colour) {
+    double dx = x1 - x0;
+    double dy = y1 - y0;
+    double length = sqrt (dx * dx + dy * dy);
+
+    if (length == 0) {
+        dx = 1;
+        dy = 0;
+    } else {
+        dx /= length;
+        dy /= length;
+    }
+
+    /* Half width across the line, and half a pixel of
+       extension at each end to cover the end points. */
+    double nx = -dy * 0.5;
+    double ny = dx * 0.5;
+    double ex = dx * 0.5;
+    double ey = dy * 0.5;
+
+    double vx[4] = { x0 - ex + nx, x0 - ex - nx, x1 + ex - nx, x1 + ex + nx };
+    double vy[4] = { y0 - ey + ny, y0 - ey - ny, y1 + ey - ny, y1 + ey + ny };
+
+    msaa_fill_quad (renderer, vx, vy, colour);
+}
 
 static void draw_line_pixel_dx (double x, double y, void *aux1, void *aux2) {
     int x_i = (int) x;
     int y_i = (int) y;
     graphics_renderer_t *renderer = (graphics_renderer_t *) aux1;
     graphics_pixel_t *pixel = (graphics_pixel_t *) aux2;
-    graphics_renderer_draw_pixel (renderer, x_i, y_i, pixel->red, pixel->green, pixel->blue);
+    put_pixel (renderer, x_i, y_i, pixel->red, pixel->green, pixel->blue);
 };
 
 static void draw_line_pixel_dy (double x, double y, void *aux1, void *aux2) {
@@ -69,7 +1442,7 @@ static void draw_line_pixel_dy (double x, double y, void *aux1, void *aux2) {
     int y_i = (int) x;
     graphics_renderer_t *renderer = (graphics_renderer_t *) aux1;
     graphics_pixel_t *pixel = (graphics_pixel_t *) aux2;
-    graphics_renderer_draw_pixel (renderer, x_i, y_i, pixel->red, pixel->green, pixel->blue);
+    put_pixel (renderer, x_i, y_i, pixel->red, pixel->green, pixel->blue);
 };
 
 static void swap_int (int *x, int *y) {
@@ -85,6 +1458,12 @@ static void swap_uint_8 (uint8_t *x, uint8_t *y) {
 }
 
 void graphics_renderer_draw_line (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, uint8_t red, uint8_t green, uint8_t blue) {
+    if (renderer->msaa) {
+        /* Integer coordinates are pixel centres */
+        msaa_draw_line (renderer, x0 + 0.5, y0 + 0.5, x1 + 0.5, y1 + 0.5, (graphics_pixel_t) { blue, green, red, 0 });
+        return;
+    }
+
     int dx = x1 - x0;
     int dy = y1 - y0;
 
@@ -93,6 +1472,10 @@ void graphics_renderer_draw_line (graphics_renderer_t *renderer, int x0, int y0,
     px.green = green;
     px.blue = blue;
 
+    /* Widened by a pixel as the interpolation may
+       round just outside the end points. */
+    mark_dirty (renderer, (x0 < x1 ? x0 : x1) - 1, (y0 < y1 ? y0 : y1) - 1, (x0 > x1 ? x0 : x1) + 1, (y0 > y1 ? y0 : y1) + 1);
+
     if (abs (dx) > abs (dy)) {
         /* Line is closer to horizontal than vertical.
            Interpolate with respect to dx from left to
@@ -126,11 +1509,20 @@ static void draw_horizontal_line (graphics_renderer_t *renderer, int x0, int x1,
         swap_int (&x0, &x1);
     }
 
-    for (int i = x0; i <= x1; i++) {
-        graphics_renderer_draw_pixel (renderer, i, y, red, green, blue);
+    if (y < 0 || y >= renderer->height || x1 < 0 || x0 >= renderer->width) {
+        return;
     }
+
+    x0 = x0 < 0 ? 0 : x0;
+    x1 = x1 >= renderer->width ? renderer->width - 1 : x1;
+
+    write_span (renderer, x0, x1, y, NULL, source_pixel (renderer, red, green, blue));
 };
 
+/* Pixels of a shaded span are generated this many
+   at a time before being blended into the target. */
+#define SHADED_SPAN_CHUNK 64
+
 static void draw_horizontal_line_shaded (graphics_renderer_t *renderer, int x0, int x1, int y, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2) {
     if (x0 > x1) {
         swap_int (&x0, &x1);
@@ -139,27 +1531,59 @@ static void draw_horizontal_line_shaded (graphics_renderer_t *renderer, int x0,
         swap_uint_8 (&b_1, &b_2);
     }
 
+    if (y < 0 || y >= renderer->height || x1 < 0 || x0 >= renderer->width) {
+        return;
+    }
+
     double r = r_1;
     double g = g_1;
     double b = b_1;
+    double dr = 0;
+    double dg = 0;
+    double db = 0;
 
     if (x1 > x0) {
-        double dr = (r_2 - r_1) / (double) (x1 - x0);
-        double dg = (g_2 - g_1) / (double) (x1 - x0);
-        double db = (b_2 - b_1) / (double) (x1 - x0);
-        
-        for (int i = x0; i <= x1; i++) {
-            graphics_renderer_draw_pixel (renderer, i, y, r, g, b);
+        dr = (r_2 - r_1) / (double) (x1 - x0);
+        dg = (g_2 - g_1) / (double) (x1 - x0);
+        db = (b_2 - b_1) / (double) (x1 - x0);
+    }
+
+    /* Skip the part of the span left of the screen */
+    if (x0 < 0) {
+        r -= dr * x0;
+        g -= dg * x0;
+        b -= db * x0;
+        x0 = 0;
+    }
+
+    x1 = x1 >= renderer->width ? renderer->width - 1 : x1;
+
+    graphics_pixel_t span[SHADED_SPAN_CHUNK];
+
+    for (int x = x0; x <= x1;) {
+        int n = x1 - x + 1 < SHADED_SPAN_CHUNK ? x1 - x + 1 : SHADED_SPAN_CHUNK;
+
+        for (int i = 0; i < n; i++) {
+            span[i] = source_pixel (renderer, (uint8_t) r, (uint8_t) g, (uint8_t) b);
             r += dr;
             g += dg;
             b += db;
         }
-    } else {
-        graphics_renderer_draw_pixel (renderer, x0, y, r_1, g_1, b_1);
+
+        write_span (renderer, x, x + n - 1, y, span, span[0]);
+        x += n;
     }
 };
 
 void graphics_renderer_draw_filled_triangle (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue) {
+    if (renderer->msaa) {
+        graphics_pixel_t c = { blue, green, red, 0 };
+        msaa_fill_triangle (renderer, x0 + 0.5, y0 + 0.5, x1 + 0.5, y1 + 0.5, x2 + 0.5, y2 + 0.5, c, c, c);
+        return;
+    }
+
+    mark_triangle_dirty (renderer, x0, y0, x1, y1, x2, y2);
+
     /* Sort the points in vertical order */
     if (y1 < y0) {
         swap_int (&x0, &x1);
@@ -190,7 +1614,7 @@ void graphics_renderer_draw_filled_triangle (graphics_renderer_t *renderer, int
         double x_0_1 = (x1 - x0) / (double) dy_0_1;
         double x_0_2 = (x2 - x0) / (double) dy_0_2;
     
-        for (int i = y0; i <= y1; i++) {
+        for (int i = y0; i < y1; i++) {
             draw_horizontal_line (renderer, (int) p1, (int) p2, i, red, green, blue);
             p1 += x_0_1;
             p2 += x_0_2;
@@ -215,6 +1639,14 @@ void graphics_renderer_draw_filled_triangle (graphics_renderer_t *renderer, int
 }
 
 void graphics_renderer_draw_shaded_triangle (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t r_0, uint8_t g_0, uint8_t b_0, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2) {
+    if (renderer->msaa) {
+        msaa_fill_triangle (renderer, x0 + 0.5, y0 + 0.5, x1 + 0.5, y1 + 0.5, x2 + 0.5, y2 + 0.5,
+            (graphics_pixel_t) { b_0, g_0, r_0, 0 }, (graphics_pixel_t) { b_1, g_1, r_1, 0 }, (graphics_pixel_t) { b_2, g_2, r_2, 0 });
+        return;
+    }
+
+    mark_triangle_dirty (renderer, x0, y0, x1, y1, x2, y2);
+
     /* Sort the points in vertical order */
     if (y1 < y0) {
         swap_int (&x0, &x1);
@@ -340,43 +1772,405 @@ static void interpolate (double i0, double d0, double i1, double d1, void (*func
     }
 };
 
-void graphics_renderer_render_model (graphics_renderer_t *renderer, resources_model_t *model, graphics_camera_t *camera) {
-    /* Transform from model space into world space */
-    maths_mat4x4f transform = maths_model_transform (model->position, model->scale, model->rotation);
+/* Frustum planes, each given by a point and two
+   directions within the plane. */
+#define GRAPHICS_CLIP_PLANES 5
+
+/* Each plane can at most double the number of
+   triangles left from one face. */
+#define GRAPHICS_MAX_CLIPPED_TRIANGLES (1 << GRAPHICS_CLIP_PLANES)
+
+typedef struct {
+    maths_vec4f point;
+    maths_vec4f dir_1;
+    maths_vec4f dir_2;
+} graphics_clip_plane_t;
+
+/* In the order the triangles pass through them - the
+   view plane first, then left, right, bottom and top. */
+static void frustum_planes (const graphics_geometry_t *geometry, graphics_clip_plane_t *planes) {
+    double d = geometry->view_distance;
+    double w = geometry->view_width / 2;
+    double h = geometry->view_height / 2;
+
+    planes[0] = (graphics_clip_plane_t) { { 0.0, 0.0, d, 1.0 }, { 1.0, 0.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0, 0.0 } };
+    planes[1] = (graphics_clip_plane_t) { { 0.0, 0.0, 0.0, 1.0 }, { -w, 0.0, d, 0.0 }, { 0.0, 1.0, 0.0, 0.0 } };
+    planes[2] = (graphics_clip_plane_t) { { 0.0, 0.0, 0.0, 1.0 }, { w, 0.0, d, 0.0 }, { 0.0, 1.0, 0.0, 0.0 } };
+    planes[3] = (graphics_clip_plane_t) { { 0.0, 0.0, 0.0, 1.0 }, { 0.0, -h, d, 0.0 }, { 1.0, 0.0, 0.0, 0.0 } };
+    planes[4] = (graphics_clip_plane_t) { { 0.0, 0.0, 0.0, 1.0 }, { 0.0, h, d, 0.0 }, { 1.0, 0.0, 0.0, 0.0 } };
+}
+
+/* Clip a camera space triangle against each plane in
+   turn, passing the pieces back and forth between two
+   halves of the scratch buffer, then project whatever
+   is left and pass it on. */
+static void clip_and_emit_triangle (const graphics_geometry_t *geometry, graphics_clip_plane_t *planes, maths_triangle4f *scratch, maths_vec4f v1, maths_vec4f v2, maths_vec4f v3) {
+    /* A point known to be inside every plane */
+    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, geometry->view_distance + 1.0, 1.0 };
+
+    maths_triangle4f *in = scratch;
+    maths_triangle4f *out = scratch + GRAPHICS_MAX_CLIPPED_TRIANGLES;
+    int count = 1;
+
+    in[0][0] = v1;
+    in[0][1] = v2;
+    in[0][2] = v3;
+
+    for (int p = 0; p < GRAPHICS_CLIP_PLANES && count > 0; p++) {
+        int n = 0;
+
+        for (int i = 0; i < count; i++) {
+            n += clip_triangle_plane (in[i], planes[p].point, planes[p].dir_1, planes[p].dir_2, sample, out[n], out[n + 1]);
+        }
+
+        maths_triangle4f *swap = in;
+        in = out;
+        out = swap;
+        count = n;
+    }
+
+    for (int i = 0; i < count; i++) {
+        maths_vec2f p[3];
+
+        for (int j = 0; j < 3; j++) {
+            p[j] = maths_project_vertex_4f_3d (geometry->view_distance, geometry->width, geometry->height, geometry->view_width, geometry->view_height, in[i][j]);
+        }
+
+        geometry->sink (geometry->aux, in[i], p);
+    }
+}
 
-    /* To transform from world space to camera space, we
-       need to first translate by the negative of the camera
-       position, then rotate by the inverse of the camera angle
-       and then scale by the camera scale. */
-    maths_mat4x4f camera_transform = maths_4x4f_translation_3d (-camera->position.x, -camera->position.y, -camera->position.z);
-    camera_transform = maths_mat4x4f_mul(maths_4x4f_rotation_yxz_3d (-camera->rotation.x, -camera->rotation.y, -camera->rotation.z), camera_transform);
+/* Scratch memory for the rest of the frame, from the
+   render thread's sub-arena. */
+static void *frame_alloc (graphics_renderer_t *renderer, size_t size, size_t align) {
+    return system_frame_arena_alloc (&renderer->frame_arena, GRAPHICS_RENDER_THREAD, size, align);
+}
+
+static void draw_projected_triangle_sink (void *aux, maths_triangle4f t, const maths_vec2f *p) {
+    graphics_renderer_draw_projected_triangle ((graphics_renderer_t *) aux, t, p);
+}
+
+/* Geometry which draws straight into the renderer */
+static graphics_geometry_t immediate_geometry (graphics_renderer_t *renderer) {
+    return (graphics_geometry_t) {
+        renderer->width,
+        renderer->height,
+        renderer->view_distance,
+        renderer->view_width,
+        renderer->view_height,
+        &renderer->frame_arena,
+        GRAPHICS_RENDER_THREAD,
+        draw_projected_triangle_sink,
+        renderer,
+        renderer->jobs
+    };
+}
+
+/* To transform from world space to camera space, we
+   need to first translate by the negative of the camera
+   position, then rotate by the inverse of the camera angle.
+   Only depends on the camera, so callers drawing many
+   models should build it once. */
+maths_mat4x4f graphics_camera_view_transform (graphics_camera_t *camera) {
+    maths_quat rotation = maths_quat_from_euler_yxz (-camera->rotation.x, -camera->rotation.y, -camera->rotation.z);
+    maths_vec4f translation = (maths_vec4f) { -camera->position.x, -camera->position.y, -camera->position.z, 1.0 };
+
+    return maths_mat4x4f_mul_affine (maths_quat_to_mat4x4f (rotation), maths_4x4f_translation_3d (translation.x, translation.y, translation.z));
+}
+
+/* World space ray from the camera through a point on
+   screen, given in output pixels, e.g. the mouse
+   position. It passes through the view plane at
+   t = 1. */
+resources_ray_t graphics_camera_pick_ray (graphics_renderer_t *renderer, graphics_camera_t *camera, double x, double y) {
+    maths_mat4x4f inverse = maths_mat4x4f_inverse_affine (graphics_camera_view_transform (camera));
+    maths_vec4f direction = {
+        (x - renderer->output_width / 2.0) * renderer->view_width / renderer->output_width,
+        (y - renderer->output_height / 2.0) * renderer->view_height / renderer->output_height,
+        renderer->view_distance,
+        0.0
+    };
+
+    return (resources_ray_t) { camera->position, maths_mat4x4f_mul_vec4f (inverse, direction), INFINITY };
+}
+
+/* Transform from model space into camera space */
+static maths_mat4x4f model_view_transform (resources_model_t *model, graphics_camera_t *camera) {
+    maths_mat4x4f view = graphics_camera_view_transform (camera);
+    return maths_mat4x4f_mul_affine (view, maths_model_transform (model->position, model->scale, model->rotation));
+}
+
+typedef struct {
+    maths_vec4f *out;
+    const resources_mesh_t *mesh;
+    const maths_mat4x4f *transform;
+} graphics_vertex_batch_t;
+
+static void transform_vertex_batch (int begin, int end, void *arg) {
+    graphics_vertex_batch_t *batch = (graphics_vertex_batch_t *) arg;
+    const resources_mesh_t *mesh = batch->mesh;
+
+    switch (mesh->format) {
+        case RESOURCES_VERTEX_FLOAT3:
+            graphics_kernels.transform_vertices_float3 (batch->out + begin, mesh->vertices_float3 + begin, end - begin, batch->transform);
+            break;
+        case RESOURCES_VERTEX_QUANTIZED:
+            graphics_kernels.transform_vertices_quantized (batch->out + begin, mesh->vertices_quantized + begin, end - begin, batch->transform);
+            break;
+        default:
+            graphics_kernels.transform_vertices (batch->out + begin, mesh->vertices + begin, end - begin, batch->transform);
+            break;
+    }
+}
 
-    transform = maths_mat4x4f_mul (camera_transform, transform);
+/* Transform each vertex once, rather than once for
+   every face that uses it, in batches shared out
+   between the workers. Quantized vertices are
+   dequantized by the same matrix. */
+static void transform_mesh_vertices (system_jobs_t *jobs, const resources_mesh_t *mesh, const maths_mat4x4f *transform, maths_vec4f *out) {
+    maths_mat4x4f dequantized;
+
+    if (mesh->format == RESOURCES_VERTEX_QUANTIZED) {
+        dequantized = resources_mesh_dequantize (mesh, *transform);
+        transform = &dequantized;
+    }
 
-    for (int i = 0; i < model->mesh->num_faces; i++) {
-        maths_vec4f v1 = model->mesh->vertices[model->mesh->faces[i][0]].coord;
-        maths_vec4f v2 = model->mesh->vertices[model->mesh->faces[i][1]].coord;
-        maths_vec4f v3 = model->mesh->vertices[model->mesh->faces[i][2]].coord;
-        v1.w = 1;
-        v2.w = 1;
-        v3.w = 1;
+    graphics_vertex_batch_t batch = { out, mesh, transform };
+    system_jobs_parallel_for (jobs, 0, mesh->num_vertices, GRAPHICS_JOB_VERTICES, transform_vertex_batch, &batch);
+}
 
-        v1 = maths_mat4x4f_mul_vec4f (transform, v1);
-        v2 = maths_mat4x4f_mul_vec4f (transform, v2);
-        v3 = maths_mat4x4f_mul_vec4f (transform, v3);
+static void draw_mesh (const graphics_geometry_t *geometry, resources_mesh_t *mesh, maths_mat4x4f transform, graphics_clip_plane_t *planes, maths_triangle4f *scratch) {
+    maths_vec4f *vertices = (maths_vec4f *) system_frame_arena_alloc (geometry->arena, geometry->thread, sizeof (maths_vec4f) * mesh->num_vertices, _Alignof (maths_vec4f));
 
-        /* vertices are now in camera space - clip them */
-        maths_triangle4f t = {v1, v2, v3};
-        clip_view_plane (renderer, t);
+    if (vertices == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate frame memory for mesh.");
+        return;
+    }
 
-        //maths_vec2f p1 = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, v1);
-        //maths_vec2f p2 = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, v2);
-        //maths_vec2f p3 = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, v3);
+    transform_mesh_vertices (geometry->jobs, mesh, &transform, vertices);
 
-        //graphics_renderer_draw_wireframe_triangle (renderer, p1.x, p1.y, p2.x, p2.y, p3.x, p3.y, 0, 0, 255);
+    for (int i = 0; i < mesh->num_faces; i++) {
+        /* Vertices are in camera space - clip them */
+        clip_and_emit_triangle (geometry, planes, scratch, vertices[mesh->faces[i][0]], vertices[mesh->faces[i][1]], vertices[mesh->faces[i][2]]);
     }
+}
+
+void graphics_renderer_render_model (graphics_renderer_t *renderer, resources_model_t *model, graphics_camera_t *camera) {
+    maths_mat4x4f transform = model_view_transform (model, camera);
+    graphics_renderer_render_mesh (renderer, model->mesh, &transform);
 };
 
+/* A frustum plane as a normal pointing inwards */
+typedef struct {
+    maths_vec4f point;
+    maths_vec4f normal;
+} graphics_edge_plane_t;
+
+/* Clip a camera space edge against each plane in
+   turn, then project and draw whatever is left. */
+static void draw_clipped_edge (graphics_renderer_t *renderer, const graphics_edge_plane_t *planes, maths_vec4f a, maths_vec4f b) {
+    for (int p = 0; p < GRAPHICS_CLIP_PLANES; p++) {
+        double d0 = maths_vec4f_dot (planes[p].normal, maths_vec4f_sub (a, planes[p].point));
+        double d1 = maths_vec4f_dot (planes[p].normal, maths_vec4f_sub (b, planes[p].point));
+
+        if (d0 < 0.0 && d1 < 0.0) {
+            return;
+        }
+
+        if (d0 < 0.0) {
+            a = maths_vec4f_add (a, maths_vec4f_scale (maths_vec4f_sub (b, a), d0 / (d0 - d1)));
+        } else if (d1 < 0.0) {
+            b = maths_vec4f_add (a, maths_vec4f_scale (maths_vec4f_sub (b, a), d0 / (d0 - d1)));
+        }
+    }
+
+    maths_vec2f p0 = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, a);
+    maths_vec2f p1 = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, b);
+
+    if (renderer->msaa) {
+        msaa_draw_line (renderer, p0.x, p0.y, p1.x, p1.y, (graphics_pixel_t) { 255, 0, 0, 0 });
+    } else {
+        graphics_renderer_draw_line (renderer, p0.x, p0.y, p1.x, p1.y, 0, 0, 255);
+    }
+}
+
+/* Wireframe from the mesh's edge list, so each edge
+   is transformed, clipped and drawn once rather than
+   once for each face sharing it. */
+static void draw_mesh_edges (graphics_renderer_t *renderer, resources_mesh_t *mesh, const maths_mat4x4f *model_view) {
+    maths_vec4f *vertices = (maths_vec4f *) frame_alloc (renderer, sizeof (maths_vec4f) * mesh->num_vertices, _Alignof (maths_vec4f));
+    bool outline = renderer->wireframe == GRAPHICS_WIREFRAME_OUTLINE;
+    uint8_t *front = outline ? (uint8_t *) frame_alloc (renderer, mesh->num_faces, 1) : NULL;
+
+    if (vertices == NULL || (outline && front == NULL)) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate frame memory for mesh.");
+        return;
+    }
+
+    transform_mesh_vertices (renderer->jobs, mesh, model_view, vertices);
+
+    if (outline) {
+        /* Which faces look towards the camera, at the
+           origin of camera space. */
+        for (int i = 0; i < mesh->num_faces; i++) {
+            maths_vec4f a = vertices[mesh->faces[i][0]];
+            maths_vec4f n = maths_vec4f_cross_3d (maths_vec4f_sub (vertices[mesh->faces[i][1]], a), maths_vec4f_sub (vertices[mesh->faces[i][2]], a));
+            front[i] = maths_vec4f_dot (n, a) < 0.0;
+        }
+    }
+
+    graphics_geometry_t geometry = immediate_geometry (renderer);
+    graphics_clip_plane_t clip[GRAPHICS_CLIP_PLANES];
+    graphics_edge_plane_t planes[GRAPHICS_CLIP_PLANES];
+    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 };
+
+    frustum_planes (&geometry, clip);
+
+    for (int p = 0; p < GRAPHICS_CLIP_PLANES; p++) {
+        maths_vec4f normal = maths_vec4f_cross_3d (clip[p].dir_1, clip[p].dir_2);
+
+        if (maths_vec4f_dot (normal, maths_vec4f_sub (sample, clip[p].point)) < 0.0) {
+            normal = maths_vec4f_scale (normal, -1.0);
+        }
+
+        planes[p] = (graphics_edge_plane_t) { clip[p].point, normal };
+    }
+
+    for (int i = 0; i < mesh->num_edges; i++) {
+        const resources_edge_t *edge = &mesh->edges[i];
+
+        if (outline && edge->faces[1] >= 0 && front[edge->faces[0]] == front[edge->faces[1]] && edge->cosine >= renderer->feature_cosine) {
+            continue;
+        }
+
+        draw_clipped_edge (renderer, planes, vertices[edge->vertices[0]], vertices[edge->vertices[1]]);
+    }
+}
+
+/* Draw a mesh given its model to camera space
+   transform, e.g. a camera view transform times a
+   world matrix from a transform hierarchy. */
+void graphics_renderer_render_mesh (graphics_renderer_t *renderer, resources_mesh_t *mesh, const maths_mat4x4f *model_view) {
+    if (renderer->wireframe != GRAPHICS_WIREFRAME_TRIANGLES && renderer->deferred == NULL && mesh->edges != NULL) {
+        draw_mesh_edges (renderer, mesh, model_view);
+        return;
+    }
+
+    graphics_geometry_t geometry = immediate_geometry (renderer);
+    graphics_geometry_render_mesh (&geometry, mesh, model_view);
+}
+
+/* Transform, clip and project a mesh, handing each
+   screen space triangle to the geometry's sink. Only
+   touches the geometry, so it may run on a different
+   thread from the renderer the triangles are for. */
+void graphics_geometry_render_mesh (const graphics_geometry_t *geometry, resources_mesh_t *mesh, const maths_mat4x4f *model_view) {
+    maths_triangle4f *scratch = (maths_triangle4f *) system_frame_arena_alloc (geometry->arena, geometry->thread, sizeof (maths_triangle4f) * 2 * GRAPHICS_MAX_CLIPPED_TRIANGLES, _Alignof (maths_vec4f));
+
+    if (scratch == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate frame memory for model.");
+        return;
+    }
+
+    graphics_clip_plane_t planes[GRAPHICS_CLIP_PLANES];
+    frustum_planes (geometry, planes);
+
+    draw_mesh (geometry, mesh, *model_view, planes, scratch);
+}
+
+/* True if a model space box is wholly outside one of
+   the frustum planes, going by its corners in camera
+   space. */
+static bool box_outside_frustum (graphics_renderer_t *renderer, maths_mat4x4f transform, graphics_clip_plane_t *planes, const float *min, const float *max, double *nearest) {
+    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 };
+    maths_vec4f corners[8];
+
+    *nearest = INFINITY;
+
+    for (int i = 0; i < 8; i++) {
+        maths_vec4f c = { i & 1 ? max[0] : min[0], i & 2 ? max[1] : min[1], i & 4 ? max[2] : min[2], 1.0 };
+        corners[i] = maths_mat4x4f_mul_vec4f (transform, c);
+
+        if (corners[i].z < *nearest) {
+            *nearest = corners[i].z;
+        }
+    }
+
+    for (int p = 0; p < GRAPHICS_CLIP_PLANES; p++) {
+        bool inside = false;
+
+        for (int i = 0; i < 8 && !inside; i++) {
+            inside = same_side_of_plane (corners[i], sample, planes[p].point, planes[p].dir_1, planes[p].dir_2);
+        }
+
+        if (!inside) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+typedef struct {
+    double depth;
+    uint32_t cluster;
+} graphics_visible_cluster_t;
+
+static int compare_visible_clusters (const void *a, const void *b) {
+    double da = ((const graphics_visible_cluster_t *) a)->depth;
+    double db = ((const graphics_visible_cluster_t *) b)->depth;
+    return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/* Draw the clusters of an out-of-core mesh which are
+   within the frustum, nearest first. Clusters not yet
+   in memory are read in up to the mesh's allowance
+   for the frame, and the rest are prefetched so they
+   can be drawn in a later frame. The model's mesh is
+   ignored - only its transform is used. */
+void graphics_renderer_render_clustered_mesh (graphics_renderer_t *renderer, resources_clustered_mesh_t *mesh, resources_model_t *model, graphics_camera_t *camera) {
+    graphics_geometry_t geometry = immediate_geometry (renderer);
+    maths_mat4x4f transform = model_view_transform (model, camera);
+    maths_triangle4f *scratch = (maths_triangle4f *) frame_alloc (renderer, sizeof (maths_triangle4f) * 2 * GRAPHICS_MAX_CLIPPED_TRIANGLES, _Alignof (maths_vec4f));
+    graphics_visible_cluster_t *visible = (graphics_visible_cluster_t *) frame_alloc (renderer, sizeof (graphics_visible_cluster_t) * (mesh->num_clusters + 1), _Alignof (graphics_visible_cluster_t));
+
+    if (scratch == NULL || visible == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/renderer", "could not allocate frame memory for clustered mesh.");
+        return;
+    }
+
+    graphics_clip_plane_t planes[GRAPHICS_CLIP_PLANES];
+    frustum_planes (&geometry, planes);
+
+    uint32_t num_visible = 0;
+
+    for (uint32_t i = 0; i < mesh->num_clusters; i++) {
+        resources_cluster_t *cluster = &mesh->clusters[i];
+        double depth;
+
+        if (!box_outside_frustum (renderer, transform, planes, cluster->min, cluster->max, &depth)) {
+            visible[num_visible++] = (graphics_visible_cluster_t) { depth, i };
+        }
+    }
+
+    /* Nearest first, so that what is read in first is
+       what covers the most of the screen. */
+    qsort (visible, num_visible, sizeof (graphics_visible_cluster_t), compare_visible_clusters);
+
+    resources_clustered_mesh_begin_frame (mesh);
+
+    for (uint32_t i = 0; i < num_visible; i++) {
+        resources_mesh_t *cluster = resources_clustered_mesh_acquire (mesh, visible[i].cluster);
+
+        if (cluster == NULL) {
+            resources_clustered_mesh_prefetch (mesh, visible[i].cluster);
+            continue;
+        }
+
+        draw_mesh (&geometry, cluster, transform, planes, scratch);
+    }
+}
+
 static bool same_side_of_plane (
     maths_vec4f p1,
     maths_vec4f p2,
@@ -556,122 +2350,32 @@ static int clip_triangle_plane (
     }
 
     if (!in_view[2]) {
-        clip_triangle_2_in (&t[2], &t[0], &t[1], plane_point, plane_dir_1, plane_dir_2, &t1[2], &t1[0], &t1[1], &t2[2], &t2[0], &t2[1]);
+        clip_triangle_2_in (&t[0], &t[1], &t[2], plane_point, plane_dir_1, plane_dir_2, &t1[0], &t1[1], &t1[2], &t2[0], &t2[1], &t2[2]);
         return 2;
     }
 
     return 0;
 }
 
-/* Clipping pipeline - clip against back plane */
-static void clip_view_plane (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec4f plane_point = (maths_vec4f) { 0.0, 0.0, renderer->view_distance, 1.0 };
-    maths_vec4f plane_dir_1 = (maths_vec4f) { 1.0, 0.0, 0.0, 0.0 };
-    maths_vec4f plane_dir_2 = (maths_vec4f) { 0.0, 1.0, 0.0, 0.0 };
-    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 };   
-    
-    maths_triangle4f o1;
-    maths_triangle4f o2;
-    int n = clip_triangle_plane (t, plane_point, plane_dir_1, plane_dir_2, sample, o1, o2);
-
-    if (n == 1) {
-        /* Send 1 triangle to the next stage of the pipeline */
-        clip_left_plane (renderer, o1);
-    } else if (n == 2) {
-        /* Send 2 triangles to the next stage of the pipeline */
-        clip_left_plane (renderer, o1);
-        clip_left_plane (renderer, o2);
-    }
-}
-
-static void clip_left_plane (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec4f plane_point = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
-    maths_vec4f plane_dir_1 = (maths_vec4f) { -renderer->view_width / 2, 0.0, renderer->view_distance, 0.0 };
-    maths_vec4f plane_dir_2 = (maths_vec4f) { 0.0, 1.0, 0.0, 0.0 };
-    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 };   
-    
-    maths_triangle4f o1;
-    maths_triangle4f o2;
-    int n = clip_triangle_plane (t, plane_point, plane_dir_1, plane_dir_2, sample, o1, o2);
-
-    if (n == 1) {
-        /* Send 1 triangle to the next stage of the pipeline */
-        clip_right_plane (renderer, o1);
-    } else if (n == 2) {
-        /* Send 2 triangles to the next stage of the pipeline */
-        clip_right_plane (renderer, o1);
-        clip_right_plane (renderer, o2);
-    }
-}
-
-static void clip_right_plane (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec4f plane_point = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
-    maths_vec4f plane_dir_1 = (maths_vec4f) { renderer->view_width / 2, 0.0, renderer->view_distance, 0.0 };
-    maths_vec4f plane_dir_2 = (maths_vec4f) { 0.0, 1.0, 0.0, 0.0 };
-    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 }; 
-    
-    maths_triangle4f o1;
-    maths_triangle4f o2;
-    int n = clip_triangle_plane (t, plane_point, plane_dir_1, plane_dir_2, sample, o1, o2);
-
-    if (n == 1) {
-        /* Send 1 triangle to the next stage of the pipeline */
-        clip_bottom_plane (renderer, o1);
-    } else if (n == 2) {
-        /* Send 2 triangles to the next stage of the pipeline */
-        clip_bottom_plane (renderer, o1);
-        clip_bottom_plane (renderer, o2);
-    }
-}
-
-static void clip_bottom_plane (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec4f plane_point = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
-    maths_vec4f plane_dir_1 = (maths_vec4f) { 0.0, -renderer->view_height / 2, renderer->view_distance, 0.0 };
-    maths_vec4f plane_dir_2 = (maths_vec4f) { 1.0, 0.0, 0.0, 0.0 };
-    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 }; 
-    
-    maths_triangle4f o1;
-    maths_triangle4f o2;
-    int n = clip_triangle_plane (t, plane_point, plane_dir_1, plane_dir_2, sample, o1, o2);
+/* Rasterize a clipped triangle, given in camera
+   space and as projected to the screen. */
+void graphics_renderer_draw_projected_triangle (graphics_renderer_t *renderer, maths_triangle4f t, const maths_vec2f *p) {
+    SYSTEM_LOG_TRACE ("graphics/renderer", "trying to render (%f, %f), (%f, %f), (%f, %f)", p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y);
 
-    if (n == 1) {
-        /* Send 1 triangle to the next stage of the pipeline */
-        clip_top_plane (renderer, o1);
-    } else if (n == 2) {
-        /* Send 2 triangles to the next stage of the pipeline */
-        clip_top_plane (renderer, o1);
-        clip_top_plane (renderer, o2);
+    if (renderer->deferred != NULL) {
+        /* Filled into the G-buffer, to be lit later */
+        graphics_deferred_draw_triangle (renderer, t, p);
+        return;
     }
-}
-
-static void clip_top_plane (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec4f plane_point = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
-    maths_vec4f plane_dir_1 = (maths_vec4f) { 0.0, renderer->view_height / 2, renderer->view_distance, 0.0 };
-    maths_vec4f plane_dir_2 = (maths_vec4f) { 1.0, 0.0, 0.0, 0.0 };
-    maths_vec4f sample = (maths_vec4f) { 0.0, 0.0, renderer->view_distance + 1.0, 1.0 }; 
-    
-    maths_triangle4f o1;
-    maths_triangle4f o2;
-    int n = clip_triangle_plane (t, plane_point, plane_dir_1, plane_dir_2, sample, o1, o2);
 
-    if (n == 1) {
-        /* Send 1 triangle to the next stage of the pipeline */
-        project_and_draw_triangle (renderer, o1);
-    } else if (n == 2) {
-        /* Send 2 triangles to the next stage of the pipeline */
-        project_and_draw_triangle (renderer, o1);
-        project_and_draw_triangle (renderer, o2);
+    if (renderer->msaa) {
+        /* Keep the sub-pixel positions for coverage */
+        graphics_pixel_t colour = { 255, 0, 0, 0 };
+        msaa_draw_line (renderer, p[0].x, p[0].y, p[1].x, p[1].y, colour);
+        msaa_draw_line (renderer, p[1].x, p[1].y, p[2].x, p[2].y, colour);
+        msaa_draw_line (renderer, p[2].x, p[2].y, p[0].x, p[0].y, colour);
+        return;
     }
-}
-
-static void project_and_draw_triangle (graphics_renderer_t *renderer, maths_triangle4f t) {
-    maths_vec2f p[3];
-
-    for (int i = 0; i < 3; i++) {
-        p[i] = maths_project_vertex_4f_3d (renderer->view_distance, renderer->width, renderer->height, renderer->view_width, renderer->view_height, t[i]);
-        printf ("(%f, %f, %f) -> (%f, %f)\n", t[i].x, t[i].y, t[i].z, p[i].x, p[i].y);
-    };
 
-    printf ("trying to render (%f, %f), (%f, %f), (%f, %f)\n", p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y);
     graphics_renderer_draw_wireframe_triangle (renderer, p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, 0, 0, 255);
 }
\ No newline at end of file
@@ -4,22 +4,162 @@
 #include "./../system/window.h"
 #include "./../maths/maths.h"
 #include "./../resources/resources.h"
+#include "./../resources/clustered_mesh.h"
+#include "./../resources/bvh.h"
+#include "./../system/frame_arena.h"
+#include "./../system/jobs.h"
 #include <stdint.h>
 
 typedef struct {
     uint8_t blue;
     uint8_t green;
     uint8_t red;
-    uint8_t pad;
+    uint8_t pad;        /* Alpha, when blending */
 } graphics_pixel_t;
 
+/* Formats of the render target, chosen when the
+   renderer is created. The compact formats halve or
+   quarter the memory each pixel written costs. They
+   are drawn in directly and only expanded to BGRX
+   where that is needed - for a display of another
+   depth, for upscaling, and for capture. They hold
+   no alpha, so blending treats the target as
+   opaque. Frames for a 16 bit display are packed to
+   RGB565 whatever the format. */
+typedef enum {
+    GRAPHICS_FORMAT_BGRX8888,
+    GRAPHICS_FORMAT_RGB565,
+    GRAPHICS_FORMAT_INDEXED8    /* Fixed palette of 3 bits red and green, 2 bits blue */
+} graphics_format_t;
+
+/* How drawn pixels are combined with the target. The
+   source colour is premultiplied by the current alpha
+   before blending, and the pad byte of the target
+   holds its accumulated alpha. */
+typedef enum {
+    GRAPHICS_BLEND_NONE,        /* Overwrite */
+    GRAPHICS_BLEND_ALPHA,       /* Premultiplied source over target */
+    GRAPHICS_BLEND_ADDITIVE,    /* Saturating add */
+    GRAPHICS_BLEND_MULTIPLY     /* Target scaled by source */
+} graphics_blend_mode_t;
+
+/* Tiled layout - the render target is split into
+   GRAPHICS_TILE_SIZE x GRAPHICS_TILE_SIZE tiles,
+   each stored contiguously in row-major order, and
+   the tiles themselves are stored in Morton order. */
+#define GRAPHICS_TILE_SHIFT 3
+#define GRAPHICS_TILE_SIZE (1 << GRAPHICS_TILE_SHIFT)
+
+typedef enum {
+    GRAPHICS_LAYOUT_LINEAR,
+    GRAPHICS_LAYOUT_TILED
+} graphics_layout_t;
+
+/* Filter used to upscale frames rendered below
+   the output resolution. */
+typedef enum {
+    GRAPHICS_UPSCALE_NEAREST,
+    GRAPHICS_UPSCALE_BILINEAR
+} graphics_upscale_filter_t;
+
+/* Screen-space rectangle, x0/y0 inclusive
+   and x1/y1 exclusive. */
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} graphics_rect_t;
+
+/* Dirty rectangles touched in one frame. When more
+   than GRAPHICS_MAX_DIRTY_RECTS regions are touched
+   the closest ones are merged together. */
+#define GRAPHICS_MAX_DIRTY_RECTS 16
+
+typedef struct {
+    graphics_rect_t rects[GRAPHICS_MAX_DIRTY_RECTS];
+    int count;
+} graphics_dirty_list_t;
+
+/* Multisampling - each pixel is normally stored as a
+   single colour. Only pixels which are partly covered
+   by an edge are expanded into a block holding one
+   colour per sample, which is averaged on resolve. */
+#define GRAPHICS_MSAA_SAMPLES 4
+
+typedef struct {
+    uint32_t pixel;                                  /* Offset into target */
+    uint16_t x;                                      /* Screen position, for dithering */
+    uint16_t y;
+    graphics_pixel_t samples[GRAPHICS_MSAA_SAMPLES];
+} graphics_msaa_block_t;
+
+/* How meshes are drawn outside deferred mode. The
+   edge modes need the mesh's edge list, and fall
+   back to whole triangles without one. */
+typedef enum {
+    GRAPHICS_WIREFRAME_TRIANGLES,   /* Outline of every face, so shared edges twice */
+    GRAPHICS_WIREFRAME_EDGES,       /* Every edge once */
+    GRAPHICS_WIREFRAME_OUTLINE      /* Only silhouette, feature and boundary edges */
+} graphics_wireframe_mode_t;
+
+/* Per-frame scratch memory. The renderer allocates
+   from its own sub-arena, leaving the others for
+   threads recording work for the frame. */
+#define GRAPHICS_FRAME_ARENA_BLOCK_SIZE (256 * 1024)
+#define GRAPHICS_RENDER_THREAD 0
+
+/* Work split into jobs when the renderer has a job
+   system - vertex batches below the first size, and
+   clears below the second, are not worth sharing. */
+#define GRAPHICS_JOB_VERTICES 4096
+#define GRAPHICS_JOB_CLEAR_BYTES (64 * 1024)
+
 typedef struct {
-    unsigned int width;
+    unsigned int width;              /* Render resolution */
     unsigned int height;
+    unsigned int output_width;       /* Resolution presented to the window */
+    unsigned int output_height;
+    int window_x;                    /* Position of the frame in the window */
+    int window_y;
     double view_distance;
     double view_width;
     double view_height;
-    graphics_pixel_t *pixels;
+    graphics_format_t format;        /* Of pixels and target */
+    unsigned int pixel_size;         /* Bytes per pixel in format */
+    bool dither;                     /* Ordered dither when packing into a compact format */
+    bool pattern_valid;              /* Whether pattern holds pattern_colour */
+    graphics_pixel_t pattern_colour;
+    uint8_t pattern[4][16];          /* Solid colour packed for each row of the dither pattern, twice over */
+    void *pixels;                    /* Linear buffer presented to the window */
+    graphics_layout_t layout;
+    void *target;                    /* Buffer the rasterizer draws into */
+    uint32_t *row_offset;            /* Offset into target of each row */
+    uint32_t *column_offset;         /* Offset into target of each column */
+    bool dirty_tracking;             /* Only clear and present touched regions */
+    bool clear_full;                 /* Next clear must clear the whole target */
+    bool present_full;               /* Next display must present the whole buffer */
+    graphics_dirty_list_t dirty;     /* Regions touched this frame */
+    graphics_dirty_list_t previous;  /* Regions touched last frame */
+    graphics_pixel_t *scaled;        /* Upscaled frame when rendering below output resolution */
+    graphics_pixel_t *expanded;      /* Compact frame expanded to BGRX, NULL until needed */
+    uint16_t *packed;                /* Frame packed to RGB565 for a 16 bit display, NULL until needed */
+    graphics_upscale_filter_t upscale_filter;
+    bool msaa;                       /* Rasterize with 4x multisampling */
+    uint32_t *sample_block;          /* Per target pixel, 1 + its block index, or 0 if compressed */
+    graphics_msaa_block_t *blocks;   /* Expanded pixels this frame */
+    uint32_t num_blocks;
+    uint32_t max_blocks;
+    graphics_blend_mode_t blend_mode;
+    uint8_t alpha;                   /* Alpha of drawn pixels */
+    graphics_wireframe_mode_t wireframe;
+    double feature_cosine;           /* Outlines keep edges whose faces meet at a lower cosine */
+    system_frame_arena_t frame_arena; /* Scratch memory, reset on clear */
+    struct graphics_deferred_t *deferred; /* G-buffer and lighting state, NULL unless deferred */
+    system_jobs_t *jobs;             /* Shared workers, or NULL to do everything on the render thread */
+    const void *presented;           /* Linear frame at output resolution, as last displayed */
+    graphics_format_t presented_format;
+    graphics_dirty_list_t presented_rects; /* Regions of it changed by the last display */
 } graphics_renderer_t;
 
 typedef struct {
@@ -28,7 +168,46 @@ typedef struct {
     maths_vec4f rotation;
 } graphics_camera_t;
 
-graphics_renderer_t *graphics_renderer_init (unsigned int width, unsigned int height);
+/* Receives each clipped triangle, in camera space and
+   projected to the screen. */
+typedef void (*graphics_triangle_sink_t) (void *aux, maths_triangle4f t, const maths_vec2f *p);
+
+/* What transforming and clipping meshes reads of a
+   renderer, so that it can run apart from the
+   rasterizer. Scratch memory comes from one sub-arena
+   of the given arena. */
+typedef struct {
+    unsigned int width;              /* Render resolution */
+    unsigned int height;
+    double view_distance;
+    double view_width;
+    double view_height;
+    system_frame_arena_t *arena;
+    unsigned int thread;
+    graphics_triangle_sink_t sink;
+    void *aux;
+    system_jobs_t *jobs;             /* Shares out vertex transforms, or NULL */
+} graphics_geometry_t;
+
+maths_mat4x4f graphics_camera_view_transform (graphics_camera_t *camera);
+resources_ray_t graphics_camera_pick_ray (graphics_renderer_t *renderer, graphics_camera_t *camera, double x, double y);
+
+unsigned int graphics_format_size (graphics_format_t format);
+graphics_renderer_t *graphics_renderer_init (unsigned int width, unsigned int height, graphics_format_t format);
+void graphics_renderer_destroy (graphics_renderer_t *renderer);
+bool graphics_renderer_set_layout (graphics_renderer_t *renderer, graphics_layout_t layout);
+void graphics_renderer_linearize (graphics_renderer_t *renderer);
+bool graphics_renderer_set_resolution (graphics_renderer_t *renderer, unsigned int width, unsigned int height);
+void graphics_renderer_set_upscale_filter (graphics_renderer_t *renderer, graphics_upscale_filter_t filter);
+bool graphics_renderer_set_msaa (graphics_renderer_t *renderer, bool enabled);
+void graphics_renderer_set_dither (graphics_renderer_t *renderer, bool enabled);
+void graphics_renderer_set_blend_mode (graphics_renderer_t *renderer, graphics_blend_mode_t mode, uint8_t alpha);
+void graphics_renderer_set_dirty_tracking (graphics_renderer_t *renderer, bool enabled);
+void graphics_renderer_set_wireframe_mode (graphics_renderer_t *renderer, graphics_wireframe_mode_t mode, double feature_angle);
+void graphics_renderer_set_window_position (graphics_renderer_t *renderer, int x, int y);
+void graphics_renderer_set_jobs (graphics_renderer_t *renderer, system_jobs_t *jobs);
+void graphics_renderer_invalidate (graphics_renderer_t *renderer);
+void graphics_renderer_mark_dirty (graphics_renderer_t *renderer, const graphics_rect_t *rect);
 void graphics_renderer_display (graphics_renderer_t *renderer, system_window_t *window);
 void graphics_renderer_clear_buffer (graphics_renderer_t *renderer);
 void graphics_renderer_draw_pixel (graphics_renderer_t *renderer, int x, int y, uint8_t red, uint8_t green, uint8_t blue);
@@ -37,5 +216,9 @@ void graphics_renderer_draw_wireframe_triangle (graphics_renderer_t *renderer, i
 void graphics_renderer_draw_filled_triangle (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t red, uint8_t green, uint8_t blue);
 void graphics_renderer_draw_shaded_triangle (graphics_renderer_t *renderer, int x0, int y0, int x1, int y1, int x2, int y2, uint8_t r_0, uint8_t g_0, uint8_t b_0, uint8_t r_1, uint8_t g_1, uint8_t b_1, uint8_t r_2, uint8_t g_2, uint8_t b_2);
 void graphics_renderer_render_model (graphics_renderer_t *renderer, resources_model_t *model, graphics_camera_t *camera);
+void graphics_renderer_render_mesh (graphics_renderer_t *renderer, resources_mesh_t *mesh, const maths_mat4x4f *model_view);
+void graphics_renderer_draw_projected_triangle (graphics_renderer_t *renderer, maths_triangle4f t, const maths_vec2f *p);
+void graphics_geometry_render_mesh (const graphics_geometry_t *geometry, resources_mesh_t *mesh, const maths_mat4x4f *model_view);
+void graphics_renderer_render_clustered_mesh (graphics_renderer_t *renderer, resources_clustered_mesh_t *mesh, resources_model_t *model, graphics_camera_t *camera);
 
 #endif
\ No newline at end of file
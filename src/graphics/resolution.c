@@ -0,0 +1,108 @@
+#include "resolution.h"
+#include <time.h>
+
+/* Keep this much of the budget spare to absorb noise. */
+#define GRAPHICS_RESOLUTION_HEADROOM 0.9
+
+/* Only scale up when frames use less than this much. */
+#define GRAPHICS_RESOLUTION_UPSCALE_THRESHOLD 0.7
+
+#define GRAPHICS_RESOLUTION_UPSCALE_STEP 1.05
+
+static double now_seconds () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void graphics_resolution_controller_init (graphics_resolution_controller_t *controller, double target_frame_time, double min_scale) {
+    assert (controller != NULL);
+    assert (target_frame_time > 0);
+
+    controller->target_frame_time = target_frame_time;
+    controller->min_scale = min_scale > 0 && min_scale <= 1 ? min_scale : 0.5;
+    controller->scale = 1;
+    controller->num_samples = 0;
+    controller->next_sample = 0;
+    controller->frame_start = 0;
+}
+
+/* Time the work between begin and end frame only, so
+   that waiting on the display or on frame pacing is
+   not mistaken for rendering load. */
+void graphics_resolution_controller_begin_frame (graphics_resolution_controller_t *controller) {
+    controller->frame_start = now_seconds ();
+}
+
+void graphics_resolution_controller_end_frame (graphics_resolution_controller_t *controller, graphics_renderer_t *renderer) {
+    graphics_resolution_controller_add_sample (controller, renderer, now_seconds () - controller->frame_start);
+}
+
+static void apply_scale (graphics_resolution_controller_t *controller, graphics_renderer_t *renderer) {
+    unsigned int width = renderer->output_width;
+    unsigned int height = renderer->output_height;
+
+    /* Round to whole tiles to keep the tiled layout
+       efficient and avoid resizing on tiny changes. */
+    if (controller->scale < 1) {
+        width = (unsigned int) (width * controller->scale) & ~(GRAPHICS_TILE_SIZE - 1);
+        height = (unsigned int) (height * controller->scale) & ~(GRAPHICS_TILE_SIZE - 1);
+
+        width = width < GRAPHICS_TILE_SIZE ? GRAPHICS_TILE_SIZE : width;
+        height = height < GRAPHICS_TILE_SIZE ? GRAPHICS_TILE_SIZE : height;
+        width = width > renderer->output_width ? renderer->output_width : width;
+        height = height > renderer->output_height ? renderer->output_height : height;
+    }
+
+    if (width != renderer->width || height != renderer->height) {
+        graphics_renderer_set_resolution (renderer, width, height);
+
+        /* Samples taken at the old resolution no
+           longer say anything about the new one. */
+        controller->num_samples = 0;
+        controller->next_sample = 0;
+    }
+}
+
+void graphics_resolution_controller_add_sample (graphics_resolution_controller_t *controller, graphics_renderer_t *renderer, double frame_time) {
+    controller->history[controller->next_sample] = frame_time;
+    controller->next_sample = (controller->next_sample + 1) % GRAPHICS_RESOLUTION_HISTORY;
+
+    if (controller->num_samples < GRAPHICS_RESOLUTION_HISTORY) {
+        controller->num_samples++;
+    }
+
+    double mean = 0;
+
+    for (int i = 0; i < controller->num_samples; i++) {
+        mean += controller->history[i];
+    }
+
+    mean /= controller->num_samples;
+
+    /* React to a spike straight away, but only on
+       the average so a single fast frame does not
+       bounce the resolution back up. */
+    double estimate = frame_time > mean ? frame_time : mean;
+    double budget = controller->target_frame_time * GRAPHICS_RESOLUTION_HEADROOM;
+    double scale = controller->scale;
+
+    if (estimate > budget) {
+        /* Cost is roughly proportional to pixel count,
+           which goes with the square of the scale. */
+        double factor = sqrt (budget / estimate);
+        scale *= factor < 0.7 ? 0.7 : factor;
+    } else if (controller->num_samples == GRAPHICS_RESOLUTION_HISTORY &&
+               mean < controller->target_frame_time * GRAPHICS_RESOLUTION_UPSCALE_THRESHOLD) {
+        scale *= GRAPHICS_RESOLUTION_UPSCALE_STEP;
+    }
+
+    if (scale < controller->min_scale) {
+        scale = controller->min_scale;
+    } else if (scale > 1) {
+        scale = 1;
+    }
+
+    controller->scale = scale;
+    apply_scale (controller, renderer);
+}
@@ -0,0 +1,32 @@
+/* graphics/resolution.h
+    Dynamic resolution controller. It measures
+    recent frame times against a target budget
+    and lowers the render resolution of a
+    renderer as soon as frames run over budget,
+    raising it again slowly once there is enough
+    headroom. The renderer upscales the result to
+    its output resolution on display. */
+
+#ifndef GRAPHICS_RESOLUTION_H
+#define GRAPHICS_RESOLUTION_H
+
+#include "renderer.h"
+
+#define GRAPHICS_RESOLUTION_HISTORY 8
+
+typedef struct {
+    double target_frame_time;                    /* Budget in seconds */
+    double min_scale;                            /* Lowest fraction of output resolution */
+    double scale;                                /* Current fraction of output resolution */
+    double history[GRAPHICS_RESOLUTION_HISTORY]; /* Recent frame times in seconds */
+    int num_samples;
+    int next_sample;
+    double frame_start;
+} graphics_resolution_controller_t;
+
+void graphics_resolution_controller_init (graphics_resolution_controller_t *controller, double target_frame_time, double min_scale);
+void graphics_resolution_controller_begin_frame (graphics_resolution_controller_t *controller);
+void graphics_resolution_controller_end_frame (graphics_resolution_controller_t *controller, graphics_renderer_t *renderer);
+void graphics_resolution_controller_add_sample (graphics_resolution_controller_t *controller, graphics_renderer_t *renderer, double frame_time);
+
+#endif
@@ -0,0 +1,850 @@
+#include "sprite.h"
+#include "kernels.h"
+#include "kernels_common.h"
+#include "./../system/log.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pixels of a row converted or scaled at a time */
+#define SPRITE_CHUNK 64
+
+/* Texels of a source row a scaled chunk may convert
+   up front, enough for shrinking to half size */
+#define SPRITE_WINDOW (2 * SPRITE_CHUNK + 2)
+
+/* Sprites a batch has room for at first, doubled as
+   needed and kept between frames */
+#define GRAPHICS_SPRITE_BATCH_SIZE 256
+
+/* Atlas of GRAPHICS_FONT_ATLAS_COLUMNS glyphs a row */
+#define GRAPHICS_FONT_ATLAS_COLUMNS 16
+
+/* The public domain font8x8 glyphs from ' ' to '~',
+   one byte per row with the leftmost pixel in the
+   lowest bit. */
+static const uint8_t font_8x8[GRAPHICS_FONT_NUM_CHARS][GRAPHICS_FONT_GLYPH_SIZE] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x18, 0x3c, 0x3c, 0x18, 0x18, 0x00, 0x18, 0x00 },
+    { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x36, 0x36, 0x7f, 0x36, 0x7f, 0x36, 0x36, 0x00 },
+    { 0x0c, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x0c, 0x00 },
+    { 0x00, 0x63, 0x33, 0x18, 0x0c, 0x66, 0x63, 0x00 },
+    { 0x1c, 0x36, 0x1c, 0x6e, 0x3b, 0x33, 0x6e, 0x00 },
+    { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x18, 0x0c, 0x06, 0x06, 0x06, 0x0c, 0x18, 0x00 },
+    { 0x06, 0x0c, 0x18, 0x18, 0x18, 0x0c, 0x06, 0x00 },
+    { 0x00, 0x66, 0x3c, 0xff, 0x3c, 0x66, 0x00, 0x00 },
+    { 0x00, 0x0c, 0x0c, 0x3f, 0x0c, 0x0c, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x06 },
+    { 0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x00 },
+    { 0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x01, 0x00 },
+    { 0x3e, 0x63, 0x73, 0x7b, 0x6f, 0x67, 0x3e, 0x00 },
+    { 0x0c, 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x3f, 0x00 },
+    { 0x1e, 0x33, 0x30, 0x1c, 0x06, 0x33, 0x3f, 0x00 },
+    { 0x1e, 0x33, 0x30, 0x1c, 0x30, 0x33, 0x1e, 0x00 },
+    { 0x38, 0x3c, 0x36, 0x33, 0x7f, 0x30, 0x78, 0x00 },
+    { 0x3f, 0x03, 0x1f, 0x30, 0x30, 0x33, 0x1e, 0x00 },
+    { 0x1c, 0x06, 0x03, 0x1f, 0x33, 0x33, 0x1e, 0x00 },
+    { 0x3f, 0x33, 0x30, 0x18, 0x0c, 0x0c, 0x0c, 0x00 },
+    { 0x1e, 0x33, 0x33, 0x1e, 0x33, 0x33, 0x1e, 0x00 },
+    { 0x1e, 0x33, 0x33, 0x3e, 0x30, 0x18, 0x0e, 0x00 },
+    { 0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x00 },
+    { 0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x06 },
+    { 0x18, 0x0c, 0x06, 0x03, 0x06, 0x0c, 0x18, 0x00 },
+    { 0x00, 0x00, 0x3f, 0x00, 0x00, 0x3f, 0x00, 0x00 },
+    { 0x06, 0x0c, 0x18, 0x30, 0x18, 0x0c, 0x06, 0x00 },
+    { 0x1e, 0x33, 0x30, 0x18, 0x0c, 0x00, 0x0c, 0x00 },
+    { 0x3e, 0x63, 0x7b, 0x7b, 0x7b, 0x03, 0x1e, 0x00 },
+    { 0x0c, 0x1e, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x00 },
+    { 0x3f, 0x66, 0x66, 0x3e, 0x66, 0x66, 0x3f, 0x00 },
+    { 0x3c, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3c, 0x00 },
+    { 0x1f, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1f, 0x00 },
+    { 0x7f, 0x46, 0x16, 0x1e, 0x16, 0x46, 0x7f, 0x00 },
+    { 0x7f, 0x46, 0x16, 0x1e, 0x16, 0x06, 0x0f, 0x00 },
+    { 0x3c, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7c, 0x00 },
+    { 0x33, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x33, 0x00 },
+    { 0x1e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 },
+    { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e, 0x00 },
+    { 0x67, 0x66, 0x36, 0x1e, 0x36, 0x66, 0x67, 0x00 },
+    { 0x0f, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7f, 0x00 },
+    { 0x63, 0x77, 0x7f, 0x7f, 0x6b, 0x63, 0x63, 0x00 },
+    { 0x63, 0x67, 0x6f, 0x7b, 0x73, 0x63, 0x63, 0x00 },
+    { 0x1c, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1c, 0x00 },
+    { 0x3f, 0x66, 0x66, 0x3e, 0x06, 0x06, 0x0f, 0x00 },
+    { 0x1e, 0x33, 0x33, 0x33, 0x3b, 0x1e, 0x38, 0x00 },
+    { 0x3f, 0x66, 0x66, 0x3e, 0x36, 0x66, 0x67, 0x00 },
+    { 0x1e, 0x33, 0x07, 0x0e, 0x38, 0x33, 0x1e, 0x00 },
+    { 0x3f, 0x2d, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 },
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3f, 0x00 },
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00 },
+    { 0x63, 0x63, 0x63, 0x6b, 0x7f, 0x77, 0x63, 0x00 },
+    { 0x63, 0x63, 0x36, 0x1c, 0x1c, 0x36, 0x63, 0x00 },
+    { 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x0c, 0x1e, 0x00 },
+    { 0x7f, 0x63, 0x31, 0x18, 0x4c, 0x66, 0x7f, 0x00 },
+    { 0x1e, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1e, 0x00 },
+    { 0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x40, 0x00 },
+    { 0x1e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1e, 0x00 },
+    { 0x08, 0x1c, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff },
+    { 0x0c, 0x0c, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x1e, 0x30, 0x3e, 0x33, 0x6e, 0x00 },
+    { 0x07, 0x06, 0x06, 0x3e, 0x66, 0x66, 0x3b, 0x00 },
+    { 0x00, 0x00, 0x1e, 0x33, 0x03, 0x33, 0x1e, 0x00 },
+    { 0x38, 0x30, 0x30, 0x3e, 0x33, 0x33, 0x6e, 0x00 },
+    { 0x00, 0x00, 0x1e, 0x33, 0x3f, 0x03, 0x1e, 0x00 },
+    { 0x1c, 0x36, 0x06, 0x0f, 0x06, 0x06, 0x0f, 0x00 },
+    { 0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x1f },
+    { 0x07, 0x06, 0x36, 0x6e, 0x66, 0x66, 0x67, 0x00 },
+    { 0x0c, 0x00, 0x0e, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 },
+    { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e },
+    { 0x07, 0x06, 0x66, 0x36, 0x1e, 0x36, 0x67, 0x00 },
+    { 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00 },
+    { 0x00, 0x00, 0x33, 0x7f, 0x7f, 0x6b, 0x63, 0x00 },
+    { 0x00, 0x00, 0x1f, 0x33, 0x33, 0x33, 0x33, 0x00 },
+    { 0x00, 0x00, 0x1e, 0x33, 0x33, 0x33, 0x1e, 0x00 },
+    { 0x00, 0x00, 0x3b, 0x66, 0x66, 0x3e, 0x06, 0x0f },
+    { 0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x78 },
+    { 0x00, 0x00, 0x3b, 0x6e, 0x66, 0x06, 0x0f, 0x00 },
+    { 0x00, 0x00, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x00 },
+    { 0x08, 0x0c, 0x3e, 0x0c, 0x0c, 0x2c, 0x18, 0x00 },
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6e, 0x00 },
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00 },
+    { 0x00, 0x00, 0x63, 0x6b, 0x7f, 0x7f, 0x36, 0x00 },
+    { 0x00, 0x00, 0x63, 0x36, 0x1c, 0x36, 0x63, 0x00 },
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3e, 0x30, 0x1f },
+    { 0x00, 0x00, 0x3f, 0x19, 0x0c, 0x26, 0x3f, 0x00 },
+    { 0x38, 0x0c, 0x0c, 0x07, 0x0c, 0x0c, 0x38, 0x00 },
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },
+    { 0x07, 0x0c, 0x0c, 0x38, 0x0c, 0x0c, 0x07, 0x00 },
+    { 0x6e, 0x3b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+};
+
+/* Sprites bucketed by the bands they cover, in the
+   order drawn */
+typedef struct {
+    graphics_renderer_t *renderer;
+    const graphics_sprite_t *sprites;
+    int first_band;
+    int *band_start;            /* Per band from first_band, its first entry in band_sprites, then the end */
+    int *band_sprites;
+} graphics_sprite_pass_t;
+
+/* A pixel as stored, widened to 32 bits */
+static inline uint32_t stored_value (const uint8_t *p, unsigned int size) {
+    switch (size) {
+        case sizeof (uint8_t):
+            return *p;
+        case sizeof (uint16_t):
+            return *(const uint16_t *) p;
+        default:
+            return *(const uint32_t *) p;
+    }
+}
+
+/* Compact formats are rounded rather than dithered, so
+   that a key colour packs the same everywhere. */
+static uint32_t pack_value (graphics_format_t format, graphics_pixel_t p) {
+    uint32_t value;
+
+    switch (format) {
+        case GRAPHICS_FORMAT_RGB565:
+            return pack_rgb565 (p, dither_threshold (false, 0, 0));
+        case GRAPHICS_FORMAT_INDEXED8:
+            return pack_indexed (p, dither_threshold (false, 0, 0));
+        default:
+            memcpy (&value, &p, sizeof (value));
+            return value;
+    }
+}
+
+/* Surfaces with alpha must be BGRX. Keyed surfaces
+   start with black as the key. */
+graphics_surface_t *graphics_surface_create (unsigned int width, unsigned int height, graphics_format_t format, graphics_surface_mode_t mode) {
+    if (mode == GRAPHICS_SURFACE_ALPHA && format != GRAPHICS_FORMAT_BGRX8888) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "surfaces with alpha must be BGRX.");
+        return NULL;
+    }
+
+    graphics_surface_t *surface = (graphics_surface_t *) calloc (1, sizeof (graphics_surface_t));
+
+    if (surface == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for surface.");
+        return NULL;
+    }
+
+    surface->width = width;
+    surface->height = height;
+    surface->format = format;
+    surface->pixel_size = graphics_format_size (format);
+    surface->pitch = (size_t) width * surface->pixel_size;
+    surface->mode = mode;
+    surface->pixels = calloc ((size_t) height, surface->pitch);
+
+    if (surface->pixels == NULL && surface->pitch * height > 0) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for surface pixels.");
+        free (surface);
+        return NULL;
+    }
+
+    graphics_surface_set_colour_key (surface, 0, 0, 0);
+    return surface;
+}
+
+void graphics_surface_destroy (graphics_surface_t *surface) {
+    if (surface == NULL) {
+        return;
+    }
+
+    free (surface->pixels);
+    free (surface);
+}
+
+/* Fill the surface from width * height BGRA pixels,
+   row by row, with straight alpha in the pad byte.
+   Alpha is premultiplied for alpha surfaces and
+   dropped for others. */
+void graphics_surface_upload (graphics_surface_t *surface, const graphics_pixel_t *pixels) {
+    for (unsigned int y = 0; y < surface->height; y++) {
+        uint8_t *row = (uint8_t *) surface->pixels + y * surface->pitch;
+
+        for (unsigned int x = 0; x < surface->width; x++) {
+            graphics_pixel_t p = pixels[(size_t) y * surface->width + x];
+
+            if (surface->mode == GRAPHICS_SURFACE_ALPHA) {
+                p = (graphics_pixel_t) { div_255 (p.blue * p.pad), div_255 (p.green * p.pad), div_255 (p.red * p.pad), p.pad };
+            } else {
+                p.pad = 255;
+            }
+
+            uint32_t value = pack_value (surface->format, p);
+            memcpy (row + x * surface->pixel_size, &value, surface->pixel_size);
+        }
+    }
+}
+
+void graphics_surface_set_colour_key (graphics_surface_t *surface, uint8_t red, uint8_t green, uint8_t blue) {
+    surface->key = pack_value (surface->format, (graphics_pixel_t) { blue, green, red, 255 });
+}
+
+/* source, or the whole surface if NULL, within the
+   surface */
+static graphics_rect_t surface_rect (const graphics_surface_t *surface, const graphics_rect_t *source) {
+    graphics_rect_t rect = { 0, 0, (int) surface->width, (int) surface->height };
+
+    if (source != NULL) {
+        rect.x0 = source->x0 > 0 ? source->x0 : 0;
+        rect.y0 = source->y0 > 0 ? source->y0 : 0;
+        rect.x1 = source->x1 < (int) surface->width ? source->x1 : (int) surface->width;
+        rect.y1 = source->y1 < (int) surface->height ? source->y1 : (int) surface->height;
+    }
+
+    return rect;
+}
+
+bool graphics_sprite_batch_init (graphics_sprite_batch_t *batch) {
+    assert (batch != NULL);
+
+    batch->count = 0;
+    batch->capacity = GRAPHICS_SPRITE_BATCH_SIZE;
+    batch->sprites = (graphics_sprite_t *) malloc (sizeof (graphics_sprite_t) * batch->capacity);
+
+    if (batch->sprites == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for sprite batch.");
+        batch->capacity = 0;
+        return false;
+    }
+
+    return true;
+}
+
+/* Start a new frame, keeping the memory */
+void graphics_sprite_batch_reset (graphics_sprite_batch_t *batch) {
+    assert (batch != NULL);
+
+    batch->count = 0;
+}
+
+void graphics_sprite_batch_destroy (graphics_sprite_batch_t *batch) {
+    assert (batch != NULL);
+
+    free (batch->sprites);
+    batch->sprites = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+}
+
+/* Add a sprite copying source, or the whole surface
+   if NULL, to dest on screen. Sprites are drawn in the
+   order added, each over the ones before. */
+bool graphics_sprite_batch_add (graphics_sprite_batch_t *batch, const graphics_surface_t *surface, const graphics_rect_t *source, const graphics_rect_t *dest, graphics_upscale_filter_t filter) {
+    graphics_rect_t rect = surface_rect (surface, source);
+
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1 || dest->x0 >= dest->x1 || dest->y0 >= dest->y1) {
+        return true;
+    }
+
+    if (batch->count == batch->capacity) {
+        int capacity = batch->capacity ? batch->capacity * 2 : GRAPHICS_SPRITE_BATCH_SIZE;
+        graphics_sprite_t *sprites = (graphics_sprite_t *) realloc (batch->sprites, sizeof (graphics_sprite_t) * capacity);
+
+        if (sprites == NULL) {
+            SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for sprite batch.");
+            return false;
+        }
+
+        batch->sprites = sprites;
+        batch->capacity = capacity;
+    }
+
+    batch->sprites[batch->count++] = (graphics_sprite_t) { surface, rect, *dest, filter };
+    return true;
+}
+
+/* Add a sprite for each character of text, with the
+   top left of the first at (x, y) and glyphs scaled
+   up scale times. Newlines start a new line, and
+   characters the font lacks are drawn as '?'. */
+bool graphics_sprite_batch_add_text (graphics_sprite_batch_t *batch, const graphics_font_t *font, int x, int y, int scale, const char *text) {
+    int pen_x = x;
+
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            pen_x = x;
+            y += font->line_height * scale;
+            continue;
+        }
+
+        int index = (unsigned char) *c - GRAPHICS_FONT_FIRST_CHAR;
+
+        if (index < 0 || index >= GRAPHICS_FONT_NUM_CHARS) {
+            index = '?' - GRAPHICS_FONT_FIRST_CHAR;
+        }
+
+        if (*c != ' ') {
+            const graphics_rect_t *glyph = &font->glyphs[index];
+            graphics_rect_t dest = { pen_x, y, pen_x + (glyph->x1 - glyph->x0) * scale, y + (glyph->y1 - glyph->y0) * scale };
+
+            if (!graphics_sprite_batch_add (batch, font->atlas, glyph, &dest, GRAPHICS_UPSCALE_NEAREST)) {
+                return false;
+            }
+        }
+
+        pen_x += font->advance * scale;
+    }
+
+    return true;
+}
+
+/* The glyphs are drawn in the text colour on a key
+   colour differing in the top bit of red, which
+   still differs once packed into any format. */
+graphics_font_t *graphics_font_create (graphics_format_t format, uint8_t red, uint8_t green, uint8_t blue) {
+    graphics_font_t *font = (graphics_font_t *) calloc (1, sizeof (graphics_font_t));
+
+    if (font == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for font.");
+        return NULL;
+    }
+
+    int rows = (GRAPHICS_FONT_NUM_CHARS + GRAPHICS_FONT_ATLAS_COLUMNS - 1) / GRAPHICS_FONT_ATLAS_COLUMNS;
+    int width = GRAPHICS_FONT_ATLAS_COLUMNS * GRAPHICS_FONT_GLYPH_SIZE;
+    int height = rows * GRAPHICS_FONT_GLYPH_SIZE;
+    graphics_pixel_t ink = { blue, green, red, 255 };
+    graphics_pixel_t paper = { blue, green, red ^ 0x80, 255 };
+    graphics_pixel_t *pixels = (graphics_pixel_t *) malloc (sizeof (graphics_pixel_t) * width * height);
+
+    font->atlas = graphics_surface_create (width, height, format, GRAPHICS_SURFACE_KEYED);
+
+    if (pixels == NULL || font->atlas == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not create font atlas.");
+        free (pixels);
+        graphics_font_destroy (font);
+        return NULL;
+    }
+
+    for (int i = 0; i < width * height; i++) {
+        pixels[i] = paper;
+    }
+
+    for (int c = 0; c < GRAPHICS_FONT_NUM_CHARS; c++) {
+        int x0 = (c % GRAPHICS_FONT_ATLAS_COLUMNS) * GRAPHICS_FONT_GLYPH_SIZE;
+        int y0 = (c / GRAPHICS_FONT_ATLAS_COLUMNS) * GRAPHICS_FONT_GLYPH_SIZE;
+
+        for (int y = 0; y < GRAPHICS_FONT_GLYPH_SIZE; y++) {
+            for (int x = 0; x < GRAPHICS_FONT_GLYPH_SIZE; x++) {
+                if (font_8x8[c][y] & (1 << x)) {
+                    pixels[(y0 + y) * width + x0 + x] = ink;
+                }
+            }
+        }
+
+        font->glyphs[c] = (graphics_rect_t) { x0, y0, x0 + GRAPHICS_FONT_GLYPH_SIZE, y0 + GRAPHICS_FONT_GLYPH_SIZE };
+    }
+
+    graphics_surface_set_colour_key (font->atlas, paper.red, paper.green, paper.blue);
+    graphics_surface_upload (font->atlas, pixels);
+    free (pixels);
+
+    font->advance = GRAPHICS_FONT_GLYPH_SIZE;
+    font->line_height = GRAPHICS_FONT_GLYPH_SIZE + 2;
+    return font;
+}
+
+void graphics_font_destroy (graphics_font_t *font) {
+    if (font == NULL) {
+        return;
+    }
+
+    graphics_surface_destroy (font->atlas);
+    free (font);
+}
+
+/* Bring the multisample blocks under a copied run up
+   to date. Pixels the copy covers are compressed
+   again, and alpha is blended into every sample. */
+static void msaa_cover (graphics_renderer_t *renderer, uint32_t offset, const uint8_t *src, unsigned int size, int n, graphics_surface_mode_t mode, uint32_t key) {
+    for (int i = 0; i < n; i++) {
+        uint32_t index = renderer->sample_block[offset + i];
+
+        if (index == 0) {
+            continue;
+        }
+
+        if (mode == GRAPHICS_SURFACE_ALPHA) {
+            graphics_msaa_block_t *block = &renderer->blocks[index - 1];
+            graphics_pixel_t p;
+            memcpy (&p, src + i * size, sizeof (p));
+
+            for (int s = 0; s < GRAPHICS_MSAA_SAMPLES; s++) {
+                blend_pixel (&block->samples[s], p, GRAPHICS_BLEND_ALPHA);
+            }
+        } else if (mode == GRAPHICS_SURFACE_OPAQUE || stored_value (src + i * size, size) != key) {
+            renderer->sample_block[offset + i] = 0;
+        }
+    }
+}
+
+/* BGRX source pixels into a compact target. Blending
+   goes by way of a BGRX copy of the target, and only
+   pixels the sprite touches are packed back, so
+   dithering leaves the rest alone. */
+static void blit_compact (graphics_renderer_t *renderer, uint8_t *dst, int x, int y, const graphics_pixel_t *src, int n, graphics_surface_mode_t mode, uint32_t key) {
+    bool rgb565 = renderer->format == GRAPHICS_FORMAT_RGB565;
+    graphics_pixel_t buffer[SPRITE_CHUNK];
+    uint16_t packed[SPRITE_CHUNK];
+    uint8_t threshold[4];
+
+    dither_row (renderer->dither, x, y, threshold);
+
+    /* Chunks are a multiple of four pixels apart, so
+       each starts at the same point of the dither row */
+    for (int i = 0; i < n; i += SPRITE_CHUNK) {
+        int m = n - i < SPRITE_CHUNK ? n - i : SPRITE_CHUNK;
+        const graphics_pixel_t *pixels = src + i;
+        uint8_t *chunk = dst + (size_t) i * renderer->pixel_size;
+
+        if (mode == GRAPHICS_SURFACE_ALPHA) {
+            if (rgb565) {
+                graphics_kernels.expand_rgb565 (buffer, (const uint16_t *) chunk, m);
+            } else {
+                graphics_kernels.expand_indexed (buffer, chunk, m);
+            }
+
+            graphics_kernels.blend_span (buffer, pixels, (graphics_pixel_t) { 0, 0, 0, 0 }, m, GRAPHICS_BLEND_ALPHA);
+            pixels = buffer;
+        }
+
+        if (rgb565) {
+            graphics_kernels.pack_rgb565 (packed, pixels, m, threshold);
+        } else {
+            graphics_kernels.pack_indexed ((uint8_t *) packed, pixels, m, threshold);
+        }
+
+        if (mode == GRAPHICS_SURFACE_OPAQUE) {
+            memcpy (chunk, packed, (size_t) m * renderer->pixel_size);
+            continue;
+        }
+
+        for (int k = 0; k < m; k++) {
+            uint32_t value;
+            memcpy (&value, &src[i + k], sizeof (value));
+
+            if (mode == GRAPHICS_SURFACE_ALPHA ? src[i + k].pad == 0 : value == key) {
+                continue;
+            }
+
+            if (rgb565) {
+                ((uint16_t *) chunk)[k] = packed[k];
+            } else {
+                chunk[k] = ((uint8_t *) packed)[k];
+            }
+        }
+    }
+}
+
+/* Copy n source pixels in format, the target's or
+   BGRX, to offset in the target, which is (x, y) on
+   screen. */
+static void blit_run (graphics_renderer_t *renderer, uint32_t offset, int x, int y, const uint8_t *src, graphics_format_t format, int n, graphics_surface_mode_t mode, uint32_t key) {
+    uint8_t *dst = (uint8_t *) renderer->target + (size_t) offset * renderer->pixel_size;
+    graphics_pixel_t key_pixel;
+    memcpy (&key_pixel, &key, sizeof (key_pixel));
+
+    if (format != renderer->format) {
+        blit_compact (renderer, dst, x, y, (const graphics_pixel_t *) src, n, mode, key);
+    } else if (mode == GRAPHICS_SURFACE_OPAQUE) {
+        memcpy (dst, src, (size_t) n * renderer->pixel_size);
+    } else if (mode == GRAPHICS_SURFACE_ALPHA) {
+        graphics_kernels.blend_span ((graphics_pixel_t *) dst, (const graphics_pixel_t *) src, (graphics_pixel_t) { 0, 0, 0, 0 }, n, GRAPHICS_BLEND_ALPHA);
+    } else if (format == GRAPHICS_FORMAT_RGB565) {
+        graphics_kernels.copy_keyed_rgb565 ((uint16_t *) dst, (const uint16_t *) src, (uint16_t) key, n);
+    } else if (format == GRAPHICS_FORMAT_INDEXED8) {
+        graphics_kernels.copy_keyed_indexed (dst, src, (uint8_t) key, n);
+    } else {
+        graphics_kernels.copy_keyed_span ((graphics_pixel_t *) dst, (const graphics_pixel_t *) src, key_pixel, n);
+    }
+
+    if (renderer->msaa) {
+        msaa_cover (renderer, offset, src, graphics_format_size (format), n, mode, key);
+    }
+}
+
+/* Copy n source pixels to row y from x, split at tile
+   boundaries in the tiled layout. */
+static void blit_row (graphics_renderer_t *renderer, int x, int y, const uint8_t *src, graphics_format_t format, int n, graphics_surface_mode_t mode, uint32_t key) {
+    uint32_t row = renderer->row_offset[y];
+
+    if (renderer->target == renderer->pixels) {
+        blit_run (renderer, row + x, x, y, src, format, n, mode, key);
+        return;
+    }
+
+    unsigned int size = graphics_format_size (format);
+
+    for (int i = x; i < x + n;) {
+        int end = ((i >> GRAPHICS_TILE_SHIFT) + 1) << GRAPHICS_TILE_SHIFT;
+
+        if (end > x + n) {
+            end = x + n;
+        }
+
+        blit_run (renderer, row + renderer->column_offset[i], i, y, src + (size_t) (i - x) * size, format, end - i, mode, key);
+        i = end;
+    }
+}
+
+/* Surface texel as premultiplied BGRA, in the byte
+   order of graphics_pixel_t. Keyed texels are
+   transparent, so keyed surfaces filter to soft
+   edges. */
+static inline uint32_t load_texel (const graphics_surface_t *surface, int x, int y) {
+    const uint8_t *p = (const uint8_t *) surface->pixels + y * surface->pitch + (size_t) x * surface->pixel_size;
+    uint32_t value = stored_value (p, surface->pixel_size);
+    graphics_pixel_t texel;
+
+    if (surface->mode == GRAPHICS_SURFACE_KEYED && value == surface->key) {
+        return 0;
+    }
+
+    switch (surface->format) {
+        case GRAPHICS_FORMAT_RGB565:
+            texel = unpack_rgb565 ((uint16_t) value);
+            break;
+        case GRAPHICS_FORMAT_INDEXED8:
+            texel = unpack_indexed ((uint8_t) value);
+            break;
+        default:
+            memcpy (&texel, &value, sizeof (texel));
+
+            if (surface->mode != GRAPHICS_SURFACE_ALPHA) {
+                texel.pad = 255;
+            }
+            break;
+    }
+
+    memcpy (&value, &texel, sizeof (value));
+    return value;
+}
+
+/* The two texels either side of position t, in 16.16
+   fixed point from the centre of the first of size
+   texels, and the weight of the second in [0, 256). */
+static inline void texel_pair (int64_t t, int size, int *t0, int *t1, unsigned int *weight) {
+    if (t < 0) {
+        *t0 = *t1 = 0;
+        *weight = 0;
+        return;
+    }
+
+    *t0 = (int) (t >> 16);
+    *t1 = *t0 + 1 < size ? *t0 + 1 : size - 1;
+    *t0 = *t0 < size ? *t0 : size - 1;
+    *weight = (unsigned int) (t >> 8) & 0xff;
+}
+
+/* From a to b by weight in [0, 256), two channels at
+   a time in 16 bit lanes. */
+static inline uint32_t lerp_texels (uint32_t a, uint32_t b, unsigned int weight) {
+    uint32_t even = ((a & 0x00ff00ff) * (256 - weight) + (b & 0x00ff00ff) * weight) >> 8;
+    uint32_t odd = ((a >> 8) & 0x00ff00ff) * (256 - weight) + ((b >> 8) & 0x00ff00ff) * weight;
+
+    return (even & 0x00ff00ff) | (odd & 0xff00ff00);
+}
+
+/* The sprite on screen, false if it is off screen or
+   cannot be drawn into the target. */
+static bool sprite_clip (const graphics_renderer_t *renderer, const graphics_sprite_t *sprite, graphics_rect_t *clip) {
+    clip->x0 = sprite->dest.x0 > 0 ? sprite->dest.x0 : 0;
+    clip->y0 = sprite->dest.y0 > 0 ? sprite->dest.y0 : 0;
+    clip->x1 = sprite->dest.x1 < (int) renderer->width ? sprite->dest.x1 : (int) renderer->width;
+    clip->y1 = sprite->dest.y1 < (int) renderer->height ? sprite->dest.y1 : (int) renderer->height;
+
+    if (clip->x0 >= clip->x1 || clip->y0 >= clip->y1) {
+        return false;
+    }
+
+    return sprite->surface->format == renderer->format || sprite->surface->format == GRAPHICS_FORMAT_BGRX8888;
+}
+
+/* Draw the rows of a drawable sprite within
+   [y0, y1). Scaled sprites sample each destination
+   pixel at its centre, in 16.16 fixed point. */
+static void draw_sprite_rows (graphics_renderer_t *renderer, const graphics_sprite_t *sprite, int y0, int y1) {
+    const graphics_surface_t *surface = sprite->surface;
+    graphics_rect_t clip;
+
+    sprite_clip (renderer, sprite, &clip);
+    clip.y0 = clip.y0 > y0 ? clip.y0 : y0;
+    clip.y1 = clip.y1 < y1 ? clip.y1 : y1;
+
+    if (clip.y0 >= clip.y1) {
+        return;
+    }
+
+    int source_width = sprite->source.x1 - sprite->source.x0;
+    int source_height = sprite->source.y1 - sprite->source.y0;
+    int dest_width = sprite->dest.x1 - sprite->dest.x0;
+    int dest_height = sprite->dest.y1 - sprite->dest.y0;
+    unsigned int size = surface->pixel_size;
+
+    if (source_width == dest_width && source_height == dest_height) {
+        int x = sprite->source.x0 + clip.x0 - sprite->dest.x0;
+
+        for (int y = clip.y0; y < clip.y1; y++) {
+            const uint8_t *row = (const uint8_t *) surface->pixels + (sprite->source.y0 + y - sprite->dest.y0) * surface->pitch;
+            blit_row (renderer, clip.x0, y, row + (size_t) x * size, surface->format, clip.x1 - clip.x0, surface->mode, surface->key);
+        }
+
+        return;
+    }
+
+    int64_t step_x = ((int64_t) source_width << 16) / dest_width;
+    int64_t step_y = ((int64_t) source_height << 16) / dest_height;
+    graphics_pixel_t buffer[SPRITE_CHUNK];
+    uint32_t window[2][SPRITE_WINDOW];
+
+    for (int y = clip.y0; y < clip.y1; y++) {
+        int64_t v = (y - sprite->dest.y0) * step_y + step_y / 2;
+
+        for (int x = clip.x0; x < clip.x1; x += SPRITE_CHUNK) {
+            int n = clip.x1 - x < SPRITE_CHUNK ? clip.x1 - x : SPRITE_CHUNK;
+            int64_t u = (x - sprite->dest.x0) * step_x + step_x / 2;
+
+            if (sprite->filter == GRAPHICS_UPSCALE_NEAREST) {
+                const uint8_t *row = (const uint8_t *) surface->pixels + (sprite->source.y0 + (int) (v >> 16)) * surface->pitch;
+                row += (size_t) sprite->source.x0 * size;
+
+                for (int i = 0; i < n; i++, u += step_x) {
+                    switch (size) {
+                        case sizeof (uint8_t):
+                            ((uint8_t *) buffer)[i] = row[u >> 16];
+                            break;
+                        case sizeof (uint16_t):
+                            ((uint16_t *) buffer)[i] = ((const uint16_t *) row)[u >> 16];
+                            break;
+                        default:
+                            buffer[i] = ((const graphics_pixel_t *) row)[u >> 16];
+                            break;
+                    }
+                }
+
+                blit_row (renderer, x, y, (const uint8_t *) buffer, surface->format, n, surface->mode, surface->key);
+                continue;
+            }
+
+            /* Filtered texels are premultiplied BGRX, blended
+               unless the surface is opaque. They are read
+               directly from BGRX surfaces without a key, and
+               otherwise converted once each into a window
+               when the chunk spans few enough of them. */
+            int ty0, ty1, first, last, unused;
+            unsigned int fy, fx;
+            texel_pair (v - 0x8000, source_height, &ty0, &ty1, &fy);
+            texel_pair (u - 0x8000, source_width, &first, &unused, &fx);
+            texel_pair (u + (n - 1) * step_x - 0x8000, source_width, &unused, &last, &fx);
+            ty0 += sprite->source.y0;
+            ty1 += sprite->source.y0;
+
+            uint32_t opaque = surface->mode == GRAPHICS_SURFACE_OPAQUE ? 0xff000000 : 0;
+            const uint32_t *row0 = NULL, *row1 = NULL;
+            int base = 0;
+
+            if (surface->format == GRAPHICS_FORMAT_BGRX8888 && surface->mode != GRAPHICS_SURFACE_KEYED) {
+                row0 = (const uint32_t *) ((const uint8_t *) surface->pixels + ty0 * surface->pitch) + sprite->source.x0;
+                row1 = (const uint32_t *) ((const uint8_t *) surface->pixels + ty1 * surface->pitch) + sprite->source.x0;
+            } else if (last - first < SPRITE_WINDOW) {
+                for (int k = 0; k <= last - first; k++) {
+                    window[0][k] = load_texel (surface, sprite->source.x0 + first + k, ty0);
+                    window[1][k] = load_texel (surface, sprite->source.x0 + first + k, ty1);
+                }
+
+                row0 = window[0];
+                row1 = window[1];
+                base = first;
+            }
+
+            uint32_t *texels = (uint32_t *) buffer;
+
+            for (int i = 0; i < n; i++, u += step_x) {
+                int tx0, tx1;
+                uint32_t top, bottom;
+                texel_pair (u - 0x8000, source_width, &tx0, &tx1, &fx);
+
+                if (row0 != NULL) {
+                    top = lerp_texels (row0[tx0 - base] | opaque, row0[tx1 - base] | opaque, fx);
+                    bottom = lerp_texels (row1[tx0 - base] | opaque, row1[tx1 - base] | opaque, fx);
+                } else {
+                    tx0 += sprite->source.x0;
+                    tx1 += sprite->source.x0;
+                    top = lerp_texels (load_texel (surface, tx0, ty0), load_texel (surface, tx1, ty0), fx);
+                    bottom = lerp_texels (load_texel (surface, tx0, ty1), load_texel (surface, tx1, ty1), fx);
+                }
+
+                texels[i] = lerp_texels (top, bottom, fy);
+            }
+
+            graphics_surface_mode_t mode = surface->mode == GRAPHICS_SURFACE_OPAQUE ? GRAPHICS_SURFACE_OPAQUE : GRAPHICS_SURFACE_ALPHA;
+            blit_row (renderer, x, y, (const uint8_t *) buffer, GRAPHICS_FORMAT_BGRX8888, n, mode, 0);
+        }
+    }
+}
+
+static void draw_bands (int begin, int end, void *arg) {
+    const graphics_sprite_pass_t *pass = (const graphics_sprite_pass_t *) arg;
+
+    for (int band = begin; band < end; band++) {
+        int y0 = band * GRAPHICS_SPRITE_BAND_ROWS;
+        int k = band - pass->first_band;
+
+        for (int i = pass->band_start[k]; i < pass->band_start[k + 1]; i++) {
+            draw_sprite_rows (pass->renderer, &pass->sprites[pass->band_sprites[i]], y0, y0 + GRAPHICS_SPRITE_BAND_ROWS);
+        }
+    }
+}
+
+static void draw_sprite_list (graphics_renderer_t *renderer, const graphics_sprite_t *sprites, int count) {
+    int num_bands = (renderer->height + GRAPHICS_SPRITE_BAND_ROWS - 1) / GRAPHICS_SPRITE_BAND_ROWS;
+    int first = num_bands, last = 0, entries = 0;
+    uint64_t pixels = 0;
+    bool skipped = false;
+    graphics_rect_t clip;
+
+    for (int i = 0; i < count; i++) {
+        if (!sprite_clip (renderer, &sprites[i], &clip)) {
+            skipped |= clip.x0 < clip.x1 && clip.y0 < clip.y1;
+            continue;
+        }
+
+        int band0 = clip.y0 / GRAPHICS_SPRITE_BAND_ROWS;
+        int band1 = (clip.y1 - 1) / GRAPHICS_SPRITE_BAND_ROWS + 1;
+
+        graphics_renderer_mark_dirty (renderer, &clip);
+        pixels += (uint64_t) (clip.x1 - clip.x0) * (clip.y1 - clip.y0);
+        entries += band1 - band0;
+        first = band0 < first ? band0 : first;
+        last = band1 > last ? band1 : last;
+    }
+
+    if (skipped) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "skipped sprites from surfaces in neither the target's format nor BGRX.");
+    }
+
+    if (first >= last) {
+        return;
+    }
+
+    graphics_sprite_pass_t pass = { renderer, sprites, first, NULL, NULL };
+    pass.band_start = (int *) calloc ((size_t) (last - first + 1) + entries, sizeof (int));
+
+    if (pass.band_start == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/sprite", "could not allocate memory for sprite bands.");
+        return;
+    }
+
+    pass.band_sprites = pass.band_start + (last - first + 1);
+
+    /* Count the sprites over each band, then place them
+       in order after the counts of the bands before */
+    for (int i = 0; i < count; i++) {
+        if (sprite_clip (renderer, &sprites[i], &clip)) {
+            for (int band = clip.y0 / GRAPHICS_SPRITE_BAND_ROWS; band <= (clip.y1 - 1) / GRAPHICS_SPRITE_BAND_ROWS; band++) {
+                pass.band_start[band - first + 1]++;
+            }
+        }
+    }
+
+    for (int k = 0; k < last - first; k++) {
+        pass.band_start[k + 1] += pass.band_start[k];
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (sprite_clip (renderer, &sprites[i], &clip)) {
+            for (int band = clip.y0 / GRAPHICS_SPRITE_BAND_ROWS; band <= (clip.y1 - 1) / GRAPHICS_SPRITE_BAND_ROWS; band++) {
+                pass.band_sprites[pass.band_start[band - first]++] = i;
+            }
+        }
+    }
+
+    /* Placing moved each start to the next band's */
+    for (int k = last - first; k > 0; k--) {
+        pass.band_start[k] = pass.band_start[k - 1];
+    }
+
+    pass.band_start[0] = 0;
+
+    /* Bands making up about GRAPHICS_SPRITE_JOB_PIXELS */
+    int min_chunk = (int) ((uint64_t) GRAPHICS_SPRITE_JOB_PIXELS * (last - first) / pixels) + 1;
+
+    system_jobs_parallel_for (renderer->jobs, first, last, min_chunk, draw_bands, &pass);
+    free (pass.band_start);
+}
+
+/* Draw every sprite in the batch, in order. The batch
+   is left as it is, to be reset for the next frame. */
+void graphics_renderer_draw_sprites (graphics_renderer_t *renderer, const graphics_sprite_batch_t *batch) {
+    draw_sprite_list (renderer, batch->sprites, batch->count);
+}
+
+/* Copy source, or the whole surface if NULL, with its
+   top left at (x, y). */
+void graphics_renderer_blit (graphics_renderer_t *renderer, const graphics_surface_t *surface, const graphics_rect_t *source, int x, int y) {
+    graphics_rect_t rect = surface_rect (surface, source);
+    graphics_sprite_t sprite = { surface, rect, { x, y, x + rect.x1 - rect.x0, y + rect.y1 - rect.y0 }, GRAPHICS_UPSCALE_NEAREST };
+
+    if (rect.x0 < rect.x1 && rect.y0 < rect.y1) {
+        draw_sprite_list (renderer, &sprite, 1);
+    }
+}
+
+/* Copy source, or the whole surface if NULL, scaled
+   to fill dest. */
+void graphics_renderer_blit_scaled (graphics_renderer_t *renderer, const graphics_surface_t *surface, const graphics_rect_t *source, const graphics_rect_t *dest, graphics_upscale_filter_t filter) {
+    graphics_rect_t rect = surface_rect (surface, source);
+    graphics_sprite_t sprite = { surface, rect, *dest, filter };
+
+    if (rect.x0 < rect.x1 && rect.y0 < rect.y1 && dest->x0 < dest->x1 && dest->y0 < dest->y1) {
+        draw_sprite_list (renderer, &sprite, 1);
+    }
+}
@@ -0,0 +1,103 @@
+/* graphics/sprite.h
+    Images and text drawn in 2D over the frame, for
+    HUDs and overlays, without going through the
+    per-pixel drawing calls.
+
+    A surface is an image stored in a pixel format,
+    normally the renderer's, so that opaque and colour
+    keyed copies are plain row copies. Surfaces with
+    alpha are always BGRX, premultiplied as the
+    renderer blends, and are packed as they are
+    blended into a compact target. Surfaces ignore the
+    renderer's blend mode.
+
+    A sprite copies a rectangle of a surface to a
+    rectangle of the screen, clipped to the screen,
+    and scaled with nearest or bilinear filtering
+    when the two differ in size. Sprites are recorded
+    into a batch over the frame and drawn together a
+    band of rows at a time, so each band of the target
+    stays in cache while every sprite over it is drawn.
+    Bands are shared between the renderer's job
+    workers when the batch covers enough pixels. Like
+    a command list, a batch only refers to its
+    surfaces, which must stay alive until it has been
+    drawn.
+
+    A font is an atlas surface of glyphs, one per
+    printable ASCII character, built from a fixed 8x8
+    bitmap font in one colour. Text is drawn as one
+    sprite per character. */
+
+#ifndef GRAPHICS_SPRITE_H
+#define GRAPHICS_SPRITE_H
+
+#include "renderer.h"
+
+/* Rows of the target drawn as one band */
+#define GRAPHICS_SPRITE_BAND_ROWS 32
+
+/* Batches covering fewer pixels than this per job
+   are drawn on the render thread alone */
+#define GRAPHICS_SPRITE_JOB_PIXELS (32 * 1024)
+
+#define GRAPHICS_FONT_FIRST_CHAR 32
+#define GRAPHICS_FONT_NUM_CHARS 95
+#define GRAPHICS_FONT_GLYPH_SIZE 8
+
+typedef enum {
+    GRAPHICS_SURFACE_OPAQUE,
+    GRAPHICS_SURFACE_KEYED,     /* Pixels of the key colour are left out */
+    GRAPHICS_SURFACE_ALPHA      /* Blended by the alpha in the pad byte, BGRX only */
+} graphics_surface_mode_t;
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    graphics_format_t format;
+    unsigned int pixel_size;
+    size_t pitch;               /* Bytes from one row to the next */
+    graphics_surface_mode_t mode;
+    uint32_t key;               /* Key colour as stored in format */
+    void *pixels;
+} graphics_surface_t;
+
+typedef struct {
+    const graphics_surface_t *surface;
+    graphics_rect_t source;     /* Within the surface */
+    graphics_rect_t dest;       /* On screen, before clipping */
+    graphics_upscale_filter_t filter;
+} graphics_sprite_t;
+
+typedef struct {
+    graphics_sprite_t *sprites;
+    int count;
+    int capacity;
+} graphics_sprite_batch_t;
+
+typedef struct {
+    graphics_surface_t *atlas;
+    graphics_rect_t glyphs[GRAPHICS_FONT_NUM_CHARS];
+    int advance;                /* Pixels from one character to the next */
+    int line_height;
+} graphics_font_t;
+
+graphics_surface_t *graphics_surface_create (unsigned int width, unsigned int height, graphics_format_t format, graphics_surface_mode_t mode);
+void graphics_surface_destroy (graphics_surface_t *surface);
+void graphics_surface_upload (graphics_surface_t *surface, const graphics_pixel_t *pixels);
+void graphics_surface_set_colour_key (graphics_surface_t *surface, uint8_t red, uint8_t green, uint8_t blue);
+
+bool graphics_sprite_batch_init (graphics_sprite_batch_t *batch);
+void graphics_sprite_batch_reset (graphics_sprite_batch_t *batch);
+void graphics_sprite_batch_destroy (graphics_sprite_batch_t *batch);
+bool graphics_sprite_batch_add (graphics_sprite_batch_t *batch, const graphics_surface_t *surface, const graphics_rect_t *source, const graphics_rect_t *dest, graphics_upscale_filter_t filter);
+bool graphics_sprite_batch_add_text (graphics_sprite_batch_t *batch, const graphics_font_t *font, int x, int y, int scale, const char *text);
+
+graphics_font_t *graphics_font_create (graphics_format_t format, uint8_t red, uint8_t green, uint8_t blue);
+void graphics_font_destroy (graphics_font_t *font);
+
+void graphics_renderer_draw_sprites (graphics_renderer_t *renderer, const graphics_sprite_batch_t *batch);
+void graphics_renderer_blit (graphics_renderer_t *renderer, const graphics_surface_t *surface, const graphics_rect_t *source, int x, int y);
+void graphics_renderer_blit_scaled (graphics_renderer_t *renderer, const graphics_surface_t *surface, const graphics_rect_t *source, const graphics_rect_t *dest, graphics_upscale_filter_t filter);
+
+#endif
@@ -0,0 +1,133 @@
+#include "viewport.h"
+#include "./../system/log.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static void draw_viewport (graphics_viewport_t *viewport) {
+    graphics_renderer_clear_buffer (viewport->renderer);
+    viewport->draw (viewport, viewport->aux);
+    graphics_renderer_display (viewport->renderer, viewport->window);
+
+    if (viewport->window != NULL) {
+        system_window_flush (viewport->window);
+    }
+}
+
+static void *viewport_thread_main (void *arg) {
+    graphics_viewport_t *viewport = (graphics_viewport_t *) arg;
+    graphics_viewports_t *viewports = viewport->viewports;
+
+    pthread_mutex_lock (&viewports->lock);
+
+    for (;;) {
+        while (!viewports->stopping && viewports->frames == viewport->frames) {
+            pthread_cond_wait (&viewports->start, &viewports->lock);
+        }
+
+        if (viewports->stopping) {
+            break;
+        }
+
+        viewport->frames = viewports->frames;
+        pthread_mutex_unlock (&viewports->lock);
+
+        draw_viewport (viewport);
+
+        pthread_mutex_lock (&viewports->lock);
+
+        if (--viewports->working == 0) {
+            pthread_cond_signal (&viewports->finished);
+        }
+    }
+
+    pthread_mutex_unlock (&viewports->lock);
+    return NULL;
+}
+
+graphics_viewports_t *graphics_viewports_create () {
+    graphics_viewports_t *viewports = (graphics_viewports_t *) calloc (1, sizeof (graphics_viewports_t));
+
+    if (viewports == NULL) {
+        SYSTEM_LOG_ERROR ("graphics/viewport", "could not allocate memory for viewports.");
+        return NULL;
+    }
+
+    pthread_mutex_init (&viewports->lock, NULL);
+    pthread_cond_init (&viewports->start, NULL);
+    pthread_cond_init (&viewports->finished, NULL);
+
+    return viewports;
+}
+
+/* Add a view drawn by draw, presented at (x, y) in
+   window. The renderer's output resolution is the
+   size of the view. Only call between frames. */
+graphics_viewport_t *graphics_viewports_add (graphics_viewports_t *viewports, graphics_renderer_t *renderer, system_window_t *window, int x, int y, graphics_viewport_draw_t draw, void *aux) {
+    assert (renderer != NULL && draw != NULL);
+
+    if (viewports->count == GRAPHICS_MAX_VIEWPORTS) {
+        SYSTEM_LOG_ERROR ("graphics/viewport", "cannot add more than %d viewports.", GRAPHICS_MAX_VIEWPORTS);
+        return NULL;
+    }
+
+    graphics_viewport_t *viewport = &viewports->viewports[viewports->count];
+    viewport->viewports = viewports;
+    viewport->renderer = renderer;
+    viewport->camera.position = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+    viewport->camera.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    viewport->camera.rotation = (maths_vec4f) { 0.0, 0.0, 0.0, 0.0 };
+    viewport->window = window;
+    viewport->draw = draw;
+    viewport->aux = aux;
+    viewport->frames = viewports->frames;
+    graphics_renderer_set_window_position (renderer, x, y);
+
+    if (pthread_create (&viewport->thread, NULL, viewport_thread_main, viewport) != 0) {
+        SYSTEM_LOG_ERROR ("graphics/viewport", "could not start viewport thread.");
+        return NULL;
+    }
+
+    viewports->count++;
+    return viewport;
+}
+
+/* Draw and present every viewport, returning once
+   they have all finished. */
+void graphics_viewports_render (graphics_viewports_t *viewports) {
+    if (viewports->count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock (&viewports->lock);
+    viewports->working = viewports->count;
+    viewports->frames++;
+    pthread_cond_broadcast (&viewports->start);
+
+    while (viewports->working > 0) {
+        pthread_cond_wait (&viewports->finished, &viewports->lock);
+    }
+
+    pthread_mutex_unlock (&viewports->lock);
+}
+
+/* Stops the viewport threads. Renderers and windows
+   are left to the caller. */
+void graphics_viewports_destroy (graphics_viewports_t *viewports) {
+    if (viewports == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock (&viewports->lock);
+    viewports->stopping = true;
+    pthread_cond_broadcast (&viewports->start);
+    pthread_mutex_unlock (&viewports->lock);
+
+    for (int i = 0; i < viewports->count; i++) {
+        pthread_join (viewports->viewports[i].thread, NULL);
+    }
+
+    pthread_cond_destroy (&viewports->finished);
+    pthread_cond_destroy (&viewports->start);
+    pthread_mutex_destroy (&viewports->lock);
+    free (viewports);
+}
@@ -0,0 +1,60 @@
+/* graphics/viewport.h
+    Several views of a scene rendered at once, for
+    split screen or for walls of monitors. Each view
+    has its own renderer and camera and a thread to
+    draw it, and presents either to a window of its
+    own or to a rectangle of a shared window.
+
+    Each frame the render thread starts every
+    viewport's thread and waits for all of them. A
+    viewport's thread clears its renderer, calls its
+    draw function and displays the result. Draw
+    functions run in parallel, so anything they share
+    must only be read while the frame is drawn. Between
+    frames everything belongs to the render thread,
+    which may move cameras and change renderers.
+
+    Events for every window are still handled on the
+    thread calling system_window_handle_events. */
+
+#ifndef GRAPHICS_VIEWPORT_H
+#define GRAPHICS_VIEWPORT_H
+
+#include "renderer.h"
+#include "./../system/window.h"
+#include <pthread.h>
+
+#define GRAPHICS_MAX_VIEWPORTS 16
+
+typedef struct graphics_viewport_t graphics_viewport_t;
+typedef void (*graphics_viewport_draw_t) (graphics_viewport_t *viewport, void *aux);
+
+struct graphics_viewport_t {
+    struct graphics_viewports_t *viewports;
+    graphics_renderer_t *renderer;  /* Owned by the caller */
+    graphics_camera_t camera;
+    system_window_t *window;        /* NULL to render without presenting */
+    graphics_viewport_draw_t draw;
+    void *aux;
+    pthread_t thread;
+    uint64_t frames;                /* Frames started when this viewport last drew */
+};
+
+typedef struct graphics_viewports_t {
+    graphics_viewport_t viewports[GRAPHICS_MAX_VIEWPORTS];
+    int count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;           /* Signalled when a frame starts, or on shutdown */
+    pthread_cond_t finished;        /* Signalled when the last viewport finishes a frame */
+    bool stopping;
+    uint64_t frames;                /* Frames started so far */
+    int working;                    /* Viewports still drawing the current frame */
+} graphics_viewports_t;
+
+graphics_viewports_t *graphics_viewports_create ();
+graphics_viewport_t *graphics_viewports_add (graphics_viewports_t *viewports, graphics_renderer_t *renderer, system_window_t *window, int x, int y, graphics_viewport_draw_t draw, void *aux);
+void graphics_viewports_render (graphics_viewports_t *viewports);
+void graphics_viewports_destroy (graphics_viewports_t *viewports);
+
+#endif
@@ -1,4 +1,5 @@
 #include "maths.h"
+#include "./../system/log.h"
 
 /* Projection */
 maths_vec2f maths_project_vertex_3f (double viewing_plane_distance, int buffer_width, int buffer_height, double view_width, double view_height, maths_vec3f v) {
@@ -7,18 +8,18 @@ maths_vec2f maths_project_vertex_3f (double viewing_plane_distance, int buffer_w
     result.x = v.x * viewing_plane_distance / v.z;
     result.y = v.y * viewing_plane_distance / v.z;
 
-    printf (">>> %lf %lf -> %lf %lf\n", v.x, v.y, result.x, result.y);
+    SYSTEM_LOG_TRACE ("maths/project_vertex", "%lf %lf -> %lf %lf", v.x, v.y, result.x, result.y);
 
     /* Convert to pixel space */
     result.x = result.x * buffer_width / view_width;
     result.y = result.y * buffer_height / view_height;
 
-    printf ("%lf %lf\n", result.x, result.y);
+    SYSTEM_LOG_TRACE ("maths/project_vertex", "pixel space %lf %lf", result.x, result.y);
 
     result.x += buffer_width / 2.f;
     result.y += buffer_height / 2.f;
 
-    printf ("%lf %lf\n", result.x, result.y);
+    SYSTEM_LOG_TRACE ("maths/project_vertex", "screen space %lf %lf", result.x, result.y);
 
     return result;
 }
@@ -39,10 +40,17 @@ maths_vec2f maths_project_vertex_4f_3d (double viewing_plane_distance, int buffe
     return result;
 }
 
+/* The same rotation as maths_4x4f_rotation_yxz_3d,
+   whose x and y rotations turn the opposite way to
+   a rotation about the positive axis. */
+maths_quat maths_quat_from_euler_yxz (double x, double y, double z) {
+    maths_quat qx = maths_quat_from_axis_angle ((maths_vec3f) { 1.0, 0.0, 0.0 }, -x);
+    maths_quat qy = maths_quat_from_axis_angle ((maths_vec3f) { 0.0, 1.0, 0.0 }, -y);
+    maths_quat qz = maths_quat_from_axis_angle ((maths_vec3f) { 0.0, 0.0, 1.0 }, z);
+    return maths_quat_mul (qz, maths_quat_mul (qx, qy));
+}
+
 maths_mat4x4f maths_model_transform (maths_vec4f position, maths_vec4f scale, maths_vec4f rotation) {
     /* scale, then rotate, then transform */
-    maths_mat4x4f scale_matrix = maths_mat4x4f_enlargment (scale.x, scale.y, scale.z, scale.w);
-    maths_mat4x4f rotation_matrix = maths_4x4f_rotation_yxz_3d (rotation.x, rotation.y, rotation.z);
-    maths_mat4x4f translation_matrix = maths_4x4f_translation_3d (position.x, position.y, position.z);
-    return maths_mat4x4f_mul (translation_matrix, maths_mat4x4f_mul (rotation_matrix, scale_matrix));
+    return maths_mat4x4f_compose (position, scale, maths_quat_from_euler_yxz (rotation.x, rotation.y, rotation.z));
 };
@@ -26,6 +26,15 @@ typedef struct {
 
 typedef maths_vec4f maths_triangle4f[3];
 
+/* Quaternions, for orientations. Only unit
+   quaternions represent rotations. */
+typedef struct {
+    double x;
+    double y;
+    double z;
+    double w;
+} maths_quat;
+
 /* Matrices 
     
    Note that, for consistency with other
@@ -486,9 +495,149 @@ static inline maths_mat4x4f maths_4x4f_translation_3d (double x, double y, doubl
     return result;
 }
 
+/* Product of two transforms which both leave w
+   alone, i.e. whose bottom row is (0, 0, 0, 1).
+   Cheaper than a full multiply. */
+static inline maths_mat4x4f maths_mat4x4f_mul_affine (maths_mat4x4f a, maths_mat4x4f b) {
+    maths_mat4x4f result;
+
+    /* i = column, j = row */
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 3; j++) {
+            result.data[i][j] =
+                a.data[0][j] * b.data[i][0] +
+                a.data[1][j] * b.data[i][1] +
+                a.data[2][j] * b.data[i][2];
+        }
+
+        result.data[i][3] = 0;
+    }
+
+    result.data[3][0] += a.data[3][0];
+    result.data[3][1] += a.data[3][1];
+    result.data[3][2] += a.data[3][2];
+    result.data[3][3] = 1;
+
+    return result;
+}
+
+/* Inverse of a transform whose bottom row is taken
+   to be (0, 0, 0, 1), from the cofactors of its
+   upper 3x3 part. */
+static inline maths_mat4x4f maths_mat4x4f_inverse_affine (maths_mat4x4f m) {
+    double (*a)[4] = m.data;
+    double c00 = a[1][1] * a[2][2] - a[2][1] * a[1][2];
+    double c01 = a[2][1] * a[0][2] - a[0][1] * a[2][2];
+    double c02 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+    double inv = 1.0 / (a[0][0] * c00 + a[1][0] * c01 + a[2][0] * c02);
+
+    maths_mat4x4f result;
+
+    result.data[0][0] = c00 * inv;
+    result.data[0][1] = c01 * inv;
+    result.data[0][2] = c02 * inv;
+    result.data[1][0] = (a[2][0] * a[1][2] - a[1][0] * a[2][2]) * inv;
+    result.data[1][1] = (a[0][0] * a[2][2] - a[2][0] * a[0][2]) * inv;
+    result.data[1][2] = (a[1][0] * a[0][2] - a[0][0] * a[1][2]) * inv;
+    result.data[2][0] = (a[1][0] * a[2][1] - a[2][0] * a[1][1]) * inv;
+    result.data[2][1] = (a[2][0] * a[0][1] - a[0][0] * a[2][1]) * inv;
+    result.data[2][2] = (a[0][0] * a[1][1] - a[1][0] * a[0][1]) * inv;
+
+    for (int j = 0; j < 3; j++) {
+        result.data[3][j] = -(result.data[0][j] * a[3][0] + result.data[1][j] * a[3][1] + result.data[2][j] * a[3][2]);
+        result.data[j][3] = 0;
+    }
+
+    result.data[3][3] = 1;
+
+    return result;
+}
+
+/* Quaternions */
+static inline maths_quat maths_quat_identity () {
+    return (maths_quat) { 0.0, 0.0, 0.0, 1.0 };
+}
+
+/* Rotation by angle radians about a unit axis */
+static inline maths_quat maths_quat_from_axis_angle (maths_vec3f axis, double angle) {
+    double s = sin (angle / 2);
+    return (maths_quat) { axis.x * s, axis.y * s, axis.z * s, cos (angle / 2) };
+}
+
+/* Rotation by b, then by a */
+static inline maths_quat maths_quat_mul (maths_quat a, maths_quat b) {
+    return (maths_quat) {
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+    };
+}
+
+static inline maths_quat maths_quat_conjugate (maths_quat q) {
+    return (maths_quat) { -q.x, -q.y, -q.z, q.w };
+}
+
+/* Rotations composed over many frames drift away
+   from unit length - renormalise them now and then. */
+static inline maths_quat maths_quat_normalise (maths_quat q) {
+    double mag = sqrt (q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    return (maths_quat) { q.x / mag, q.y / mag, q.z / mag, q.w / mag };
+}
+
+static inline maths_mat4x4f maths_quat_to_mat4x4f (maths_quat q) {
+    maths_mat4x4f result;
+
+    double xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    double xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    double wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    result.data[0][0] = 1 - 2 * (yy + zz);
+    result.data[0][1] = 2 * (xy + wz);
+    result.data[0][2] = 2 * (xz - wy);
+    result.data[0][3] = 0;
+
+    result.data[1][0] = 2 * (xy - wz);
+    result.data[1][1] = 1 - 2 * (xx + zz);
+    result.data[1][2] = 2 * (yz + wx);
+    result.data[1][3] = 0;
+
+    result.data[2][0] = 2 * (xz + wy);
+    result.data[2][1] = 2 * (yz - wx);
+    result.data[2][2] = 1 - 2 * (xx + yy);
+    result.data[2][3] = 0;
+
+    result.data[3][0] = 0;
+    result.data[3][1] = 0;
+    result.data[3][2] = 0;
+    result.data[3][3] = 1;
+
+    return result;
+}
+
+/* Scale, then rotate, then translate, built in one
+   go rather than by multiplying three matrices. */
+static inline maths_mat4x4f maths_mat4x4f_compose (maths_vec4f position, maths_vec4f scale, maths_quat rotation) {
+    maths_mat4x4f result = maths_quat_to_mat4x4f (rotation);
+
+    for (int j = 0; j < 3; j++) {
+        result.data[0][j] *= scale.x;
+        result.data[1][j] *= scale.y;
+        result.data[2][j] *= scale.z;
+    }
+
+    result.data[3][0] = position.x * scale.w;
+    result.data[3][1] = position.y * scale.w;
+    result.data[3][2] = position.z * scale.w;
+    result.data[3][3] = scale.w;
+
+    return result;
+}
+
 maths_vec2f maths_project_vertex_3f (double viewing_plane_distance, int buffer_width, int buffer_height, double view_width, double view_height, maths_vec3f v);
 maths_vec2f maths_project_vertex_4f_3d (double viewing_plane_distance, int buffer_width, int buffer_height, double view_width, double view_height, maths_vec4f v);
 
+maths_quat maths_quat_from_euler_yxz (double x, double y, double z);
 maths_mat4x4f maths_model_transform (maths_vec4f position, maths_vec4f scale, maths_vec4f rotation);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "transform.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <assert.h>
+
+static bool grow (maths_transform_hierarchy_t *hierarchy, uint32_t capacity) {
+    maths_vec4f *position = (maths_vec4f *) realloc (hierarchy->position, sizeof (maths_vec4f) * capacity);
+    hierarchy->position = position != NULL ? position : hierarchy->position;
+    maths_vec4f *scale = (maths_vec4f *) realloc (hierarchy->scale, sizeof (maths_vec4f) * capacity);
+    hierarchy->scale = scale != NULL ? scale : hierarchy->scale;
+    maths_quat *rotation = (maths_quat *) realloc (hierarchy->rotation, sizeof (maths_quat) * capacity);
+    hierarchy->rotation = rotation != NULL ? rotation : hierarchy->rotation;
+    maths_transform_t *parent = (maths_transform_t *) realloc (hierarchy->parent, sizeof (maths_transform_t) * capacity);
+    hierarchy->parent = parent != NULL ? parent : hierarchy->parent;
+    maths_mat4x4f *local = (maths_mat4x4f *) realloc (hierarchy->local, sizeof (maths_mat4x4f) * capacity);
+    hierarchy->local = local != NULL ? local : hierarchy->local;
+    maths_mat4x4f *world = (maths_mat4x4f *) realloc (hierarchy->world, sizeof (maths_mat4x4f) * capacity);
+    hierarchy->world = world != NULL ? world : hierarchy->world;
+    uint8_t *flags = (uint8_t *) realloc (hierarchy->flags, sizeof (uint8_t) * capacity);
+    hierarchy->flags = flags != NULL ? flags : hierarchy->flags;
+    maths_transform_t *order = (maths_transform_t *) realloc (hierarchy->order, sizeof (maths_transform_t) * capacity);
+    hierarchy->order = order != NULL ? order : hierarchy->order;
+    uint32_t *depth = (uint32_t *) realloc (hierarchy->depth, sizeof (uint32_t) * capacity);
+    hierarchy->depth = depth != NULL ? depth : hierarchy->depth;
+
+    if (position == NULL || scale == NULL || rotation == NULL || parent == NULL || local == NULL || world == NULL || flags == NULL || order == NULL || depth == NULL) {
+        SYSTEM_LOG_ERROR ("maths/transform", "could not allocate memory for %u transforms.", capacity);
+        return false;
+    }
+
+    hierarchy->capacity = capacity;
+    return true;
+}
+
+bool maths_transform_hierarchy_init (maths_transform_hierarchy_t *hierarchy, uint32_t capacity) {
+    assert (hierarchy != NULL);
+
+    memset (hierarchy, 0, sizeof (maths_transform_hierarchy_t));
+
+    if (!grow (hierarchy, capacity > 0 ? capacity : 16)) {
+        maths_transform_hierarchy_destroy (hierarchy);
+        return false;
+    }
+
+    return true;
+}
+
+void maths_transform_hierarchy_destroy (maths_transform_hierarchy_t *hierarchy) {
+    assert (hierarchy != NULL);
+
+    free (hierarchy->position);
+    free (hierarchy->scale);
+    free (hierarchy->rotation);
+    free (hierarchy->parent);
+    free (hierarchy->local);
+    free (hierarchy->world);
+    free (hierarchy->flags);
+    free (hierarchy->order);
+    free (hierarchy->depth);
+
+    memset (hierarchy, 0, sizeof (maths_transform_hierarchy_t));
+}
+
+static void mark (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, uint8_t flags) {
+    assert (transform < hierarchy->count);
+
+    hierarchy->flags[transform] |= flags;
+    hierarchy->dirty = true;
+}
+
+/* A new identity transform, with parent
+   MATHS_TRANSFORM_NONE for a root. */
+maths_transform_t maths_transform_hierarchy_add (maths_transform_hierarchy_t *hierarchy, maths_transform_t parent) {
+    assert (parent == MATHS_TRANSFORM_NONE || parent < hierarchy->count);
+
+    if (hierarchy->count == hierarchy->capacity && !grow (hierarchy, hierarchy->capacity * 2)) {
+        return MATHS_TRANSFORM_NONE;
+    }
+
+    maths_transform_t transform = hierarchy->count++;
+
+    hierarchy->position[transform] = (maths_vec4f) { 0.0, 0.0, 0.0, 1.0 };
+    hierarchy->scale[transform] = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    hierarchy->rotation[transform] = maths_quat_identity ();
+    hierarchy->parent[transform] = parent;
+    hierarchy->flags[transform] = 0;
+
+    /* Parents always come before their children until
+       something is reparented, so the new transform
+       can go at the end of the order. */
+    hierarchy->order[transform] = transform;
+    hierarchy->depth[transform] = parent != MATHS_TRANSFORM_NONE ? hierarchy->depth[parent] + 1 : 0;
+
+    if (!hierarchy->order_dirty && transform > 0 && hierarchy->depth[hierarchy->order[transform - 1]] > hierarchy->depth[transform]) {
+        hierarchy->order_dirty = true;
+    }
+
+    mark (hierarchy, transform, MATHS_TRANSFORM_LOCAL_DIRTY);
+
+    return transform;
+}
+
+void maths_transform_hierarchy_set_parent (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_transform_t parent) {
+    assert (transform < hierarchy->count);
+    assert (parent == MATHS_TRANSFORM_NONE || parent < hierarchy->count);
+
+    /* Must not make a transform its own ancestor */
+    for (maths_transform_t p = parent; p != MATHS_TRANSFORM_NONE; p = hierarchy->parent[p]) {
+        assert (p != transform);
+    }
+
+    hierarchy->parent[transform] = parent;
+    hierarchy->order_dirty = true;
+
+    mark (hierarchy, transform, MATHS_TRANSFORM_WORLD_DIRTY);
+}
+
+void maths_transform_hierarchy_set_position (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_vec4f position) {
+    mark (hierarchy, transform, MATHS_TRANSFORM_LOCAL_DIRTY);
+    hierarchy->position[transform] = position;
+}
+
+void maths_transform_hierarchy_set_scale (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_vec4f scale) {
+    mark (hierarchy, transform, MATHS_TRANSFORM_LOCAL_DIRTY);
+    hierarchy->scale[transform] = scale;
+}
+
+void maths_transform_hierarchy_set_rotation (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_quat rotation) {
+    mark (hierarchy, transform, MATHS_TRANSFORM_LOCAL_DIRTY);
+    hierarchy->rotation[transform] = rotation;
+}
+
+/* Apply a further rotation after the current one */
+void maths_transform_hierarchy_rotate (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_quat rotation) {
+    mark (hierarchy, transform, MATHS_TRANSFORM_LOCAL_DIRTY);
+    hierarchy->rotation[transform] = maths_quat_normalise (maths_quat_mul (rotation, hierarchy->rotation[transform]));
+}
+
+/* Counting sort of the transforms by depth */
+static void rebuild_order (maths_transform_hierarchy_t *hierarchy) {
+    uint32_t max_depth = 0;
+
+    for (uint32_t i = 0; i < hierarchy->count; i++) {
+        uint32_t depth = 0;
+
+        for (maths_transform_t p = hierarchy->parent[i]; p != MATHS_TRANSFORM_NONE; p = hierarchy->parent[p]) {
+            depth++;
+        }
+
+        hierarchy->depth[i] = depth;
+        max_depth = depth > max_depth ? depth : max_depth;
+    }
+
+    uint32_t *start = (uint32_t *) calloc (max_depth + 2, sizeof (uint32_t));
+
+    if (start == NULL) {
+        SYSTEM_LOG_ERROR ("maths/transform", "could not allocate memory to sort transforms.");
+        return;
+    }
+
+    for (uint32_t i = 0; i < hierarchy->count; i++) {
+        start[hierarchy->depth[i] + 1]++;
+    }
+
+    for (uint32_t d = 1; d <= max_depth + 1; d++) {
+        start[d] += start[d - 1];
+    }
+
+    for (uint32_t i = 0; i < hierarchy->count; i++) {
+        hierarchy->order[start[hierarchy->depth[i]]++] = i;
+    }
+
+    free (start);
+    hierarchy->order_dirty = false;
+}
+
+void maths_transform_hierarchy_update (maths_transform_hierarchy_t *hierarchy) {
+    assert (hierarchy != NULL);
+
+    if (!hierarchy->dirty) {
+        /* Nothing changed this time - clear what the last
+           update flagged, once. */
+        if (hierarchy->changed) {
+            memset (hierarchy->flags, 0, hierarchy->count);
+            hierarchy->changed = false;
+        }
+
+        return;
+    }
+
+    if (hierarchy->order_dirty) {
+        rebuild_order (hierarchy);
+    }
+
+    uint8_t *flags = hierarchy->flags;
+
+    for (uint32_t k = 0; k < hierarchy->count; k++) {
+        maths_transform_t i = hierarchy->order[k];
+        maths_transform_t parent = hierarchy->parent[i];
+        uint8_t f = flags[i];
+
+        if (f & MATHS_TRANSFORM_LOCAL_DIRTY) {
+            hierarchy->local[i] = maths_mat4x4f_compose (hierarchy->position[i], hierarchy->scale[i], hierarchy->rotation[i]);
+        }
+
+        /* The parent has already been visited this
+           update, so its flags are current. */
+        if (parent != MATHS_TRANSFORM_NONE && (flags[parent] & MATHS_TRANSFORM_CHANGED)) {
+            f |= MATHS_TRANSFORM_WORLD_DIRTY;
+        }
+
+        if (f & (MATHS_TRANSFORM_LOCAL_DIRTY | MATHS_TRANSFORM_WORLD_DIRTY)) {
+            hierarchy->world[i] = parent != MATHS_TRANSFORM_NONE ? maths_mat4x4f_mul_affine (hierarchy->world[parent], hierarchy->local[i]) : hierarchy->local[i];
+            flags[i] = MATHS_TRANSFORM_CHANGED;
+        } else {
+            flags[i] = 0;
+        }
+    }
+
+    hierarchy->dirty = false;
+    hierarchy->changed = true;
+}
@@ -0,0 +1,73 @@
+/* maths/transform.h
+    Transform hierarchy. Each transform has a
+    position, scale and quaternion rotation relative
+    to its parent, and caches both its local matrix
+    and its world matrix (parent's world times local).
+
+    Setters only mark a transform dirty. Matrices are
+    brought up to date by maths_transform_hierarchy_update,
+    which walks the transforms breadth first so that
+    parents are always done before their children, and
+    only rebuilds a world matrix if the transform or an
+    ancestor changed. When nothing was marked dirty the
+    update returns straight away.
+
+    Transforms are stored as a structure of arrays
+    and referred to by index. */
+
+#ifndef MATHS_TRANSFORM_H
+#define MATHS_TRANSFORM_H
+
+#include "maths.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t maths_transform_t;
+
+#define MATHS_TRANSFORM_NONE UINT32_MAX
+
+/* Flags */
+#define MATHS_TRANSFORM_LOCAL_DIRTY 1   /* Local matrix needs rebuilding */
+#define MATHS_TRANSFORM_WORLD_DIRTY 2   /* World matrix needs rebuilding */
+#define MATHS_TRANSFORM_CHANGED 4       /* World matrix changed by the last update */
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+
+    /* Relative to the parent */
+    maths_vec4f *position;
+    maths_vec4f *scale;
+    maths_quat *rotation;
+    maths_transform_t *parent;
+
+    maths_mat4x4f *local;
+    maths_mat4x4f *world;
+    uint8_t *flags;
+
+    /* Transforms sorted by depth in the tree, rebuilt
+       when a parent changes. */
+    maths_transform_t *order;
+    uint32_t *depth;
+    bool order_dirty;
+
+    bool dirty;                 /* Any transform marked since the last update */
+    bool changed;               /* Any CHANGED flags set by the last update */
+} maths_transform_hierarchy_t;
+
+bool maths_transform_hierarchy_init (maths_transform_hierarchy_t *hierarchy, uint32_t capacity);
+void maths_transform_hierarchy_destroy (maths_transform_hierarchy_t *hierarchy);
+maths_transform_t maths_transform_hierarchy_add (maths_transform_hierarchy_t *hierarchy, maths_transform_t parent);
+void maths_transform_hierarchy_set_parent (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_transform_t parent);
+void maths_transform_hierarchy_set_position (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_vec4f position);
+void maths_transform_hierarchy_set_scale (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_vec4f scale);
+void maths_transform_hierarchy_set_rotation (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_quat rotation);
+void maths_transform_hierarchy_rotate (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform, maths_quat rotation);
+void maths_transform_hierarchy_update (maths_transform_hierarchy_t *hierarchy);
+
+/* Only valid after an update */
+static inline maths_mat4x4f *maths_transform_hierarchy_world (maths_transform_hierarchy_t *hierarchy, maths_transform_t transform) {
+    return &hierarchy->world[transform];
+}
+
+#endif
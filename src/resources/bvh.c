@@ -0,0 +1,924 @@
+#include "bvh.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+#include <assert.h>
+
+#if defined (__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+/* Relative costs for the surface area heuristic */
+#define RESOURCES_BVH_TRAVERSAL_COST 1.0
+#define RESOURCES_BVH_PACKET_COST 1.0
+
+/* Hash of the geometry a hierarchy was built for */
+static uint64_t mesh_hash (const resources_mesh_t *mesh) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t sizes[2] = { 0, sizeof (resources_triangle_t) * mesh->num_faces };
+    const unsigned char *bytes[2] = { (const unsigned char *) resources_mesh_vertex_data (mesh, &sizes[0]), (const unsigned char *) mesh->faces };
+
+    for (int i = 0; i < 2; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            hash = (hash ^ bytes[i][j]) * 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+/* Building */
+
+typedef struct {
+    double min[3];
+    double max[3];
+} bounds_t;
+
+typedef struct {
+    const resources_mesh_t *mesh;
+    bounds_t *face_bounds;
+    double (*centroids)[3];
+    int *order;                 /* Faces, partitioned in place as nodes are split */
+    resources_bvh_t *bvh;
+} build_t;
+
+static inline void bounds_empty (bounds_t *b) {
+    for (int i = 0; i < 3; i++) {
+        b->min[i] = INFINITY;
+        b->max[i] = -INFINITY;
+    }
+}
+
+static inline void bounds_grow (bounds_t *b, const bounds_t *other) {
+    for (int i = 0; i < 3; i++) {
+        b->min[i] = other->min[i] < b->min[i] ? other->min[i] : b->min[i];
+        b->max[i] = other->max[i] > b->max[i] ? other->max[i] : b->max[i];
+    }
+}
+
+/* Half the surface area, which is all the heuristic
+   needs since only ratios are compared. */
+static inline double half_area (const bounds_t *b) {
+    double dx = b->max[0] - b->min[0];
+    double dy = b->max[1] - b->min[1];
+    double dz = b->max[2] - b->min[2];
+    return dx < 0.0 ? 0.0 : dx * dy + dy * dz + dz * dx;
+}
+
+static inline int packets_for (int faces) {
+    return (faces + RESOURCES_BVH_PACKET - 1) / RESOURCES_BVH_PACKET;
+}
+
+/* Rounded outwards, so the single precision bounds
+   still hold the whole face. */
+static inline float round_down (double x) {
+    float f = (float) x;
+    return (double) f > x ? nextafterf (f, -INFINITY) : f;
+}
+
+static inline float round_up (double x) {
+    float f = (float) x;
+    return (double) f < x ? nextafterf (f, INFINITY) : f;
+}
+
+static void make_leaf (build_t *build, uint32_t node, int start, int end) {
+    resources_bvh_t *bvh = build->bvh;
+    const resources_mesh_t *mesh = build->mesh;
+
+    bvh->nodes[node].first = bvh->num_packets;
+    bvh->nodes[node].count = packets_for (end - start);
+
+    for (int i = start; i < end; i += RESOURCES_BVH_PACKET) {
+        resources_bvh_packet_t *packet = &bvh->packets[bvh->num_packets++];
+        memset (packet, 0, sizeof (resources_bvh_packet_t));
+
+        for (int lane = 0; lane < RESOURCES_BVH_PACKET; lane++) {
+            if (i + lane >= end) {
+                packet->face[lane] = -1;
+                continue;
+            }
+
+            int face = build->order[i + lane];
+            maths_vec4f v0 = resources_mesh_vertex (mesh, mesh->faces[face][0]);
+            maths_vec4f v1 = resources_mesh_vertex (mesh, mesh->faces[face][1]);
+            maths_vec4f v2 = resources_mesh_vertex (mesh, mesh->faces[face][2]);
+            double p0[3] = { v0.x, v0.y, v0.z };
+            double p1[3] = { v1.x, v1.y, v1.z };
+            double p2[3] = { v2.x, v2.y, v2.z };
+
+            for (int k = 0; k < 3; k++) {
+                packet->v0[k][lane] = (float) p0[k];
+                packet->e1[k][lane] = (float) (p1[k] - p0[k]);
+                packet->e2[k][lane] = (float) (p2[k] - p0[k]);
+            }
+
+            packet->face[lane] = face;
+        }
+    }
+}
+
+/* Split faces [start, end) between two children,
+   at the binned plane with the lowest estimated
+   cost, or make a leaf if that is cheaper. */
+static uint32_t build_node (build_t *build, int start, int end, int depth) {
+    resources_bvh_t *bvh = build->bvh;
+    uint32_t node = bvh->num_nodes++;
+    int n = end - start;
+
+    bounds_t bounds;
+    bounds_t centroid_bounds;
+    bounds_empty (&bounds);
+    bounds_empty (&centroid_bounds);
+
+    for (int i = start; i < end; i++) {
+        int face = build->order[i];
+        bounds_t centroid = { { build->centroids[face][0], build->centroids[face][1], build->centroids[face][2] },
+                              { build->centroids[face][0], build->centroids[face][1], build->centroids[face][2] } };
+        bounds_grow (&bounds, &build->face_bounds[face]);
+        bounds_grow (&centroid_bounds, &centroid);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        bvh->nodes[node].min[i] = round_down (bounds.min[i]);
+        bvh->nodes[node].max[i] = round_up (bounds.max[i]);
+    }
+
+    double leaf_cost = RESOURCES_BVH_PACKET_COST * packets_for (n);
+
+    if (n <= RESOURCES_BVH_PACKET || depth >= RESOURCES_BVH_MAX_DEPTH) {
+        make_leaf (build, node, start, end);
+        return node;
+    }
+
+    double best_cost = INFINITY;
+    int best_axis = -1;
+    int best_split = 0;
+    double area = half_area (&bounds);
+
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = centroid_bounds.min[axis];
+        double extent = centroid_bounds.max[axis] - lo;
+
+        if (extent <= 0.0) {
+            continue;
+        }
+
+        bounds_t bins[RESOURCES_BVH_BINS];
+        int counts[RESOURCES_BVH_BINS] = { 0 };
+
+        for (int b = 0; b < RESOURCES_BVH_BINS; b++) {
+            bounds_empty (&bins[b]);
+        }
+
+        for (int i = start; i < end; i++) {
+            int face = build->order[i];
+            int b = (int) ((build->centroids[face][axis] - lo) / extent * RESOURCES_BVH_BINS);
+            b = b >= RESOURCES_BVH_BINS ? RESOURCES_BVH_BINS - 1 : b;
+            counts[b]++;
+            bounds_grow (&bins[b], &build->face_bounds[face]);
+        }
+
+        /* Sweep from the right to get the area and
+           count of everything right of each plane, then
+           from the left to cost each plane. */
+        double right_area[RESOURCES_BVH_BINS];
+        int right_count[RESOURCES_BVH_BINS];
+        bounds_t right;
+        bounds_empty (&right);
+        int count = 0;
+
+        for (int b = RESOURCES_BVH_BINS - 1; b > 0; b--) {
+            bounds_grow (&right, &bins[b]);
+            count += counts[b];
+            right_area[b] = half_area (&right);
+            right_count[b] = count;
+        }
+
+        bounds_t left;
+        bounds_empty (&left);
+        count = 0;
+
+        for (int b = 1; b < RESOURCES_BVH_BINS; b++) {
+            bounds_grow (&left, &bins[b - 1]);
+            count += counts[b - 1];
+
+            if (count == 0 || right_count[b] == 0) {
+                continue;
+            }
+
+            double cost = RESOURCES_BVH_TRAVERSAL_COST + RESOURCES_BVH_PACKET_COST *
+                (half_area (&left) * packets_for (count) + right_area[b] * packets_for (right_count[b])) / area;
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    if (best_axis >= 0 && best_cost >= leaf_cost && packets_for (n) <= RESOURCES_BVH_MAX_LEAF_PACKETS) {
+        make_leaf (build, node, start, end);
+        return node;
+    }
+
+    int mid = (start + end) / 2;
+
+    if (best_axis >= 0) {
+        double lo = centroid_bounds.min[best_axis];
+        double extent = centroid_bounds.max[best_axis] - lo;
+        int i = start;
+        int j = end - 1;
+
+        while (i <= j) {
+            int b = (int) ((build->centroids[build->order[i]][best_axis] - lo) / extent * RESOURCES_BVH_BINS);
+            b = b >= RESOURCES_BVH_BINS ? RESOURCES_BVH_BINS - 1 : b;
+
+            if (b < best_split) {
+                i++;
+            } else {
+                int swap = build->order[i];
+                build->order[i] = build->order[j];
+                build->order[j--] = swap;
+            }
+        }
+
+        mid = i;
+    } else if (packets_for (n) <= RESOURCES_BVH_MAX_LEAF_PACKETS) {
+        /* Every centroid in the same place */
+        make_leaf (build, node, start, end);
+        return node;
+    }
+
+    build_node (build, start, mid, depth + 1);
+    bvh->nodes[node].first = build_node (build, mid, end, depth + 1);
+    bvh->nodes[node].count = 0;
+
+    return node;
+}
+
+resources_bvh_t *resources_bvh_build (const resources_mesh_t *mesh) {
+    assert (mesh != NULL);
+
+    int n = mesh->num_faces;
+    resources_bvh_t *bvh = (resources_bvh_t *) calloc (1, sizeof (resources_bvh_t));
+    build_t build = { mesh };
+
+    build.face_bounds = (bounds_t *) malloc (sizeof (bounds_t) * (n + 1));
+    build.centroids = (double (*)[3]) malloc (sizeof (double) * 3 * (n + 1));
+    build.order = (int *) malloc (sizeof (int) * (n + 1));
+    build.bvh = bvh;
+
+    if (bvh != NULL) {
+        /* At most one packet per face, and a binary
+           tree over them has fewer than twice as many
+           nodes as leaves. */
+        bvh->nodes = (resources_bvh_node_t *) malloc (sizeof (resources_bvh_node_t) * (2 * n + 1));
+        bvh->packets = (resources_bvh_packet_t *) malloc (sizeof (resources_bvh_packet_t) * (n + 1));
+    }
+
+    if (bvh == NULL || build.face_bounds == NULL || build.centroids == NULL || build.order == NULL || bvh->nodes == NULL || bvh->packets == NULL) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not allocate memory for hierarchy over %d faces.", n);
+        resources_bvh_free (bvh);
+        bvh = NULL;
+        goto done;
+    }
+
+    for (int i = 0; i < n; i++) {
+        bounds_empty (&build.face_bounds[i]);
+
+        for (int k = 0; k < 3; k++) {
+            maths_vec4f v = resources_mesh_vertex (mesh, mesh->faces[i][k]);
+            bounds_t point = { { v.x, v.y, v.z }, { v.x, v.y, v.z } };
+            bounds_grow (&build.face_bounds[i], &point);
+        }
+
+        for (int k = 0; k < 3; k++) {
+            build.centroids[i][k] = (build.face_bounds[i].min[k] + build.face_bounds[i].max[k]) * 0.5;
+        }
+
+        build.order[i] = i;
+    }
+
+    if (n > 0) {
+        build_node (&build, 0, n, 0);
+    }
+
+    bvh->mesh_hash = mesh_hash (mesh);
+
+    /* Give back what the worst case did not need */
+    resources_bvh_node_t *nodes = (resources_bvh_node_t *) realloc (bvh->nodes, sizeof (resources_bvh_node_t) * (bvh->num_nodes + 1));
+    resources_bvh_packet_t *packets = (resources_bvh_packet_t *) realloc (bvh->packets, sizeof (resources_bvh_packet_t) * (bvh->num_packets + 1));
+    bvh->nodes = nodes != NULL ? nodes : bvh->nodes;
+    bvh->packets = packets != NULL ? packets : bvh->packets;
+
+    SYSTEM_LOG_DEBUG ("resources/bvh", "built hierarchy of %u nodes and %u packets over %d faces.", bvh->num_nodes, bvh->num_packets, n);
+
+done:
+    free (build.face_bounds);
+    free (build.centroids);
+    free (build.order);
+
+    return bvh;
+}
+
+void resources_bvh_free (resources_bvh_t *bvh) {
+    if (bvh == NULL) {
+        return;
+    }
+
+    free (bvh->nodes);
+    free (bvh->packets);
+    free (bvh);
+}
+
+size_t resources_bvh_size (const resources_bvh_t *bvh) {
+    if (bvh == NULL) {
+        return 0;
+    }
+
+    return sizeof (resources_bvh_t) + sizeof (resources_bvh_node_t) * bvh->num_nodes + sizeof (resources_bvh_packet_t) * bvh->num_packets;
+}
+
+/* Storing */
+
+bool resources_bvh_write (const resources_bvh_t *bvh, const char *path) {
+    assert (bvh != NULL && path != NULL);
+
+    FILE *file = fopen (path, "wb");
+
+    if (file == NULL) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not open %s for writing.", path);
+        return false;
+    }
+
+    resources_bvh_header_t header;
+    memcpy (header.magic, RESOURCES_BVH_MAGIC, 4);
+    header.version = RESOURCES_BVH_VERSION;
+    header.num_nodes = bvh->num_nodes;
+    header.num_packets = bvh->num_packets;
+    header.mesh_hash = bvh->mesh_hash;
+
+    bool ok = fwrite (&header, sizeof (header), 1, file) == 1 &&
+              fwrite (bvh->nodes, sizeof (resources_bvh_node_t), bvh->num_nodes, file) == bvh->num_nodes &&
+              fwrite (bvh->packets, sizeof (resources_bvh_packet_t), bvh->num_packets, file) == bvh->num_packets;
+
+    if (fclose (file) != 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not write hierarchy to %s.", path);
+    }
+
+    return ok;
+}
+
+/* Every child and packet a node refers to must be in
+   range, and no node deeper than a built tree's can
+   be, so that a damaged file cannot send a query out
+   of bounds or overflow its stack. Children always
+   follow their parents, so depths are found in one
+   pass. */
+static bool valid_hierarchy (const resources_bvh_t *bvh, const resources_mesh_t *mesh) {
+    uint8_t *depth = (uint8_t *) calloc (bvh->num_nodes, sizeof (uint8_t));
+
+    if (depth == NULL) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not allocate memory to check hierarchy.");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < bvh->num_nodes; i++) {
+        const resources_bvh_node_t *node = &bvh->nodes[i];
+
+        if (node->count == 0 ? (node->first <= i + 1 || node->first >= bvh->num_nodes) : (node->first > bvh->num_packets || node->count > bvh->num_packets - node->first)) {
+            free (depth);
+            return false;
+        }
+
+        if (node->count == 0) {
+            if (depth[i] >= RESOURCES_BVH_MAX_DEPTH) {
+                free (depth);
+                return false;
+            }
+
+            uint32_t children[2] = { i + 1, node->first };
+
+            for (int c = 0; c < 2; c++) {
+                if (depth[children[c]] < depth[i] + 1) {
+                    depth[children[c]] = depth[i] + 1;
+                }
+            }
+        }
+    }
+
+    free (depth);
+
+    for (uint32_t i = 0; i < bvh->num_packets; i++) {
+        for (int lane = 0; lane < RESOURCES_BVH_PACKET; lane++) {
+            if (bvh->packets[i].face[lane] >= mesh->num_faces) {
+                return false;
+            }
+        }
+    }
+
+    return bvh->num_nodes > 0;
+}
+
+/* Read a hierarchy written for the given mesh.
+   Returns NULL if the file is not a hierarchy, or
+   was built for different geometry. */
+resources_bvh_t *resources_bvh_read (const char *path, const resources_mesh_t *mesh) {
+    assert (path != NULL && mesh != NULL);
+
+    FILE *file = fopen (path, "rb");
+
+    if (file == NULL) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not open file %s.", path);
+        return NULL;
+    }
+
+    resources_bvh_header_t header;
+    resources_bvh_t *bvh = NULL;
+
+    if (fread (&header, sizeof (header), 1, file) != 1 || memcmp (header.magic, RESOURCES_BVH_MAGIC, 4) != 0 || header.version != RESOURCES_BVH_VERSION) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "%s is not a hierarchy file.", path);
+        goto done;
+    }
+
+    if (header.mesh_hash != mesh_hash (mesh)) {
+        SYSTEM_LOG_INFO ("resources/bvh", "%s was built for a different mesh.", path);
+        goto done;
+    }
+
+    if (header.num_nodes > 2 * (uint32_t) mesh->num_faces + 1 || header.num_packets > (uint32_t) mesh->num_faces) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "%s is damaged.", path);
+        goto done;
+    }
+
+    bvh = (resources_bvh_t *) calloc (1, sizeof (resources_bvh_t));
+
+    if (bvh != NULL) {
+        bvh->nodes = (resources_bvh_node_t *) malloc (sizeof (resources_bvh_node_t) * (header.num_nodes + 1));
+        bvh->packets = (resources_bvh_packet_t *) malloc (sizeof (resources_bvh_packet_t) * (header.num_packets + 1));
+    }
+
+    if (bvh == NULL || bvh->nodes == NULL || bvh->packets == NULL) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "could not allocate memory for hierarchy in %s.", path);
+        resources_bvh_free (bvh);
+        bvh = NULL;
+        goto done;
+    }
+
+    bvh->num_nodes = header.num_nodes;
+    bvh->num_packets = header.num_packets;
+    bvh->mesh_hash = header.mesh_hash;
+
+    if (fread (bvh->nodes, sizeof (resources_bvh_node_t), bvh->num_nodes, file) != bvh->num_nodes ||
+        fread (bvh->packets, sizeof (resources_bvh_packet_t), bvh->num_packets, file) != bvh->num_packets ||
+        !valid_hierarchy (bvh, mesh)) {
+        SYSTEM_LOG_ERROR ("resources/bvh", "%s is damaged.", path);
+        resources_bvh_free (bvh);
+        bvh = NULL;
+    }
+
+done:
+    fclose (file);
+    return bvh;
+}
+
+/* Give a mesh its hierarchy. With a cache path, it is
+   read from there if it is up to date, and otherwise
+   built and written there for next time. */
+bool resources_mesh_build_bvh (resources_mesh_t *mesh, const char *cache_path) {
+    assert (mesh != NULL);
+
+    if (mesh->bvh != NULL) {
+        return true;
+    }
+
+    if (cache_path != NULL && access (cache_path, R_OK) == 0) {
+        mesh->bvh = resources_bvh_read (cache_path, mesh);
+
+        if (mesh->bvh != NULL) {
+            return true;
+        }
+    }
+
+    mesh->bvh = resources_bvh_build (mesh);
+
+    if (mesh->bvh == NULL) {
+        return false;
+    }
+
+    if (cache_path != NULL && !resources_bvh_write (mesh->bvh, cache_path)) {
+        SYSTEM_LOG_WARN ("resources/bvh", "could not cache hierarchy, it will be rebuilt next time.");
+    }
+
+    return true;
+}
+
+/* Queries */
+
+typedef struct {
+    float origin[4];
+    float direction[4];
+    float inverse[4];           /* 1 / direction, huge rather than infinite for 0 */
+    float max_t;
+} query_t;
+
+static bool setup_query (const resources_ray_t *ray, query_t *query) {
+    double d[3] = { ray->direction.x, ray->direction.y, ray->direction.z };
+    double o[3] = { ray->origin.x, ray->origin.y, ray->origin.z };
+
+    if (d[0] == 0.0 && d[1] == 0.0 && d[2] == 0.0) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        query->origin[i] = (float) o[i];
+        query->direction[i] = (float) d[i];
+        query->inverse[i] = fabs (d[i]) > 1e-30 ? (float) (1.0 / d[i]) : (d[i] < 0.0 ? -1e30f : 1e30f);
+    }
+
+    query->origin[3] = 0.0f;
+    query->direction[3] = 0.0f;
+    query->inverse[3] = 0.0f;
+    query->max_t = ray->max_t < (double) FLT_MAX ? (float) ray->max_t : INFINITY;
+
+    return true;
+}
+
+#if defined (__SSE2__)
+
+/* Slab test. The last lane of the loaded bounds is
+   the node's first or count and is ignored. */
+static inline bool box_hit (const resources_bvh_node_t *node, __m128 origin, __m128 inverse, float max_t, float *near) {
+    __m128 t1 = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (node->min), origin), inverse);
+    __m128 t2 = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (node->max), origin), inverse);
+    __m128 lo = _mm_min_ps (t1, t2);
+    __m128 hi = _mm_max_ps (t1, t2);
+
+    __m128 entry = _mm_max_ss (_mm_max_ss (lo, _mm_shuffle_ps (lo, lo, _MM_SHUFFLE (1, 1, 1, 1))), _mm_shuffle_ps (lo, lo, _MM_SHUFFLE (2, 2, 2, 2)));
+    __m128 exit = _mm_min_ss (_mm_min_ss (hi, _mm_shuffle_ps (hi, hi, _MM_SHUFFLE (1, 1, 1, 1))), _mm_shuffle_ps (hi, hi, _MM_SHUFFLE (2, 2, 2, 2)));
+    entry = _mm_max_ss (entry, _mm_setzero_ps ());
+    exit = _mm_min_ss (exit, _mm_set_ss (max_t));
+
+    *near = _mm_cvtss_f32 (entry);
+    return _mm_comile_ss (entry, exit);
+}
+
+/* Moller-Trumbore against all four faces at once.
+   Returns the lane of the nearest hit closer than
+   max_t, or -1. */
+static inline int packet_hit (const resources_bvh_packet_t *p, const query_t *q, float max_t, float *t_out) {
+    __m128 dx = _mm_set1_ps (q->direction[0]);
+    __m128 dy = _mm_set1_ps (q->direction[1]);
+    __m128 dz = _mm_set1_ps (q->direction[2]);
+    __m128 e1x = _mm_loadu_ps (p->e1[0]), e1y = _mm_loadu_ps (p->e1[1]), e1z = _mm_loadu_ps (p->e1[2]);
+    __m128 e2x = _mm_loadu_ps (p->e2[0]), e2y = _mm_loadu_ps (p->e2[1]), e2z = _mm_loadu_ps (p->e2[2]);
+
+    __m128 px = _mm_sub_ps (_mm_mul_ps (dy, e2z), _mm_mul_ps (dz, e2y));
+    __m128 py = _mm_sub_ps (_mm_mul_ps (dz, e2x), _mm_mul_ps (dx, e2z));
+    __m128 pz = _mm_sub_ps (_mm_mul_ps (dx, e2y), _mm_mul_ps (dy, e2x));
+    __m128 det = _mm_add_ps (_mm_add_ps (_mm_mul_ps (e1x, px), _mm_mul_ps (e1y, py)), _mm_mul_ps (e1z, pz));
+
+    __m128 tx = _mm_sub_ps (_mm_set1_ps (q->origin[0]), _mm_loadu_ps (p->v0[0]));
+    __m128 ty = _mm_sub_ps (_mm_set1_ps (q->origin[1]), _mm_loadu_ps (p->v0[1]));
+    __m128 tz = _mm_sub_ps (_mm_set1_ps (q->origin[2]), _mm_loadu_ps (p->v0[2]));
+
+    __m128 qx = _mm_sub_ps (_mm_mul_ps (ty, e1z), _mm_mul_ps (tz, e1y));
+    __m128 qy = _mm_sub_ps (_mm_mul_ps (tz, e1x), _mm_mul_ps (tx, e1z));
+    __m128 qz = _mm_sub_ps (_mm_mul_ps (tx, e1y), _mm_mul_ps (ty, e1x));
+
+    __m128 inv = _mm_div_ps (_mm_set1_ps (1.0f), det);
+    __m128 u = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (tx, px), _mm_mul_ps (ty, py)), _mm_mul_ps (tz, pz)), inv);
+    __m128 v = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (dx, qx), _mm_mul_ps (dy, qy)), _mm_mul_ps (dz, qz)), inv);
+    __m128 t = _mm_mul_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (e2x, qx), _mm_mul_ps (e2y, qy)), _mm_mul_ps (e2z, qz)), inv);
+
+    __m128 zero = _mm_setzero_ps ();
+    __m128 mask = _mm_cmpneq_ps (det, zero);
+    mask = _mm_and_ps (mask, _mm_cmpge_ps (u, zero));
+    mask = _mm_and_ps (mask, _mm_cmpge_ps (v, zero));
+    mask = _mm_and_ps (mask, _mm_cmple_ps (_mm_add_ps (u, v), _mm_set1_ps (1.0f)));
+    mask = _mm_and_ps (mask, _mm_cmpge_ps (t, zero));
+    mask = _mm_and_ps (mask, _mm_cmplt_ps (t, _mm_set1_ps (max_t)));
+
+    int bits = _mm_movemask_ps (mask);
+
+    if (bits == 0) {
+        return -1;
+    }
+
+    float ts[4];
+    _mm_storeu_ps (ts, t);
+
+    int best = -1;
+
+    for (int lane = 0; lane < RESOURCES_BVH_PACKET; lane++) {
+        if ((bits & (1 << lane)) && (best < 0 || ts[lane] < ts[best])) {
+            best = lane;
+        }
+    }
+
+    *t_out = ts[best];
+    return best;
+}
+
+#else
+
+static inline bool box_hit (const resources_bvh_node_t *node, const query_t *q, float max_t, float *near) {
+    float entry = 0.0f;
+    float exit = max_t;
+
+    for (int i = 0; i < 3; i++) {
+        float t1 = (node->min[i] - q->origin[i]) * q->inverse[i];
+        float t2 = (node->max[i] - q->origin[i]) * q->inverse[i];
+        entry = fmaxf (entry, fminf (t1, t2));
+        exit = fminf (exit, fmaxf (t1, t2));
+    }
+
+    *near = entry;
+    return entry <= exit;
+}
+
+static inline int packet_hit (const resources_bvh_packet_t *p, const query_t *q, float max_t, float *t_out) {
+    const float *d = q->direction;
+    int best = -1;
+
+    for (int lane = 0; lane < RESOURCES_BVH_PACKET; lane++) {
+        float e1[3] = { p->e1[0][lane], p->e1[1][lane], p->e1[2][lane] };
+        float e2[3] = { p->e2[0][lane], p->e2[1][lane], p->e2[2][lane] };
+        float pv[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+        float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+
+        if (det == 0.0f) {
+            continue;
+        }
+
+        float tv[3] = { q->origin[0] - p->v0[0][lane], q->origin[1] - p->v0[1][lane], q->origin[2] - p->v0[2][lane] };
+        float qv[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0] };
+        float inv = 1.0f / det;
+        float u = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) * inv;
+        float v = (d[0] * qv[0] + d[1] * qv[1] + d[2] * qv[2]) * inv;
+        float t = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) * inv;
+
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < max_t) {
+            max_t = t;
+            best = lane;
+        }
+    }
+
+    *t_out = max_t;
+    return best;
+}
+
+#endif
+
+/* Walk the hierarchy nearest child first, skipping
+   anything further than the best hit so far. With
+   any set, stops at the first hit found. Returns
+   the face hit, or -1. */
+static int traverse (const resources_bvh_t *bvh, const query_t *q, bool any, float *t_out) {
+#if defined (__SSE2__)
+    __m128 origin = _mm_loadu_ps (q->origin);
+    __m128 inverse = _mm_loadu_ps (q->inverse);
+    #define BOX_HIT(node, near) box_hit (node, origin, inverse, max_t, near)
+#else
+    #define BOX_HIT(node, near) box_hit (node, q, max_t, near)
+#endif
+
+    struct {
+        uint32_t node;
+        float near;
+    } stack[RESOURCES_BVH_MAX_DEPTH + 2];
+
+    float max_t = q->max_t;
+    float near;
+    int face = -1;
+    int top = 0;
+    uint32_t index = 0;
+
+    if (bvh->num_nodes == 0 || !BOX_HIT (&bvh->nodes[0], &near)) {
+        return -1;
+    }
+
+    for (;;) {
+        const resources_bvh_node_t *node = &bvh->nodes[index];
+
+        if (node->count == 0) {
+            uint32_t children[2] = { index + 1, node->first };
+            float nears[2];
+            bool hits[2] = { BOX_HIT (&bvh->nodes[children[0]], &nears[0]), BOX_HIT (&bvh->nodes[children[1]], &nears[1]) };
+
+            if (hits[0] && hits[1]) {
+                int first = nears[1] < nears[0];
+                stack[top].node = children[!first];
+                stack[top].near = nears[!first];
+                top++;
+                index = children[first];
+                continue;
+            }
+
+            if (hits[0] || hits[1]) {
+                index = children[hits[1]];
+                continue;
+            }
+        } else {
+            for (uint32_t i = 0; i < node->count; i++) {
+                const resources_bvh_packet_t *packet = &bvh->packets[node->first + i];
+                float t;
+                int lane = packet_hit (packet, q, max_t, &t);
+
+                if (lane >= 0) {
+                    max_t = t;
+                    face = packet->face[lane];
+                    *t_out = t;
+
+                    if (any) {
+                        return face;
+                    }
+                }
+            }
+        }
+
+        /* Next pushed node still nearer than the best hit */
+        while (top > 0 && stack[top - 1].near > max_t) {
+            top--;
+        }
+
+        if (top == 0) {
+            return face;
+        }
+
+        index = stack[--top].node;
+    }
+
+#undef BOX_HIT
+}
+
+/* Where the ray meets the plane of a face, in double
+   precision. Returns false if it is parallel. */
+static bool face_solve (const resources_mesh_t *mesh, int face, const resources_ray_t *ray, double *t, double *u, double *v) {
+    maths_vec4f v0 = resources_mesh_vertex (mesh, mesh->faces[face][0]);
+    maths_vec4f e1 = maths_vec4f_sub (resources_mesh_vertex (mesh, mesh->faces[face][1]), v0);
+    maths_vec4f e2 = maths_vec4f_sub (resources_mesh_vertex (mesh, mesh->faces[face][2]), v0);
+    maths_vec4f s = maths_vec4f_sub (ray->origin, v0);
+    maths_vec4f d = ray->direction;
+
+    e1.w = e2.w = s.w = d.w = 0.0;
+
+    maths_vec4f p = maths_vec4f_cross_3d (d, e2);
+    double det = maths_vec4f_dot (e1, p);
+
+    if (det == 0.0) {
+        return false;
+    }
+
+    double inv = 1.0 / det;
+    maths_vec4f q = maths_vec4f_cross_3d (s, e1);
+
+    *u = maths_vec4f_dot (s, p) * inv;
+    *v = maths_vec4f_dot (d, q) * inv;
+    *t = maths_vec4f_dot (e2, q) * inv;
+
+    return true;
+}
+
+static void set_hit (resources_ray_hit_t *hit, const resources_ray_t *ray, int face, double t, double u, double v) {
+    hit->hit = true;
+    hit->face = face;
+    hit->t = t;
+    hit->u = u;
+    hit->v = v;
+    hit->position = (maths_vec4f) { ray->origin.x + t * ray->direction.x, ray->origin.y + t * ray->direction.y, ray->origin.z + t * ray->direction.z, 1.0 };
+}
+
+static bool face_hit (const resources_mesh_t *mesh, int face, const resources_ray_t *ray, double max_t, resources_ray_hit_t *hit) {
+    double t, u, v;
+
+    if (!face_solve (mesh, face, ray, &t, &u, &v) || u < 0.0 || v < 0.0 || u + v > 1.0 || t < 0.0 || t > max_t) {
+        return false;
+    }
+
+    set_hit (hit, ray, face, t, u, v);
+    return true;
+}
+
+/* Nearest hit of a ray in model space. Meshes without
+   a hierarchy test every face. */
+bool resources_mesh_intersect (const resources_mesh_t *mesh, const resources_ray_t *ray, resources_ray_hit_t *hit) {
+    hit->hit = false;
+    hit->face = -1;
+
+    if (mesh->bvh == NULL) {
+        double max_t = ray->max_t;
+
+        for (int i = 0; i < mesh->num_faces; i++) {
+            if (face_hit (mesh, i, ray, max_t, hit)) {
+                max_t = hit->t;
+            }
+        }
+
+        return hit->hit;
+    }
+
+    query_t query;
+    float t_found;
+
+    if (!setup_query (ray, &query)) {
+        return false;
+    }
+
+    int face = traverse (mesh->bvh, &query, false, &t_found);
+
+    if (face < 0) {
+        return false;
+    }
+
+    /* Recompute the hit exactly. A grazing hit may land
+       just outside the face in double precision, so
+       only the distance is kept from the test which
+       found it. */
+    double t, u, v;
+
+    if (!face_solve (mesh, face, ray, &t, &u, &v)) {
+        t = t_found;
+        u = v = 0.0;
+    }
+
+    set_hit (hit, ray, face, t, u, v);
+    return true;
+}
+
+/* Whether anything lies on the ray within max_t, e.g.
+   between two points for line of sight. */
+bool resources_mesh_occluded (const resources_mesh_t *mesh, const resources_ray_t *ray) {
+    if (mesh->bvh == NULL) {
+        resources_ray_hit_t hit;
+
+        for (int i = 0; i < mesh->num_faces; i++) {
+            if (face_hit (mesh, i, ray, ray->max_t, &hit)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    query_t query;
+    float t;
+    return setup_query (ray, &query) && traverse (mesh->bvh, &query, true, &t) >= 0;
+}
+
+/* World space rays are moved into model space by the
+   inverse of the model transform. Distances along a
+   ray are unchanged by an affine transform, so hits
+   come back in the caller's units. */
+static resources_ray_t ray_to_model (const maths_mat4x4f *inverse, const resources_ray_t *ray) {
+    maths_vec4f origin = ray->origin;
+    maths_vec4f direction = ray->direction;
+    origin.w = 1.0;
+    direction.w = 0.0;
+
+    return (resources_ray_t) {
+        maths_mat4x4f_mul_vec4f (*inverse, origin),
+        maths_mat4x4f_mul_vec4f (*inverse, direction),
+        ray->max_t
+    };
+}
+
+/* Nearest hits of a batch of world space rays, which
+   share the one inverse transform. Returns how many
+   rays hit. */
+int resources_model_intersect (const resources_model_t *model, const resources_ray_t *rays, int num_rays, resources_ray_hit_t *hits) {
+    maths_mat4x4f transform = maths_model_transform (model->position, model->scale, model->rotation);
+    maths_mat4x4f inverse = maths_mat4x4f_inverse_affine (transform);
+    int count = 0;
+
+    for (int i = 0; i < num_rays; i++) {
+        resources_ray_t local = ray_to_model (&inverse, &rays[i]);
+
+        if (resources_mesh_intersect (model->mesh, &local, &hits[i])) {
+            hits[i].position = (maths_vec4f) {
+                rays[i].origin.x + hits[i].t * rays[i].direction.x,
+                rays[i].origin.y + hits[i].t * rays[i].direction.y,
+                rays[i].origin.z + hits[i].t * rays[i].direction.z,
+                1.0
+            };
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool resources_model_occluded (const resources_model_t *model, const resources_ray_t *ray) {
+    maths_mat4x4f inverse = maths_mat4x4f_inverse_affine (maths_model_transform (model->position, model->scale, model->rotation));
+    resources_ray_t local = ray_to_model (&inverse, ray);
+    return resources_mesh_occluded (model->mesh, &local);
+}
@@ -0,0 +1,104 @@
+/* resources/bvh.h
+    Ray queries against meshes, for picking and line
+    of sight checks. Each mesh can carry a bounding
+    volume hierarchy over its faces, built top down
+    choosing each split with the surface area
+    heuristic over binned face centroids.
+
+    Faces are stored in leaves as packets of four,
+    laid out so that one packet is tested against a
+    ray at once with SSE, as are the bounds of a
+    node. Hits found in single precision are then
+    recomputed from the mesh's own vertices, so the
+    distance returned is exact.
+
+    A hierarchy can be written next to its mesh and
+    read back in place of building it. The file holds
+    a hash of the mesh it was built for, and is only
+    used if the mesh still matches.
+
+    File layout (native byte order):
+        header      resources_bvh_header_t
+        nodes       resources_bvh_node_t x num_nodes
+        packets     resources_bvh_packet_t x num_packets */
+
+#ifndef RESOURCES_BVH_H
+#define RESOURCES_BVH_H
+
+#include "resources.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RESOURCES_BVH_MAGIC "SGBV"
+#define RESOURCES_BVH_VERSION 1
+
+#define RESOURCES_BVH_PACKET 4           /* Faces tested at once */
+#define RESOURCES_BVH_MAX_LEAF_PACKETS 4
+#define RESOURCES_BVH_BINS 16            /* Candidate splits per axis */
+#define RESOURCES_BVH_MAX_DEPTH 64
+
+/* A ray, or a segment when max_t is finite. Points
+   on it are origin + t * direction for t in
+   [0, max_t]. */
+typedef struct {
+    maths_vec4f origin;
+    maths_vec4f direction;
+    double max_t;
+} resources_ray_t;
+
+typedef struct {
+    bool hit;
+    int face;                   /* Index into the mesh's faces */
+    double t;                   /* Along the ray, in units of its direction */
+    double u;                   /* Barycentric weights of the face's second and third vertices */
+    double v;
+    maths_vec4f position;       /* In the space the ray was given in */
+} resources_ray_hit_t;
+
+typedef struct {
+    float min[3];
+    uint32_t first;             /* First packet of a leaf, or the second child of an inner node */
+    float max[3];
+    uint32_t count;             /* Packets in a leaf, 0 for an inner node */
+} resources_bvh_node_t;
+
+/* Four faces, as their first vertex and the two
+   edges from it, each split into components. Unused
+   slots have zero edges, which no ray can hit. */
+typedef struct {
+    float v0[3][RESOURCES_BVH_PACKET];
+    float e1[3][RESOURCES_BVH_PACKET];
+    float e2[3][RESOURCES_BVH_PACKET];
+    int32_t face[RESOURCES_BVH_PACKET];
+} resources_bvh_packet_t;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_nodes;
+    uint32_t num_packets;
+    uint64_t mesh_hash;
+} resources_bvh_header_t;
+
+typedef struct resources_bvh_t {
+    resources_bvh_node_t *nodes;     /* Depth first, the first child of a node follows it */
+    resources_bvh_packet_t *packets;
+    uint32_t num_nodes;
+    uint32_t num_packets;
+    uint64_t mesh_hash;
+} resources_bvh_t;
+
+resources_bvh_t *resources_bvh_build (const resources_mesh_t *mesh);
+void resources_bvh_free (resources_bvh_t *bvh);
+size_t resources_bvh_size (const resources_bvh_t *bvh);
+bool resources_bvh_write (const resources_bvh_t *bvh, const char *path);
+resources_bvh_t *resources_bvh_read (const char *path, const resources_mesh_t *mesh);
+
+bool resources_mesh_build_bvh (resources_mesh_t *mesh, const char *cache_path);
+bool resources_mesh_intersect (const resources_mesh_t *mesh, const resources_ray_t *ray, resources_ray_hit_t *hit);
+bool resources_mesh_occluded (const resources_mesh_t *mesh, const resources_ray_t *ray);
+int resources_model_intersect (const resources_model_t *model, const resources_ray_t *rays, int num_rays, resources_ray_hit_t *hits);
+bool resources_model_occluded (const resources_model_t *model, const resources_ray_t *ray);
+
+#endif
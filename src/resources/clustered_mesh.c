@@ -0,0 +1,449 @@
+#include "clustered_mesh.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+/* Writing */
+
+typedef struct {
+    uint64_t code;
+    int face;
+} face_key_t;
+
+static int compare_face_keys (const void *a, const void *b) {
+    uint64_t ca = ((const face_key_t *) a)->code;
+    uint64_t cb = ((const face_key_t *) b)->code;
+    return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+/* Spread the low 21 bits of v so that there are two
+   zero bits between each. */
+static uint64_t spread_bits_3 (uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+}
+
+static bool write_at (FILE *file, const void *data, size_t size) {
+    return size == 0 || fwrite (data, size, 1, file) == 1;
+}
+
+/* Split a mesh into clusters of faces which are close
+   in space, by sorting faces along a Morton curve
+   through their centroids and cutting the sorted list
+   into runs. */
+bool resources_clustered_mesh_write (resources_mesh_t *mesh, const char *path, int faces_per_cluster) {
+    assert (mesh != NULL && path != NULL);
+
+    if (faces_per_cluster <= 0) {
+        faces_per_cluster = RESOURCES_CLUSTER_FACES;
+    }
+
+    uint32_t num_clusters = (mesh->num_faces + faces_per_cluster - 1) / faces_per_cluster;
+    face_key_t *keys = (face_key_t *) malloc (sizeof (face_key_t) * (mesh->num_faces + 1));
+    int *remap = (int *) malloc (sizeof (int) * (mesh->num_vertices + 1));
+    int *locals = (int *) malloc (sizeof (int) * 3 * faces_per_cluster);
+    float *vertices = (float *) malloc (sizeof (float) * 9 * faces_per_cluster);
+    uint32_t *faces = (uint32_t *) malloc (sizeof (uint32_t) * 3 * faces_per_cluster);
+    resources_cluster_t *table = (resources_cluster_t *) calloc (num_clusters + 1, sizeof (resources_cluster_t));
+    FILE *file = fopen (path, "wb");
+    bool ok = false;
+
+    if (keys == NULL || remap == NULL || locals == NULL || vertices == NULL || faces == NULL || table == NULL || file == NULL) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not set up writing %s.", path);
+        goto done;
+    }
+
+    /* Bounds of the whole mesh, for quantizing centroids */
+    maths_vec4f lo = { 0, 0, 0, 0 };
+    maths_vec4f hi = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < mesh->num_vertices; i++) {
+        maths_vec4f v = resources_mesh_vertex (mesh, i);
+
+        if (i == 0) {
+            lo = hi = v;
+        }
+
+        lo.x = v.x < lo.x ? v.x : lo.x;
+        lo.y = v.y < lo.y ? v.y : lo.y;
+        lo.z = v.z < lo.z ? v.z : lo.z;
+        hi.x = v.x > hi.x ? v.x : hi.x;
+        hi.y = v.y > hi.y ? v.y : hi.y;
+        hi.z = v.z > hi.z ? v.z : hi.z;
+    }
+
+    double scale_x = hi.x > lo.x ? 0x1fffff / (hi.x - lo.x) : 0;
+    double scale_y = hi.y > lo.y ? 0x1fffff / (hi.y - lo.y) : 0;
+    double scale_z = hi.z > lo.z ? 0x1fffff / (hi.z - lo.z) : 0;
+
+    for (int i = 0; i < mesh->num_faces; i++) {
+        maths_vec4f a = resources_mesh_vertex (mesh, mesh->faces[i][0]);
+        maths_vec4f b = resources_mesh_vertex (mesh, mesh->faces[i][1]);
+        maths_vec4f c = resources_mesh_vertex (mesh, mesh->faces[i][2]);
+        uint64_t qx = (uint64_t) (((a.x + b.x + c.x) / 3 - lo.x) * scale_x);
+        uint64_t qy = (uint64_t) (((a.y + b.y + c.y) / 3 - lo.y) * scale_y);
+        uint64_t qz = (uint64_t) (((a.z + b.z + c.z) / 3 - lo.z) * scale_z);
+
+        keys[i].code = spread_bits_3 (qx) | spread_bits_3 (qy) << 1 | spread_bits_3 (qz) << 2;
+        keys[i].face = i;
+    }
+
+    qsort (keys, mesh->num_faces, sizeof (face_key_t), compare_face_keys);
+
+    for (int i = 0; i < mesh->num_vertices; i++) {
+        remap[i] = -1;
+    }
+
+    resources_clustered_header_t header;
+    memcpy (header.magic, RESOURCES_CLUSTERED_MAGIC, 4);
+    header.version = RESOURCES_CLUSTERED_VERSION;
+    header.num_clusters = num_clusters;
+    header.reserved = 0;
+
+    /* The table is written again once the payload
+       offsets are known. */
+    if (!write_at (file, &header, sizeof (header)) || !write_at (file, table, sizeof (resources_cluster_t) * num_clusters)) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not write header of %s.", path);
+        goto done;
+    }
+
+    uint64_t offset = sizeof (header) + sizeof (resources_cluster_t) * (uint64_t) num_clusters;
+
+    for (uint32_t c = 0; c < num_clusters; c++) {
+        int first = c * faces_per_cluster;
+        int last = first + faces_per_cluster < mesh->num_faces ? first + faces_per_cluster : mesh->num_faces;
+        resources_cluster_t *cluster = &table[c];
+        int num_vertices = 0;
+
+        for (int i = first; i < last; i++) {
+            for (int k = 0; k < 3; k++) {
+                int v = mesh->faces[keys[i].face][k];
+
+                if (remap[v] < 0) {
+                    maths_vec4f p = resources_mesh_vertex (mesh, v);
+                    remap[v] = num_vertices;
+                    locals[num_vertices] = v;
+                    vertices[num_vertices * 3 + 0] = (float) p.x;
+                    vertices[num_vertices * 3 + 1] = (float) p.y;
+                    vertices[num_vertices * 3 + 2] = (float) p.z;
+
+                    for (int a = 0; a < 3; a++) {
+                        float value = vertices[num_vertices * 3 + a];
+
+                        if (num_vertices == 0 || value < cluster->min[a]) {
+                            cluster->min[a] = value;
+                        }
+
+                        if (num_vertices == 0 || value > cluster->max[a]) {
+                            cluster->max[a] = value;
+                        }
+                    }
+
+                    num_vertices++;
+                }
+
+                faces[(i - first) * 3 + k] = (uint32_t) remap[v];
+            }
+        }
+
+        /* Reset the remap for the next cluster */
+        for (int i = 0; i < num_vertices; i++) {
+            remap[locals[i]] = -1;
+        }
+
+        cluster->offset = offset;
+        cluster->num_vertices = num_vertices;
+        cluster->num_faces = last - first;
+
+        if (!write_at (file, vertices, sizeof (float) * 3 * num_vertices) || !write_at (file, faces, sizeof (uint32_t) * 3 * cluster->num_faces)) {
+            SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not write cluster %u of %s.", c, path);
+            goto done;
+        }
+
+        offset += sizeof (float) * 3 * num_vertices + sizeof (uint32_t) * 3 * cluster->num_faces;
+    }
+
+    if (fseeko (file, sizeof (header), SEEK_SET) != 0 || !write_at (file, table, sizeof (resources_cluster_t) * num_clusters)) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not write cluster table of %s.", path);
+        goto done;
+    }
+
+    ok = true;
+
+done:
+    if (file != NULL && fclose (file) != 0) {
+        ok = false;
+    }
+
+    free (keys);
+    free (remap);
+    free (locals);
+    free (vertices);
+    free (faces);
+    free (table);
+
+    return ok;
+}
+
+/* Reading */
+
+resources_clustered_mesh_t *resources_clustered_mesh_open (const char *path, size_t budget) {
+    resources_clustered_mesh_t *mesh = (resources_clustered_mesh_t *) calloc (1, sizeof (resources_clustered_mesh_t));
+
+    if (mesh == NULL) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not allocate memory for clustered mesh.");
+        return NULL;
+    }
+
+    mesh->fd = open (path, O_RDONLY);
+
+    if (mesh->fd < 0) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not open file %s.", path);
+        free (mesh);
+        return NULL;
+    }
+
+    resources_clustered_header_t header;
+
+    if (pread (mesh->fd, &header, sizeof (header), 0) != sizeof (header) || memcmp (header.magic, RESOURCES_CLUSTERED_MAGIC, 4) != 0 || header.version != RESOURCES_CLUSTERED_VERSION) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "%s is not a clustered mesh file.", path);
+        resources_clustered_mesh_close (mesh);
+        return NULL;
+    }
+
+    uint32_t n = header.num_clusters;
+    size_t table_size = sizeof (resources_cluster_t) * n;
+
+    mesh->num_clusters = n;
+    mesh->clusters = (resources_cluster_t *) malloc (table_size + 1);
+    mesh->resident = (resources_mesh_t **) calloc (n + 1, sizeof (resources_mesh_t *));
+    mesh->prev = (int32_t *) malloc (sizeof (int32_t) * (n + 1));
+    mesh->next = (int32_t *) malloc (sizeof (int32_t) * (n + 1));
+    mesh->used_frame = (uint64_t *) calloc (n + 1, sizeof (uint64_t));
+
+    if (mesh->clusters == NULL || mesh->resident == NULL || mesh->prev == NULL || mesh->next == NULL || mesh->used_frame == NULL) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not allocate memory for %u clusters.", n);
+        resources_clustered_mesh_close (mesh);
+        return NULL;
+    }
+
+    if (pread (mesh->fd, mesh->clusters, table_size, sizeof (header)) != (ssize_t) table_size) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not read cluster table of %s.", path);
+        resources_clustered_mesh_close (mesh);
+        return NULL;
+    }
+
+    mesh->head = -1;
+    mesh->tail = -1;
+    mesh->frame = 1;
+    mesh->budget = budget;
+    mesh->loads_per_frame = RESOURCES_CLUSTER_LOADS_PER_FRAME;
+
+    return mesh;
+}
+
+void resources_clustered_mesh_close (resources_clustered_mesh_t *mesh) {
+    if (mesh == NULL) {
+        return;
+    }
+
+    if (mesh->resident != NULL) {
+        for (uint32_t i = 0; i < mesh->num_clusters; i++) {
+            resources_mesh_free (mesh->resident[i]);
+        }
+    }
+
+    if (mesh->fd >= 0) {
+        close (mesh->fd);
+    }
+
+    free (mesh->clusters);
+    free (mesh->resident);
+    free (mesh->prev);
+    free (mesh->next);
+    free (mesh->used_frame);
+    free (mesh->scratch);
+    free (mesh);
+}
+
+/* Clusters acquired from here on belong to a new frame,
+   and the previous frame's may now be evicted. */
+void resources_clustered_mesh_begin_frame (resources_clustered_mesh_t *mesh) {
+    mesh->frame++;
+    mesh->loads = 0;
+}
+
+bool resources_clustered_mesh_is_resident (resources_clustered_mesh_t *mesh, uint32_t cluster) {
+    return cluster < mesh->num_clusters && mesh->resident[cluster] != NULL;
+}
+
+static void lru_unlink (resources_clustered_mesh_t *mesh, int32_t i) {
+    if (mesh->prev[i] >= 0) {
+        mesh->next[mesh->prev[i]] = mesh->next[i];
+    } else {
+        mesh->head = mesh->next[i];
+    }
+
+    if (mesh->next[i] >= 0) {
+        mesh->prev[mesh->next[i]] = mesh->prev[i];
+    } else {
+        mesh->tail = mesh->prev[i];
+    }
+}
+
+static void lru_push_front (resources_clustered_mesh_t *mesh, int32_t i) {
+    mesh->prev[i] = -1;
+    mesh->next[i] = mesh->head;
+
+    if (mesh->head >= 0) {
+        mesh->prev[mesh->head] = i;
+    } else {
+        mesh->tail = i;
+    }
+
+    mesh->head = i;
+}
+
+static size_t cluster_size (resources_cluster_t *cluster) {
+    return sizeof (resources_mesh_t) + sizeof (resources_vertex_float3_t) * cluster->num_vertices + sizeof (resources_triangle_t) * cluster->num_faces;
+}
+
+/* Evict least recently used clusters, other than those
+   used this frame, until size more bytes fit. */
+static bool make_room (resources_clustered_mesh_t *mesh, size_t size) {
+    while (mesh->cached + size > mesh->budget) {
+        int32_t victim = mesh->tail;
+
+        if (victim < 0 || mesh->used_frame[victim] == mesh->frame) {
+            return false;
+        }
+
+        lru_unlink (mesh, victim);
+        resources_mesh_free (mesh->resident[victim]);
+        mesh->resident[victim] = NULL;
+        mesh->cached -= cluster_size (&mesh->clusters[victim]);
+    }
+
+    return true;
+}
+
+static resources_mesh_t *read_cluster (resources_clustered_mesh_t *mesh, uint32_t index) {
+    resources_cluster_t *cluster = &mesh->clusters[index];
+    size_t vertex_bytes = sizeof (float) * 3 * cluster->num_vertices;
+    size_t size = vertex_bytes + sizeof (uint32_t) * 3 * cluster->num_faces;
+
+    if (size > mesh->scratch_size) {
+        void *scratch = realloc (mesh->scratch, size);
+
+        if (scratch == NULL) {
+            SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not allocate read buffer of %zu bytes.", size);
+            return NULL;
+        }
+
+        mesh->scratch = scratch;
+        mesh->scratch_size = size;
+    }
+
+    if (pread (mesh->fd, mesh->scratch, size, cluster->offset) != (ssize_t) size) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not read cluster %u.", index);
+        return NULL;
+    }
+
+    resources_mesh_t *result = (resources_mesh_t *) malloc (sizeof (resources_mesh_t));
+
+    if (result == NULL) {
+        return NULL;
+    }
+
+    resources_mesh_init (result);
+    result->format = RESOURCES_VERTEX_FLOAT3;
+    result->num_vertices = cluster->num_vertices;
+    result->num_faces = cluster->num_faces;
+    result->vertices_float3 = (resources_vertex_float3_t *) malloc (sizeof (resources_vertex_float3_t) * (cluster->num_vertices + 1));
+    result->faces = (resources_triangle_t *) malloc (sizeof (resources_triangle_t) * (cluster->num_faces + 1));
+
+    if (result->vertices_float3 == NULL || result->faces == NULL) {
+        SYSTEM_LOG_ERROR ("resources/clustered_mesh", "could not allocate memory for cluster %u.", index);
+        resources_mesh_free (result);
+        return NULL;
+    }
+
+    const float *v = (const float *) mesh->scratch;
+    const uint32_t *f = (const uint32_t *) ((const char *) mesh->scratch + vertex_bytes);
+
+    for (uint32_t i = 0; i < cluster->num_vertices; i++) {
+        result->vertices_float3[i] = (resources_vertex_float3_t) { v[i * 3], v[i * 3 + 1], v[i * 3 + 2] };
+    }
+
+    for (uint32_t i = 0; i < cluster->num_faces * 3; i++) {
+        if (f[i] >= cluster->num_vertices) {
+            SYSTEM_LOG_ERROR ("resources/clustered_mesh", "cluster %u has a face index out of range.", index);
+            resources_mesh_free (result);
+            return NULL;
+        }
+
+        result->faces[i / 3][i % 3] = (int) f[i];
+    }
+
+    return result;
+}
+
+/* The decoded cluster, read from disk if it is not
+   cached. Returns NULL if it is not cached and either
+   this frame's read allowance is used up or it cannot
+   fit within the budget - callers should prefetch it
+   and try again next frame. */
+resources_mesh_t *resources_clustered_mesh_acquire (resources_clustered_mesh_t *mesh, uint32_t cluster) {
+    if (cluster >= mesh->num_clusters) {
+        return NULL;
+    }
+
+    if (mesh->resident[cluster] != NULL) {
+        lru_unlink (mesh, cluster);
+        lru_push_front (mesh, cluster);
+        mesh->used_frame[cluster] = mesh->frame;
+        return mesh->resident[cluster];
+    }
+
+    size_t size = cluster_size (&mesh->clusters[cluster]);
+
+    if (mesh->loads >= mesh->loads_per_frame || !make_room (mesh, size)) {
+        return NULL;
+    }
+
+    resources_mesh_t *result = read_cluster (mesh, cluster);
+
+    if (result == NULL) {
+        return NULL;
+    }
+
+    mesh->loads++;
+    mesh->resident[cluster] = result;
+    mesh->cached += size;
+    mesh->used_frame[cluster] = mesh->frame;
+    lru_push_front (mesh, cluster);
+
+    return result;
+}
+
+/* Ask the kernel to start reading a cluster in, so
+   that a later acquire does not wait on the disk. */
+void resources_clustered_mesh_prefetch (resources_clustered_mesh_t *mesh, uint32_t cluster) {
+    if (cluster >= mesh->num_clusters || mesh->resident[cluster] != NULL) {
+        return;
+    }
+
+    resources_cluster_t *c = &mesh->clusters[cluster];
+    size_t size = sizeof (float) * 3 * c->num_vertices + sizeof (uint32_t) * 3 * c->num_faces;
+
+    posix_fadvise (mesh->fd, c->offset, size, POSIX_FADV_WILLNEED);
+}
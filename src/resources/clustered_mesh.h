@@ -0,0 +1,88 @@
+/* resources/clustered_mesh.h
+    Out-of-core meshes. A clustered mesh file splits
+    a mesh into clusters of spatially close faces,
+    each with its own bounds and its own copy of the
+    vertices it uses, so that any cluster can be read
+    and drawn on its own.
+
+    An opened mesh only keeps the cluster table in
+    memory. Clusters are read in on demand into a
+    cache bounded by a byte budget, and the least
+    recently used are evicted to make room. Clusters
+    used since the last call to begin_frame are never
+    evicted, so their meshes stay valid for the rest
+    of the frame.
+
+    File layout (native byte order):
+        header      resources_clustered_header_t
+        table       resources_cluster_t x num_clusters
+        payloads    per cluster, num_vertices x float[3]
+                    then num_faces x uint32_t[3] of
+                    indices local to the cluster */
+
+#ifndef RESOURCES_CLUSTERED_MESH_H
+#define RESOURCES_CLUSTERED_MESH_H
+
+#include "resources.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RESOURCES_CLUSTERED_MAGIC "SGCM"
+#define RESOURCES_CLUSTERED_VERSION 1
+
+/* Default faces per cluster when writing */
+#define RESOURCES_CLUSTER_FACES 256
+
+/* Default number of clusters read from disk per
+   frame - the rest are prefetched for later frames. */
+#define RESOURCES_CLUSTER_LOADS_PER_FRAME 32
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_clusters;
+    uint32_t reserved;
+} resources_clustered_header_t;
+
+typedef struct {
+    float min[3];               /* Bounds in model space */
+    float max[3];
+    uint64_t offset;            /* Of the payload in the file */
+    uint32_t num_vertices;
+    uint32_t num_faces;
+} resources_cluster_t;
+
+typedef struct {
+    int fd;
+    uint32_t num_clusters;
+    resources_cluster_t *clusters;
+
+    /* Cache of decoded clusters, with an intrusive LRU
+       list through prev/next (most recent at head). */
+    resources_mesh_t **resident;
+    int32_t *prev;
+    int32_t *next;
+    int32_t head;
+    int32_t tail;
+    uint64_t *used_frame;       /* Frame each cluster was last used in */
+    uint64_t frame;
+    size_t budget;              /* Bytes of decoded clusters to keep */
+    size_t cached;              /* Bytes of decoded clusters held */
+
+    int loads_per_frame;
+    int loads;                  /* Clusters read this frame */
+
+    void *scratch;              /* Payload read buffer */
+    size_t scratch_size;
+} resources_clustered_mesh_t;
+
+bool resources_clustered_mesh_write (resources_mesh_t *mesh, const char *path, int faces_per_cluster);
+resources_clustered_mesh_t *resources_clustered_mesh_open (const char *path, size_t budget);
+void resources_clustered_mesh_close (resources_clustered_mesh_t *mesh);
+void resources_clustered_mesh_begin_frame (resources_clustered_mesh_t *mesh);
+bool resources_clustered_mesh_is_resident (resources_clustered_mesh_t *mesh, uint32_t cluster);
+resources_mesh_t *resources_clustered_mesh_acquire (resources_clustered_mesh_t *mesh, uint32_t cluster);
+void resources_clustered_mesh_prefetch (resources_clustered_mesh_t *mesh, uint32_t cluster);
+
+#endif
@@ -0,0 +1,407 @@
+#include "manager.h"
+#include "bvh.h"
+#include "./../system/log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define RESOURCES_MANAGER_INITIAL_QUEUE 64
+
+/* A unit cube, shown in place of meshes which have
+   not arrived yet. */
+static resources_mesh_t *create_placeholder (void) {
+    static const double corners[8][3] = {
+        { -0.5, -0.5, -0.5 }, { 0.5, -0.5, -0.5 }, { 0.5, 0.5, -0.5 }, { -0.5, 0.5, -0.5 },
+        { -0.5, -0.5, 0.5 }, { 0.5, -0.5, 0.5 }, { 0.5, 0.5, 0.5 }, { -0.5, 0.5, 0.5 }
+    };
+
+    static const int faces[12][3] = {
+        { 0, 2, 1 }, { 0, 3, 2 }, { 4, 5, 6 }, { 4, 6, 7 },
+        { 0, 1, 5 }, { 0, 5, 4 }, { 3, 6, 2 }, { 3, 7, 6 },
+        { 0, 4, 7 }, { 0, 7, 3 }, { 1, 2, 6 }, { 1, 6, 5 }
+    };
+
+    resources_mesh_t *mesh = (resources_mesh_t *) malloc (sizeof (resources_mesh_t));
+
+    if (mesh == NULL) {
+        return NULL;
+    }
+
+    resources_mesh_init (mesh);
+    mesh->num_vertices = 8;
+    mesh->num_faces = 12;
+    mesh->vertices = (resources_vertex_t *) malloc (sizeof (resources_vertex_t) * mesh->num_vertices);
+    mesh->faces = (resources_triangle_t *) malloc (sizeof (resources_triangle_t) * mesh->num_faces);
+
+    if (mesh->vertices == NULL || mesh->faces == NULL) {
+        resources_mesh_free (mesh);
+        return NULL;
+    }
+
+    for (int i = 0; i < mesh->num_vertices; i++) {
+        mesh->vertices[i].coord = (maths_vec4f) { corners[i][0], corners[i][1], corners[i][2], 1.0 };
+    }
+
+    memcpy (mesh->faces, faces, sizeof (faces));
+    resources_mesh_build_edges (mesh);
+
+    return mesh;
+}
+
+static size_t mesh_size (resources_mesh_t *mesh) {
+    size_t vertex_bytes;
+    resources_mesh_vertex_data (mesh, &vertex_bytes);
+
+    return sizeof (resources_mesh_t) + vertex_bytes + sizeof (resources_triangle_t) * mesh->num_faces + sizeof (resources_edge_t) * mesh->num_edges + resources_bvh_size (mesh->bvh);
+}
+
+static void build_bvh (resources_mesh_t *mesh, const char *path, resources_bvh_mode_t mode) {
+    char *cache_path = NULL;
+
+    if (mode == RESOURCES_BVH_CACHED) {
+        size_t length = strlen (path) + sizeof (".bvh");
+        cache_path = (char *) malloc (length);
+
+        if (cache_path != NULL) {
+            snprintf (cache_path, length, "%s.bvh", path);
+        }
+    }
+
+    if (!resources_mesh_build_bvh (mesh, cache_path)) {
+        SYSTEM_LOG_WARN ("resources/manager", "%s will not answer ray queries quickly.", path);
+    }
+
+    free (cache_path);
+}
+
+/* Must be called with the lock held. */
+static resources_entry_t *entry_for (resources_manager_t *manager, resources_handle_t handle) {
+    if (handle == RESOURCES_INVALID_HANDLE || handle > manager->num_entries) {
+        return NULL;
+    }
+
+    return &manager->entries[handle - 1];
+}
+
+/* Evict unreferenced meshes, least recently released
+   first, until the loaded meshes fit the budget. Must
+   be called with the lock held. */
+static void evict_over_budget (resources_manager_t *manager) {
+    while (manager->resident > manager->budget) {
+        resources_entry_t *victim = NULL;
+
+        for (uint32_t i = 0; i < manager->num_entries; i++) {
+            resources_entry_t *entry = &manager->entries[i];
+
+            if (entry->state == RESOURCES_STATE_READY && entry->references == 0 && (victim == NULL || entry->last_used < victim->last_used)) {
+                victim = entry;
+            }
+        }
+
+        if (victim == NULL) {
+            /* Everything loaded is in use */
+            return;
+        }
+
+        SYSTEM_LOG_DEBUG ("resources/manager", "evicting %s (%zu bytes).", victim->path, victim->size);
+
+        resources_mesh_free (victim->mesh);
+        manager->resident -= victim->size;
+        victim->mesh = NULL;
+        victim->size = 0;
+        victim->state = RESOURCES_STATE_EVICTED;
+    }
+}
+
+/* Must be called with the lock held. The load is
+   only started by start_load, once it is released. */
+static bool queue_push (resources_manager_t *manager, uint32_t index) {
+    if (manager->queue_count == manager->queue_size) {
+        uint32_t size = manager->queue_size * 2;
+        uint32_t *queue = (uint32_t *) malloc (sizeof (uint32_t) * size);
+
+        if (queue == NULL) {
+            SYSTEM_LOG_ERROR ("resources/manager", "could not grow load queue.");
+            return false;
+        }
+
+        /* Unwrap the ring into the new array */
+        for (uint32_t i = 0; i < manager->queue_count; i++) {
+            queue[i] = manager->queue[(manager->queue_head + i) % manager->queue_size];
+        }
+
+        free (manager->queue);
+        manager->queue = queue;
+        manager->queue_head = 0;
+        manager->queue_size = size;
+    }
+
+    manager->queue[(manager->queue_head + manager->queue_count) % manager->queue_size] = index;
+    manager->queue_count++;
+
+    return true;
+}
+
+/* Load the mesh at the front of the queue. One job
+   is submitted per queued load, so there is always
+   one left for each entry in the queue. */
+static void load_job (void *aux) {
+    resources_manager_t *manager = (resources_manager_t *) aux;
+
+    pthread_mutex_lock (&manager->lock);
+
+    if (!manager->stopping && manager->queue_count > 0) {
+        uint32_t index = manager->queue[manager->queue_head];
+        manager->queue_head = (manager->queue_head + 1) % manager->queue_size;
+        manager->queue_count--;
+
+        /* The path string stays put even if the entry
+           array is reallocated while loading. */
+        char *path = manager->entries[index].path;
+        resources_bvh_mode_t bvh_mode = manager->bvh_mode;
+        resources_vertex_format_t vertex_format = manager->vertex_format;
+
+        pthread_mutex_unlock (&manager->lock);
+        resources_mesh_t *mesh = resources_load_mesh_from_obj_file (path);
+
+        if (mesh != NULL && !resources_mesh_set_vertex_format (mesh, vertex_format)) {
+            resources_mesh_free (mesh);
+            mesh = NULL;
+        }
+
+        if (mesh != NULL && bvh_mode != RESOURCES_BVH_NONE) {
+            build_bvh (mesh, path, bvh_mode);
+        }
+
+        pthread_mutex_lock (&manager->lock);
+
+        resources_entry_t *entry = &manager->entries[index];
+
+        if (mesh == NULL) {
+            SYSTEM_LOG_WARN ("resources/manager", "could not load %s, using placeholder.", path);
+            entry->state = RESOURCES_STATE_FAILED;
+        } else {
+            entry->mesh = mesh;
+            entry->size = mesh_size (mesh);
+            entry->state = RESOURCES_STATE_READY;
+            manager->resident += entry->size;
+
+            if (entry->references == 0) {
+                /* Every handle was released while loading */
+                entry->last_used = ++manager->clock;
+            }
+
+            evict_over_budget (manager);
+        }
+    }
+
+    pthread_mutex_unlock (&manager->lock);
+}
+
+/* Must be called without the lock held, as a full
+   job queue runs the load straight away. */
+static void start_load (resources_manager_t *manager) {
+    system_job_t job = { load_job, manager };
+    system_jobs_submit (manager->jobs, &job, 1, &manager->loads);
+}
+
+/* Loads run as jobs on jobs, which must outlive the
+   manager. */
+resources_manager_t *resources_manager_create (system_jobs_t *jobs, size_t budget) {
+    assert (jobs != NULL);
+
+    resources_manager_t *manager = (resources_manager_t *) calloc (1, sizeof (resources_manager_t));
+
+    if (manager == NULL) {
+        SYSTEM_LOG_ERROR ("resources/manager", "could not allocate memory for resource manager.");
+        return NULL;
+    }
+
+    pthread_mutex_init (&manager->lock, NULL);
+    system_job_counter_init (&manager->loads);
+    manager->jobs = jobs;
+    manager->budget = budget;
+    manager->queue_size = RESOURCES_MANAGER_INITIAL_QUEUE;
+    manager->queue = (uint32_t *) malloc (sizeof (uint32_t) * manager->queue_size);
+    manager->placeholder = create_placeholder ();
+
+    if (manager->queue == NULL || manager->placeholder == NULL) {
+        SYSTEM_LOG_ERROR ("resources/manager", "could not allocate memory for resource manager.");
+        resources_manager_destroy (manager);
+        return NULL;
+    }
+
+    return manager;
+}
+
+/* Waits for loads already in progress, but drops any
+   which have not started. */
+void resources_manager_destroy (resources_manager_t *manager) {
+    if (manager == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock (&manager->lock);
+    manager->stopping = true;
+    pthread_mutex_unlock (&manager->lock);
+
+    /* Jobs which have not started return at once */
+    system_jobs_wait (manager->jobs, &manager->loads);
+
+    for (uint32_t i = 0; i < manager->num_entries; i++) {
+        resources_mesh_free (manager->entries[i].mesh);
+        free (manager->entries[i].path);
+    }
+
+    resources_mesh_free (manager->placeholder);
+    free (manager->entries);
+    free (manager->queue);
+    system_job_counter_destroy (&manager->loads);
+    pthread_mutex_destroy (&manager->lock);
+    free (manager);
+}
+
+resources_handle_t resources_manager_load_mesh (resources_manager_t *manager, const char *path) {
+    assert (manager != NULL && path != NULL);
+
+    pthread_mutex_lock (&manager->lock);
+
+    /* Share an existing load of the same path */
+    for (uint32_t i = 0; i < manager->num_entries; i++) {
+        resources_entry_t *entry = &manager->entries[i];
+
+        if (strcmp (entry->path, path) != 0) {
+            continue;
+        }
+
+        if (entry->state == RESOURCES_STATE_EVICTED) {
+            if (!queue_push (manager, i)) {
+                pthread_mutex_unlock (&manager->lock);
+                return RESOURCES_INVALID_HANDLE;
+            }
+
+            entry->state = RESOURCES_STATE_LOADING;
+            entry->references++;
+            pthread_mutex_unlock (&manager->lock);
+            start_load (manager);
+
+            return i + 1;
+        }
+
+        entry->references++;
+        pthread_mutex_unlock (&manager->lock);
+
+        return i + 1;
+    }
+
+    if (manager->num_entries == manager->max_entries) {
+        uint32_t max_entries = manager->max_entries ? manager->max_entries * 2 : 64;
+        resources_entry_t *entries = (resources_entry_t *) realloc (manager->entries, sizeof (resources_entry_t) * max_entries);
+
+        if (entries == NULL) {
+            SYSTEM_LOG_ERROR ("resources/manager", "could not allocate memory for resource entries.");
+            pthread_mutex_unlock (&manager->lock);
+            return RESOURCES_INVALID_HANDLE;
+        }
+
+        manager->entries = entries;
+        manager->max_entries = max_entries;
+    }
+
+    resources_entry_t *entry = &manager->entries[manager->num_entries];
+    entry->path = strdup (path);
+    entry->mesh = NULL;
+    entry->size = 0;
+    entry->state = RESOURCES_STATE_LOADING;
+    entry->references = 1;
+    entry->last_used = 0;
+
+    if (entry->path == NULL || !queue_push (manager, manager->num_entries)) {
+        SYSTEM_LOG_ERROR ("resources/manager", "could not queue load of %s.", path);
+        free (entry->path);
+        pthread_mutex_unlock (&manager->lock);
+        return RESOURCES_INVALID_HANDLE;
+    }
+
+    resources_handle_t handle = ++manager->num_entries;
+    pthread_mutex_unlock (&manager->lock);
+    start_load (manager);
+
+    return handle;
+}
+
+void resources_manager_retain (resources_manager_t *manager, resources_handle_t handle) {
+    pthread_mutex_lock (&manager->lock);
+
+    resources_entry_t *entry = entry_for (manager, handle);
+
+    if (entry != NULL) {
+        entry->references++;
+    }
+
+    pthread_mutex_unlock (&manager->lock);
+}
+
+void resources_manager_release (resources_manager_t *manager, resources_handle_t handle) {
+    pthread_mutex_lock (&manager->lock);
+
+    resources_entry_t *entry = entry_for (manager, handle);
+
+    if (entry == NULL || entry->references == 0) {
+        SYSTEM_LOG_WARN ("resources/manager", "release of unheld handle %u.", handle);
+    } else if (--entry->references == 0) {
+        entry->last_used = ++manager->clock;
+        evict_over_budget (manager);
+    }
+
+    pthread_mutex_unlock (&manager->lock);
+}
+
+resources_state_t resources_manager_state (resources_manager_t *manager, resources_handle_t handle) {
+    pthread_mutex_lock (&manager->lock);
+
+    resources_entry_t *entry = entry_for (manager, handle);
+    resources_state_t state = entry != NULL ? entry->state : RESOURCES_STATE_FAILED;
+
+    pthread_mutex_unlock (&manager->lock);
+
+    return state;
+}
+
+/* The loaded mesh, or the placeholder if it is not
+   ready. Never returns NULL. */
+resources_mesh_t *resources_manager_get_mesh (resources_manager_t *manager, resources_handle_t handle) {
+    pthread_mutex_lock (&manager->lock);
+
+    resources_entry_t *entry = entry_for (manager, handle);
+    resources_mesh_t *mesh = entry != NULL && entry->state == RESOURCES_STATE_READY ? entry->mesh : manager->placeholder;
+
+    pthread_mutex_unlock (&manager->lock);
+
+    return mesh;
+}
+
+size_t resources_manager_resident (resources_manager_t *manager) {
+    pthread_mutex_lock (&manager->lock);
+    size_t resident = manager->resident;
+    pthread_mutex_unlock (&manager->lock);
+
+    return resident;
+}
+
+/* Applies to meshes loaded from now on */
+void resources_manager_set_bvh_mode (resources_manager_t *manager, resources_bvh_mode_t mode) {
+    pthread_mutex_lock (&manager->lock);
+    manager->bvh_mode = mode;
+    pthread_mutex_unlock (&manager->lock);
+}
+
+/* Applies to meshes loaded from now on. Loaded
+   meshes are converted before their hierarchy is
+   built, so it fits the stored positions. */
+void resources_manager_set_vertex_format (resources_manager_t *manager, resources_vertex_format_t format) {
+    pthread_mutex_lock (&manager->lock);
+    manager->vertex_format = format;
+    pthread_mutex_unlock (&manager->lock);
+}
@@ -0,0 +1,94 @@
+/* resources/manager.h
+    Asynchronous mesh loading. Loads are queued and
+    run as jobs on the engine's job system, and the
+    caller gets a handle straight away. Until a mesh
+    has arrived (or if it failed to load) its handle
+    resolves to a placeholder cube, so the render
+    loop never waits on the disk.
+
+    Loading a path which is already loaded, or still
+    loading, returns the same handle with its count
+    of references raised. Each load must be matched
+    with a release. Meshes with no references stay
+    cached until the memory held by loaded meshes
+    goes over the budget, at which point the least
+    recently released are evicted.
+
+    All functions may be called from any thread. A
+    mesh pointer from resources_manager_get_mesh is
+    only valid while the handle is held.
+
+    The load jobs can also give each mesh its ray
+    query hierarchy, optionally cached in a file next
+    to the mesh with ".bvh" added to its name. */
+
+#ifndef RESOURCES_MANAGER_H
+#define RESOURCES_MANAGER_H
+
+#include "resources.h"
+#include "./../system/jobs.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t resources_handle_t;
+
+typedef enum {
+    RESOURCES_BVH_NONE,         /* Meshes have no hierarchy */
+    RESOURCES_BVH_BUILD,        /* Built after loading */
+    RESOURCES_BVH_CACHED        /* Read from the cache file if up to date, else built and cached */
+} resources_bvh_mode_t;
+
+#define RESOURCES_INVALID_HANDLE 0
+
+typedef enum {
+    RESOURCES_STATE_LOADING,
+    RESOURCES_STATE_READY,
+    RESOURCES_STATE_FAILED,
+    RESOURCES_STATE_EVICTED
+} resources_state_t;
+
+typedef struct {
+    char *path;
+    resources_mesh_t *mesh;
+    size_t size;                /* Bytes held by mesh */
+    resources_state_t state;
+    int references;
+    uint64_t last_used;         /* Manager clock at last release */
+} resources_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    system_jobs_t *jobs;
+    system_job_counter_t loads; /* Load jobs not yet run */
+    bool stopping;
+
+    resources_entry_t *entries; /* Handle h refers to entries[h - 1] */
+    uint32_t num_entries;
+    uint32_t max_entries;
+
+    uint32_t *queue;            /* Ring of entry indices waiting to load */
+    uint32_t queue_head;
+    uint32_t queue_count;
+    uint32_t queue_size;
+
+    resources_mesh_t *placeholder;
+    size_t budget;              /* Bytes of meshes kept once unreferenced */
+    size_t resident;            /* Bytes held by loaded meshes */
+    uint64_t clock;
+    resources_bvh_mode_t bvh_mode;
+    resources_vertex_format_t vertex_format;
+} resources_manager_t;
+
+resources_manager_t *resources_manager_create (system_jobs_t *jobs, size_t budget);
+void resources_manager_destroy (resources_manager_t *manager);
+resources_handle_t resources_manager_load_mesh (resources_manager_t *manager, const char *path);
+void resources_manager_retain (resources_manager_t *manager, resources_handle_t handle);
+void resources_manager_release (resources_manager_t *manager, resources_handle_t handle);
+resources_state_t resources_manager_state (resources_manager_t *manager, resources_handle_t handle);
+resources_mesh_t *resources_manager_get_mesh (resources_manager_t *manager, resources_handle_t handle);
+size_t resources_manager_resident (resources_manager_t *manager);
+void resources_manager_set_bvh_mode (resources_manager_t *manager, resources_bvh_mode_t mode);
+void resources_manager_set_vertex_format (resources_manager_t *manager, resources_vertex_format_t format);
+
+#endif
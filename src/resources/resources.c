@@ -1,10 +1,13 @@
  #include "resources.h"
+#include "bvh.h"
+#include "./../system/log.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <malloc.h>
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <math.h>
 
 resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
     /* Open file */
@@ -16,11 +19,7 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
         result = (resources_mesh_t *) malloc (sizeof (resources_mesh_t));
 
         if (result == NULL) {
-            fprintf (
-                stderr,
-                "Error - resources/load_mesh_from_obj_file:"
-                " could not allocate memory for mesh structure/n"
-            );
+            SYSTEM_LOG_ERROR ("resources/load_mesh_from_obj_file", "could not allocate memory for mesh structure.");
 
             fclose (obj_file);
             return NULL;
@@ -30,8 +29,7 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
            so that buffers can be allocated for
            these within mesh before parsing
            of the file takes place. */
-        result->num_vertices = 0;
-        result->num_faces = 0;
+        resources_mesh_init (result);
 
         char *buff = NULL;
         size_t len = 0;
@@ -47,17 +45,13 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
             }
         }
 
-        printf ("done with pass 1\n");
+        SYSTEM_LOG_DEBUG ("resources/load_mesh_from_obj_file", "counted %d vertices and %d faces in %s.", result->num_vertices, result->num_faces, file_name);
 
         /* Allocate number of vertices and faces */
         result->vertices = (resources_vertex_t *) malloc (sizeof (resources_vertex_t) * result->num_vertices);
 
         if (result->vertices == NULL) {
-            fprintf (
-                stderr,
-                "Error - resources/load_mesh_from_obj_file:"
-                " could not allocate memory for vertices."
-            );
+            SYSTEM_LOG_ERROR ("resources/load_mesh_from_obj_file", "could not allocate memory for vertices.");
 
             if (buff) {
                 free (buff);
@@ -73,17 +67,13 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
         result->faces = (resources_triangle_t *) malloc (sizeof (resources_triangle_t) * result->num_faces);
 
         if (result->faces == NULL) {
-            fprintf (
-                stderr,
-                "Error - resources/load_mesh_from_obj_file:"
-                " could not allocate memory for faces."
-            );
+            SYSTEM_LOG_ERROR ("resources/load_mesh_from_obj_file", "could not allocate memory for faces.");
 
             if (buff) {
                 free (buff);
             }
 
-            free (result->faces);
+            free (result->vertices);
             free (result);
 
             fclose (obj_file);
@@ -122,9 +112,9 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
                         result->faces[face_index][1] = i2 - 1;
                         result->faces[face_index][2] = i3 - 1;
                         face_index ++;
-                    }
 
-                    printf ("New face: %d %d %d\n", i1, i2, i3);
+                        SYSTEM_LOG_TRACE ("resources/load_mesh_from_obj_file", "new face: %d %d %d", i1, i2, i3);
+                    }
                 }
             }
         }
@@ -135,15 +125,287 @@ resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name) {
 
         fclose (obj_file);
 
+        /* Lines which did not parse were counted */
+        result->num_vertices = vertex_index;
+        result->num_faces = face_index;
+
+        if (!resources_mesh_build_edges (result)) {
+            SYSTEM_LOG_WARN ("resources/load_mesh_from_obj_file", "%s will be drawn without an edge list.", file_name);
+        }
+
         return result;
     } else {
-        fprintf (
-            stderr,
-            "Error - resources/load_mesh_from_obj_file:"
-            "could not open file %s/n",
-            file_name
-        );
+        SYSTEM_LOG_ERROR ("resources/load_mesh_from_obj_file", "could not open file %s.", file_name);
 
         return NULL;
     }
-}
\ No newline at end of file
+}
+
+/* An empty mesh with double vertices, for filling
+   in by hand. */
+void resources_mesh_init (resources_mesh_t *mesh) {
+    memset (mesh, 0, sizeof (resources_mesh_t));
+    mesh->format = RESOURCES_VERTEX_DOUBLE;
+}
+
+/* The array holding the vertices, and its size */
+const void *resources_mesh_vertex_data (const resources_mesh_t *mesh, size_t *size) {
+    switch (mesh->format) {
+        case RESOURCES_VERTEX_FLOAT3:
+            *size = sizeof (resources_vertex_float3_t) * mesh->num_vertices;
+            return mesh->vertices_float3;
+        case RESOURCES_VERTEX_QUANTIZED:
+            *size = sizeof (resources_vertex_quantized_t) * mesh->num_vertices;
+            return mesh->vertices_quantized;
+        default:
+            *size = sizeof (resources_vertex_t) * mesh->num_vertices;
+            return mesh->vertices;
+    }
+}
+
+static void quantize_axis (double lo, double hi, double *min, double *scale) {
+    *min = lo;
+    *scale = hi > lo ? (hi - lo) / 65535.0 : 0.0;
+}
+
+static uint16_t quantize (double v, double min, double scale) {
+    if (scale == 0.0) {
+        return 0;
+    }
+
+    long q = lround ((v - min) / scale);
+    return (uint16_t) (q < 0 ? 0 : q > 65535 ? 65535 : q);
+}
+
+/* Convert the mesh's vertices to another format.
+   Quantizing is lossy - each position moves by up
+   to half a step, 1/131070 of the mesh's size along
+   each axis. Converting back does not restore the
+   lost precision. */
+bool resources_mesh_set_vertex_format (resources_mesh_t *mesh, resources_vertex_format_t format) {
+    if (format == mesh->format) {
+        return true;
+    }
+
+    resources_vertex_t *vertices = NULL;
+    resources_vertex_float3_t *vertices_float3 = NULL;
+    resources_vertex_quantized_t *vertices_quantized = NULL;
+    maths_vec4f min = { 0.0, 0.0, 0.0, 1.0 };
+    maths_vec4f scale = { 0.0, 0.0, 0.0, 0.0 };
+
+    switch (format) {
+        case RESOURCES_VERTEX_FLOAT3:
+            vertices_float3 = (resources_vertex_float3_t *) malloc (sizeof (resources_vertex_float3_t) * mesh->num_vertices + 1);
+
+            if (vertices_float3 == NULL) {
+                break;
+            }
+
+            for (int i = 0; i < mesh->num_vertices; i++) {
+                maths_vec4f v = resources_mesh_vertex (mesh, i);
+                vertices_float3[i] = (resources_vertex_float3_t) { (float) v.x, (float) v.y, (float) v.z };
+            }
+
+            break;
+        case RESOURCES_VERTEX_QUANTIZED:
+            vertices_quantized = (resources_vertex_quantized_t *) malloc (sizeof (resources_vertex_quantized_t) * mesh->num_vertices + 1);
+
+            if (vertices_quantized == NULL) {
+                break;
+            }
+
+            maths_vec4f lo = mesh->num_vertices > 0 ? resources_mesh_vertex (mesh, 0) : min;
+            maths_vec4f hi = lo;
+
+            for (int i = 1; i < mesh->num_vertices; i++) {
+                maths_vec4f v = resources_mesh_vertex (mesh, i);
+                lo.x = v.x < lo.x ? v.x : lo.x;
+                lo.y = v.y < lo.y ? v.y : lo.y;
+                lo.z = v.z < lo.z ? v.z : lo.z;
+                hi.x = v.x > hi.x ? v.x : hi.x;
+                hi.y = v.y > hi.y ? v.y : hi.y;
+                hi.z = v.z > hi.z ? v.z : hi.z;
+            }
+
+            quantize_axis (lo.x, hi.x, &min.x, &scale.x);
+            quantize_axis (lo.y, hi.y, &min.y, &scale.y);
+            quantize_axis (lo.z, hi.z, &min.z, &scale.z);
+
+            for (int i = 0; i < mesh->num_vertices; i++) {
+                maths_vec4f v = resources_mesh_vertex (mesh, i);
+                vertices_quantized[i] = (resources_vertex_quantized_t) { quantize (v.x, min.x, scale.x), quantize (v.y, min.y, scale.y), quantize (v.z, min.z, scale.z), 0 };
+            }
+
+            break;
+        default:
+            vertices = (resources_vertex_t *) malloc (sizeof (resources_vertex_t) * mesh->num_vertices + 1);
+
+            if (vertices == NULL) {
+                break;
+            }
+
+            for (int i = 0; i < mesh->num_vertices; i++) {
+                vertices[i].coord = resources_mesh_vertex (mesh, i);
+            }
+
+            break;
+    }
+
+    if (vertices == NULL && vertices_float3 == NULL && vertices_quantized == NULL) {
+        SYSTEM_LOG_ERROR ("resources/set_vertex_format", "could not allocate memory for %d vertices.", mesh->num_vertices);
+        return false;
+    }
+
+    free (mesh->vertices);
+    free (mesh->vertices_float3);
+    free (mesh->vertices_quantized);
+    mesh->format = format;
+    mesh->vertices = vertices;
+    mesh->vertices_float3 = vertices_float3;
+    mesh->vertices_quantized = vertices_quantized;
+    mesh->quantized_min = min;
+    mesh->quantized_scale = scale;
+
+    return true;
+}
+
+/* A model transform with the mesh's dequantization
+   folded in, so quantized vertices can be multiplied
+   by it directly. Other formats are returned as they
+   are. */
+maths_mat4x4f resources_mesh_dequantize (const resources_mesh_t *mesh, maths_mat4x4f transform) {
+    if (mesh->format != RESOURCES_VERTEX_QUANTIZED) {
+        return transform;
+    }
+
+    maths_mat4x4f dequantize = maths_4x4f_translation_3d (mesh->quantized_min.x, mesh->quantized_min.y, mesh->quantized_min.z);
+    dequantize.data[0][0] = mesh->quantized_scale.x;
+    dequantize.data[1][1] = mesh->quantized_scale.y;
+    dequantize.data[2][2] = mesh->quantized_scale.z;
+
+    return maths_mat4x4f_mul_affine (transform, dequantize);
+}
+
+typedef struct {
+    int other;                      /* Higher vertex of the edge */
+    int face;
+} resources_half_edge_t;
+
+static float face_cosine (resources_mesh_t *mesh, int f0, int f1) {
+    maths_vec4f n[2];
+
+    for (int i = 0; i < 2; i++) {
+        const int *face = mesh->faces[i == 0 ? f0 : f1];
+        maths_vec4f a = resources_mesh_vertex (mesh, face[0]);
+        n[i] = maths_vec4f_cross_3d (maths_vec4f_sub (resources_mesh_vertex (mesh, face[1]), a), maths_vec4f_sub (resources_mesh_vertex (mesh, face[2]), a));
+
+        /* Degenerate faces have no angle to speak of */
+        if (maths_vec4f_dot (n[i], n[i]) == 0.0) {
+            return 1.0f;
+        }
+
+        n[i] = maths_vec4f_normalise (n[i]);
+    }
+
+    return (float) maths_vec4f_dot (n[0], n[1]);
+}
+
+/* Build the list of unique edges, so wireframes can
+   draw each edge once rather than once per face. The
+   sides of every face are bucketed by their lower
+   vertex, and matched up within each bucket, leaving
+   the edges ordered by vertex. */
+bool resources_mesh_build_edges (resources_mesh_t *mesh) {
+    free (mesh->edges);
+    mesh->edges = NULL;
+    mesh->num_edges = 0;
+
+    int *start = (int *) calloc (mesh->num_vertices + 1, sizeof (int));
+    int *cursor = (int *) malloc (sizeof (int) * (mesh->num_vertices + 1));
+    resources_half_edge_t *sides = (resources_half_edge_t *) malloc (sizeof (resources_half_edge_t) * 3 * mesh->num_faces + 1);
+    resources_edge_t *edges = (resources_edge_t *) malloc (sizeof (resources_edge_t) * 3 * mesh->num_faces + 1);
+
+    if (start == NULL || cursor == NULL || sides == NULL || edges == NULL) {
+        SYSTEM_LOG_ERROR ("resources/build_edges", "could not allocate memory for edges.");
+        free (start);
+        free (cursor);
+        free (sides);
+        free (edges);
+        return false;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int f = 0; f < mesh->num_faces; f++) {
+            for (int k = 0; k < 3; k++) {
+                int a = mesh->faces[f][k];
+                int b = mesh->faces[f][(k + 1) % 3];
+                int low = a < b ? a : b;
+                int high = a < b ? b : a;
+
+                if (low < 0 || high >= mesh->num_vertices || low == high) {
+                    continue;
+                }
+
+                if (pass == 0) {
+                    start[low + 1]++;
+                } else {
+                    sides[cursor[low]++] = (resources_half_edge_t) { high, f };
+                }
+            }
+        }
+
+        if (pass == 0) {
+            for (int v = 0; v < mesh->num_vertices; v++) {
+                start[v + 1] += start[v];
+                cursor[v] = start[v];
+            }
+        }
+    }
+
+    int count = 0;
+
+    for (int v = 0; v < mesh->num_vertices; v++) {
+        int first = count;
+
+        for (int i = start[v]; i < start[v + 1]; i++) {
+            int e = first;
+
+            while (e < count && edges[e].vertices[1] != sides[i].other) {
+                e++;
+            }
+
+            if (e == count) {
+                edges[count++] = (resources_edge_t) { { v, sides[i].other }, { sides[i].face, -1 }, 1.0f };
+            } else if (edges[e].faces[1] == -1) {
+                edges[e].faces[1] = sides[i].face;
+                edges[e].cosine = face_cosine (mesh, edges[e].faces[0], sides[i].face);
+            }
+        }
+    }
+
+    free (start);
+    free (cursor);
+    free (sides);
+
+    /* Shared edges leave the list with room to spare */
+    resources_edge_t *shrunk = (resources_edge_t *) realloc (edges, sizeof (resources_edge_t) * count + 1);
+
+    mesh->edges = shrunk != NULL ? shrunk : edges;
+    mesh->num_edges = count;
+
+    return true;
+}
+
+void resources_mesh_free (resources_mesh_t *mesh) {
+    if (mesh == NULL) {
+        return;
+    }
+
+    free (mesh->vertices);
+    free (mesh->vertices_float3);
+    free (mesh->vertices_quantized);
+    free (mesh->faces);
+    free (mesh->edges);
+    resources_bvh_free (mesh->bvh);
+    free (mesh);
+}
@@ -2,18 +2,62 @@
 #define RESOURCES_H
 
 #include "./../maths/maths.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef struct {
     maths_vec4f coord;
 } resources_vertex_t;
 
+/* How a mesh stores its vertex positions. Only the
+   array for the mesh's format is allocated. */
+typedef enum {
+    RESOURCES_VERTEX_DOUBLE,        /* vertices, 32 bytes each */
+    RESOURCES_VERTEX_FLOAT3,        /* vertices_float3, 12 bytes each */
+    RESOURCES_VERTEX_QUANTIZED      /* vertices_quantized, 8 bytes each */
+} resources_vertex_format_t;
+
+typedef struct {
+    float x;
+    float y;
+    float z;
+} resources_vertex_float3_t;
+
+/* Steps of quantized_scale from quantized_min, so the
+   mesh's bounds are split into 65536 steps along each
+   axis. The padding lets a vertex load in one go. */
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t z;
+    uint16_t pad;
+} resources_vertex_quantized_t;
+
 typedef int resources_triangle_t[3];
 
+/* An edge and the faces either side of it. faces[1]
+   is -1 on the boundary of an open mesh. Where more
+   than two faces meet at an edge, the rest are left
+   out. */
+typedef struct {
+    int vertices[2];
+    int faces[2];
+    float cosine;                   /* Of the angle between the face normals, 1 where flat */
+} resources_edge_t;
+
 typedef struct {
+    resources_vertex_format_t format;
     resources_vertex_t *vertices;
+    resources_vertex_float3_t *vertices_float3;
+    resources_vertex_quantized_t *vertices_quantized;
+    maths_vec4f quantized_min;      /* Position of quantized (0, 0, 0) */
+    maths_vec4f quantized_scale;    /* Size of one quantized step along each axis */
     resources_triangle_t *faces;
     int num_vertices;
     int num_faces;
+    struct resources_bvh_t *bvh;    /* For ray queries, NULL until built */
+    resources_edge_t *edges;        /* Each edge once, NULL until built */
+    int num_edges;
 } resources_mesh_t;
 
 typedef struct {
@@ -23,6 +67,29 @@ typedef struct {
     maths_vec4f rotation;
 } resources_model_t;
 
+/* Position of vertex i, whatever the format */
+static inline maths_vec4f resources_mesh_vertex (const resources_mesh_t *mesh, int i) {
+    switch (mesh->format) {
+        case RESOURCES_VERTEX_FLOAT3:
+            return (maths_vec4f) { mesh->vertices_float3[i].x, mesh->vertices_float3[i].y, mesh->vertices_float3[i].z, 1.0 };
+        case RESOURCES_VERTEX_QUANTIZED:
+            return (maths_vec4f) {
+                mesh->quantized_min.x + mesh->vertices_quantized[i].x * mesh->quantized_scale.x,
+                mesh->quantized_min.y + mesh->vertices_quantized[i].y * mesh->quantized_scale.y,
+                mesh->quantized_min.z + mesh->vertices_quantized[i].z * mesh->quantized_scale.z,
+                1.0
+            };
+        default:
+            return mesh->vertices[i].coord;
+    }
+}
+
 resources_mesh_t *resources_load_mesh_from_obj_file (const char *file_name);
+void resources_mesh_init (resources_mesh_t *mesh);
+const void *resources_mesh_vertex_data (const resources_mesh_t *mesh, size_t *size);
+bool resources_mesh_set_vertex_format (resources_mesh_t *mesh, resources_vertex_format_t format);
+maths_mat4x4f resources_mesh_dequantize (const resources_mesh_t *mesh, maths_mat4x4f transform);
+bool resources_mesh_build_edges (resources_mesh_t *mesh);
+void resources_mesh_free (resources_mesh_t *mesh);
 
 #endif
\ No newline at end of file
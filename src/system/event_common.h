@@ -12,7 +12,8 @@ typedef struct system_window_t system_window_t;
 
 typedef enum  {
     SYSTEM_EVENT_NONE,
-    SYSTEM_EVENT_EXIT
+    SYSTEM_EVENT_EXIT,
+    SYSTEM_EVENT_EXPOSE
 } system_event_code_t;
 
 typedef void (*system_event_handler_t)(system_window_t *window, void *, void *);
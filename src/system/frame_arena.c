@@ -0,0 +1,100 @@
+#include "frame_arena.h"
+#include "log.h"
+#include <assert.h>
+
+void system_frame_arena_init (system_frame_arena_t *arena, size_t block_size) {
+    assert (arena != NULL);
+
+    arena->block_size = block_size != 0 ? block_size : SYSTEM_LINEAR_ALLOCATOR_DEFAULT_BLOCK_SIZE;
+    arena->frames = 0;
+
+    for (int i = 0; i < SYSTEM_FRAME_ARENA_MAX_THREADS; i++) {
+        arena->threads[i].initialised = false;
+        arena->threads[i].high_water = 0;
+    }
+}
+
+void *system_frame_arena_alloc (system_frame_arena_t *arena, unsigned int thread, size_t size, size_t align) {
+    assert (arena != NULL);
+    assert (thread < SYSTEM_FRAME_ARENA_MAX_THREADS);
+
+    system_frame_sub_arena_t *sub = &arena->threads[thread];
+
+    if (!sub->initialised) {
+        if (!system_linear_allocator_init (&sub->allocator, arena->block_size)) {
+            SYSTEM_LOG_ERROR ("system/frame_arena", "could not create sub-arena for thread %u.", thread);
+            return NULL;
+        }
+
+        sub->initialised = true;
+    }
+
+    return system_linear_allocator_alloc (&sub->allocator, size, align);
+}
+
+void system_frame_arena_reset (system_frame_arena_t *arena) {
+    assert (arena != NULL);
+
+    for (int i = 0; i < SYSTEM_FRAME_ARENA_MAX_THREADS; i++) {
+        system_frame_sub_arena_t *sub = &arena->threads[i];
+
+        if (!sub->initialised) {
+            continue;
+        }
+
+        if (sub->allocator.used > sub->high_water) {
+            sub->high_water = sub->allocator.used;
+        }
+
+        /* Spilled into more than one block - replace them
+           with one block large enough for the worst frame
+           so far, plus room for alignment padding. */
+        if (sub->allocator.head->next != NULL) {
+            size_t block_size = sub->high_water + sub->high_water / 8;
+
+            system_linear_allocator_destroy (&sub->allocator);
+
+            if (!system_linear_allocator_init (&sub->allocator, block_size > arena->block_size ? block_size : arena->block_size)) {
+                SYSTEM_LOG_ERROR ("system/frame_arena", "could not resize sub-arena for thread %d.", i);
+                sub->initialised = false;
+            }
+
+            continue;
+        }
+
+        system_linear_allocator_reset (&sub->allocator);
+    }
+
+    arena->frames++;
+}
+
+void system_frame_arena_stats (system_frame_arena_t *arena, system_frame_arena_stats_t *stats) {
+    assert (arena != NULL && stats != NULL);
+
+    stats->used = 0;
+    stats->high_water = 0;
+    stats->reserved = 0;
+
+    for (int i = 0; i < SYSTEM_FRAME_ARENA_MAX_THREADS; i++) {
+        system_frame_sub_arena_t *sub = &arena->threads[i];
+
+        if (!sub->initialised) {
+            continue;
+        }
+
+        stats->used += sub->allocator.used;
+        stats->high_water += sub->allocator.used > sub->high_water ? sub->allocator.used : sub->high_water;
+        stats->reserved += sub->allocator.reserved;
+    }
+}
+
+void system_frame_arena_destroy (system_frame_arena_t *arena) {
+    assert (arena != NULL);
+
+    for (int i = 0; i < SYSTEM_FRAME_ARENA_MAX_THREADS; i++) {
+        if (arena->threads[i].initialised) {
+            system_linear_allocator_destroy (&arena->threads[i].allocator);
+            arena->threads[i].initialised = false;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/* system/frame_arena.h
+    Scratch memory which only lives for one frame.
+    The arena holds one linear allocator per thread,
+    so that threads can allocate without locking,
+    and all of them are reset together at the start
+    of each frame.
+
+    The largest amount used in any frame is kept as
+    a high-water mark. When a frame overflows the
+    first block of a sub-arena, the sub-arena is
+    rebuilt at the next reset as a single block big
+    enough for the high-water mark, so that steady
+    state frames do not touch malloc.
+
+    A thread must only allocate from its own index,
+    and the arena must not be reset while any thread
+    is still using memory from it. */
+
+#ifndef SYSTEM_FRAME_ARENA_H
+#define SYSTEM_FRAME_ARENA_H
+
+#include "linear_allocator.h"
+
+#define SYSTEM_FRAME_ARENA_MAX_THREADS 16
+
+typedef struct {
+    system_linear_allocator_t allocator;
+    bool initialised;                   /* Blocks are only created on first use */
+    size_t high_water;                  /* Most bytes used in one frame */
+} system_frame_sub_arena_t;
+
+typedef struct {
+    size_t block_size;
+    unsigned long frames;               /* Resets so far */
+    system_frame_sub_arena_t threads[SYSTEM_FRAME_ARENA_MAX_THREADS];
+} system_frame_arena_t;
+
+typedef struct {
+    size_t used;                        /* Bytes allocated this frame */
+    size_t high_water;                  /* Sum of the per-thread high-water marks */
+    size_t reserved;                    /* Bytes held in blocks */
+} system_frame_arena_stats_t;
+
+void system_frame_arena_init (system_frame_arena_t *arena, size_t block_size);
+void *system_frame_arena_alloc (system_frame_arena_t *arena, unsigned int thread, size_t size, size_t align);
+void system_frame_arena_reset (system_frame_arena_t *arena);
+void system_frame_arena_stats (system_frame_arena_t *arena, system_frame_arena_stats_t *stats);
+void system_frame_arena_destroy (system_frame_arena_t *arena);
+
+#endif
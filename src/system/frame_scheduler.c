@@ -0,0 +1,93 @@
+#include "frame_scheduler.h"
+#include <time.h>
+
+/* Monotonic time in seconds */
+double system_time_now () {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void system_frame_scheduler_init (system_frame_scheduler_t *scheduler, double frame_rate, double update_rate) {
+    assert (scheduler != NULL);
+    assert (frame_rate > 0 && update_rate > 0);
+
+    scheduler->frame_period = 1.0 / frame_rate;
+    scheduler->update_period = 1.0 / update_rate;
+    scheduler->accumulator = 0;
+    scheduler->previous_time = 0;
+    scheduler->next_frame_time = 0;
+    scheduler->frames = 0;
+    scheduler->updates = 0;
+}
+
+/* Run until *running is cleared, typically by an event
+   handler. update is called with the fixed time step,
+   and render with how far (0 to 1) the current time is
+   between the last update and the next, for
+   interpolation. */
+void system_frame_scheduler_run (
+    system_frame_scheduler_t *scheduler,
+    system_window_t *window,
+    volatile bool *running,
+    system_update_func_t update,
+    system_render_func_t render,
+    void *aux
+) {
+    assert (scheduler != NULL && window != NULL && running != NULL);
+
+    scheduler->previous_time = system_time_now ();
+    scheduler->next_frame_time = scheduler->previous_time;
+
+    while (*running) {
+        system_window_handle_events (window);
+
+        if (!*running) {
+            break;
+        }
+
+        double now = system_time_now ();
+        bool mapped = system_window_is_mapped (window);
+
+        if (now < scheduler->next_frame_time) {
+            /* Sleep until the next frame is due, waking
+               early to handle events as they arrive. */
+            system_window_wait_events (window, scheduler->next_frame_time - now);
+            continue;
+        }
+
+        /* Fixed time step updates */
+        double elapsed = now - scheduler->previous_time;
+        double max_elapsed = SYSTEM_FRAME_SCHEDULER_MAX_UPDATES * scheduler->update_period;
+        scheduler->previous_time = now;
+        scheduler->accumulator += elapsed < max_elapsed ? elapsed : max_elapsed;
+
+        while (scheduler->accumulator >= scheduler->update_period) {
+            if (update) {
+                update (scheduler->update_period, aux);
+            }
+
+            scheduler->accumulator -= scheduler->update_period;
+            scheduler->updates++;
+        }
+
+        if (mapped) {
+            if (render) {
+                render (scheduler->accumulator / scheduler->update_period, aux);
+            }
+
+            scheduler->frames++;
+            scheduler->next_frame_time += scheduler->frame_period;
+        } else {
+            /* Nothing to draw to - just keep the
+               simulation ticking slowly. */
+            scheduler->next_frame_time = now + SYSTEM_FRAME_SCHEDULER_UNMAPPED_WAIT;
+        }
+
+        /* If a frame overran, drop the missed frames
+           rather than rendering them back to back. */
+        if (scheduler->next_frame_time < now) {
+            scheduler->next_frame_time = now + scheduler->frame_period;
+        }
+    }
+}
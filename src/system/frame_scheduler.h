@@ -0,0 +1,40 @@
+/* system/frame_scheduler.h
+    Main loop driver. Rather than rendering as fast
+    as possible, the scheduler sleeps on the window
+    connection until either an event arrives or the
+    next frame is due, paces rendering to a target
+    frame rate, and runs game logic in fixed time
+    steps independent of the render rate. Nothing
+    is rendered while the window is unmapped. */
+
+#ifndef SYSTEM_FRAME_SCHEDULER_H
+#define SYSTEM_FRAME_SCHEDULER_H
+
+#include "window.h"
+
+/* Cap on the number of fixed updates run to catch up
+   after a stall, so that a long pause does not cause
+   a burst of updates. */
+#define SYSTEM_FRAME_SCHEDULER_MAX_UPDATES 8
+
+/* How long to sleep between checks while unmapped */
+#define SYSTEM_FRAME_SCHEDULER_UNMAPPED_WAIT 0.1
+
+typedef void (*system_update_func_t)(double dt, void *aux);
+typedef void (*system_render_func_t)(double alpha, void *aux);
+
+typedef struct {
+    double frame_period;    /* Seconds between rendered frames */
+    double update_period;   /* Seconds simulated by each update */
+    double accumulator;     /* Simulation time not yet updated */
+    double previous_time;
+    double next_frame_time;
+    unsigned long frames;   /* Frames rendered */
+    unsigned long updates;  /* Updates run */
+} system_frame_scheduler_t;
+
+double system_time_now ();
+void system_frame_scheduler_init (system_frame_scheduler_t *scheduler, double frame_rate, double update_rate);
+void system_frame_scheduler_run (system_frame_scheduler_t *scheduler, system_window_t *window, volatile bool *running, system_update_func_t update, system_render_func_t render, void *aux);
+
+#endif
@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include "log.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Jobs waiting on a counter to reach zero */
+typedef struct system_job_batch_t {
+    struct system_job_batch_t *next;
+    int count;
+    system_job_item_t items[];
+} system_job_batch_t;
+
+typedef struct {
+    system_jobs_t *jobs;
+    int index;
+} system_jobs_worker_t;
+
+/* The pool the current thread works for, if any */
+static _Thread_local system_jobs_t *current_jobs;
+static _Thread_local int current_index;
+
+static void run_item (system_jobs_t *jobs, int index, system_job_item_t *item);
+
+/* Workers use their own deque, other threads the
+   shared one after them. */
+static int thread_index (system_jobs_t *jobs) {
+    return current_jobs == jobs ? current_index : jobs->num_deques - 1;
+}
+
+static void counter_add (system_job_counter_t *counter, int count) {
+    pthread_mutex_lock (&counter->lock);
+    __atomic_add_fetch (&counter->value, count, __ATOMIC_RELEASE);
+    pthread_mutex_unlock (&counter->lock);
+}
+
+/* Deques */
+
+static bool push (system_jobs_t *jobs, int index, const system_job_item_t *item) {
+    system_job_deque_t *deque = &jobs->deques[index];
+
+    /* Counted first, so a thief never takes it below zero */
+    __atomic_add_fetch (&jobs->queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock (&deque->lock);
+
+    if (deque->bottom - deque->top == SYSTEM_JOBS_DEQUE_SIZE) {
+        pthread_mutex_unlock (&deque->lock);
+        __atomic_sub_fetch (&jobs->queued, 1, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    deque->items[deque->bottom % SYSTEM_JOBS_DEQUE_SIZE] = *item;
+    deque->bottom++;
+    pthread_mutex_unlock (&deque->lock);
+
+    if (__atomic_load_n (&jobs->sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock (&jobs->lock);
+        pthread_cond_signal (&jobs->wake);
+        pthread_mutex_unlock (&jobs->lock);
+    }
+
+    return true;
+}
+
+/* Push, or run straight away if the deque is full */
+static void push_or_run (system_jobs_t *jobs, int index, system_job_item_t *item) {
+    if (!push (jobs, index, item)) {
+        run_item (jobs, index, item);
+    }
+}
+
+/* Take the newest job from the bottom, or the oldest
+   from the top when stealing. Only jobs counted by
+   only are taken, unless it is NULL. */
+static bool take (system_jobs_t *jobs, int index, bool steal, system_job_counter_t *only, system_job_item_t *item) {
+    system_job_deque_t *deque = &jobs->deques[index];
+    pthread_mutex_lock (&deque->lock);
+
+    if (deque->bottom == deque->top) {
+        pthread_mutex_unlock (&deque->lock);
+        return false;
+    }
+
+    unsigned int slot = steal ? deque->top : deque->bottom - 1;
+
+    if (only != NULL && deque->items[slot % SYSTEM_JOBS_DEQUE_SIZE].counter != only) {
+        pthread_mutex_unlock (&deque->lock);
+        return false;
+    }
+
+    *item = deque->items[slot % SYSTEM_JOBS_DEQUE_SIZE];
+
+    if (steal) {
+        deque->top++;
+    } else {
+        deque->bottom--;
+    }
+
+    pthread_mutex_unlock (&deque->lock);
+    __atomic_sub_fetch (&jobs->queued, 1, __ATOMIC_SEQ_CST);
+
+    return true;
+}
+
+static bool deque_empty (system_jobs_t *jobs, int index) {
+    system_job_deque_t *deque = &jobs->deques[index];
+    pthread_mutex_lock (&deque->lock);
+    bool empty = deque->bottom == deque->top;
+    pthread_mutex_unlock (&deque->lock);
+
+    return empty;
+}
+
+/* Run a job from this thread's deque, or failing
+   that one stolen from another. */
+static bool run_one (system_jobs_t *jobs, int index, system_job_counter_t *only) {
+    if (__atomic_load_n (&jobs->queued, __ATOMIC_SEQ_CST) == 0) {
+        return false;
+    }
+
+    system_job_item_t item;
+    bool found = take (jobs, index, false, only, &item);
+
+    for (int i = 1; i < jobs->num_deques && !found; i++) {
+        found = take (jobs, (index + i) % jobs->num_deques, true, only, &item);
+    }
+
+    if (found) {
+        run_item (jobs, index, &item);
+    }
+
+    return found;
+}
+
+/* Jobs */
+
+/* Count a job as run, releasing the jobs waiting on
+   its counter if it was the last. The count only
+   changes under the lock, so a waiter which has
+   seen zero and taken the lock may destroy it. */
+static void finish (system_jobs_t *jobs, int index, system_job_counter_t *counter) {
+    if (counter == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock (&counter->lock);
+    system_job_batch_t *batch = NULL;
+
+    if (__atomic_sub_fetch (&counter->value, 1, __ATOMIC_ACQ_REL) == 0) {
+        batch = counter->waiting;
+        counter->waiting = NULL;
+    }
+
+    pthread_mutex_unlock (&counter->lock);
+
+    while (batch != NULL) {
+        system_job_batch_t *next = batch->next;
+
+        for (int i = 0; i < batch->count; i++) {
+            push_or_run (jobs, index, &batch->items[i]);
+        }
+
+        free (batch);
+        batch = next;
+    }
+}
+
+/* Run a loop chunk by chunk, splitting off the back
+   half of what is left whenever this thread's deque
+   is empty, so there is something to steal. */
+static void run_range (system_jobs_t *jobs, int index, system_job_item_t *item) {
+    int begin = item->begin;
+    int end = item->end;
+
+    while (end - begin > item->min_chunk) {
+        if (deque_empty (jobs, index)) {
+            system_job_item_t half = *item;
+            half.begin = begin + (end - begin) / 2;
+            half.end = end;
+
+            /* The counter cannot reach zero meanwhile, as
+               this chunk is still running. */
+            counter_add (item->counter, 1);
+
+            if (push (jobs, index, &half)) {
+                end = half.begin;
+                continue;
+            }
+
+            counter_add (item->counter, -1);
+        }
+
+        item->range (begin, begin + item->min_chunk, item->arg);
+        begin += item->min_chunk;
+    }
+
+    item->range (begin, end, item->arg);
+}
+
+static void run_item (system_jobs_t *jobs, int index, system_job_item_t *item) {
+    if (item->range != NULL) {
+        run_range (jobs, index, item);
+    } else {
+        item->func (item->arg);
+    }
+
+    finish (jobs, index, item->counter);
+}
+
+/* Workers */
+
+static void *worker_main (void *arg) {
+    system_jobs_worker_t *worker = (system_jobs_worker_t *) arg;
+    system_jobs_t *jobs = worker->jobs;
+    current_jobs = jobs;
+    current_index = worker->index;
+    free (worker);
+
+    for (;;) {
+        if (run_one (jobs, current_index, NULL)) {
+            continue;
+        }
+
+        pthread_mutex_lock (&jobs->lock);
+
+        if (jobs->stopping) {
+            pthread_mutex_unlock (&jobs->lock);
+            break;
+        }
+
+        /* Paired with the count and check in push, so
+           one side always sees the other. */
+        __atomic_add_fetch (&jobs->sleeping, 1, __ATOMIC_SEQ_CST);
+
+        while (!jobs->stopping && __atomic_load_n (&jobs->queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait (&jobs->wake, &jobs->lock);
+        }
+
+        __atomic_sub_fetch (&jobs->sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&jobs->lock);
+    }
+
+    return NULL;
+}
+
+static void pin_thread (pthread_t thread, int core) {
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (core, &set);
+
+    if (pthread_setaffinity_np (thread, sizeof (cpu_set_t), &set) != 0) {
+        SYSTEM_LOG_WARN ("system/jobs", "could not pin a worker to core %d.", core);
+    }
+}
+
+/* Start num_threads workers, or given less than 1,
+   one per core less one for the thread which waits
+   on them, but at least one. Pinned workers are
+   tied to a core each, starting from the second, to
+   leave the first to the main thread. */
+system_jobs_t *system_jobs_create (int num_threads, bool pin) {
+    system_jobs_t *jobs = (system_jobs_t *) calloc (1, sizeof (system_jobs_t));
+
+    if (jobs == NULL) {
+        SYSTEM_LOG_ERROR ("system/jobs", "could not allocate memory for job system.");
+        return NULL;
+    }
+
+    long cores = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (cores < 1) {
+        cores = 1;
+    }
+
+    if (num_threads < 1) {
+        num_threads = cores > 1 ? (int) cores - 1 : 1;
+    }
+
+    if (num_threads > SYSTEM_JOBS_MAX_THREADS) {
+        num_threads = SYSTEM_JOBS_MAX_THREADS;
+    }
+
+    jobs->num_deques = num_threads + 1;
+    jobs->deques = (system_job_deque_t *) calloc (jobs->num_deques, sizeof (system_job_deque_t));
+
+    if (jobs->deques == NULL) {
+        SYSTEM_LOG_ERROR ("system/jobs", "could not allocate memory for job queues.");
+        free (jobs);
+        return NULL;
+    }
+
+    pthread_mutex_init (&jobs->lock, NULL);
+    pthread_cond_init (&jobs->wake, NULL);
+
+    for (int i = 0; i < jobs->num_deques; i++) {
+        pthread_mutex_init (&jobs->deques[i].lock, NULL);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        system_jobs_worker_t *worker = (system_jobs_worker_t *) malloc (sizeof (system_jobs_worker_t));
+
+        if (worker != NULL) {
+            worker->jobs = jobs;
+            worker->index = i;
+        }
+
+        if (worker == NULL || pthread_create (&jobs->threads[i], NULL, worker_main, worker) != 0) {
+            SYSTEM_LOG_WARN ("system/jobs", "could only start %d of %d workers.", i, num_threads);
+            free (worker);
+            break;
+        }
+
+        if (pin) {
+            pin_thread (jobs->threads[i], (int) ((i + 1) % cores));
+        }
+
+        jobs->num_threads++;
+    }
+
+    return jobs;
+}
+
+/* Jobs already queued are run before the workers
+   stop, but nothing may be submitted from now on. */
+void system_jobs_destroy (system_jobs_t *jobs) {
+    if (jobs == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock (&jobs->lock);
+    jobs->stopping = true;
+    pthread_cond_broadcast (&jobs->wake);
+    pthread_mutex_unlock (&jobs->lock);
+
+    for (int i = 0; i < jobs->num_threads; i++) {
+        pthread_join (jobs->threads[i], NULL);
+    }
+
+    for (int i = 0; i < jobs->num_deques; i++) {
+        pthread_mutex_destroy (&jobs->deques[i].lock);
+    }
+
+    pthread_cond_destroy (&jobs->wake);
+    pthread_mutex_destroy (&jobs->lock);
+    free (jobs->deques);
+    free (jobs);
+}
+
+void system_job_counter_init (system_job_counter_t *counter) {
+    counter->value = 0;
+    counter->waiting = NULL;
+    pthread_mutex_init (&counter->lock, NULL);
+}
+
+/* Only once it has been waited on */
+void system_job_counter_destroy (system_job_counter_t *counter) {
+    pthread_mutex_destroy (&counter->lock);
+}
+
+static system_job_item_t job_item (const system_job_t *job, system_job_counter_t *counter) {
+    return (system_job_item_t) { job->func, NULL, job->arg, 0, 0, 0, counter };
+}
+
+/* Queue jobs to run as soon as a thread is free.
+   counter, if not NULL, counts them until they
+   have run. */
+void system_jobs_submit (system_jobs_t *jobs, const system_job_t *list, int count, system_job_counter_t *counter) {
+    int index = thread_index (jobs);
+
+    if (counter != NULL) {
+        counter_add (counter, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        system_job_item_t item = job_item (&list[i], counter);
+        push_or_run (jobs, index, &item);
+    }
+}
+
+/* Queue jobs to run once after reaches zero. They
+   are counted by counter straight away. */
+void system_jobs_submit_after (system_jobs_t *jobs, const system_job_t *list, int count, system_job_counter_t *after, system_job_counter_t *counter) {
+    system_job_batch_t *batch = (system_job_batch_t *) malloc (sizeof (system_job_batch_t) + sizeof (system_job_item_t) * count);
+
+    if (batch == NULL) {
+        SYSTEM_LOG_ERROR ("system/jobs", "could not allocate memory for dependent jobs, waiting instead.");
+        system_jobs_wait (jobs, after);
+        system_jobs_submit (jobs, list, count, counter);
+        return;
+    }
+
+    if (counter != NULL) {
+        counter_add (counter, count);
+    }
+
+    batch->count = count;
+
+    for (int i = 0; i < count; i++) {
+        batch->items[i] = job_item (&list[i], counter);
+    }
+
+    pthread_mutex_lock (&after->lock);
+
+    if (__atomic_load_n (&after->value, __ATOMIC_ACQUIRE) > 0) {
+        batch->next = after->waiting;
+        after->waiting = batch;
+        pthread_mutex_unlock (&after->lock);
+        return;
+    }
+
+    pthread_mutex_unlock (&after->lock);
+
+    int index = thread_index (jobs);
+
+    for (int i = 0; i < count; i++) {
+        push_or_run (jobs, index, &batch->items[i]);
+    }
+
+    free (batch);
+}
+
+/* Run jobs until counter reaches zero */
+void system_jobs_wait (system_jobs_t *jobs, system_job_counter_t *counter) {
+    int index = thread_index (jobs);
+    system_job_counter_t *only = current_jobs == jobs ? NULL : counter;
+
+    while (__atomic_load_n (&counter->value, __ATOMIC_ACQUIRE) > 0) {
+        if (!run_one (jobs, index, only)) {
+            sched_yield ();
+        }
+    }
+
+    /* Let the last finish leave the lock */
+    pthread_mutex_lock (&counter->lock);
+    pthread_mutex_unlock (&counter->lock);
+}
+
+/* Call func over [begin, end) in chunks of at least
+   min_chunk indices, returning once all have run.
+   Without a job system the whole range runs on the
+   calling thread. */
+void system_jobs_parallel_for (system_jobs_t *jobs, int begin, int end, int min_chunk, system_job_range_func_t func, void *arg) {
+    if (end <= begin) {
+        return;
+    }
+
+    if (min_chunk < 1) {
+        min_chunk = 1;
+    }
+
+    if (jobs == NULL || end - begin <= min_chunk) {
+        func (begin, end, arg);
+        return;
+    }
+
+    system_job_counter_t counter;
+    system_job_counter_init (&counter);
+    counter.value = 1;
+
+    system_job_item_t item = { NULL, func, arg, begin, end, min_chunk, &counter };
+    int index = thread_index (jobs);
+
+    run_item (jobs, index, &item);
+    system_jobs_wait (jobs, &counter);
+    system_job_counter_destroy (&counter);
+}
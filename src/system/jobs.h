@@ -0,0 +1,100 @@
+/* system/jobs.h
+    A pool of worker threads shared by the whole
+    engine, one per core by default, so that systems
+    wanting parallelism hand it small jobs rather than
+    each starting threads of their own.
+
+    Each worker has a deque of jobs. It pushes and
+    pops its own jobs at the bottom, newest first,
+    which keeps the data it just touched in cache,
+    and when it runs out it steals the oldest job from
+    the top of another's. Threads which are not
+    workers share one more deque. A thread waiting on
+    jobs runs jobs itself until they are done, so
+    jobs may submit and wait on jobs of their own. A
+    worker waiting runs any job, but other threads,
+    such as the render thread, only help with the jobs
+    they wait on, so they are never held up by a long
+    job of someone else's, such as a file load.
+
+    A counter tracks a group of jobs, reaching zero
+    once all of them have run. Jobs may be submitted
+    to start only once another counter reaches zero,
+    to build chains of dependent work without a
+    thread blocking in between.
+
+    Parallel loops split their range lazily: a loop
+    runs chunks of min_chunk indices in turn, and only
+    halves what is left, leaving one half to be
+    stolen, when its worker's deque is empty. Loops
+    on a busy pool thus run in a few large pieces,
+    and loops on an idle one spread out. */
+
+#ifndef SYSTEM_JOBS_H
+#define SYSTEM_JOBS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define SYSTEM_JOBS_MAX_THREADS 64
+#define SYSTEM_JOBS_DEQUE_SIZE 1024
+
+typedef void (*system_job_func_t) (void *arg);
+
+/* Runs one chunk of a parallel loop, [begin, end) */
+typedef void (*system_job_range_func_t) (int begin, int end, void *arg);
+
+typedef struct {
+    system_job_func_t func;
+    void *arg;
+} system_job_t;
+
+struct system_job_batch_t;
+
+typedef struct {
+    int value;                              /* Jobs still to run, read and written atomically */
+    pthread_mutex_t lock;                   /* Guards waiting */
+    struct system_job_batch_t *waiting;     /* Submitted to start once value reaches 0 */
+} system_job_counter_t;
+
+/* A job, or a chunk of a parallel loop */
+typedef struct {
+    system_job_func_t func;
+    system_job_range_func_t range;
+    void *arg;
+    int begin;
+    int end;
+    int min_chunk;
+    system_job_counter_t *counter;
+} system_job_item_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    system_job_item_t items[SYSTEM_JOBS_DEQUE_SIZE];
+    unsigned int top;                       /* Oldest, taken by thieves */
+    unsigned int bottom;                    /* Newest, pushed and popped by the owner */
+} system_job_deque_t;
+
+typedef struct system_jobs_t {
+    system_job_deque_t *deques;             /* One per worker, then one shared by other threads */
+    int num_deques;
+    pthread_t threads[SYSTEM_JOBS_MAX_THREADS];
+    int num_threads;                        /* Workers started */
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;                    /* Signalled when a job is pushed while workers sleep, or on shutdown */
+    int queued;                             /* Jobs in the deques, read and written atomically */
+    int sleeping;                           /* Workers waiting on wake, read and written atomically */
+    bool stopping;
+} system_jobs_t;
+
+system_jobs_t *system_jobs_create (int num_threads, bool pin);
+void system_jobs_destroy (system_jobs_t *jobs);
+void system_job_counter_init (system_job_counter_t *counter);
+void system_job_counter_destroy (system_job_counter_t *counter);
+void system_jobs_submit (system_jobs_t *jobs, const system_job_t *list, int count, system_job_counter_t *counter);
+void system_jobs_submit_after (system_jobs_t *jobs, const system_job_t *list, int count, system_job_counter_t *after, system_job_counter_t *counter);
+void system_jobs_wait (system_jobs_t *jobs, system_job_counter_t *counter);
+void system_jobs_parallel_for (system_jobs_t *jobs, int begin, int end, int min_chunk, system_job_range_func_t func, void *arg);
+
+#endif
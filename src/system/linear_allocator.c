@@ -0,0 +1,128 @@
+#include "linear_allocator.h"
+#include "log.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+static system_linear_block_t *create_block (size_t size) {
+    system_linear_block_t *block = (system_linear_block_t *) malloc (sizeof (system_linear_block_t) + size);
+
+    if (block == NULL) {
+        SYSTEM_LOG_ERROR ("system/linear_allocator", "could not allocate block of %zu bytes.", size);
+        return NULL;
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+bool system_linear_allocator_init (system_linear_allocator_t *allocator, size_t block_size) {
+    assert (allocator != NULL);
+
+    if (block_size == 0) {
+        block_size = SYSTEM_LINEAR_ALLOCATOR_DEFAULT_BLOCK_SIZE;
+    }
+
+    allocator->block_size = block_size;
+    allocator->used = 0;
+    allocator->head = create_block (block_size);
+    allocator->current = allocator->head;
+
+    if (allocator->head == NULL) {
+        allocator->reserved = 0;
+        return false;
+    }
+
+    allocator->reserved = block_size;
+
+    return true;
+}
+
+/* Offset into a block at which an allocation
+   with the given alignment would start. */
+static size_t aligned_offset (system_linear_block_t *block, size_t align) {
+    uintptr_t start = (uintptr_t) (block->data + block->used);
+    uintptr_t aligned = (start + align - 1) & ~((uintptr_t) align - 1);
+    return block->used + (aligned - start);
+}
+
+void *system_linear_allocator_alloc (system_linear_allocator_t *allocator, size_t size, size_t align) {
+    assert (allocator != NULL);
+    assert (align != 0 && (align & (align - 1)) == 0);
+
+    system_linear_block_t *block = allocator->current;
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    size_t offset = aligned_offset (block, align);
+
+    if (offset + size > block->size) {
+        /* Move on to the next block in the chain, which
+           is only reused if it is large enough - otherwise
+           a new block is linked in after the current one. */
+        system_linear_block_t *next = block->next;
+
+        if (next == NULL || size + align > next->size) {
+            size_t new_size = allocator->block_size;
+
+            if (size + align > new_size) {
+                new_size = size + align;
+            }
+
+            system_linear_block_t *new_block = create_block (new_size);
+
+            if (new_block == NULL) {
+                return NULL;
+            }
+
+            new_block->next = next;
+            block->next = new_block;
+            allocator->reserved += new_size;
+            next = new_block;
+        }
+
+        next->used = 0;
+        allocator->current = next;
+        block = next;
+        offset = aligned_offset (block, align);
+    }
+
+    allocator->used += offset + size - block->used;
+    block->used = offset + size;
+
+    return block->data + offset;
+}
+
+void system_linear_allocator_reset (system_linear_allocator_t *allocator) {
+    assert (allocator != NULL);
+
+    for (system_linear_block_t *block = allocator->head; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+
+    allocator->current = allocator->head;
+    allocator->used = 0;
+}
+
+void system_linear_allocator_destroy (system_linear_allocator_t *allocator) {
+    assert (allocator != NULL);
+
+    system_linear_block_t *block = allocator->head;
+
+    while (block != NULL) {
+        system_linear_block_t *next = block->next;
+        free (block);
+        block = next;
+    }
+
+    allocator->head = NULL;
+    allocator->current = NULL;
+    allocator->used = 0;
+    allocator->reserved = 0;
+}
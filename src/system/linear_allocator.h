@@ -0,0 +1,40 @@
+/* system/linear_allocator.h
+    A chunked bump allocator. Allocations are
+    carved linearly out of large blocks and are
+    never freed individually - instead the whole
+    allocator is reset at once, which keeps the
+    blocks around so that steady state use does
+    not touch malloc.
+
+    An allocator is not thread-safe; each thread
+    should own its own allocator. */
+
+#ifndef SYSTEM_LINEAR_ALLOCATOR_H
+#define SYSTEM_LINEAR_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SYSTEM_LINEAR_ALLOCATOR_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+typedef struct system_linear_block_t {
+    struct system_linear_block_t *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} system_linear_block_t;
+
+typedef struct {
+    system_linear_block_t *head;    /* First block in chain */
+    system_linear_block_t *current; /* Block being allocated from */
+    size_t block_size;              /* Minimum size of new blocks */
+    size_t used;                    /* Bytes allocated since reset */
+    size_t reserved;                /* Bytes held in all blocks */
+} system_linear_allocator_t;
+
+bool system_linear_allocator_init (system_linear_allocator_t *allocator, size_t block_size);
+void *system_linear_allocator_alloc (system_linear_allocator_t *allocator, size_t size, size_t align);
+void system_linear_allocator_reset (system_linear_allocator_t *allocator);
+void system_linear_allocator_destroy (system_linear_allocator_t *allocator);
+
+#endif
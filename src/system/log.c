@@ -0,0 +1,174 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/* How long the flush thread sleeps when the ring is empty */
+#define SYSTEM_LOG_IDLE_NS (2 * 1000 * 1000)
+
+/* A slot is free for the producer claiming position p when
+   its sequence is p, and holds a message for the consumer
+   at position p once its sequence is p + 1. */
+typedef struct {
+    atomic_size_t sequence;
+    int level;
+    char text[SYSTEM_LOG_MESSAGE_SIZE];
+} system_log_slot_t;
+
+static system_log_slot_t ring[SYSTEM_LOG_RING_SIZE];
+static atomic_size_t enqueue_position;
+static size_t dequeue_position;
+static atomic_uint_fast64_t dropped;
+static atomic_bool running;
+static pthread_t flush_thread;
+
+static const char *level_names[] = { "Trace", "Debug", "Info", "Warning", "Error" };
+
+static void format_message (char *buffer, int level, const char *module, const char *format, va_list args) {
+    int n = snprintf (buffer, SYSTEM_LOG_MESSAGE_SIZE, "%s - %s: ", level_names[level], module);
+
+    if (n >= 0 && n < SYSTEM_LOG_MESSAGE_SIZE) {
+        vsnprintf (buffer + n, SYSTEM_LOG_MESSAGE_SIZE - n, format, args);
+    }
+}
+
+/* Warnings and errors go to stderr, as before. */
+static void emit (int level, const char *text) {
+    FILE *out = level >= SYSTEM_LOG_LEVEL_WARN ? stderr : stdout;
+    fputs (text, out);
+    fputc ('\n', out);
+}
+
+/* Write out the next message, if there is one. Only
+   ever called by one thread at a time. */
+static bool flush_one (void) {
+    system_log_slot_t *slot = &ring[dequeue_position & (SYSTEM_LOG_RING_SIZE - 1)];
+    size_t sequence = atomic_load_explicit (&slot->sequence, memory_order_acquire);
+
+    if (sequence != dequeue_position + 1) {
+        return false;
+    }
+
+    emit (slot->level, slot->text);
+    atomic_store_explicit (&slot->sequence, dequeue_position + SYSTEM_LOG_RING_SIZE, memory_order_release);
+    dequeue_position++;
+
+    return true;
+}
+
+static void flush_all (void) {
+    while (flush_one ()) {
+    }
+
+    fflush (stdout);
+    fflush (stderr);
+}
+
+static void *flush_thread_main (void *aux) {
+    struct timespec idle = { 0, SYSTEM_LOG_IDLE_NS };
+
+    while (atomic_load_explicit (&running, memory_order_acquire)) {
+        if (flush_one ()) {
+            flush_all ();
+        } else {
+            nanosleep (&idle, NULL);
+        }
+    }
+
+    flush_all ();
+
+    return NULL;
+}
+
+bool system_log_init (void) {
+    if (atomic_load (&running)) {
+        return true;
+    }
+
+    for (size_t i = 0; i < SYSTEM_LOG_RING_SIZE; i++) {
+        atomic_init (&ring[i].sequence, i);
+    }
+
+    atomic_store (&enqueue_position, 0);
+    atomic_store (&dropped, 0);
+    dequeue_position = 0;
+    atomic_store (&running, true);
+
+    if (pthread_create (&flush_thread, NULL, flush_thread_main, NULL) != 0) {
+        atomic_store (&running, false);
+        fprintf (stderr, "Error - system/log: could not start flush thread.\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* Stop the flush thread after it has written out
+   everything logged so far. */
+void system_log_shutdown (void) {
+    if (!atomic_load (&running)) {
+        return;
+    }
+
+    atomic_store (&running, false);
+    pthread_join (flush_thread, NULL);
+
+    uint64_t count = atomic_load (&dropped);
+
+    if (count > 0) {
+        fprintf (stderr, "Warning - system/log: %llu messages were dropped.\n", (unsigned long long) count);
+    }
+}
+
+void system_log_write (int level, const char *module, const char *format, ...) {
+    va_list args;
+
+    if (level < SYSTEM_LOG_LEVEL_TRACE || level > SYSTEM_LOG_LEVEL_ERROR) {
+        return;
+    }
+
+    if (!atomic_load_explicit (&running, memory_order_acquire)) {
+        char buffer[SYSTEM_LOG_MESSAGE_SIZE];
+        va_start (args, format);
+        format_message (buffer, level, module, format, args);
+        va_end (args);
+        emit (level, buffer);
+        return;
+    }
+
+    /* Claim a slot */
+    size_t position = atomic_load_explicit (&enqueue_position, memory_order_relaxed);
+    system_log_slot_t *slot;
+
+    for (;;) {
+        slot = &ring[position & (SYSTEM_LOG_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit (&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit (&enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            /* Full - the flush thread has fallen behind */
+            atomic_fetch_add_explicit (&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            position = atomic_load_explicit (&enqueue_position, memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    va_start (args, format);
+    format_message (slot->text, level, module, format, args);
+    va_end (args);
+
+    /* Publish to the flush thread */
+    atomic_store_explicit (&slot->sequence, position + 1, memory_order_release);
+}
+
+uint64_t system_log_dropped (void) {
+    return atomic_load (&dropped);
+}
@@ -0,0 +1,58 @@
+/* system/log.h
+    Levelled logging. Levels below SYSTEM_LOG_LEVEL
+    are removed at compile time, so trace and debug
+    logging in hot paths costs nothing in normal
+    builds - build with -DSYSTEM_LOG_LEVEL=0 to see
+    everything.
+
+    Enabled messages are formatted by the caller into
+    a lock-free ring buffer and written out by a
+    background thread, so logging never waits on the
+    terminal. If the ring is full the message is
+    dropped and counted rather than blocking. Before
+    system_log_init and after system_log_shutdown
+    messages are written out directly. */
+
+#ifndef SYSTEM_LOG_H
+#define SYSTEM_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SYSTEM_LOG_LEVEL_TRACE 0
+#define SYSTEM_LOG_LEVEL_DEBUG 1
+#define SYSTEM_LOG_LEVEL_INFO  2
+#define SYSTEM_LOG_LEVEL_WARN  3
+#define SYSTEM_LOG_LEVEL_ERROR 4
+#define SYSTEM_LOG_LEVEL_NONE  5
+
+#ifndef SYSTEM_LOG_LEVEL
+    #define SYSTEM_LOG_LEVEL SYSTEM_LOG_LEVEL_INFO
+#endif
+
+/* Ring capacity in messages (a power of two), and
+   the longest message kept - longer ones are cut. */
+#define SYSTEM_LOG_RING_SIZE 1024
+#define SYSTEM_LOG_MESSAGE_SIZE 256
+
+/* Disabled levels still type-check their arguments,
+   but the call is dead code and never emitted. */
+#define SYSTEM_LOG_AT(level, module, ...) \
+    do { \
+        if ((level) >= SYSTEM_LOG_LEVEL) { \
+            system_log_write ((level), (module), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define SYSTEM_LOG_TRACE(module, ...) SYSTEM_LOG_AT (SYSTEM_LOG_LEVEL_TRACE, module, __VA_ARGS__)
+#define SYSTEM_LOG_DEBUG(module, ...) SYSTEM_LOG_AT (SYSTEM_LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#define SYSTEM_LOG_INFO(module, ...)  SYSTEM_LOG_AT (SYSTEM_LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define SYSTEM_LOG_WARN(module, ...)  SYSTEM_LOG_AT (SYSTEM_LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define SYSTEM_LOG_ERROR(module, ...) SYSTEM_LOG_AT (SYSTEM_LOG_LEVEL_ERROR, module, __VA_ARGS__)
+
+bool system_log_init (void);
+void system_log_shutdown (void);
+void system_log_write (int level, const char *module, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+uint64_t system_log_dropped (void);
+
+#endif
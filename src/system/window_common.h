@@ -18,6 +18,12 @@ void system_window_set_shown (system_window_t *window, bool shown);
 bool system_window_bind_event_table (system_window_t *window, system_event_table_t et);
 bool system_window_bind_event (system_window_t *window, system_event_code_t event, system_event_handler_t callback);
 void system_window_handle_events (system_window_t *window);
+bool system_window_wait_events (system_window_t *window, double timeout);
+bool system_window_is_mapped (system_window_t *window);
+unsigned int system_window_depth (system_window_t *window);
 void system_window_render_buffer_to_screen (system_window_t *window, void *buffer);
+void system_window_render_buffer_region_to_screen (system_window_t *window, void *buffer, int x, int y, unsigned int width, unsigned int height);
+void system_window_render_view_to_screen (system_window_t *window, void *buffer, unsigned int buffer_width, unsigned int buffer_height, int x, int y, unsigned int width, unsigned int height, int window_x, int window_y);
+void system_window_flush (system_window_t *window);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,11 @@
+#define _GNU_SOURCE
 #include "window_x11.h"
+#include "log.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <poll.h>
+#include <time.h>
 
 /* Window structure implementation */
 struct system_window_t  {
@@ -11,12 +15,23 @@ struct system_window_t  {
     XImage *framebuffer;              /* RGB buffer */
     unsigned int width;               /* Width in pixels */
     unsigned int height;              /* Height in pixels*/
+    bool mapped;                      /* Whether the window is currently mapped */
 };
 
 /* Handle for a connection to the X server
-   - effectively a socket. */
+   - effectively a socket. Shared by every window,
+   and safe to use from any thread as Xlib is
+   initialised for threads before it is opened. */
 static Display *x_server_connection;
 
+/* Finds the window structure for an X window ID,
+   so that events go to the window they are for. */
+static XContext window_context;
+
+/* Events taken off the queue at once by
+   system_window_handle_events. */
+#define SYSTEM_WINDOW_EVENT_BATCH 64
+
 static system_event_code_t translate_event (XEvent *event);
 static void dispatch_event (system_window_t *window, XEvent *event, system_event_code_t event_code);
 
@@ -24,16 +39,25 @@ static Atom wm_delete_window;
 
 /* Initialise the window module. */
 bool system_window_init () {
+    /* Windows may be drawn to from several threads,
+       so Xlib must lock its connection. This has to
+       come before any other Xlib call. */
+    if (XInitThreads () == 0) {
+        SYSTEM_LOG_ERROR ("system/window", "could not initialise X for threads.");
+        return false;
+    }
+
     /* Open connection to the X server. */
     x_server_connection = XOpenDisplay (NULL);
 
     if (x_server_connection == NULL) {
-        fprintf (stderr, "Error - system/window: could not open X display.\n");
+        SYSTEM_LOG_ERROR ("system/window", "could not open X display.");
         return false;
     }
 
     /* Initialise close-window atom */
     wm_delete_window = XInternAtom (x_server_connection, "WM_DELETE_WINDOW", False);
+    window_context = XUniqueContext ();
 
     return true;
 }
@@ -51,11 +75,7 @@ system_window_t *system_window_create (
     system_window_t *window = (system_window_t *) calloc (sizeof (system_window_t), 1);
 
     if (window == NULL) {
-        fprintf (
-            stderr,
-            "Error - system/window: could not allocate"
-            "space for window structure during creation."
-        );
+        SYSTEM_LOG_ERROR ("system/window", "could not allocate space for window structure during creation.");
 
         free (window);
         return NULL;
@@ -65,6 +85,16 @@ system_window_t *system_window_create (
        window to. */
     window->screen = DefaultScreen (x_server_connection);
 
+    /* Frames are presented as 32 bit BGRX, or as
+       RGB565 on a 16 bit display */
+    int depth = DefaultDepth (x_server_connection, window->screen);
+
+    if (depth != 16 && depth != 24 && depth != 32) {
+        SYSTEM_LOG_ERROR ("system/window", "display depth %d is not supported, only 16, 24 and 32.", depth);
+        free (window);
+        return NULL;
+    }
+
     /* Create the window using X11 */
     window->window = XCreateSimpleWindow (
         x_server_connection,
@@ -79,7 +109,7 @@ system_window_t *system_window_create (
     );
 
     if (window->window == 0) {
-        fprintf (stderr, "Error - system/window: could not create window\n");
+        SYSTEM_LOG_ERROR ("system/window", "could not create window");
         free (window);
         return NULL;
     }
@@ -98,6 +128,16 @@ system_window_t *system_window_create (
     /* Create framebuffer */
     window->framebuffer = XCreateImage (x_server_connection, DefaultVisual (x_server_connection, window->screen), DefaultDepth (x_server_connection, window->screen), ZPixmap, 0, NULL, window->width, window->height, 32, 0);
 
+    if (window->framebuffer == NULL) {
+        SYSTEM_LOG_ERROR ("system/window", "could not create framebuffer image.");
+        XDestroyWindow (x_server_connection, window->window);
+        free (window);
+        return NULL;
+    }
+
+    /* Route this window's events to it */
+    XSaveContext (x_server_connection, window->window, window_context, (XPointer) window);
+
     /* Flush X server commands from this connection.
        The X server handles all currently open windows
        for the OS, so it is important that its queue
@@ -111,7 +151,12 @@ system_window_t *system_window_create (
 void system_window_destroy (system_window_t *window) {
     assert (window != NULL);
 
+    XDeleteContext (x_server_connection, window->window, window_context);
     XDestroyWindow (x_server_connection, window->window);
+
+    /* The image never owns the buffers shown in it */
+    window->framebuffer->data = NULL;
+    XDestroyImage (window->framebuffer);
     free (window);
 }
 
@@ -133,7 +178,7 @@ void system_window_set_shown (system_window_t *window, bool shown) {
 
 bool system_window_bind_event_table (system_window_t *window, system_event_table_t et) {
     if (window == NULL) {
-        fprintf (stderr, "Error - system/window: cannot bind event table to NULL window.");
+        SYSTEM_LOG_ERROR ("system/window", "cannot bind event table to NULL window.");
         return false;
     }
 
@@ -144,10 +189,10 @@ bool system_window_bind_event_table (system_window_t *window, system_event_table
 
 bool system_window_bind_event (system_window_t *window, system_event_code_t event, system_event_handler_t callback) {
     if (window == NULL) {
-        fprintf (stderr, "Error - system/window: cannot bind event function to NULL window.");
+        SYSTEM_LOG_ERROR ("system/window", "cannot bind event function to NULL window.");
         return false;
     } else if (callback == NULL) {
-        fprintf (stderr, "Error - system/window: cannot bind NULL callback to window event.");
+        SYSTEM_LOG_ERROR ("system/window", "cannot bind NULL callback to window event.");
         return false;
     }
     
@@ -156,20 +201,91 @@ bool system_window_bind_event (system_window_t *window, system_event_code_t even
     return true;
 };
 
+/* Handle the pending events of every window, each
+   dispatched to the window it is for, so callbacks
+   for other windows run on the calling thread too.
+   Events are taken off the queue in batches with the
+   connection locked, and dispatched once it is
+   unlocked, so callbacks may use other windows. */
 void system_window_handle_events (system_window_t *window) {
-    XEvent event;
+    XEvent events[SYSTEM_WINDOW_EVENT_BATCH];
+    int count;
+
+    (void) window;
+
+    do {
+        /* Iterate through all events in event queue. */
+        XLockDisplay (x_server_connection);
+
+        for (count = 0; count < SYSTEM_WINDOW_EVENT_BATCH && XPending (x_server_connection); count++) {
+            XNextEvent (x_server_connection, &events[count]);
+        }
+
+        XUnlockDisplay (x_server_connection);
+
+        for (int i = 0; i < count; i++) {
+            XEvent *event = &events[i];
+            XPointer target;
 
-    /* Iterate through all events in event queue. */
-    while (XPending (x_server_connection)) {
-        /* There is an event pending - obtain
-           it's data and remove from queue. */
-        XNextEvent (x_server_connection, &event);
+            if (XFindContext (x_server_connection, event->xany.window, window_context, &target) != 0) {
+                /* Not one of ours, or already destroyed */
+                continue;
+            }
+
+            system_window_t *to = (system_window_t *) target;
+
+            /* Track visibility for the frame scheduler */
+            if (event->type == MapNotify) {
+                to->mapped = true;
+            } else if (event->type == UnmapNotify) {
+                to->mapped = false;
+            }
+
+            /* Translate Event */
+            system_event_code_t evt = translate_event (event);
+
+            dispatch_event (to, event, evt);
+        }
+    } while (count == SYSTEM_WINDOW_EVENT_BATCH);
+}
 
-        /* Translate Event */
-        system_event_code_t evt = translate_event (&event);
+/* Block until there are events to handle or the timeout
+   (in seconds) expires. Returns whether events are ready.
+   Waits on the connection's file descriptor, so it does
+   not spin while nothing is happening. */
+bool system_window_wait_events (system_window_t *window, double timeout) {
+    /* Anything already read off the socket will not
+       wake poll, so check the queue first. */
+    if (XEventsQueued (x_server_connection, QueuedAfterFlush) > 0) {
+        return true;
+    }
 
-        dispatch_event (window, &event, evt);
+    if (timeout <= 0) {
+        return false;
     }
+
+    struct pollfd fd;
+    fd.fd = ConnectionNumber (x_server_connection);
+    fd.events = POLLIN;
+    fd.revents = 0;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t) timeout;
+    ts.tv_nsec = (long) ((timeout - ts.tv_sec) * 1e9);
+
+    return ppoll (&fd, 1, &ts, NULL) > 0;
+}
+
+bool system_window_is_mapped (system_window_t *window) {
+    assert (window != NULL);
+    return window->mapped;
+}
+
+/* Bits of colour per pixel the window's buffers hold,
+   e.g. 24 for 32 bit BGRX, or 16 for RGB565. */
+unsigned int system_window_depth (system_window_t *window) {
+    assert (window != NULL);
+    return (unsigned int) window->framebuffer->depth;
 }
 
 static system_event_code_t translate_event (XEvent *event) {
@@ -182,6 +298,16 @@ static system_event_code_t translate_event (XEvent *event) {
             }
             break;
         }
+
+        case Expose: {
+            /* Only report the last of a run of expose
+               events, by which point the whole exposed
+               area is known. */
+            if (event->xexpose.count == 0) {
+                evt = SYSTEM_EVENT_EXPOSE;
+            }
+            break;
+        }
     }
 
     return evt;
@@ -197,7 +323,46 @@ static void dispatch_event (
     }
 }
 
+/* Push part of a buffer of any size to a position in
+   the window. Each call describes the buffer with its
+   own image, so threads may present to the same or
+   different windows at once. */
+static void put_buffer (system_window_t *window, void *buffer, unsigned int buffer_width, unsigned int buffer_height,
+                        int x, int y, unsigned int width, unsigned int height, int window_x, int window_y) {
+    XImage image = *window->framebuffer;
+    image.width = (int) buffer_width;
+    image.height = (int) buffer_height;
+    image.bytes_per_line = 0;
+    image.data = (char *) buffer;
+
+    if (XInitImage (&image) == 0) {
+        SYSTEM_LOG_ERROR ("system/window", "could not describe buffer to X.");
+        return;
+    }
+
+    XPutImage (x_server_connection, window->window, DefaultGC (x_server_connection, window->screen), &image, x, y, window_x, window_y, width, height);
+}
+
 void system_window_render_buffer_to_screen (system_window_t *window, void *buffer) {
-    window->framebuffer->data = buffer;
-    XPutImage (x_server_connection, window->window, DefaultGC (x_server_connection, window->screen), window->framebuffer, 0, 0, 0, 0, window->width, window->height);
-};
+    put_buffer (window, buffer, window->width, window->height, 0, 0, window->width, window->height, 0, 0);
+}
+
+/* Push only part of the buffer to the window. The buffer
+   must still be the full width x height of the window. */
+void system_window_render_buffer_region_to_screen (system_window_t *window, void *buffer, int x, int y, unsigned int width, unsigned int height) {
+    put_buffer (window, buffer, window->width, window->height, x, y, width, height, x, y);
+}
+
+/* Push part of a buffer of buffer_width x buffer_height,
+   e.g. one viewport's frame, to (window_x, window_y) in
+   the window. */
+void system_window_render_view_to_screen (system_window_t *window, void *buffer, unsigned int buffer_width, unsigned int buffer_height,
+                                          int x, int y, unsigned int width, unsigned int height, int window_x, int window_y) {
+    put_buffer (window, buffer, buffer_width, buffer_height, x, y, width, height, window_x, window_y);
+}
+
+/* Send presented frames to the X server. */
+void system_window_flush (system_window_t *window) {
+    (void) window;
+    XFlush (x_server_connection);
+}
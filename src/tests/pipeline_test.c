@@ -0,0 +1,179 @@
+/* pipeline_test.c
+    Checks that frames drawn through the pipeline
+    match executing the same command lists one after
+    another, for every number of frames in flight.
+    Views set by one list must carry on into the
+    lists after it, as they do when executed.
+
+    Usage:
+        pipeline_test
+
+    Exits with 0 if every frame matches. */
+
+#include "../graphics/renderer.h"
+#include "../graphics/command_list.h"
+#include "../graphics/pipeline.h"
+#include "../resources/resources.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_WIDTH 160
+#define TEST_HEIGHT 120
+#define TEST_FRAMES 6
+
+/* Cube of side 2 about the origin */
+static resources_mesh_t *test_create_cube () {
+    static const double corners[8][3] = {
+        { -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 },
+        { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 }
+    };
+    static const int faces[12][3] = {
+        { 0, 2, 1 }, { 0, 3, 2 }, { 4, 5, 6 }, { 4, 6, 7 },
+        { 0, 1, 5 }, { 0, 5, 4 }, { 3, 6, 2 }, { 3, 7, 6 },
+        { 0, 4, 7 }, { 0, 7, 3 }, { 1, 2, 6 }, { 1, 6, 5 }
+    };
+
+    resources_mesh_t *mesh = (resources_mesh_t *) malloc (sizeof (resources_mesh_t));
+
+    if (mesh == NULL) {
+        return NULL;
+    }
+
+    resources_mesh_init (mesh);
+    mesh->num_vertices = 8;
+    mesh->num_faces = 12;
+    mesh->vertices = (resources_vertex_t *) malloc (sizeof (resources_vertex_t) * 8);
+    mesh->faces = (resources_triangle_t *) malloc (sizeof (resources_triangle_t) * 12);
+
+    if (mesh->vertices == NULL || mesh->faces == NULL) {
+        resources_mesh_free (mesh);
+        return NULL;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        mesh->vertices[i].coord = (maths_vec4f) { corners[i][0], corners[i][1], corners[i][2], 1.0 };
+    }
+
+    memcpy (mesh->faces, faces, sizeof (faces));
+    return mesh;
+}
+
+static graphics_renderer_t *test_create_renderer () {
+    graphics_renderer_t *renderer = graphics_renderer_init (TEST_WIDTH, TEST_HEIGHT, GRAPHICS_FORMAT_BGRX8888);
+
+    if (renderer != NULL) {
+        renderer->view_distance = 1;
+        renderer->view_width = 2;
+        renderer->view_height = 1.5;
+    }
+
+    return renderer;
+}
+
+/* Frames alternate between setting a view and
+   relying on the one the frame before set. */
+static bool test_record (graphics_command_list_t *lists, resources_model_t *model) {
+    static const double distances[TEST_FRAMES] = { 2.0, 0.0, 0.5, 0.0, 1.0, 0.0 };
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        if (!graphics_command_list_init (&lists[i])) {
+            return false;
+        }
+
+        graphics_command_list_clear (&lists[i]);
+
+        if (distances[i] > 0.0) {
+            graphics_command_list_set_view (&lists[i], distances[i], 2.0, 1.5);
+        }
+
+        model->rotation.y = 0.3 * i;
+        graphics_command_list_draw_model (&lists[i], model);
+    }
+
+    return true;
+}
+
+static size_t test_frame_size () {
+    return sizeof (graphics_pixel_t) * TEST_WIDTH * TEST_HEIGHT;
+}
+
+/* Compare the frame the pipeline last rasterized */
+static bool test_check (graphics_renderer_t *renderer, uint8_t *expected, int frame, int max_frames) {
+    graphics_renderer_linearize (renderer);
+
+    if (memcmp (renderer->pixels, expected + frame * test_frame_size (), test_frame_size ()) != 0) {
+        fprintf (stderr, "Error - pipeline_test: frame %d differs with %d in flight.\n", frame, max_frames);
+        return false;
+    }
+
+    return true;
+}
+
+int main () {
+    static graphics_command_list_t lists[TEST_FRAMES];
+    resources_mesh_t *cube = test_create_cube ();
+    graphics_renderer_t *reference = test_create_renderer ();
+    uint8_t *expected = (uint8_t *) malloc (test_frame_size () * TEST_FRAMES);
+    int failures = 0;
+
+    resources_model_t model;
+    model.mesh = cube;
+    model.position = (maths_vec4f) { 0.0, 0.0, 6.0, 1.0 };
+    model.scale = (maths_vec4f) { 1.0, 1.0, 1.0, 1.0 };
+    model.rotation = (maths_vec4f) { 0.4, 0.0, 0.0, 0.0 };
+
+    if (cube == NULL || reference == NULL || expected == NULL || !test_record (lists, &model)) {
+        fprintf (stderr, "Error - pipeline_test: could not set up.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        graphics_command_list_t *list = &lists[i];
+        graphics_renderer_execute_command_lists (reference, &list, 1);
+        graphics_renderer_linearize (reference);
+        memcpy (expected + i * test_frame_size (), reference->pixels, test_frame_size ());
+    }
+
+    for (int max_frames = 1; max_frames <= 3; max_frames++) {
+        graphics_renderer_t *renderer = test_create_renderer ();
+        graphics_pipeline_t *pipeline = renderer != NULL ? graphics_pipeline_create (renderer, max_frames, 4) : NULL;
+        int rastered = 0;
+
+        if (pipeline == NULL) {
+            fprintf (stderr, "Error - pipeline_test: could not create pipeline.\n");
+            graphics_renderer_destroy (renderer);
+            failures++;
+            continue;
+        }
+
+        for (int i = 0; i < TEST_FRAMES; i++) {
+            if (graphics_pipeline_frame (pipeline, &lists[i])) {
+                failures += !test_check (renderer, expected, rastered++, max_frames);
+            }
+        }
+
+        while (graphics_pipeline_flush (pipeline)) {
+            failures += !test_check (renderer, expected, rastered++, max_frames);
+        }
+
+        if (rastered != TEST_FRAMES) {
+            fprintf (stderr, "Error - pipeline_test: %d of %d frames rasterized with %d in flight.\n", rastered, TEST_FRAMES, max_frames);
+            failures++;
+        }
+
+        graphics_pipeline_destroy (pipeline);
+        graphics_renderer_destroy (renderer);
+    }
+
+    for (int i = 0; i < TEST_FRAMES; i++) {
+        graphics_command_list_destroy (&lists[i]);
+    }
+
+    graphics_renderer_destroy (reference);
+    resources_mesh_free (cube);
+    free (expected);
+
+    fprintf (stderr, "pipeline_test: %s\n", failures == 0 ? "passed" : "failed");
+    return failures == 0 ? 0 : 1;
+}